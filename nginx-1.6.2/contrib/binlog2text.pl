@@ -0,0 +1,221 @@
+#!/usr/bin/perl -w
+
+# this script converts access logs written with a "log_format ... binary"
+# format to text or JSON
+#
+#   binlog2text.pl [-j] [-n name,name,...] [file ...]
+#
+#   -j      print one JSON object (or array, if no names are given) per record
+#   -n      field names, usually the variables of the log_format in order
+#
+# for example, with
+#
+#   log_format  bin  binary  $remote_addr $msec $status $body_bytes_sent;
+#
+# use
+#
+#   binlog2text.pl -j -n remote_addr,msec,status,body_bytes_sent access.bin
+#
+# a record is a varint length followed by fields; each field is a type byte
+# and a varint value, strings are a varint length and raw bytes
+
+
+use warnings;
+use strict;
+
+use POSIX qw(strftime);
+
+use constant {
+    NULL     => 0,
+    STRING   => 1,
+    UINT     => 2,
+    TIME     => 3,
+    MSEC     => 4,
+    DURATION => 5,
+};
+
+my $json = 0;
+my @names;
+
+while (@ARGV && $ARGV[0] =~ /^-/) {
+    my $opt = shift @ARGV;
+
+    if ($opt eq '-j') {
+        $json = 1;
+
+    } elsif ($opt eq '-n') {
+        @names = split /,/, shift(@ARGV) // '';
+
+    } elsif ($opt eq '--') {
+        last;
+
+    } else {
+        die "usage: $0 [-j] [-n name,name,...] [file ...]\n";
+    }
+}
+
+push @ARGV, '-' unless @ARGV;
+
+for my $file (@ARGV) {
+    my $fh;
+
+    if ($file eq '-') {
+        $fh = \*STDIN;
+
+    } else {
+        open($fh, '<', $file) or die "$file: $!\n";
+    }
+
+    binmode $fh;
+    decode($fh, $file);
+}
+
+
+sub decode {
+    my ($fh, $file) = @_;
+
+    my $buf = '';
+    my $n = 0;
+
+    for ( ;; ) {
+        my ($len, $pos) = varint(\$buf, 0);
+
+        if (!defined $len || length($buf) < $pos + $len) {
+            my $rc = read($fh, $buf, 65536, length $buf);
+
+            die "$file: $!\n" unless defined $rc;
+
+            if ($rc == 0) {
+                warn "$file: truncated record at the end\n" if length $buf;
+                return;
+            }
+
+            next;
+        }
+
+        my $record = substr($buf, $pos, $len);
+        substr($buf, 0, $pos + $len) = '';
+
+        my @fields = fields($record, $file, $n++);
+        print $json ? to_json(@fields) : to_text(@fields), "\n";
+    }
+}
+
+
+sub fields {
+    my ($record, $file, $n) = @_;
+
+    my @fields;
+    my $pos = 0;
+
+    while ($pos < length $record) {
+        my $type = ord substr($record, $pos++, 1);
+        my $value;
+
+        if ($type == NULL) {
+            push @fields, [ NULL, undef ];
+            next;
+        }
+
+        ($value, $pos) = varint(\$record, $pos);
+
+        die "$file: record $n is corrupted\n" unless defined $value;
+
+        if ($type == STRING) {
+            die "$file: record $n is corrupted\n"
+                if $pos + $value > length $record;
+
+            push @fields, [ STRING, substr($record, $pos, $value) ];
+            $pos += $value;
+            next;
+        }
+
+        die "$file: unknown field type $type in record $n\n"
+            if $type > DURATION;
+
+        push @fields, [ $type, $value ];
+    }
+
+    return @fields;
+}
+
+
+sub varint {
+    my ($buf, $pos) = @_;
+
+    my $value = 0;
+    my $shift = 0;
+
+    while ($pos < length $$buf) {
+        my $byte = ord substr($$buf, $pos++, 1);
+
+        $value += ($byte & 0x7f) * 2 ** $shift;
+        $shift += 7;
+
+        return ($value, $pos) if ($byte & 0x80) == 0;
+    }
+
+    return;
+}
+
+
+sub format_field {
+    my ($type, $value) = @{$_[0]};
+
+    return undef if $type == NULL;
+
+    if ($type == TIME) {
+        return strftime('%d/%b/%Y:%H:%M:%S %z', localtime $value);
+    }
+
+    if ($type == MSEC || $type == DURATION) {
+        return sprintf('%d.%03d', int($value / 1000), $value % 1000);
+    }
+
+    return $value;
+}
+
+
+sub to_text {
+    return join ' ', map {
+        my $v = format_field($_);
+
+        if (!defined $v) {
+            '-';
+
+        } else {
+            $v =~ s/([\x00-\x1f"\\\x7f-\xff])/sprintf('\\x%02X', ord $1)/ge;
+            $v;
+        }
+    } @_;
+}
+
+
+sub to_json {
+    my @values = map {
+        my $v = format_field($_);
+
+        if (!defined $v) {
+            'null';
+
+        } elsif ($_->[0] == UINT || $_->[0] == MSEC || $_->[0] == DURATION) {
+            $v;
+
+        } else {
+            $v =~ s/(["\\])/\\$1/g;
+            $v =~ s/([\x00-\x1f\x7f-\xff])/sprintf('\\u%04x', ord $1)/ge;
+            "\"$v\"";
+        }
+    } @_;
+
+    return '[' . join(',', @values) . ']' unless @names;
+
+    my @pairs;
+
+    for my $i (0 .. $#values) {
+        my $name = $i < @names ? $names[$i] : "field$i";
+        push @pairs, "\"$name\":$values[$i]";
+    }
+
+    return '{' . join(',', @pairs) . '}';
+}
@@ -0,0 +1,268 @@
+#!/usr/bin/perl -w
+
+# (C) Nginx, Inc.
+#
+# Compiles a geo ranges file, as included from a "geo" block with
+# the "ranges" parameter, into the binary range base loaded by
+# ngx_http_geo_module instead of the text file:
+#
+#   geo2bin.pl /etc/nginx/geo.conf [/etc/nginx/geo.conf.bin]
+#
+# The file may contain "default", "delete" and "start-end value"
+# entries.  Overlapping ranges are handled as the module does: a range
+# nested in an earlier one replaces its part, a partial overlap is an
+# error.  The base is written under a temporary name and renamed, so
+# running nginx processes keep their mapping of the previous one.
+
+use warnings;
+use strict;
+
+use Compress::Zlib qw(crc32);
+
+
+my $src = shift or die "usage: $0 ranges-file [binary-file]\n";
+my $dst = shift || "$src.bin";
+
+my (@low, %values, $default, $entries);
+
+open(my $in, '<', $src) or die "$src: $!\n";
+my $text = do { local $/; <$in> };
+close($in);
+
+my @args;
+
+while ($text =~ /\G \s* (?: \#[^\n]*
+                         | "((?:[^"\\]|\\.)*)"
+                         | '((?:[^'\\]|\\.)*)'
+                         | (;)
+                         | ([^\s;"'\#]+) )/gcx)
+{
+    if (defined $1 || defined $2) {
+        push @args, defined $1 ? $1 : $2;
+
+    } elsif (defined $3) {
+        entry(@args) if @args;
+        @args = ();
+
+    } elsif (defined $4) {
+        push @args, $4;
+    }
+}
+
+$text =~ /\G\s*$/gc or die "$src: unexpected character\n";
+die "$src: unexpected end of file, expecting \";\"\n" if @args;
+
+write_base();
+
+exit 0;
+
+
+sub entry {
+    my ($net, $value) = @_;
+
+    die "$src: invalid number of arguments in \"@_\"\n" if @_ != 2;
+
+    if ($net eq 'default') {
+        $default = $value;
+        return;
+    }
+
+    my $del = 0;
+
+    if ($net eq 'delete') {
+        $net = $value;
+        $del = 1;
+    }
+
+    my ($start, $end) = $net =~ /^(\d+\.\d+\.\d+\.\d+)-(\d+\.\d+\.\d+\.\d+)$/
+        or die "$src: invalid range \"$net\"\n";
+
+    $start = ip2long($start);
+    $end = ip2long($end);
+
+    die "$src: invalid range \"$net\"\n" if $start > $end;
+
+    $entries++;
+
+    if ($del) {
+        delete_range($start, $end)
+            or warn "$src: no address range \"$net\" to delete\n";
+        return;
+    }
+
+    $values{$value} = 0;
+
+    add_range($start, $end, $value, $net);
+}
+
+
+# the same procedure as ngx_http_geo_add_range()
+
+sub add_range {
+    my ($start, $end, $value, $net) = @_;
+
+    RANGE:
+    for (my $n = $start; $n <= $end; $n = ($n + 0x10000) & 0xffff0000) {
+
+        my $h = $n >> 16;
+        my $s = ($n == $start) ? $n & 0xffff : 0;
+        my $e = (($n | 0xffff) > $end) ? $end & 0xffff : 0xffff;
+
+        my $a = $low[$h] ||= [];
+        my $i = @$a;
+
+        while ($i) {
+            $i--;
+
+            my $r = $a->[$i];
+
+            next if $e < $r->[0];
+
+            if ($s > $r->[1]) {
+                splice(@$a, $i + 1, 0, [$s, $e, $value]);
+                next RANGE;
+            }
+
+            if ($s == $r->[0] && $e == $r->[1]) {
+                warn "$src: duplicate range \"$net\", value: \"$value\", "
+                     . "old value: \"$r->[2]\"\n";
+                $r->[2] = $value;
+                next RANGE;
+            }
+
+            if ($s > $r->[0] && $e < $r->[1]) {
+                splice(@$a, $i + 1, 0, [$s, $e, $value],
+                       [$e + 1, $r->[1], $r->[2]]);
+                $r->[1] = $s - 1;
+                next RANGE;
+            }
+
+            if ($s == $r->[0] && $e < $r->[1]) {
+                splice(@$a, $i, 0, [$s, $e, $value]);
+                $r->[0] = $e + 1;
+                next RANGE;
+            }
+
+            if ($s > $r->[0] && $e == $r->[1]) {
+                splice(@$a, $i + 1, 0, [$s, $e, $value]);
+                $r->[1] = $s - 1;
+                next RANGE;
+            }
+
+            die "$src: range \"$net\" overlaps \""
+                . long2ip(($h << 16) + $r->[0]) . "-"
+                . long2ip(($h << 16) + $r->[1]) . "\"\n";
+        }
+
+        push @$a, [$s, $e, $value];
+    }
+}
+
+
+# the same procedure as ngx_http_geo_delete_range()
+
+sub delete_range {
+    my ($start, $end) = @_;
+    my $found = 1;
+
+    for (my $n = $start; $n <= $end; $n += 0x10000) {
+
+        my $h = $n >> 16;
+        my $s = ($n == $start) ? $n & 0xffff : 0;
+        my $e = (($n | 0xffff) > $end) ? $end & 0xffff : 0xffff;
+
+        my $a = $low[$h];
+
+        unless ($a) {
+            $found = 0;
+            next;
+        }
+
+        for (my $i = 0; $i < @$a; $i++) {
+            my $r = $a->[$i];
+
+            if ($s == $r->[0] && $e == $r->[1]) {
+                splice(@$a, $i, 1);
+                last;
+            }
+
+            next if $s != $r->[0] && $e != $r->[1];
+
+            $found = 0;
+        }
+    }
+
+    return $found;
+}
+
+
+sub write_base {
+    my $header = 24;
+    my $off = $header + 0x10000 * 4;
+    my $data = '';
+
+    $values{$default} = 0 if defined $default;
+
+    for my $v (sort keys %values) {
+        $values{$v} = $off + length($data);
+        $data .= pack('L', length($v)) . $v;
+        $data .= "\0" x ((4 - length($data) % 4) % 4);
+    }
+
+    $off += length($data);
+
+    my @index = (0) x 0x10000;
+    my $ranges = '';
+
+    for my $h (0 .. 0xffff) {
+        next unless $low[$h] && @{$low[$h]};
+
+        $index[$h] = $off + length($ranges);
+
+        for my $r (@{$low[$h]}) {
+            $ranges .= pack('S S L', $r->[0], $r->[1], $values{$r->[2]});
+        }
+
+        $ranges .= pack('S S L', 0, 0, 0);
+    }
+
+    my $body = pack('L*', @index) . $data . $ranges;
+    my $size = $header + length($body);
+
+    die "$src: binary base is too large\n" if $size > 0xffffffff;
+
+    my $tmp = "$dst.$$";
+
+    open(my $out, '>', $tmp) or die "$tmp: $!\n";
+    binmode($out);
+
+    print $out pack('a6 C C L L L L', 'GEORNG', 1, 4, 0x12345678,
+                    crc32($body), $size,
+                    defined $default ? $values{$default} : 0);
+    print $out $body;
+
+    close($out) or die "$tmp: $!\n";
+    rename($tmp, $dst) or die "rename $tmp to $dst: $!\n";
+
+    printf STDERR "%s: %d entries, %d values, %d bytes\n",
+                  $dst, $entries || 0, scalar(keys %values), $size;
+}
+
+
+sub ip2long {
+    my @a = split(/\./, shift);
+
+    for (@a) {
+        die "$src: invalid address\n" if $_ > 255;
+    }
+
+    return ($a[0] << 24) + ($a[1] << 16) + ($a[2] << 8) + $a[3];
+}
+
+
+sub long2ip {
+    my $ip = shift;
+
+    return join('.', $ip >> 24, ($ip >> 16) & 255, ($ip >> 8) & 255,
+                $ip & 255);
+}
@@ -104,6 +104,13 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("worker_numa"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, numa),
+      NULL },
+
     { ngx_string("worker_rlimit_nofile"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -125,6 +132,20 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, rlimit_sigpending),
       NULL },
 
+    { ngx_string("worker_pool_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_core_conf_t, pool_cache),
+      NULL },
+
+    { ngx_string("huge_pages"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, huge_pages),
+      NULL },
+
     { ngx_string("working_directory"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -222,7 +243,7 @@ main(int argc, char *const *argv)
 
         if (ngx_show_help) {
             ngx_write_stderr(
-                "Usage: nginx [-?hvVtq] [-s signal] [-c filename] "
+                "Usage: nginx [-?hvVtqPC] [-s signal] [-c filename] "
                              "[-p prefix] [-g directives]" NGX_LINEFEED
                              NGX_LINEFEED
                 "Options:" NGX_LINEFEED
@@ -233,8 +254,13 @@ main(int argc, char *const *argv)
                 "  -t            : test configuration and exit" NGX_LINEFEED
                 "  -q            : suppress non-error messages "
                                    "during configuration testing" NGX_LINEFEED
+                "  -P            : log the time spent in configuration "
+                                   "directives and phases" NGX_LINEFEED
+                "  -C            : cache the configuration tokens "
+                                   "in a binary snapshot" NGX_LINEFEED
                 "  -s signal     : send signal to a master process: "
-                                   "stop, quit, reopen, reload" NGX_LINEFEED
+                                   "stop, quit, reopen, reload, update"
+                                   NGX_LINEFEED
 #ifdef NGX_PREFIX
                 "  -p prefix     : set prefix path (default: "
                                    NGX_PREFIX ")" NGX_LINEFEED
@@ -709,6 +735,14 @@ ngx_get_options(int argc, char *const *argv)
                 ngx_quiet_mode = 1;
                 break;
 
+            case 'P':
+                ngx_conf_profile = 1;
+                break;
+
+            case 'C':
+                ngx_conf_snapshot = 1;
+                break;
+
             case 'p':
                 if (*p) {
                     ngx_prefix = p;
@@ -766,7 +800,8 @@ ngx_get_options(int argc, char *const *argv)
                 if (ngx_strcmp(ngx_signal, "stop") == 0
                     || ngx_strcmp(ngx_signal, "quit") == 0
                     || ngx_strcmp(ngx_signal, "reopen") == 0
-                    || ngx_strcmp(ngx_signal, "reload") == 0)
+                    || ngx_strcmp(ngx_signal, "reload") == 0
+                    || ngx_strcmp(ngx_signal, "update") == 0)
                 {
                     ngx_process = NGX_PROCESS_SIGNALLER;
                     goto next;
@@ -959,6 +994,10 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
     ccf->rlimit_core = NGX_CONF_UNSET;
     ccf->rlimit_sigpending = NGX_CONF_UNSET;
 
+    ccf->pool_cache = NGX_CONF_UNSET_SIZE;
+    ccf->huge_pages = NGX_CONF_UNSET;
+    ccf->numa = NGX_CONF_UNSET;
+
     ccf->user = (ngx_uid_t) NGX_CONF_UNSET_UINT;
     ccf->group = (ngx_gid_t) NGX_CONF_UNSET_UINT;
 
@@ -988,6 +1027,19 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
+    ngx_conf_init_size_value(ccf->pool_cache, 1024 * 1024);
+    ngx_conf_init_value(ccf->huge_pages, 0);
+    ngx_conf_init_value(ccf->numa, 0);
+
+#if !(NGX_HAVE_NUMA)
+
+    if (ccf->numa) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"worker_numa\" is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
 
 #if (NGX_HAVE_CPU_AFFINITY)
 
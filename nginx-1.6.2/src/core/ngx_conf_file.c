@@ -13,6 +13,10 @@
 static ngx_int_t ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last);
 static ngx_int_t ngx_conf_read_token(ngx_conf_t *cf);
 static void ngx_conf_flush_files(ngx_cycle_t *cycle);
+static void ngx_conf_profile_command(ngx_command_t *cmd, uint64_t total,
+    uint64_t self);
+static int ngx_libc_cdecl ngx_conf_profile_cmp(const void *one,
+    const void *two);
 
 
 static ngx_command_t  ngx_conf_commands[] = {
@@ -58,6 +62,43 @@ static ngx_uint_t argument_number[] = {
 };
 
 
+/*
+ * the startup profiler, enabled by the "-P" command line switch:
+ * the commands are found by their address in an open addressing table,
+ * "self" is the time of a handler without the nested directives and
+ * the reading of their tokens
+ */
+
+#define NGX_CONF_PROFILE_COMMANDS  2048
+#define NGX_CONF_PROFILE_PHASES    32
+
+
+typedef struct {
+    ngx_command_t    *cmd;
+    ngx_uint_t        count;
+    uint64_t          total;
+    uint64_t          self;
+} ngx_conf_profile_command_t;
+
+
+typedef struct {
+    char             *name;
+    ngx_uint_t        count;
+    uint64_t          time;
+} ngx_conf_profile_phase_t;
+
+
+ngx_uint_t  ngx_conf_profile;
+
+static ngx_conf_profile_command_t
+    ngx_conf_profile_commands[NGX_CONF_PROFILE_COMMANDS];
+static ngx_conf_profile_phase_t  ngx_conf_profile_phases[NGX_CONF_PROFILE_PHASES];
+static ngx_uint_t                ngx_conf_profile_nphases;
+
+/* the time spent in the nested directives of the current handler */
+static uint64_t                  ngx_conf_profile_nested;
+
+
 char *
 ngx_conf_param(ngx_conf_t *cf)
 {
@@ -101,6 +142,7 @@ char *
 ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
 {
     char             *rv;
+    uint64_t          start;
     ngx_fd_t          fd;
     ngx_int_t         rc;
     ngx_buf_t         buf;
@@ -155,6 +197,12 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
         cf->conf_file->file.offset = 0;
         cf->conf_file->file.log = cf->log;
         cf->conf_file->line = 1;
+        cf->conf_file->snapshot = NULL;
+        cf->conf_file->replay = NULL;
+
+        if (ngx_conf_snapshot_file(cf, cf->conf_file) != NGX_OK) {
+            goto failed;
+        }
 
         type = parse_file;
 
@@ -168,7 +216,25 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
 
 
     for ( ;; ) {
-        rc = ngx_conf_read_token(cf);
+        start = ngx_conf_profile_time();
+
+        if (cf->conf_file->replay) {
+            rc = ngx_conf_snapshot_read_token(cf);
+
+        } else {
+            rc = ngx_conf_read_token(cf);
+
+            if (cf->conf_file->snapshot && rc != NGX_ERROR) {
+                if (ngx_conf_snapshot_record(cf, rc) != NGX_OK) {
+                    goto failed;
+                }
+            }
+        }
+
+        if (ngx_conf_profile) {
+            ngx_conf_profile_nested += ngx_conf_profile_phase("read tokens",
+                                                              start);
+        }
 
         /*
          * ngx_conf_read_token() may return
@@ -285,6 +351,7 @@ ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
 {
     char           *rv;
     void           *conf, **confp;
+    uint64_t        start, elapsed, nested;
     ngx_uint_t      i, found;
     ngx_str_t      *name;
     ngx_command_t  *cmd;
@@ -388,7 +455,21 @@ ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
                 }
             }
 			//对应于每个模块中的ngx_command_t结构中的set方法
-            rv = cmd->set(cf, cmd, conf);
+            if (ngx_conf_profile) {
+                nested = ngx_conf_profile_nested;
+                ngx_conf_profile_nested = 0;
+                start = ngx_conf_profile_time();
+
+                rv = cmd->set(cf, cmd, conf);
+
+                elapsed = ngx_conf_profile_time() - start;
+                ngx_conf_profile_command(cmd, elapsed,
+                                         elapsed - ngx_conf_profile_nested);
+                ngx_conf_profile_nested = nested + elapsed;
+
+            } else {
+                rv = cmd->set(cf, cmd, conf);
+            }
 
             if (rv == NGX_CONF_OK) {
                 return NGX_OK;
@@ -1400,3 +1481,155 @@ ngx_conf_check_num_bounds(ngx_conf_t *cf, void *post, void *data)
 
     return NGX_CONF_ERROR;
 }
+
+
+uint64_t
+ngx_conf_profile_time(void)
+{
+    struct timeval  tv;
+
+    if (!ngx_conf_profile) {
+        return 0;
+    }
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+uint64_t
+ngx_conf_profile_phase(char *name, uint64_t start)
+{
+    uint64_t                   elapsed;
+    ngx_uint_t                 i;
+    ngx_conf_profile_phase_t  *ph;
+
+    if (!ngx_conf_profile) {
+        return 0;
+    }
+
+    elapsed = ngx_conf_profile_time() - start;
+
+    for (i = 0; i < ngx_conf_profile_nphases; i++) {
+        ph = &ngx_conf_profile_phases[i];
+
+        if (ngx_strcmp(ph->name, name) == 0) {
+            goto found;
+        }
+    }
+
+    if (ngx_conf_profile_nphases == NGX_CONF_PROFILE_PHASES) {
+        return elapsed;
+    }
+
+    ph = &ngx_conf_profile_phases[ngx_conf_profile_nphases++];
+    ph->name = name;
+
+found:
+
+    ph->count++;
+    ph->time += elapsed;
+
+    return elapsed;
+}
+
+
+static void
+ngx_conf_profile_command(ngx_command_t *cmd, uint64_t total, uint64_t self)
+{
+    ngx_uint_t                   i, n;
+    ngx_conf_profile_command_t  *pc;
+
+    i = ((uintptr_t) cmd / sizeof(ngx_command_t))
+        % NGX_CONF_PROFILE_COMMANDS;
+
+    for (n = 0; n < NGX_CONF_PROFILE_COMMANDS; n++) {
+        pc = &ngx_conf_profile_commands[i];
+
+        if (pc->cmd == cmd || pc->cmd == NULL) {
+            pc->cmd = cmd;
+            pc->count++;
+            pc->total += total;
+            pc->self += self;
+            return;
+        }
+
+        i = (i + 1) % NGX_CONF_PROFILE_COMMANDS;
+    }
+}
+
+
+void
+ngx_conf_profile_reset(void)
+{
+    ngx_memzero(ngx_conf_profile_commands, sizeof(ngx_conf_profile_commands));
+    ngx_memzero(ngx_conf_profile_phases, sizeof(ngx_conf_profile_phases));
+
+    ngx_conf_profile_nphases = 0;
+    ngx_conf_profile_nested = 0;
+}
+
+
+void
+ngx_conf_profile_report(ngx_log_t *log)
+{
+    ngx_uint_t                   i, n;
+    ngx_conf_profile_phase_t    *ph;
+    ngx_conf_profile_command_t  *pc;
+
+    if (!ngx_conf_profile) {
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0, "configuration profile, phases:");
+
+    for (i = 0; i < ngx_conf_profile_nphases; i++) {
+        ph = &ngx_conf_profile_phases[i];
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "  %s: %uL.%03uL ms, %ui calls",
+                      ph->name, ph->time / 1000, ph->time % 1000, ph->count);
+    }
+
+    /* move the used entries to the start and sort them by the self time */
+
+    pc = ngx_conf_profile_commands;
+
+    for (i = 0, n = 0; i < NGX_CONF_PROFILE_COMMANDS; i++) {
+        if (pc[i].cmd) {
+            pc[n++] = pc[i];
+        }
+    }
+
+    ngx_qsort(pc, n, sizeof(ngx_conf_profile_command_t),
+              ngx_conf_profile_cmp);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "configuration profile, directives by self time:");
+
+    for (i = 0; i < n; i++) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "  %V: %uL.%03uL ms, %uL.%03uL ms total, %ui calls",
+                      &pc[i].cmd->name, pc[i].self / 1000, pc[i].self % 1000,
+                      pc[i].total / 1000, pc[i].total % 1000, pc[i].count);
+    }
+
+    ngx_conf_profile_reset();
+}
+
+
+static int ngx_libc_cdecl
+ngx_conf_profile_cmp(const void *one, const void *two)
+{
+    ngx_conf_profile_command_t  *first, *second;
+
+    first = (ngx_conf_profile_command_t *) one;
+    second = (ngx_conf_profile_command_t *) two;
+
+    if (first->self == second->self) {
+        return 0;
+    }
+
+    return (first->self < second->self) ? 1 : -1;
+}
@@ -158,10 +158,17 @@ typedef struct {
 } ngx_core_module_t;
 
 
+typedef struct ngx_conf_snapshot_file_s  ngx_conf_snapshot_file_t;
+
+
 typedef struct {
-    ngx_file_t            file;
-    ngx_buf_t            *buffer;
-    ngx_uint_t            line;
+    ngx_file_t                 file;
+    ngx_buf_t                 *buffer;
+    ngx_uint_t                 line;
+
+    /* the tokens are replayed from the snapshot if replay is set */
+    ngx_conf_snapshot_file_t  *snapshot;
+    u_char                    *replay;
 } ngx_conf_file_t;
 
 
@@ -349,6 +356,13 @@ char *ngx_conf_set_enum_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_conf_set_bitmask_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
+uint64_t ngx_conf_profile_time(void);
+uint64_t ngx_conf_profile_phase(char *name, uint64_t start);
+void ngx_conf_profile_reset(void);
+void ngx_conf_profile_report(ngx_log_t *log);
+
+
+extern ngx_uint_t     ngx_conf_profile;
 extern ngx_uint_t     ngx_max_module;
 extern ngx_module_t  *ngx_modules[];
 
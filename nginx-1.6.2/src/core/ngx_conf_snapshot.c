@@ -0,0 +1,709 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_md5.h>
+
+
+/*
+ * the snapshot file is the header followed by the files, each of them is
+ * the entry, the name and the token records aligned to 8 bytes; a token
+ * record is the return code of the tokenizer, the line, the number of
+ * arguments and the arguments as the length and the data aligned to 4 bytes
+ */
+
+typedef struct {
+    u_char                      magic[8];
+    uint32_t                    version;
+    uint32_t                    nfiles;
+    uint32_t                    size;
+    uint32_t                    hash;
+} ngx_conf_snapshot_header_t;
+
+
+typedef struct {
+    uint64_t                    size;
+    uint64_t                    mtime;
+    uint64_t                    uniq;
+    u_char                      md5[16];
+    uint32_t                    name_len;
+    uint32_t                    data_len;
+} ngx_conf_snapshot_entry_t;
+
+
+static ngx_int_t ngx_conf_snapshot_name(ngx_cycle_t *cycle, ngx_str_t *name);
+static ngx_int_t ngx_conf_snapshot_parse(u_char *buf, size_t size);
+static ngx_int_t ngx_conf_snapshot_check(u_char *p, size_t len);
+static ngx_int_t ngx_conf_snapshot_md5(ngx_conf_file_t *file, u_char *md5);
+static ngx_conf_snapshot_file_t *ngx_conf_snapshot_find(ngx_str_t *name,
+    ngx_file_info_t *fi, u_char *md5);
+static ngx_uint_t ngx_conf_snapshot_match(ngx_conf_snapshot_file_t *sf,
+    ngx_str_t *name, ngx_file_info_t *fi, u_char *md5);
+
+
+static u_char  ngx_conf_snapshot_magic[8] = "NGXCONF";
+
+
+ngx_uint_t  ngx_conf_snapshot;
+
+static ngx_pool_t   *ngx_conf_snapshot_pool;
+
+/* the files of the loaded snapshot */
+static ngx_array_t   ngx_conf_snapshot_loaded;
+
+/* the files used by the current configuration cycle */
+static ngx_array_t   ngx_conf_snapshot_files;
+
+static ngx_uint_t    ngx_conf_snapshot_dirty;
+
+
+ngx_int_t
+ngx_conf_snapshot_load(ngx_cycle_t *cycle, ngx_pool_t *pool)
+{
+    u_char           *buf;
+    size_t            size;
+    ssize_t           n;
+    ngx_str_t         name;
+    ngx_file_t        file;
+    ngx_file_info_t   fi;
+
+    ngx_conf_snapshot_pool = NULL;
+
+    if (!ngx_conf_snapshot) {
+        return NGX_OK;
+    }
+
+    if (ngx_array_init(&ngx_conf_snapshot_loaded, pool, 16,
+                       sizeof(ngx_conf_snapshot_file_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&ngx_conf_snapshot_files, pool, 16,
+                       sizeof(ngx_conf_snapshot_file_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_conf_snapshot_pool = pool;
+    ngx_conf_snapshot_dirty = 0;
+
+    if (ngx_conf_snapshot_name(cycle, &name) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = name;
+    file.log = cycle->log;
+
+    file.fd = ngx_open_file(name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", name.data);
+        }
+
+        ngx_conf_snapshot_dirty = 1;
+        return NGX_OK;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name.data);
+        goto invalid;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_conf_snapshot_header_t)
+        || (off_t) size != ngx_file_size(&fi))
+    {
+        goto invalid;
+    }
+
+    buf = ngx_palloc(pool, size);
+    if (buf == NULL) {
+        (void) ngx_close_file(file.fd);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+
+    if (n != (ssize_t) size) {
+        goto invalid;
+    }
+
+    if (ngx_conf_snapshot_parse(buf, size) != NGX_OK) {
+        goto invalid;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name.data);
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                  "configuration snapshot \"%s\" is invalid, ignored",
+                  name.data);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name.data);
+    }
+
+    ngx_conf_snapshot_loaded.nelts = 0;
+    ngx_conf_snapshot_dirty = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_conf_snapshot_name(ngx_cycle_t *cycle, ngx_str_t *name)
+{
+    name->len = cycle->conf_file.len + sizeof(".bin") - 1;
+
+    name->data = ngx_pnalloc(ngx_conf_snapshot_pool, name->len + 1);
+    if (name->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_sprintf(name->data, "%V.bin%Z", &cycle->conf_file);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_conf_snapshot_parse(u_char *buf, size_t size)
+{
+    u_char                      *p, *last;
+    size_t                       len;
+    ngx_uint_t                   i;
+    ngx_conf_snapshot_file_t    *file;
+    ngx_conf_snapshot_entry_t   *entry;
+    ngx_conf_snapshot_header_t  *header;
+
+    header = (ngx_conf_snapshot_header_t *) buf;
+
+    if (ngx_memcmp(header->magic, ngx_conf_snapshot_magic, 8) != 0
+        || header->version != NGX_CONF_SNAPSHOT_VERSION
+        || header->size != size
+        || header->hash != ngx_murmur_hash2(buf + sizeof(*header),
+                                            size - sizeof(*header)))
+    {
+        return NGX_ERROR;
+    }
+
+    p = buf + sizeof(ngx_conf_snapshot_header_t);
+    last = buf + size;
+
+    for (i = 0; i < header->nfiles; i++) {
+
+        if ((size_t) (last - p) < sizeof(ngx_conf_snapshot_entry_t)) {
+            return NGX_ERROR;
+        }
+
+        entry = (ngx_conf_snapshot_entry_t *) p;
+        p += sizeof(ngx_conf_snapshot_entry_t);
+
+        len = ngx_align(entry->name_len, 8) + ngx_align(entry->data_len, 8);
+
+        if (entry->name_len == 0 || (size_t) (last - p) < len) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_conf_snapshot_check(p + ngx_align(entry->name_len, 8),
+                                    entry->data_len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        file = ngx_array_push(&ngx_conf_snapshot_loaded);
+        if (file == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(file, sizeof(ngx_conf_snapshot_file_t));
+
+        file->name.len = entry->name_len;
+        file->name.data = p;
+        file->size = (off_t) entry->size;
+        file->mtime = (time_t) entry->mtime;
+        file->uniq = (ngx_file_uniq_t) entry->uniq;
+        ngx_memcpy(file->md5, entry->md5, 16);
+        file->data = p + ngx_align(entry->name_len, 8);
+        file->len = entry->data_len;
+        file->done = 1;
+
+        p += len;
+    }
+
+    return (p == last) ? NGX_OK : NGX_ERROR;
+}
+
+
+/* the records are checked once, so they are replayed without checks */
+
+static ngx_int_t
+ngx_conf_snapshot_check(u_char *p, size_t len)
+{
+    u_char    *last;
+    uint32_t  *rec, n, alen;
+
+    last = p + len;
+
+    while ((size_t) (last - p) >= 3 * sizeof(uint32_t)) {
+
+        rec = (uint32_t *) p;
+        p += 3 * sizeof(uint32_t);
+
+        if (rec[0] > NGX_CONF_FILE_DONE) {
+            return NGX_ERROR;
+        }
+
+        for (n = rec[2]; n; n--) {
+            if ((size_t) (last - p) < sizeof(uint32_t)) {
+                return NGX_ERROR;
+            }
+
+            alen = *(uint32_t *) p;
+            p += sizeof(uint32_t);
+
+            if ((size_t) (last - p) < ngx_align(alen, 4)) {
+                return NGX_ERROR;
+            }
+
+            p += ngx_align(alen, 4);
+        }
+
+        if (rec[0] == NGX_CONF_FILE_DONE) {
+            return (p == last) ? NGX_OK : NGX_ERROR;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_conf_snapshot_file(ngx_conf_t *cf, ngx_conf_file_t *file)
+{
+    u_char                      md5[16];
+    size_t                      len;
+    ngx_conf_snapshot_file_t   *sf, **sfp;
+
+    if (ngx_conf_snapshot_pool == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_conf_snapshot_md5(file, md5) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    sf = ngx_conf_snapshot_find(&file->file.name, &file->file.info, md5);
+
+    if (sf) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                       "conf snapshot replay: \"%V\"", &sf->name);
+
+        file->snapshot = sf;
+        file->replay = sf->data;
+
+        return NGX_OK;
+    }
+
+    /* the file is new or has changed, its tokens are recorded */
+
+    sf = ngx_pcalloc(ngx_conf_snapshot_pool, sizeof(ngx_conf_snapshot_file_t));
+    if (sf == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = file->file.name.len;
+
+    sf->name.data = ngx_pnalloc(ngx_conf_snapshot_pool, len);
+    if (sf->name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(sf->name.data, file->file.name.data, len);
+    sf->name.len = len;
+
+    sf->size = ngx_file_size(&file->file.info);
+    sf->mtime = ngx_file_mtime(&file->file.info);
+    sf->uniq = ngx_file_uniq(&file->file.info);
+    ngx_memcpy(sf->md5, md5, 16);
+
+    sfp = ngx_array_push(&ngx_conf_snapshot_files);
+    if (sfp == NULL) {
+        return NGX_ERROR;
+    }
+
+    *sfp = sf;
+
+    ngx_conf_snapshot_dirty = 1;
+
+    file->snapshot = sf;
+    file->replay = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_conf_snapshot_md5(ngx_conf_file_t *file, u_char *md5)
+{
+    u_char     *buf;
+    size_t      size;
+    ssize_t     n;
+    ngx_md5_t   ctx;
+
+    size = (size_t) ngx_file_size(&file->file.info);
+
+    buf = ngx_alloc(size ? size : 1, file->file.log);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_file(&file->file, buf, size, 0);
+
+    if (n != (ssize_t) size) {
+        ngx_free(buf);
+        return NGX_ERROR;
+    }
+
+    ngx_md5_init(&ctx);
+    ngx_md5_update(&ctx, buf, size);
+    ngx_md5_final(md5, &ctx);
+
+    ngx_free(buf);
+
+    file->file.offset = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_conf_snapshot_file_t *
+ngx_conf_snapshot_find(ngx_str_t *name, ngx_file_info_t *fi, u_char *md5)
+{
+    ngx_uint_t                  i;
+    ngx_conf_snapshot_file_t   *sf, **sfp;
+
+    /* the file may be included again, e.g. mime.types */
+
+    sfp = ngx_conf_snapshot_files.elts;
+
+    for (i = 0; i < ngx_conf_snapshot_files.nelts; i++) {
+        sf = sfp[i];
+
+        if (sf->done && ngx_conf_snapshot_match(sf, name, fi, md5)) {
+            return sf;
+        }
+    }
+
+    sf = ngx_conf_snapshot_loaded.elts;
+
+    for (i = 0; i < ngx_conf_snapshot_loaded.nelts; i++) {
+
+        if (ngx_conf_snapshot_match(&sf[i], name, fi, md5)) {
+            sfp = ngx_array_push(&ngx_conf_snapshot_files);
+            if (sfp == NULL) {
+                return NULL;
+            }
+
+            *sfp = &sf[i];
+
+            return &sf[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * a file rewritten in place within a second keeps its size and mtime,
+ * a file replaced by another one gets another inode, and the digest
+ * catches both
+ */
+
+static ngx_uint_t
+ngx_conf_snapshot_match(ngx_conf_snapshot_file_t *sf, ngx_str_t *name,
+    ngx_file_info_t *fi, u_char *md5)
+{
+    return sf->size == ngx_file_size(fi)
+           && sf->mtime == ngx_file_mtime(fi)
+           && sf->uniq == ngx_file_uniq(fi)
+           && ngx_memcmp(sf->md5, md5, 16) == 0
+           && sf->name.len == name->len
+           && ngx_strncmp(sf->name.data, name->data, name->len) == 0;
+}
+
+
+ngx_int_t
+ngx_conf_snapshot_read_token(ngx_conf_t *cf)
+{
+    u_char     *p;
+    uint32_t   *rec, n, len;
+    ngx_str_t  *word;
+
+    p = cf->conf_file->replay;
+
+    rec = (uint32_t *) p;
+    p += 3 * sizeof(uint32_t);
+
+    cf->args->nelts = 0;
+
+    for (n = rec[2]; n; n--) {
+        len = *(uint32_t *) p;
+        p += sizeof(uint32_t);
+
+        word = ngx_array_push(cf->args);
+        if (word == NULL) {
+            return NGX_ERROR;
+        }
+
+        word->data = ngx_pnalloc(cf->pool, len + 1);
+        if (word->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(word->data, p, len);
+        word->data[len] = '\0';
+        word->len = len;
+
+        p += ngx_align(len, 4);
+    }
+
+    cf->conf_file->line = rec[1];
+    cf->conf_file->replay = p;
+
+    return (ngx_int_t) rec[0];
+}
+
+
+ngx_int_t
+ngx_conf_snapshot_record(ngx_conf_t *cf, ngx_int_t rc)
+{
+    u_char                    *p;
+    size_t                     len, size;
+    uint32_t                  *rec;
+    ngx_uint_t                 i;
+    ngx_str_t                 *word;
+    ngx_conf_snapshot_file_t  *sf;
+
+    sf = cf->conf_file->snapshot;
+    word = cf->args->elts;
+
+    len = 3 * sizeof(uint32_t);
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        len += sizeof(uint32_t) + ngx_align(word[i].len, 4);
+    }
+
+    if (sf->len + len > sf->alloc) {
+        size = ngx_max(2 * sf->alloc, sf->len + len);
+        size = ngx_max(size, 4096);
+
+        p = ngx_palloc(ngx_conf_snapshot_pool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (sf->len) {
+            ngx_memcpy(p, sf->data, sf->len);
+        }
+
+        sf->data = p;
+        sf->alloc = size;
+    }
+
+    p = sf->data + sf->len;
+    sf->len += len;
+
+    rec = (uint32_t *) p;
+    rec[0] = (uint32_t) rc;
+    rec[1] = (uint32_t) cf->conf_file->line;
+    rec[2] = (uint32_t) cf->args->nelts;
+
+    p += 3 * sizeof(uint32_t);
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        *(uint32_t *) p = (uint32_t) word[i].len;
+        p += sizeof(uint32_t);
+
+        p = ngx_cpymem(p, word[i].data, word[i].len);
+
+        while ((uintptr_t) p & 3) {
+            *p++ = '\0';
+        }
+    }
+
+    if (rc == NGX_CONF_FILE_DONE) {
+        sf->done = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_conf_snapshot_save(ngx_cycle_t *cycle)
+{
+    u_char                      *buf, *p;
+    size_t                       size;
+    ngx_fd_t                     fd;
+    ngx_str_t                    name, temp;
+    ngx_uint_t                   i;
+    ngx_conf_snapshot_file_t    *sf, **sfp;
+    ngx_conf_snapshot_entry_t   *entry;
+    ngx_conf_snapshot_header_t  *header;
+
+    if (ngx_conf_snapshot_pool == NULL) {
+        return;
+    }
+
+    if (!ngx_conf_snapshot_dirty
+        && ngx_conf_snapshot_files.nelts == ngx_conf_snapshot_loaded.nelts)
+    {
+        goto done;
+    }
+
+    sfp = ngx_conf_snapshot_files.elts;
+
+    size = sizeof(ngx_conf_snapshot_header_t);
+
+    for (i = 0; i < ngx_conf_snapshot_files.nelts; i++) {
+        sf = sfp[i];
+
+        if (!sf->done) {
+            goto done;
+        }
+
+        size += sizeof(ngx_conf_snapshot_entry_t)
+                + ngx_align(sf->name.len, 8) + ngx_align(sf->len, 8);
+    }
+
+    if (size > NGX_MAX_UINT32_VALUE) {
+        goto done;
+    }
+
+    buf = ngx_pcalloc(ngx_conf_snapshot_pool, size);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    p = buf + sizeof(ngx_conf_snapshot_header_t);
+
+    for (i = 0; i < ngx_conf_snapshot_files.nelts; i++) {
+        sf = sfp[i];
+
+        entry = (ngx_conf_snapshot_entry_t *) p;
+        entry->size = (uint64_t) sf->size;
+        entry->mtime = (uint64_t) sf->mtime;
+        entry->uniq = (uint64_t) sf->uniq;
+        ngx_memcpy(entry->md5, sf->md5, 16);
+        entry->name_len = (uint32_t) sf->name.len;
+        entry->data_len = (uint32_t) sf->len;
+
+        p += sizeof(ngx_conf_snapshot_entry_t);
+
+        ngx_memcpy(p, sf->name.data, sf->name.len);
+        p += ngx_align(sf->name.len, 8);
+
+        ngx_memcpy(p, sf->data, sf->len);
+        p += ngx_align(sf->len, 8);
+    }
+
+    header = (ngx_conf_snapshot_header_t *) buf;
+
+    ngx_memcpy(header->magic, ngx_conf_snapshot_magic, 8);
+    header->version = NGX_CONF_SNAPSHOT_VERSION;
+    header->nfiles = (uint32_t) ngx_conf_snapshot_files.nelts;
+    header->size = (uint32_t) size;
+    header->hash = ngx_murmur_hash2(buf + sizeof(ngx_conf_snapshot_header_t),
+                                    size - sizeof(ngx_conf_snapshot_header_t));
+
+    if (ngx_conf_snapshot_name(cycle, &name) != NGX_OK) {
+        goto done;
+    }
+
+    /* the snapshot is written under a temporary name and renamed */
+
+    temp.len = name.len + 1 + NGX_INT64_LEN;
+
+    temp.data = ngx_pnalloc(ngx_conf_snapshot_pool, temp.len + 1);
+    if (temp.data == NULL) {
+        goto done;
+    }
+
+    (void) ngx_sprintf(temp.data, "%V.%P%Z", &name, ngx_pid);
+
+    fd = ngx_open_file(temp.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp.data);
+        goto done;
+    }
+
+    if (ngx_write_fd(fd, buf, size) != (ssize_t) size) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp.data);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
+        fd = NGX_INVALID_FILE;
+        goto failed;
+    }
+
+    if (ngx_rename_file(temp.data, name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp.data, name.data);
+        fd = NGX_INVALID_FILE;
+        goto failed;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "configuration snapshot \"%s\" saved, %ui files",
+                  name.data, ngx_conf_snapshot_files.nelts);
+
+    goto done;
+
+failed:
+
+    if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
+    }
+
+    if (ngx_delete_file(temp.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp.data);
+    }
+
+done:
+
+    ngx_conf_snapshot_pool = NULL;
+}
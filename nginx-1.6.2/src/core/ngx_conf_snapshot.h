@@ -0,0 +1,57 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_CONF_SNAPSHOT_H_INCLUDED_
+#define _NGX_CONF_SNAPSHOT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * A snapshot of the tokens of the configuration files, enabled by the
+ * "-C" command line switch and kept in the "<configuration file>.bin"
+ * file.  A configuration file whose size, modification time, inode and
+ * MD5 digest match the snapshot is not tokenized: its directives are
+ * replayed from the snapshot with the same line numbers.  The directive
+ * handlers are always called, so the names are resolved and the
+ * certificates and files are loaded as usual.  The snapshot is rewritten
+ * after a successful configuration cycle if any file has changed.
+ */
+
+
+#define NGX_CONF_SNAPSHOT_VERSION  2
+
+
+struct ngx_conf_snapshot_file_s {
+    ngx_str_t                  name;
+    off_t                      size;
+    time_t                     mtime;
+    ngx_file_uniq_t            uniq;
+    u_char                     md5[16];
+
+    /* the token records */
+    u_char                    *data;
+    size_t                     len;
+    size_t                     alloc;
+
+    unsigned                   done:1;
+};
+
+
+ngx_int_t ngx_conf_snapshot_load(ngx_cycle_t *cycle, ngx_pool_t *pool);
+ngx_int_t ngx_conf_snapshot_file(ngx_conf_t *cf, ngx_conf_file_t *file);
+ngx_int_t ngx_conf_snapshot_read_token(ngx_conf_t *cf);
+ngx_int_t ngx_conf_snapshot_record(ngx_conf_t *cf, ngx_int_t rc);
+void ngx_conf_snapshot_save(ngx_cycle_t *cycle);
+
+
+extern ngx_uint_t  ngx_conf_snapshot;
+
+
+#endif /* _NGX_CONF_SNAPSHOT_H_INCLUDED_ */
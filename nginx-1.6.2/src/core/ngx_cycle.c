@@ -53,8 +53,12 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_listening_t     *ls, *nls;
     ngx_core_conf_t     *ccf, *old_ccf;
     ngx_core_module_t   *module;
+    uint64_t             start, phase;
     char                 hostname[NGX_MAXHOSTNAMELEN];
 
+    ngx_conf_profile_reset();
+    start = ngx_conf_profile_time();
+
     ngx_timezone_update();
 
     /* force localtime update with a new timezone */
@@ -255,6 +259,14 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     log->log_level = NGX_LOG_DEBUG_ALL;
 #endif
 
+    if (ngx_conf_snapshot_load(cycle, conf.temp_pool) != NGX_OK) {
+        environ = senv;
+        ngx_destroy_cycle_pools(&conf);
+        return NULL;
+    }
+
+    phase = ngx_conf_profile_time();
+
     if (ngx_conf_param(&conf) != NGX_CONF_OK) {
         environ = senv;
         ngx_destroy_cycle_pools(&conf);
@@ -267,6 +279,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         return NULL;
     }
 
+    ngx_conf_profile_phase("parse", phase);
+    phase = ngx_conf_profile_time();
+
     if (ngx_test_config && !ngx_quiet_mode) {
         ngx_log_stderr(0, "the configuration file %s syntax is ok",
                        cycle->conf_file.data);
@@ -290,6 +305,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
     }
 
+    ngx_conf_profile_phase("init conf", phase);
+
     if (ngx_process == NGX_PROCESS_SIGNALLER) {
         return cycle;
     }
@@ -391,6 +408,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
     /* create shared memory */
 
+    phase = ngx_conf_profile_time();
+
     part = &cycle->shared_memory.part;
     shm_zone = part->elts;
 
@@ -413,6 +432,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
 
         shm_zone[i].shm.log = cycle->log;
+        shm_zone[i].shm.huge = ccf->huge_pages;
 
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
@@ -444,6 +464,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 && shm_zone[i].shm.size == oshm_zone[n].shm.size)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.huge = oshm_zone[n].shm.huge;
 
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
@@ -477,6 +498,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     }
 
 
+    ngx_conf_profile_phase("shared memory", phase);
+    phase = ngx_conf_profile_time();
+
+
     /* handle the listening sockets */
 
     if (old_cycle->listening.nelts) {
@@ -584,6 +609,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         ngx_configure_listening_sockets(cycle);
     }
 
+    ngx_conf_profile_phase("listening sockets", phase);
+
 
     /* commit the new cycle configuration */
 
@@ -592,6 +619,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     }
 
     pool->log = cycle->log;
+
+    phase = ngx_conf_profile_time();
 	//调用所有模块的ngx_module_s结构中的init_module方法
     for (i = 0; ngx_modules[i]; i++) {
         if (ngx_modules[i]->init_module) {
@@ -602,6 +631,12 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
     }
 
+    ngx_conf_profile_phase("init modules", phase);
+    ngx_conf_profile_phase("total", start);
+    ngx_conf_profile_report(log);
+
+    ngx_conf_snapshot_save(cycle);
+
 
     /* close and delete stuff that lefts from an old cycle */
 
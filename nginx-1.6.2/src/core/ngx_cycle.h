@@ -89,9 +89,18 @@ typedef struct {
 
      int                      priority;
 
+	 //工作进程中缓存的已释放内存池块的最大总大小，0表示不缓存
+     size_t                   pool_cache;
+
+	 //共享内存区和工作进程的连接、事件数组是否使用大页
+     ngx_flag_t               huge_pages;
+
      ngx_uint_t               cpu_affinity_n;
      uint64_t                *cpu_affinity;
 
+	 //按NUMA节点分组绑定工作进程，并优先在本节点上分配内存
+     ngx_flag_t               numa;
+
      char                    *username;
      ngx_uid_t                user;
      ngx_gid_t                group;
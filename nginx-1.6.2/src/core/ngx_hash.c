@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 
 
+static ngx_uint_t ngx_hash_fits(ngx_hash_key_t *names, ngx_uint_t nelts,
+    u_short *test, ngx_uint_t size, ngx_uint_t bucket_size);
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -254,9 +258,11 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
     u_char          *elts;
     size_t           len;
     u_short         *test;
-    ngx_uint_t       i, n, key, size, start, bucket_size;
+    ngx_uint_t       i, n, key, size, start, step, bucket_size;
     ngx_hash_elt_t  *elt, **buckets;
 
+    len = 0;
+
     for (n = 0; n < nelts; n++) {
         if (hinit->bucket_size < NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *))
         {
@@ -266,6 +272,10 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                           hinit->name, hinit->name, hinit->bucket_size);
             return NGX_ERROR;
         }
+
+        if (names[n].key.data) {
+            len += NGX_HASH_ELT_SIZE(&names[n]);
+        }
     }
 
     test = ngx_alloc(hinit->max_size * sizeof(u_short), hinit->pool->log);
@@ -275,41 +285,43 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 
     bucket_size = hinit->bucket_size - sizeof(void *);
 
+    /*
+     * fewer buckets cannot hold all the elements; from there the sizes
+     * are probed with a step of about 1/64 of the size, so a large hash
+     * is usually found in a few hundred probes, the max_size is always
+     * probed
+     */
+
     start = nelts / (bucket_size / (2 * sizeof(void *)));
+    start = ngx_max(start, len / bucket_size);
     start = start ? start : 1;
 
-    if (hinit->max_size > 10000 && nelts && hinit->max_size / nelts < 100) {
-        start = hinit->max_size - 1000;
-    }
-
-    for (size = start; size <= hinit->max_size; size++) {
-
-        ngx_memzero(test, size * sizeof(u_short));
-
-        for (n = 0; n < nelts; n++) {
-            if (names[n].key.data == NULL) {
-                continue;
-            }
+    for (size = start; size <= hinit->max_size; size += step) {
 
-            key = names[n].key_hash % size;
-            test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+        step = (size >> 6) + 1;
 
-#if 0
-            ngx_log_error(NGX_LOG_ALERT, hinit->pool->log, 0,
-                          "%ui: %ui %ui \"%V\"",
-                          size, key, test[key], &names[n].key);
-#endif
+        if (size < hinit->max_size && size + step > hinit->max_size) {
+            step = hinit->max_size - size;
+        }
 
-            if (test[key] > (u_short) bucket_size) {
-                goto next;
-            }
+        if (ngx_hash_fits(names, nelts, test, size, bucket_size)) {
+            goto found;
         }
+    }
 
-        goto found;
+    /*
+     * the steps may skip every fitting size below a tight max_size,
+     * so these sizes are probed one by one as before
+     */
 
-    next:
+    if (hinit->max_size > 10000 && nelts && hinit->max_size / nelts < 100) {
+        start = ngx_max(start, hinit->max_size - 1000);
+    }
 
-        continue;
+    for (size = start; size < hinit->max_size; size++) {
+        if (ngx_hash_fits(names, nelts, test, size, bucket_size)) {
+            goto found;
+        }
     }
 
     ngx_log_error(NGX_LOG_WARN, hinit->pool->log, 0,
@@ -319,6 +331,8 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                   hinit->name, hinit->name, hinit->max_size,
                   hinit->name, hinit->bucket_size, hinit->name);
 
+    size = hinit->max_size;
+
 found:
 
     for (i = 0; i < size; i++) {
@@ -452,6 +466,37 @@ found:
 }
 
 
+static ngx_uint_t
+ngx_hash_fits(ngx_hash_key_t *names, ngx_uint_t nelts, u_short *test,
+    ngx_uint_t size, ngx_uint_t bucket_size)
+{
+    ngx_uint_t  n, key;
+
+    ngx_memzero(test, size * sizeof(u_short));
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        key = names[n].key_hash % size;
+        test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+
+#if 0
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "%ui: %ui %ui \"%V\"",
+                      size, key, test[key], &names[n].key);
+#endif
+
+        if (test[key] > (u_short) bucket_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
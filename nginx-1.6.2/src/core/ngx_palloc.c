@@ -9,8 +9,54 @@
 #include <ngx_core.h>
 
 
+/*
+ * freed pool blocks and large allocations are kept in per-process free
+ * lists and reused by the next ngx_create_pool() and ngx_palloc_large();
+ * the cache is enabled in worker processes only, which are single-threaded,
+ * so the lists need no locking
+ */
+
+typedef struct ngx_cached_block_s  ngx_cached_block_t;
+
+struct ngx_cached_block_s {
+    ngx_cached_block_t       *next;
+};
+
+
+typedef struct {
+    size_t                    size;
+    ngx_uint_t                number;
+    ngx_cached_block_t       *block;
+    ngx_uint_t                seen;
+} ngx_cached_block_slot_t;
+
+
+/* the number of distinct pool sizes, usually there are only a few of them */
+#define NGX_POOL_CACHE_SIZES  8
+
+/* a pool size is cached only after it has been allocated this many times */
+#define NGX_POOL_CACHE_SEEN   16
+
+/* large allocations up to this number of pages are rounded and cached */
+#define NGX_POOL_CACHE_PAGES  16
+
+
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_alloc_block(size_t size, ngx_log_t *log);
+static void ngx_pool_free_block(void *p, size_t size);
+static void ngx_pool_free_large(void *p, size_t size);
+static void *ngx_get_cached_block(ngx_cached_block_slot_t *slot);
+static ngx_int_t ngx_put_cached_block(ngx_cached_block_slot_t *slot, void *p);
+
+
+static ngx_cached_block_slot_t  ngx_pool_blocks[NGX_POOL_CACHE_SIZES];
+static ngx_cached_block_slot_t  ngx_large_blocks[NGX_POOL_CACHE_PAGES + 1];
+
+static size_t  ngx_pool_cache_size;
+static size_t  ngx_pool_cache_max;
+
+ngx_pool_cache_stat_t  ngx_pool_cache_stat;
 
 
 ngx_pool_t *
@@ -18,7 +64,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_alloc_block(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -61,7 +107,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
 
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l->alloc, l->size);
         }
     }
 
@@ -84,7 +130,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 #endif
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_free_block(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -101,7 +147,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l->alloc, l->size);
         }
     }
 
@@ -185,7 +231,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_alloc_block(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -219,13 +265,33 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
-    void              *p;
-    ngx_uint_t         n;
-    ngx_pool_large_t  *large;
+    void                     *p;
+    size_t                    cached;
+    ngx_uint_t                n;
+    ngx_pool_large_t         *large;
+    ngx_cached_block_slot_t  *slot;
+
+    p = NULL;
+    cached = 0;
+
+    n = (size + ngx_pagesize - 1) / ngx_pagesize;
+
+    if (ngx_pool_cache_max && n <= NGX_POOL_CACHE_PAGES) {
+
+        /* the size is rounded up to pages to share the cached blocks */
+
+        slot = &ngx_large_blocks[n];
+        cached = n * ngx_pagesize;
+        size = cached;
+
+        p = ngx_get_cached_block(slot);
+    }
 
-    p = ngx_alloc(size, pool->log);
     if (p == NULL) {
-        return NULL;
+        p = ngx_alloc(size, pool->log);
+        if (p == NULL) {
+            return NULL;
+        }
     }
 
     n = 0;
@@ -233,6 +299,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = cached;
             return p;
         }
 
@@ -243,11 +310,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc(pool, sizeof(ngx_pool_large_t));
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_free_large(p, cached);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = cached;
     large->next = pool->large;
     pool->large = large;
 
@@ -273,6 +341,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -289,7 +358,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_free_large(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -407,30 +476,168 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+
+void
+ngx_pool_cache_init(size_t max)
+{
+    ngx_uint_t  i;
+
+    for (i = 1; i <= NGX_POOL_CACHE_PAGES; i++) {
+        ngx_large_blocks[i].size = i * ngx_pagesize;
+    }
+
+    ngx_pool_cache_max = max;
+}
+
+
+/*
+ * a pool block size takes a slot only after it has been seen repeatedly,
+ * so a burst of one-off sizes does not use up the slots: until then the
+ * slot is a candidate, and a new size replaces the least seen candidate
+ */
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_alloc_block(size_t size, ngx_log_t *log)
 {
     void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_uint_t                i;
+    ngx_cached_block_slot_t  *slot, *candidate;
 
-    if (ngx_cycle->cache == NULL) {
-        return NULL;
+    if (ngx_pool_cache_max == 0) {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
+
+    candidate = NULL;
+
+    for (i = 0; i < NGX_POOL_CACHE_SIZES; i++) {
+        slot = &ngx_pool_blocks[i];
+
+        if (slot->size == size) {
+            break;
+        }
+
+        if (slot->seen < NGX_POOL_CACHE_SEEN
+            && (candidate == NULL || slot->seen < candidate->seen))
+        {
+            candidate = slot;
+        }
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    if (i == NGX_POOL_CACHE_SIZES) {
+
+        if (candidate == NULL) {
+            /* all slots are taken by the frequent sizes */
+            return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+        }
+
+        slot = candidate;
+        slot->size = size;
+        slot->seen = 0;
+    }
+
+    if (slot->seen < NGX_POOL_CACHE_SEEN) {
+        slot->seen++;
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
 
-    slot->tries++;
+    p = ngx_get_cached_block(slot);
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
+    if (p) {
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "cached pool block: %p:%uz", p, size);
         return p;
     }
 
-    return NULL;
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
 }
 
-#endif
+
+static void
+ngx_pool_free_block(void *p, size_t size)
+{
+    ngx_uint_t                i;
+    ngx_cached_block_slot_t  *slot;
+
+    /* the pool log may be already freed, so nothing is logged here */
+
+    if (ngx_pool_cache_max) {
+
+        for (i = 0; i < NGX_POOL_CACHE_SIZES; i++) {
+            slot = &ngx_pool_blocks[i];
+
+            if (slot->size == size) {
+                if (slot->seen == NGX_POOL_CACHE_SEEN
+                    && ngx_put_cached_block(slot, p) == NGX_OK)
+                {
+                    return;
+                }
+
+                break;
+            }
+        }
+    }
+
+    ngx_free(p);
+}
+
+
+static void
+ngx_pool_free_large(void *p, size_t size)
+{
+    if (size && ngx_pool_cache_max) {
+        if (ngx_put_cached_block(&ngx_large_blocks[size / ngx_pagesize], p)
+            == NGX_OK)
+        {
+            return;
+        }
+    }
+
+    ngx_free(p);
+}
+
+
+/*
+ * the cached blocks are returned as is: like malloc() memory they are
+ * not cleared, ngx_pcalloc() zeroes only what is actually requested
+ */
+
+static void *
+ngx_get_cached_block(ngx_cached_block_slot_t *slot)
+{
+    ngx_cached_block_t  *b;
+
+    if (slot->number == 0) {
+        ngx_pool_cache_stat.misses++;
+        return NULL;
+    }
+
+    b = slot->block;
+    slot->block = b->next;
+    slot->number--;
+
+    ngx_pool_cache_size -= slot->size;
+    ngx_pool_cache_stat.hits++;
+
+    return b;
+}
+
+
+static ngx_int_t
+ngx_put_cached_block(ngx_cached_block_slot_t *slot, void *p)
+{
+    ngx_cached_block_t  *b;
+
+    if (ngx_pool_cache_size + slot->size > ngx_pool_cache_max) {
+        ngx_pool_cache_stat.drops++;
+        return NGX_DECLINED;
+    }
+
+    b = p;
+    b->next = slot->block;
+    slot->block = b;
+    slot->number++;
+
+    ngx_pool_cache_size += slot->size;
+
+    return NGX_OK;
+}
@@ -46,6 +46,8 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    //分配的大小，为0表示该块不能放入缓存中复用（如ngx_pmemalign()分配的）
+    size_t                size;
 };
 
 
@@ -78,6 +80,16 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct {
+	//从缓存中取得内存块的次数
+    ngx_uint_t            hits;
+	//缓存中没有合适的内存块，需要调用malloc的次数
+    ngx_uint_t            misses;
+	//缓存已满，直接free的次数
+    ngx_uint_t            drops;
+} ngx_pool_cache_stat_t;
+
+
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
@@ -97,5 +109,10 @@ void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
 void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
+void ngx_pool_cache_init(size_t max);
+
+
+extern ngx_pool_cache_stat_t  ngx_pool_cache_stat;
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
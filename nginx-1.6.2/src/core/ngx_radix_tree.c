@@ -9,9 +9,30 @@
 #include <ngx_core.h>
 
 
+static ngx_int_t ngx_radix_trie_build(ngx_array_t *nodes,
+    ngx_array_t *leaves, ngx_uint_t n, ngx_radix_node_t *node,
+    uintptr_t value);
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
 
 
+#define NGX_RADIX_TRIE_STRIDE  6
+
+
+static ngx_inline ngx_uint_t
+ngx_radix_popcount(uint64_t n)
+{
+#if (NGX_HAVE_GCC_BUILTIN_POPCOUNT)
+    return __builtin_popcountll(n);
+#else
+    n = n - ((n >> 1) & 0x5555555555555555ULL);
+    n = (n & 0x3333333333333333ULL) + ((n >> 2) & 0x3333333333333333ULL);
+    n = (n + (n >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((n * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+
 ngx_radix_tree_t *
 ngx_radix_tree_create(ngx_pool_t *pool, ngx_int_t preallocate)
 {
@@ -263,6 +284,179 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 }
 
 
+ngx_radix_trie_t *
+ngx_radix_trie_create(ngx_radix_tree_t *tree, ngx_pool_t *pool)
+{
+    ngx_array_t        nodes, leaves;
+    ngx_radix_trie_t  *trie;
+
+    if (ngx_array_init(&nodes, tree->pool, 64, sizeof(ngx_radix_trie_node_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&leaves, tree->pool, 64, sizeof(uintptr_t)) != NGX_OK) {
+        return NULL;
+    }
+
+    if (ngx_array_push(&nodes) == NULL) {
+        return NULL;
+    }
+
+    if (ngx_radix_trie_build(&nodes, &leaves, 0, tree->root, tree->root->value)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    trie = ngx_palloc(pool, sizeof(ngx_radix_trie_t));
+    if (trie == NULL) {
+        return NULL;
+    }
+
+    trie->nnodes = nodes.nelts;
+    trie->nleaves = leaves.nelts;
+
+    trie->nodes = ngx_palloc(pool, nodes.nelts * sizeof(ngx_radix_trie_node_t));
+    if (trie->nodes == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(trie->nodes, nodes.elts,
+               nodes.nelts * sizeof(ngx_radix_trie_node_t));
+
+    trie->leaves = ngx_palloc(pool, leaves.nelts * sizeof(uintptr_t));
+    if (trie->leaves == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(trie->leaves, leaves.elts, leaves.nelts * sizeof(uintptr_t));
+
+    return trie;
+}
+
+
+/*
+ * expands the 64 slots of the trie node n from the binary subtree
+ * of "node", "value" is the longest match inherited from above
+ */
+
+static ngx_int_t
+ngx_radix_trie_build(ngx_array_t *nodes, ngx_array_t *leaves, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value)
+{
+    uint64_t                vector, leafvec;
+    uintptr_t               v, last, *leaf, values[64];
+    ngx_uint_t              s, i, k, base0, base1;
+    ngx_radix_node_t       *child, *children[64];
+    ngx_radix_trie_node_t  *tn;
+
+    vector = 0;
+    leafvec = 0;
+    base0 = leaves->nelts;
+    last = NGX_RADIX_NO_VALUE;
+    k = 0;
+
+    for (s = 0; s < 64; s++) {
+
+        child = node;
+        v = value;
+
+        for (i = 0; i < NGX_RADIX_TRIE_STRIDE; i++) {
+            child = (s & (0x20 >> i)) ? child->right : child->left;
+
+            if (child == NULL) {
+                break;
+            }
+
+            if (child->value != NGX_RADIX_NO_VALUE) {
+                v = child->value;
+            }
+        }
+
+        if (child && (child->right || child->left)) {
+            vector |= (uint64_t) 1 << s;
+            children[k] = child;
+            values[k] = v;
+            k++;
+            continue;
+        }
+
+        if (leaves->nelts == base0 || v != last) {
+            leaf = ngx_array_push(leaves);
+            if (leaf == NULL) {
+                return NGX_ERROR;
+            }
+
+            *leaf = v;
+            last = v;
+            leafvec |= (uint64_t) 1 << s;
+        }
+    }
+
+    base1 = nodes->nelts;
+
+    if (k && ngx_array_push_n(nodes, k) == NULL) {
+        return NGX_ERROR;
+    }
+
+    tn = (ngx_radix_trie_node_t *) nodes->elts + n;
+
+    tn->vector = vector;
+    tn->leafvec = leafvec;
+    tn->base0 = (uint32_t) base0;
+    tn->base1 = (uint32_t) base1;
+
+    for (i = 0; i < k; i++) {
+        if (ngx_radix_trie_build(nodes, leaves, base1 + i, children[i],
+                                 values[i])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+uintptr_t
+ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key)
+{
+    uint64_t                bit;
+    ngx_uint_t              idx, shift;
+    ngx_radix_trie_node_t  *node;
+
+    node = trie->nodes;
+    shift = 32;
+
+    for ( ;; ) {
+
+        if (shift >= NGX_RADIX_TRIE_STRIDE) {
+            idx = (key >> (shift - NGX_RADIX_TRIE_STRIDE)) & 0x3f;
+
+        } else {
+            idx = (key << (NGX_RADIX_TRIE_STRIDE - shift)) & 0x3f;
+        }
+
+        bit = (uint64_t) 1 << idx;
+
+        if ((node->vector & bit) == 0) {
+            return trie->leaves[node->base0
+                                + ngx_radix_popcount(node->leafvec
+                                                     & ((bit << 1) - 1))
+                                - 1];
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_radix_popcount(node->vector & (bit - 1))];
+
+        shift -= NGX_RADIX_TRIE_STRIDE;
+    }
+}
+
+
 #if (NGX_HAVE_INET6)
 
 ngx_int_t
@@ -457,6 +651,42 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     return value;
 }
 
+
+uintptr_t
+ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key)
+{
+    uint64_t                bit;
+    ngx_uint_t              i, w, idx, off;
+    ngx_radix_trie_node_t  *node;
+
+    node = trie->nodes;
+
+    for (off = 0; /* void */ ; off += NGX_RADIX_TRIE_STRIDE) {
+
+        i = off >> 3;
+
+        w = key[i] << 8;
+
+        if (i < 15) {
+            w |= key[i + 1];
+        }
+
+        idx = (w >> (16 - NGX_RADIX_TRIE_STRIDE - (off & 7))) & 0x3f;
+
+        bit = (uint64_t) 1 << idx;
+
+        if ((node->vector & bit) == 0) {
+            return trie->leaves[node->base0
+                                + ngx_radix_popcount(node->leafvec
+                                                     & ((bit << 1) - 1))
+                                - 1];
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_radix_popcount(node->vector & (bit - 1))];
+    }
+}
+
 #endif
 
 
@@ -43,6 +43,31 @@ typedef struct {
 } ngx_radix_tree_t;
 
 
+/*
+ * a read-only multibit trie compiled from a radix tree: every node covers
+ * 6 bits of the key, its children and leaves are stored contiguously and
+ * are addressed by popcount over the "vector" and "leafvec" bitmaps,
+ * runs of equal leaves are stored once
+ */
+
+typedef struct {
+    uint64_t               vector;
+    uint64_t               leafvec;
+	//本节点第一个叶子在leaves数组中的下标
+    uint32_t               base0;
+	//本节点第一个子节点在nodes数组中的下标
+    uint32_t               base1;
+} ngx_radix_trie_node_t;
+
+
+typedef struct {
+    ngx_radix_trie_node_t  *nodes;
+    uintptr_t              *leaves;
+    ngx_uint_t              nnodes;
+    ngx_uint_t              nleaves;
+} ngx_radix_trie_t;
+
+
 ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool,
     ngx_int_t preallocate);
 
@@ -52,12 +77,17 @@ ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask);
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
 
+ngx_radix_trie_t *ngx_radix_trie_create(ngx_radix_tree_t *tree,
+    ngx_pool_t *pool);
+uintptr_t ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key);
+
 #if (NGX_HAVE_INET6)
 ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
     u_char *key, u_char *mask, uintptr_t value);
 ngx_int_t ngx_radix128tree_delete(ngx_radix_tree_t *tree,
     u_char *key, u_char *mask);
 uintptr_t ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key);
+uintptr_t ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key);
 #endif
 
 
@@ -20,6 +20,12 @@ static void ngx_libc_cdecl ngx_regex_free(void *p);
 static void ngx_pcre_free_studies(void *data);
 #endif
 
+static ngx_int_t ngx_regex_literal(ngx_regex_compile_t *rc);
+static ngx_int_t ngx_regex_single_branch(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_class(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_group(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_quantifier(u_char *p, u_char *last);
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
@@ -154,6 +160,10 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     rc->regex->code = re;
 
+    if (ngx_regex_literal(rc) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     /* do not study at runtime */
 
     if (ngx_pcre_studies != NULL) {
@@ -208,6 +218,416 @@ failed:
 }
 
 
+/*
+ * The literal is extracted conservatively: only characters that any match
+ * has to contain are collected.  Groups, classes, escape sequences other
+ * than escaped punctuation, bytes of multibyte characters, and characters
+ * followed by a quantifier which allows zero repetitions end a literal run.
+ * Patterns with top-level alternation, inline options, verbs or \Q...\E
+ * quoting get no literal at all.
+ */
+
+static ngx_int_t
+ngx_regex_literal(ngx_regex_compile_t *rc)
+{
+    u_char       *p, *last, *run, *best, c;
+    size_t        n, len;
+    ngx_uint_t    caseless, anchored, first;
+    ngx_regex_t  *re;
+
+    re = rc->regex;
+
+    p = rc->pattern.data;
+    last = p + rc->pattern.len;
+
+    if (ngx_regex_single_branch(p, last) != NGX_OK) {
+        return NGX_OK;
+    }
+
+    /*
+     * the verbs such as (*UTF8) or (*ACCEPT) change the meaning of the
+     * bytes or end the match early, even inside a group
+     */
+
+    if (ngx_strnstr(p, "(*", rc->pattern.len)) {
+        return NGX_OK;
+    }
+
+    caseless = (rc->options & NGX_REGEX_CASELESS) ? 1 : 0;
+
+    anchored = 0;
+
+    if (p < last && *p == '^') {
+        anchored = 1;
+        p++;
+    }
+
+    run = ngx_pnalloc(rc->pool, 2 * rc->pattern.len + 2);
+    if (run == NULL) {
+        return NGX_ERROR;
+    }
+
+    best = run + rc->pattern.len + 1;
+
+    n = 0;
+    len = 0;
+    first = anchored;
+
+    while (p < last) {
+
+        c = *p;
+
+        switch (c) {
+
+        case '\\':
+            if (p + 1 == last) {
+                return NGX_OK;
+            }
+
+            c = p[1];
+
+            if (c >= 0x80
+                || (c >= '0' && c <= '9')
+                || (c >= 'a' && c <= 'z')
+                || (c >= 'A' && c <= 'Z'))
+            {
+                /* character types and assertions have no arguments */
+
+                if (ngx_strchr("dDsSwWbBAzZGhHvVRX", c) == NULL) {
+                    return NGX_OK;
+                }
+
+                p += 2;
+                goto end;
+            }
+
+            p += 2;
+            goto literal;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NGX_OK;
+            }
+
+            goto end;
+
+        case '(':
+            if (p + 1 < last && p[1] == '?'
+                && (p + 2 == last || ngx_strchr(":=!<>P", p[2]) == NULL))
+            {
+                /* inline options, comments, recursion and conditions */
+                return NGX_OK;
+            }
+
+            p = ngx_regex_skip_group(p, last);
+            if (p == NULL) {
+                return NGX_OK;
+            }
+
+            goto end;
+
+        case '{':
+            p = ngx_regex_skip_quantifier(p, last);
+            if (p == NULL) {
+                return NGX_OK;
+            }
+
+            goto end;
+
+        case ')':
+        case '|':
+            return NGX_OK;
+
+        case '.':
+        case '^':
+        case '$':
+        case '*':
+        case '+':
+        case '?':
+            p++;
+            goto end;
+
+        default:
+            p++;
+
+            if (c >= 0x80) {
+                /* may be a part of a multibyte character */
+                goto end;
+            }
+
+            goto literal;
+        }
+
+    literal:
+
+        if (p < last && (*p == '?' || *p == '*' || *p == '{')) {
+            /* the character is optional */
+            goto end;
+        }
+
+        if (caseless) {
+            c = ngx_tolower(c);
+        }
+
+        run[n++] = c;
+
+        if (p < last && *p == '+') {
+            goto end;
+        }
+
+        continue;
+
+    end:
+
+        if (first && n) {
+            /* a prefix of an anchored pattern is the cheapest to check */
+            ngx_memcpy(best, run, n);
+            len = n;
+            break;
+        }
+
+        first = 0;
+
+        if (n > len) {
+            ngx_memcpy(best, run, n);
+            len = n;
+        }
+
+        n = 0;
+    }
+
+    if (p == last && n) {
+        if (first) {
+            ngx_memcpy(best, run, n);
+            len = n;
+
+        } else if (n > len) {
+            ngx_memcpy(best, run, n);
+            len = n;
+        }
+    }
+
+    if (!first || len == 0) {
+        anchored = 0;
+    }
+
+    re->literal.data = best;
+    re->literal.len = len;
+    re->anchored = anchored;
+    re->caseless = caseless;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a literal is only extracted from a pattern that is a single alternative:
+ * there is no "|" outside of classes and groups, and nothing follows "$"
+ */
+
+static ngx_int_t
+ngx_regex_single_branch(u_char *p, u_char *last)
+{
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            p += 2;
+            continue;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NGX_DECLINED;
+            }
+
+            continue;
+
+        case '(':
+            p = ngx_regex_skip_group(p, last);
+            if (p == NULL) {
+                return NGX_DECLINED;
+            }
+
+            continue;
+
+        case '|':
+            return NGX_DECLINED;
+
+        case '$':
+            if (p + 1 != last) {
+                return NGX_DECLINED;
+            }
+
+            break;
+        }
+
+        p++;
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_regex_skip_class(u_char *p, u_char *last)
+{
+    /* p points to "[" */
+
+    p++;
+
+    if (p < last && *p == '^') {
+        p++;
+    }
+
+    if (p < last && *p == ']') {
+        p++;
+    }
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            p += 2;
+            continue;
+
+        case '[':
+            if (p + 1 < last && p[1] == ':') {
+                p = ngx_strlchr(p + 2, last, ']');
+                if (p == NULL) {
+                    return NULL;
+                }
+            }
+
+            break;
+
+        case ']':
+            return p + 1;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_group(u_char *p, u_char *last)
+{
+    ngx_uint_t  depth;
+
+    depth = 0;
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            p += 2;
+            continue;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NULL;
+            }
+
+            continue;
+
+        case '(':
+            depth++;
+            break;
+
+        case ')':
+            if (--depth == 0) {
+                return p + 1;
+            }
+
+            break;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_quantifier(u_char *p, u_char *last)
+{
+    /* only "{n}", "{n,}" and "{n,m}" are quantifiers */
+
+    p++;
+
+    if (p == last || *p < '0' || *p > '9') {
+        return NULL;
+    }
+
+    while (p < last && *p >= '0' && *p <= '9') {
+        p++;
+    }
+
+    if (p < last && *p == ',') {
+        p++;
+
+        while (p < last && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    if (p < last && *p == '}') {
+        return p + 1;
+    }
+
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_regex_prefilter(ngx_regex_t *re, ngx_str_t *s)
+{
+    u_char  *p, *last, *literal;
+    size_t   len;
+
+    literal = re->literal.data;
+    len = re->literal.len;
+
+    if (s->len < len) {
+        return NGX_DECLINED;
+    }
+
+    if (re->anchored) {
+
+        if (re->caseless) {
+            return ngx_strncasecmp(s->data, literal, len) ? NGX_DECLINED
+                                                          : NGX_OK;
+        }
+
+        return ngx_strncmp(s->data, literal, len) ? NGX_DECLINED : NGX_OK;
+    }
+
+    if (re->caseless) {
+        p = ngx_strlcasestrn(s->data, s->data + s->len, literal, len - 1);
+        return p ? NGX_OK : NGX_DECLINED;
+    }
+
+    last = s->data + s->len - len;
+
+    for (p = s->data; p <= last; p++) {
+        if (*p == *literal && ngx_memcmp(p + 1, literal + 1, len - 1) == 0) {
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 {
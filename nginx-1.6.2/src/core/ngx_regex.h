@@ -23,6 +23,14 @@
 typedef struct {
     pcre        *code;
     pcre_extra  *extra;
+
+    /*
+     * 编译时从模式中提取的、任何匹配都必须包含的字面量字符串，
+     * 匹配前先用它过滤，不含该字符串的subject不再调用pcre_exec()
+     */
+    ngx_str_t    literal;
+    unsigned     anchored:1;   /* literal is a prefix of any match */
+    unsigned     caseless:1;   /* literal is lowercased */
 } ngx_regex_t;
 
 
@@ -50,10 +58,13 @@ void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 #define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+    (((re)->literal.len && ngx_regex_prefilter(re, s) != NGX_OK)             \
+     ? NGX_REGEX_NO_MATCHED                                                  \
+     : pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len,    \
+                 0, 0, captures, size))
 #define ngx_regex_exec_n      "pcre_exec()"
 
+ngx_int_t ngx_regex_prefilter(ngx_regex_t *re, ngx_str_t *s);
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
 
@@ -0,0 +1,990 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_SHARED_TABLE_CHECK  0
+#define NGX_SHARED_TABLE_FORCE  1
+#define NGX_SHARED_TABLE_SYNC   2
+
+
+/*
+ * A version is a single slab allocation: the header, an open addressing
+ * index of 2^n buckets which is at most half full, and the entries,
+ * each one is the key length, the value length, the key and the value
+ * aligned to 4 bytes.  The bucket offsets are relative to the header,
+ * so an empty bucket has the zero offset.
+ */
+
+typedef struct {
+    uint32_t                     hash;
+    uint32_t                     offset;
+} ngx_shared_table_bucket_t;
+
+
+typedef struct {
+    ngx_str_t                    key;
+    ngx_str_t                    value;
+    ngx_uint_t                   class;
+} ngx_shared_table_elt_t;
+
+
+static ngx_int_t ngx_shared_table_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_shared_table_handler(ngx_event_t *ev);
+static ngx_int_t ngx_shared_table_update(ngx_shared_table_t *st,
+    ngx_uint_t mode);
+static ngx_int_t ngx_shared_table_build(ngx_shared_table_t *st,
+    ngx_file_info_t *fi, ngx_uint_t level);
+static ngx_int_t ngx_shared_table_parse(ngx_shared_table_t *st,
+    ngx_pool_t *pool, u_char *p, u_char *last, ngx_array_t *elts,
+    ngx_uint_t level);
+static ngx_shared_table_version_t *ngx_shared_table_create(
+    ngx_shared_table_t *st, ngx_array_t *elts, ngx_uint_t level);
+static ngx_uint_t ngx_shared_table_free_retired(ngx_shared_table_t *st);
+
+
+ngx_shared_table_t *
+ngx_shared_table_add(ngx_conf_t *cf, ngx_str_t *args, ngx_uint_t nargs,
+    void *tag)
+{
+    u_char              *p;
+    ssize_t              size;
+    ngx_str_t            name, s;
+    ngx_uint_t           i;
+    ngx_msec_t           interval;
+    ngx_shm_zone_t      *shm_zone;
+    ngx_shared_table_t  *st;
+
+    size = 0;
+    name.len = 0;
+    interval = 5000;
+
+    for (i = 1; i < nargs; i++) {
+
+        if (ngx_strncmp(args[i].data, "zone=", 5) == 0) {
+
+            name.data = args[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &args[i]);
+                return NULL;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = args[i].data + args[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &args[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &args[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(args[i].data, "interval=", 9) == 0) {
+
+            s.len = args[i].len - 9;
+            s.data = args[i].data + 9;
+
+            interval = ngx_parse_time(&s, 0);
+
+            if (interval == (ngx_msec_t) NGX_ERROR || interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid interval \"%V\"", &args[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &args[i]);
+        return NULL;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "dynamic table \"%V\" must have \"zone\" parameter",
+                           &args[0]);
+        return NULL;
+    }
+
+    st = ngx_pcalloc(cf->cycle->pool, sizeof(ngx_shared_table_t));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    /* the arguments may be allocated in a temporary pool */
+
+    p = ngx_pnalloc(cf->cycle->pool, name.len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(p, name.data, name.len);
+    name.data = p;
+
+    st->file.len = args[0].len;
+    st->file.data = ngx_pnalloc(cf->cycle->pool, args[0].len + 1);
+    if (st->file.data == NULL) {
+        return NULL;
+    }
+
+    ngx_cpystrn(st->file.data, args[0].data, args[0].len + 1);
+
+    if (ngx_conf_full_name(cf->cycle, &st->file, 1) != NGX_OK) {
+        return NULL;
+    }
+
+    st->interval = interval;
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, tag);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NULL;
+    }
+
+    shm_zone->init = ngx_shared_table_init_zone;
+    shm_zone->data = st;
+
+    st->shm_zone = shm_zone;
+
+    return st;
+}
+
+
+static ngx_int_t
+ngx_shared_table_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_shared_table_t  *ost = data;
+
+    size_t                  len;
+    ngx_slab_pool_t        *shpool;
+    ngx_shared_table_t     *st;
+    ngx_shared_table_sh_t  *sh;
+
+    st = shm_zone->data;
+
+    if (ost) {
+        st->sh = ost->sh;
+        st->shpool = ost->shpool;
+
+        /* the file may be changed by the new configuration */
+
+        return ngx_shared_table_update(st, NGX_SHARED_TABLE_SYNC);
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    st->shpool = shpool;
+
+    if (shm_zone->shm.exists) {
+        st->sh = shpool->data;
+
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_shared_table_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh, sizeof(ngx_shared_table_sh_t));
+
+    sh->generation = 1;
+
+    st->sh = sh;
+    shpool->data = sh;
+
+    len = sizeof(" in dynamic table zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in dynamic table zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return ngx_shared_table_update(st, NGX_SHARED_TABLE_SYNC);
+}
+
+
+ngx_int_t
+ngx_shared_table_init_process(ngx_cycle_t *cycle, void *tag)
+{
+    ngx_uint_t           i;
+    ngx_event_t         *ev;
+    ngx_shm_zone_t      *shm_zone;
+    ngx_list_part_t     *part;
+    ngx_shared_table_t  *st;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_shared_table_init_zone
+            || shm_zone[i].tag != tag)
+        {
+            continue;
+        }
+
+        st = shm_zone[i].data;
+
+        /* the slot may be left by a crashed process */
+
+        st->sh->readers[ngx_process_slot] = 0;
+
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        ev->handler = ngx_shared_table_handler;
+        ev->data = st;
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        st->event = ev;
+
+        ngx_add_timer(ev, st->interval);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * makes the worker process check the files of all dynamic tables
+ * right away, regardless of the interval; used by the "update" command
+ */
+
+void
+ngx_shared_table_refresh(ngx_cycle_t *cycle)
+{
+    ngx_uint_t           i;
+    ngx_shm_zone_t      *shm_zone;
+    ngx_list_part_t     *part;
+    ngx_shared_table_t  *st;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_shared_table_init_zone) {
+            continue;
+        }
+
+        st = shm_zone[i].data;
+
+        if (st->event == NULL) {
+            continue;
+        }
+
+        st->force = 1;
+
+        ngx_add_timer(st->event, 1);
+    }
+}
+
+
+static void
+ngx_shared_table_handler(ngx_event_t *ev)
+{
+    ngx_shared_table_t  *st = ev->data;
+
+    ngx_int_t  rc;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    rc = ngx_shared_table_update(st, st->force ? NGX_SHARED_TABLE_FORCE
+                                               : NGX_SHARED_TABLE_CHECK);
+
+    if (rc == NGX_AGAIN && st->force) {
+
+        /* the file may have been checked before it was changed */
+
+        ngx_add_timer(ev, 10);
+        return;
+    }
+
+    st->force = 0;
+
+    ngx_add_timer(ev, st->interval);
+}
+
+
+/*
+ * the update is synchronous while the configuration is read by the master
+ * process: an error is a configuration error then; a worker process
+ * updates the table only if it got the zone mutex and, unless the update
+ * is forced, nobody has checked the file during the interval
+ */
+
+static ngx_int_t
+ngx_shared_table_update(ngx_shared_table_t *st, ngx_uint_t mode)
+{
+    ngx_int_t               rc;
+    ngx_err_t               err;
+    ngx_log_t              *log;
+    ngx_uint_t              level;
+    ngx_uint_t              sync;
+    ngx_file_info_t         fi;
+    ngx_slab_pool_t        *shpool;
+    ngx_shared_table_sh_t  *sh;
+
+    sh = st->sh;
+    shpool = st->shpool;
+    log = st->shm_zone->shm.log;
+
+    sync = (mode == NGX_SHARED_TABLE_SYNC);
+
+    if (sync) {
+        ngx_shmtx_lock(&shpool->mutex);
+        level = NGX_LOG_EMERG;
+
+    } else {
+        if (mode == NGX_SHARED_TABLE_CHECK
+            && (ngx_msec_int_t) (ngx_current_msec - sh->checked)
+               < (ngx_msec_int_t) st->interval)
+        {
+            return NGX_OK;
+        }
+
+        if (!ngx_shmtx_trylock(&shpool->mutex)) {
+            return NGX_AGAIN;
+        }
+
+        level = NGX_LOG_ERR;
+    }
+
+    sh->checked = ngx_current_msec;
+
+    if (sh->retired) {
+        (void) ngx_shared_table_free_retired(st);
+    }
+
+    rc = NGX_OK;
+
+    if (ngx_file_info(st->file.data, &fi) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        /* a missing file is reported once, the table is kept */
+
+        if (sync || sh->size != -1) {
+            ngx_log_error(level, log, err,
+                          ngx_file_info_n " \"%s\" failed", st->file.data);
+        }
+
+        if (sync) {
+            rc = NGX_ERROR;
+
+        } else {
+            sh->mtime = 0;
+            sh->size = -1;
+            sh->uniq = 0;
+        }
+
+        goto done;
+    }
+
+    if (sh->current
+        && sh->mtime == ngx_file_mtime(&fi)
+        && sh->size == ngx_file_size(&fi)
+        && sh->uniq == ngx_file_uniq(&fi))
+    {
+        goto done;
+    }
+
+    if (sh->retired) {
+        /* somebody still may look at the previous version */
+        goto done;
+    }
+
+    rc = ngx_shared_table_build(st, &fi, level);
+
+    /* a broken file is not retried until it is changed */
+
+    if (rc == NGX_OK || !sync) {
+        sh->mtime = ngx_file_mtime(&fi);
+        sh->size = ngx_file_size(&fi);
+        sh->uniq = ngx_file_uniq(&fi);
+    }
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_shared_table_build(ngx_shared_table_t *st, ngx_file_info_t *fi,
+    ngx_uint_t level)
+{
+    u_char                      *buf;
+    size_t                       size;
+    ssize_t                      n;
+    ngx_int_t                    rc;
+    ngx_log_t                   *log;
+    ngx_file_t                   file;
+    ngx_pool_t                  *pool;
+    ngx_array_t                  elts;
+    ngx_shared_table_sh_t       *sh;
+    ngx_shared_table_version_t  *v, *old;
+
+    sh = st->sh;
+    log = st->shm_zone->shm.log;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = st->file;
+    file.log = log;
+
+    file.fd = ngx_open_file(st->file.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(level, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", st->file.data);
+        goto failed;
+    }
+
+    /* the file may have been replaced after it was checked */
+
+    if (ngx_fd_info(file.fd, fi) == NGX_FILE_ERROR) {
+        ngx_log_error(level, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", st->file.data);
+        goto close;
+    }
+
+    size = (size_t) ngx_file_size(fi);
+
+    buf = ngx_pnalloc(pool, size + 1);
+    if (buf == NULL) {
+        goto close;
+    }
+
+    n = ngx_read_file(&file, buf, size, 0);
+
+    if (n == NGX_ERROR) {
+        goto close;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(level, log, 0,
+                      ngx_read_file_n " \"%s\" returned only %z bytes "
+                      "instead of %uz", st->file.data, n, size);
+        goto close;
+    }
+
+    if (ngx_array_init(&elts, pool, 256, sizeof(ngx_shared_table_elt_t))
+        != NGX_OK)
+    {
+        goto close;
+    }
+
+    if (ngx_shared_table_parse(st, pool, buf, buf + size, &elts, level)
+        != NGX_OK)
+    {
+        goto close;
+    }
+
+    v = ngx_shared_table_create(st, &elts, level);
+    if (v == NULL) {
+        goto close;
+    }
+
+    /*
+     * the readers announce the generation before they look at the current
+     * version, so after the increment the previous version may be used only
+     * by the processes which announced an older generation
+     */
+
+    v->generation = sh->generation + 1;
+
+    old = sh->current;
+    sh->current = v;
+
+    (void) ngx_atomic_fetch_add(&sh->generation, 1);
+
+    if (old) {
+        sh->retired = old;
+        (void) ngx_shared_table_free_retired(st);
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "dynamic table \"%s\" loaded, entries: %uD, generation: %uA",
+                  st->file.data, v->nelts, v->generation);
+
+    rc = NGX_OK;
+
+close:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", st->file.data);
+    }
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return rc;
+}
+
+
+/*
+ * the file consists of "key value;" entries, the tokens may be quoted
+ * and the "#" comments are allowed as in the configuration files
+ */
+
+static ngx_int_t
+ngx_shared_table_parse(ngx_shared_table_t *st, ngx_pool_t *pool, u_char *p,
+    u_char *last, ngx_array_t *elts, ngx_uint_t level)
+{
+    u_char                  ch, quote, *start, *dst;
+    ngx_int_t               rc;
+    ngx_str_t               args[2];
+    ngx_uint_t              n, line;
+    ngx_log_t              *log;
+    ngx_shared_table_elt_t *elt;
+
+    log = st->shm_zone->shm.log;
+
+    n = 0;
+    line = 1;
+
+    while (p < last) {
+
+        ch = *p;
+
+        if (ch == LF) {
+            line++;
+            p++;
+            continue;
+        }
+
+        if (ch == ' ' || ch == '\t' || ch == CR) {
+            p++;
+            continue;
+        }
+
+        if (ch == '#') {
+            while (p < last && *p != LF) {
+                p++;
+            }
+
+            continue;
+        }
+
+        if (ch == ';') {
+
+            if (n != 2) {
+                ngx_log_error(level, log, 0,
+                              "invalid number of arguments in %s:%ui",
+                              st->file.data, line);
+                return NGX_ERROR;
+            }
+
+            /* a delimiter or a quote follows the key, so there is room */
+
+            args[0].data[args[0].len] = '\0';
+
+            elt = ngx_array_push(elts);
+            if (elt == NULL) {
+                return NGX_ERROR;
+            }
+
+            elt->value = args[1];
+            elt->class = 0;
+
+            rc = st->entry ? st->entry(st, pool, &args[0], &elt->class)
+                           : NGX_OK;
+
+            if (rc == NGX_ERROR || elt->class >= NGX_SHARED_TABLE_CLASSES) {
+                ngx_log_error(level, log, 0,
+                              "invalid key \"%V\" in %s:%ui",
+                              &args[0], st->file.data, line);
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_DECLINED) {
+                elts->nelts--;
+
+            } else {
+                elt->key = args[0];
+            }
+
+            n = 0;
+            p++;
+            continue;
+        }
+
+        if (n == 2) {
+            ngx_log_error(level, log, 0,
+                          "unexpected \"%c\" in %s:%ui, expecting \";\"",
+                          ch, st->file.data, line);
+            return NGX_ERROR;
+        }
+
+        if (ch == '"' || ch == '\'') {
+            quote = ch;
+            start = ++p;
+            dst = p;
+
+            for ( ;; ) {
+
+                if (p == last) {
+                    ngx_log_error(level, log, 0,
+                                  "unexpected end of file in %s, "
+                                  "expecting %c", st->file.data, quote);
+                    return NGX_ERROR;
+                }
+
+                ch = *p++;
+
+                if (ch == quote) {
+                    break;
+                }
+
+                if (ch == '\\' && p < last) {
+                    ch = *p++;
+
+                    switch (ch) {
+                    case 't':
+                        ch = '\t';
+                        break;
+                    case 'r':
+                        ch = '\r';
+                        break;
+                    case 'n':
+                        ch = '\n';
+                        break;
+                    }
+
+                } else if (ch == LF) {
+                    line++;
+                }
+
+                *dst++ = ch;
+            }
+
+        } else {
+            start = p;
+
+            while (p < last) {
+                ch = *p;
+
+                if (ch == ' ' || ch == '\t' || ch == CR || ch == LF
+                    || ch == ';')
+                {
+                    break;
+                }
+
+                p++;
+            }
+
+            dst = p;
+        }
+
+        args[n].len = dst - start;
+        args[n].data = start;
+        n++;
+    }
+
+    if (n) {
+        ngx_log_error(level, log, 0,
+                      "unexpected end of file in %s, expecting \";\"",
+                      st->file.data);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_shared_table_version_t *
+ngx_shared_table_create(ngx_shared_table_t *st, ngx_array_t *elts,
+    ngx_uint_t level)
+{
+    u_char                      *p;
+    size_t                       size, len;
+    uint32_t                     hash, off, *ln;
+    ngx_uint_t                   i, k, nb;
+    ngx_shared_table_elt_t      *elt;
+    ngx_shared_table_bucket_t   *b;
+    ngx_shared_table_version_t  *v;
+
+    elt = elts->elts;
+
+    for (nb = 2; nb < elts->nelts * 2; nb <<= 1) { /* void */ }
+
+    size = sizeof(ngx_shared_table_version_t)
+           + nb * sizeof(ngx_shared_table_bucket_t);
+
+    for (i = 0; i < elts->nelts; i++) {
+        size += ngx_align(2 * sizeof(uint32_t) + elt[i].key.len
+                          + elt[i].value.len, 4);
+    }
+
+    if (size > 0xffffffff) {
+        ngx_log_error(level, st->shm_zone->shm.log, 0,
+                      "dynamic table \"%s\" is too large", st->file.data);
+        return NULL;
+    }
+
+    v = ngx_slab_alloc_locked(st->shpool, size);
+
+    if (v == NULL) {
+        ngx_log_error(level, st->shm_zone->shm.log, 0,
+                      "zone \"%V\" is too small for dynamic table \"%s\" "
+                      "of %uz bytes", &st->shm_zone->shm.name,
+                      st->file.data, size);
+        return NULL;
+    }
+
+    off = sizeof(ngx_shared_table_version_t)
+          + nb * sizeof(ngx_shared_table_bucket_t);
+
+    ngx_memzero(v, off);
+
+    v->mask = nb - 1;
+
+    b = (ngx_shared_table_bucket_t *) (v + 1);
+
+    for (i = 0; i < elts->nelts; i++) {
+
+        hash = ngx_murmur_hash2(elt[i].key.data, elt[i].key.len);
+
+        /* a later entry replaces an earlier one with the same key */
+
+        for (k = hash & v->mask; b[k].offset; k = (k + 1) & v->mask) {
+
+            if (b[k].hash != hash) {
+                continue;
+            }
+
+            p = (u_char *) v + b[k].offset;
+            ln = (uint32_t *) p;
+
+            if (ln[0] == elt[i].key.len
+                && ngx_memcmp(p + 2 * sizeof(uint32_t), elt[i].key.data,
+                              elt[i].key.len)
+                   == 0)
+            {
+                break;
+            }
+        }
+
+        if (b[k].offset == 0) {
+            v->nelts++;
+        }
+
+        b[k].hash = hash;
+        b[k].offset = off;
+
+        p = (u_char *) v + off;
+        ln = (uint32_t *) p;
+
+        ln[0] = (uint32_t) elt[i].key.len;
+        ln[1] = (uint32_t) elt[i].value.len;
+
+        p = ngx_cpymem(p + 2 * sizeof(uint32_t), elt[i].key.data,
+                       elt[i].key.len);
+        ngx_memcpy(p, elt[i].value.data, elt[i].value.len);
+
+        len = 2 * sizeof(uint32_t) + elt[i].key.len + elt[i].value.len;
+        off += ngx_align(len, 4);
+
+        v->classes[elt[i].class >> 6] |= (uint64_t) 1 << (elt[i].class & 63);
+    }
+
+    return v;
+}
+
+
+static ngx_uint_t
+ngx_shared_table_free_retired(ngx_shared_table_t *st)
+{
+    ngx_uint_t              i;
+    ngx_atomic_uint_t       gen, r;
+    ngx_shared_table_sh_t  *sh;
+
+    sh = st->sh;
+    gen = sh->retired->generation;
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        r = sh->readers[i];
+
+        if (r && r <= gen) {
+            return 0;
+        }
+    }
+
+    ngx_slab_free_locked(st->shpool, sh->retired);
+    sh->retired = NULL;
+
+    return 1;
+}
+
+
+ngx_shared_table_version_t *
+ngx_shared_table_enter(ngx_shared_table_t *st)
+{
+    ngx_atomic_t           *slot;
+    ngx_atomic_uint_t       gen;
+    ngx_shared_table_sh_t  *sh;
+
+    sh = st->sh;
+    slot = &sh->readers[ngx_process_slot];
+
+    for ( ;; ) {
+        gen = sh->generation;
+
+        /*
+         * the locked instruction makes the announced generation visible
+         * before the current version is read
+         */
+
+        (void) ngx_atomic_cmp_set(slot, *slot, gen);
+
+        if (sh->generation == gen) {
+            return sh->current;
+        }
+    }
+}
+
+
+ngx_int_t
+ngx_shared_table_get(ngx_shared_table_version_t *v, u_char *key, size_t len,
+    ngx_str_t *value)
+{
+    u_char                     *p;
+    uint32_t                    hash, *ln;
+    ngx_uint_t                  k;
+    ngx_shared_table_bucket_t  *b;
+
+    if (v == NULL || v->nelts == 0) {
+        return NGX_DECLINED;
+    }
+
+    hash = ngx_murmur_hash2(key, len);
+
+    b = (ngx_shared_table_bucket_t *) (v + 1);
+
+    for (k = hash & v->mask; b[k].offset; k = (k + 1) & v->mask) {
+
+        if (b[k].hash != hash) {
+            continue;
+        }
+
+        p = (u_char *) v + b[k].offset;
+        ln = (uint32_t *) p;
+
+        if (ln[0] != len
+            || ngx_memcmp(p + 2 * sizeof(uint32_t), key, len) != 0)
+        {
+            continue;
+        }
+
+        value->len = ln[1];
+        value->data = p + 2 * sizeof(uint32_t) + len;
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_shared_table_lookup(ngx_shared_table_t *st, ngx_pool_t *pool,
+    u_char *key, size_t len, ngx_str_t *value)
+{
+    ngx_int_t                    rc;
+    ngx_str_t                    val;
+    ngx_shared_table_version_t  *v;
+
+    v = ngx_shared_table_enter(st);
+
+    rc = ngx_shared_table_get(v, key, len, &val);
+
+    if (rc == NGX_OK) {
+        value->len = val.len;
+        value->data = ngx_pnalloc(pool, val.len);
+
+        if (value->data == NULL) {
+            rc = NGX_ERROR;
+
+        } else {
+            ngx_memcpy(value->data, val.data, val.len);
+        }
+    }
+
+    ngx_shared_table_leave(st);
+
+    return rc;
+}
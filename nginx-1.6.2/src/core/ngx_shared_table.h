@@ -0,0 +1,103 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SHARED_TABLE_H_INCLUDED_
+#define _NGX_SHARED_TABLE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * A key-value table which lives in a shared memory zone and is rebuilt
+ * from a watched file without a configuration reload.  The file is
+ * checked by the worker processes with a timer; the first one which
+ * gets the zone mutex builds a new version of the table in the zone and
+ * swaps it in.  Readers do not take the mutex: they announce the table
+ * generation they have seen in their process slot, and the replaced
+ * version is freed only when no slot may still refer to it.
+ */
+
+
+#define NGX_SHARED_TABLE_CLASSES  256
+
+
+typedef struct ngx_shared_table_s  ngx_shared_table_t;
+
+typedef ngx_int_t (*ngx_shared_table_entry_pt)(ngx_shared_table_t *st,
+    ngx_pool_t *pool, ngx_str_t *key, ngx_uint_t *class);
+
+
+typedef struct {
+    ngx_atomic_uint_t             generation;
+    uint32_t                      nelts;
+    uint32_t                      mask;
+    uint64_t                      classes[NGX_SHARED_TABLE_CLASSES / 64];
+} ngx_shared_table_version_t;
+
+
+typedef struct {
+    ngx_shared_table_version_t   *current;
+    ngx_shared_table_version_t   *retired;
+
+    ngx_atomic_t                  generation;
+    ngx_msec_t                    checked;
+
+    /* the identity of the file the current version was built from */
+    time_t                        mtime;
+    off_t                         size;
+    ngx_file_uniq_t               uniq;
+
+    ngx_atomic_t                  readers[NGX_MAX_PROCESSES];
+} ngx_shared_table_sh_t;
+
+
+struct ngx_shared_table_s {
+    ngx_shared_table_sh_t        *sh;
+    ngx_slab_pool_t              *shpool;
+    ngx_shm_zone_t               *shm_zone;
+
+    ngx_str_t                     file;
+    ngx_msec_t                    interval;
+
+    /* converts a key read from the file, may decline an entry */
+    ngx_shared_table_entry_pt     entry;
+    void                         *data;
+
+    /* the check timer of the process */
+    ngx_event_t                  *event;
+    ngx_uint_t                    force;      /* unsigned  force:1; */
+};
+
+
+ngx_shared_table_t *ngx_shared_table_add(ngx_conf_t *cf, ngx_str_t *args,
+    ngx_uint_t nargs, void *tag);
+ngx_int_t ngx_shared_table_init_process(ngx_cycle_t *cycle, void *tag);
+void ngx_shared_table_refresh(ngx_cycle_t *cycle);
+
+ngx_shared_table_version_t *ngx_shared_table_enter(ngx_shared_table_t *st);
+ngx_int_t ngx_shared_table_get(ngx_shared_table_version_t *v, u_char *key,
+    size_t len, ngx_str_t *value);
+ngx_int_t ngx_shared_table_lookup(ngx_shared_table_t *st, ngx_pool_t *pool,
+    u_char *key, size_t len, ngx_str_t *value);
+
+
+#define ngx_shared_table_has_class(v, c)                                      \
+    ((v)->classes[(c) >> 6] & ((uint64_t) 1 << ((c) & 63)))
+
+
+static ngx_inline void
+ngx_shared_table_leave(ngx_shared_table_t *st)
+{
+    ngx_memory_barrier();
+
+    st->sh->readers[ngx_process_slot] = 0;
+}
+
+
+#endif /* _NGX_SHARED_TABLE_H_INCLUDED_ */
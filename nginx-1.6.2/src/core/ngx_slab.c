@@ -106,6 +106,13 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_page_t);
 
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
+
+    p += n * sizeof(ngx_slab_stat_t);
+
+    size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
+
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
     ngx_memzero(p, pages * sizeof(ngx_slab_page_t));
@@ -129,9 +136,14 @@ ngx_slab_init(ngx_slab_pool_t *pool)
         pool->pages->slab = pages;
     }
 
+    pool->last = pool->start + (pages << ngx_pagesize_shift);
+    pool->pfree = pages;
+
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+    pool->pools = NULL;
 }
 
 
@@ -193,6 +205,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 
+    pool->stats[slot].reqs++;
+
     if (page->next != page) {
 
         if (shift < ngx_slab_exact_shift) {
@@ -223,6 +237,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                                      if (bitmap[n] != NGX_SLAB_BUSY) {
                                          p = (uintptr_t) bitmap + i;
 
+                                         pool->stats[slot].used++;
+
                                          goto done;
                                      }
                                 }
@@ -238,6 +254,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                             p = (uintptr_t) bitmap + i;
 
+                            pool->stats[slot].used++;
+
                             goto done;
                         }
                     }
@@ -273,6 +291,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
+                        pool->stats[slot].used++;
+
                         goto done;
                     }
                 }
@@ -315,6 +335,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
+                        pool->stats[slot].used++;
+
                         goto done;
                     }
                 }
@@ -353,9 +375,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += (ngx_pagesize >> shift) - n;
+
             p = ((page - pool->pages) << ngx_pagesize_shift) + s * n;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
 
         } else if (shift == ngx_slab_exact_shift) {
@@ -366,9 +392,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += sizeof(uintptr_t) * 8;
+
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
 
         } else { /* shift > ngx_slab_exact_shift */
@@ -379,15 +409,21 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += ngx_pagesize >> shift;
+
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
         }
     }
 
     p = 0;
 
+    pool->stats[slot].fails++;
+
 done:
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab alloc: %p", p);
@@ -412,7 +448,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
-    ngx_uint_t        n, type, slot, shift, map;
+    ngx_uint_t        i, n, type, slot, shift, map;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
@@ -445,11 +481,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                              ((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1));
 
         if (bitmap[n] & m) {
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -460,6 +496,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             bitmap[n] &= ~m;
 
+            pool->stats[slot].used--;
+
             n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
 
             if (n == 0) {
@@ -472,14 +510,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
-            for (n = 1; n < map; n++) {
-                if (bitmap[n]) {
+            for (i = 1; i < map; i++) {
+                if (bitmap[i]) {
                     goto done;
                 }
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
             goto done;
         }
 
@@ -496,10 +536,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         }
 
         if (slab & m) {
+            slot = ngx_slab_exact_shift - pool->min_shift;
+
             if (slab == NGX_SLAB_BUSY) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -510,12 +551,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= sizeof(uintptr_t) * 8;
+
             goto done;
         }
 
@@ -534,11 +579,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                               + NGX_SLAB_MAP_SHIFT);
 
         if (slab & m) {
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -549,12 +594,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab & NGX_SLAB_MAP_MASK) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
             goto done;
         }
 
@@ -616,6 +665,127 @@ fail:
 }
 
 
+/*
+ * carves an independent slab pool with its own mutex out of the pool,
+ * so that the data of one shared zone may be split into partitions
+ * which are locked separately; the partitions are listed in the pool
+ * for the statistics
+ */
+
+ngx_slab_pool_t *
+ngx_slab_create_pool(ngx_slab_pool_t *pool, size_t size)
+{
+    ngx_slab_pool_t  *sp, **last;
+
+    size = ngx_align(size, ngx_pagesize);
+
+    sp = ngx_slab_alloc(pool, size);
+    if (sp == NULL) {
+        return NULL;
+    }
+
+    sp->end = (u_char *) sp + size;
+    sp->min_shift = pool->min_shift;
+    sp->addr = sp;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return NULL;
+    }
+
+#else
+
+    /* the lock file has already been deleted, so its descriptor is shared */
+
+    sp->mutex = pool->mutex;
+
+#endif
+
+    ngx_slab_init(sp);
+
+    sp->next = NULL;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    for (last = &pool->pools; *last; last = &(*last)->next) { /* void */ }
+
+    *last = sp;
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return sp;
+}
+
+
+void
+ngx_slab_usage(ngx_slab_pool_t *pool, ngx_slab_usage_t *u)
+{
+    ngx_uint_t              i, n, shift, chunks, pages;
+    ngx_slab_page_t        *page;
+    ngx_slab_slot_usage_t  *slot;
+
+    ngx_memzero(u, sizeof(ngx_slab_usage_t));
+
+    u->nslots = ngx_min(ngx_pagesize_shift - pool->min_shift,
+                        NGX_SLAB_MAX_SLOTS);
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    u->free_pages = pool->pfree;
+
+    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        u->free_runs++;
+
+        if (page->slab > u->max_free_run) {
+            u->max_free_run = page->slab;
+        }
+    }
+
+    for (i = 0; i < u->nslots; i++) {
+        slot = &u->slots[i];
+
+        slot->total = pool->stats[i].total;
+        slot->used = pool->stats[i].used;
+        slot->reqs = pool->stats[i].reqs;
+        slot->fails = pool->stats[i].fails;
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    u->pages = (pool->last - pool->start) >> ngx_pagesize_shift;
+
+    pages = 0;
+
+    for (i = 0; i < u->nslots; i++) {
+        slot = &u->slots[i];
+
+        shift = pool->min_shift + i;
+        slot->size = (size_t) 1 << shift;
+
+        chunks = ngx_pagesize >> shift;
+
+        if (shift < ngx_slab_exact_shift) {
+
+            /* the chunks occupied by the bitmap */
+
+            n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
+
+            if (n == 0) {
+                n = 1;
+            }
+
+            chunks -= n;
+        }
+
+        slot->pages = slot->total / chunks;
+        pages += slot->pages;
+    }
+
+    u->large_pages = u->pages - u->free_pages - pages;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
@@ -625,6 +795,8 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 
         if (page->slab >= pages) {
 
+            pool->pfree -= pages;
+
             if (page->slab > pages) {
                 page[pages].slab = page->slab - pages;
                 page[pages].next = page->next;
@@ -674,6 +846,8 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 {
     ngx_slab_page_t  *prev;
 
+    pool->pfree += pages;
+
     page->slab = pages--;
 
     if (pages) {
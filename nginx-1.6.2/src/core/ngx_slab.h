@@ -23,6 +23,17 @@ struct ngx_slab_page_s {
 
 
 typedef struct {
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_stat_t;
+
+
+typedef struct ngx_slab_pool_s  ngx_slab_pool_t;
+
+struct ngx_slab_pool_s {
     ngx_shmtx_sh_t    lock;
 
     size_t            min_size;
@@ -31,7 +42,11 @@ typedef struct {
     ngx_slab_page_t  *pages;
     ngx_slab_page_t   free;
 
+    ngx_slab_stat_t  *stats;
+    ngx_uint_t        pfree;
+
     u_char           *start;
+    u_char           *last;
     u_char           *end;
 
     ngx_shmtx_t       mutex;
@@ -43,7 +58,41 @@ typedef struct {
 
     void             *data;
     void             *addr;
-} ngx_slab_pool_t;
+
+    /* the pools created in this pool by ngx_slab_create_pool() */
+    ngx_slab_pool_t  *pools;
+    ngx_slab_pool_t  *next;
+};
+
+
+#define NGX_SLAB_MAX_SLOTS  16
+
+
+typedef struct {
+    size_t            size;
+    ngx_uint_t        pages;
+
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_slot_usage_t;
+
+
+typedef struct {
+    ngx_uint_t             pages;
+    ngx_uint_t             free_pages;
+    /* pages of allocations of ngx_pagesize / 2 and more */
+    ngx_uint_t             large_pages;
+
+    /* free runs are not merged, so this is the largest allocatable run */
+    ngx_uint_t             free_runs;
+    ngx_uint_t             max_free_run;
+
+    ngx_uint_t             nslots;
+    ngx_slab_slot_usage_t  slots[NGX_SLAB_MAX_SLOTS];
+} ngx_slab_usage_t;
 
 
 void ngx_slab_init(ngx_slab_pool_t *pool);
@@ -51,6 +100,9 @@ void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+ngx_slab_pool_t *ngx_slab_create_pool(ngx_slab_pool_t *pool, size_t size);
+
+void ngx_slab_usage(ngx_slab_pool_t *pool, ngx_slab_usage_t *u);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -0,0 +1,619 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_SYSLOG_MAX_BATCH  1024
+
+
+static char *ngx_syslog_parse_args(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
+static u_char *ngx_syslog_header(ngx_syslog_peer_t *peer, u_char *buf,
+    ngx_uint_t severity);
+static ngx_int_t ngx_syslog_init_peer(ngx_syslog_peer_t *peer);
+static ngx_int_t ngx_syslog_batching(ngx_syslog_peer_t *peer);
+static void ngx_syslog_drop(ngx_syslog_peer_t *peer, ngx_err_t err,
+    ngx_uint_t n);
+static void ngx_syslog_flush_handler(ngx_event_t *ev);
+static void ngx_syslog_cleanup(void *data);
+
+
+static char  *facilities[] = {
+    "kern", "user", "mail", "daemon", "auth", "intern", "lpr", "news", "uucp",
+    "clock", "authpriv", "ftp", "ntp", "audit", "alert", "cron", "local0",
+    "local1", "local2", "local3", "local4", "local5", "local6", "local7",
+    NULL
+};
+
+/* note 'error/warn' like in nginx.conf, not 'err/warning' */
+static char  *severities[] = {
+    "emerg", "alert", "crit", "error", "warn", "notice", "info", "debug", NULL
+};
+
+
+char *
+ngx_syslog_process_conf(ngx_conf_t *cf, ngx_syslog_peer_t *peer)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    peer->facility = NGX_CONF_UNSET_UINT;
+    peer->severity = NGX_CONF_UNSET_UINT;
+    peer->batch = NGX_CONF_UNSET_UINT;
+    peer->flush = NGX_CONF_UNSET_MSEC;
+
+    if (ngx_syslog_parse_args(cf, peer) != NGX_CONF_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (peer->server.sockaddr == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no syslog server specified");
+        return NGX_CONF_ERROR;
+    }
+
+    if (peer->facility == NGX_CONF_UNSET_UINT) {
+        peer->facility = 23; /* local7 */
+    }
+
+    if (peer->severity == NGX_CONF_UNSET_UINT) {
+        peer->severity = 6; /* info */
+    }
+
+    if (peer->tag.data == NULL) {
+        ngx_str_set(&peer->tag, "nginx");
+    }
+
+    if (peer->batch == NGX_CONF_UNSET_UINT) {
+        peer->batch = 1;
+    }
+
+    if (peer->flush == NGX_CONF_UNSET_MSEC) {
+        peer->flush = 100;
+    }
+
+    peer->fd = (ngx_socket_t) -1;
+
+    if (peer->batch > 1) {
+
+        /*
+         * the buffer is written only by a worker process,
+         * so the pages are not shared after fork()
+         */
+
+        peer->start = ngx_pnalloc(cf->pool, NGX_SYSLOG_BUFFER_SIZE);
+        if (peer->start == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        peer->pos = peer->start;
+        peer->last = peer->start + NGX_SYSLOG_BUFFER_SIZE;
+
+        peer->iovs = ngx_pcalloc(cf->pool,
+                                 peer->batch * sizeof(struct iovec));
+        if (peer->iovs == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+#if (NGX_HAVE_SENDMMSG)
+        peer->msgs = ngx_pcalloc(cf->pool,
+                                 peer->batch * sizeof(struct mmsghdr));
+        if (peer->msgs == NULL) {
+            return NGX_CONF_ERROR;
+        }
+#endif
+
+        peer->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+        if (peer->event == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        peer->event->handler = ngx_syslog_flush_handler;
+        peer->event->data = peer;
+        peer->event->log = &cf->cycle->new_log;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_syslog_cleanup;
+    cln->data = peer;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_syslog_parse_args(ngx_conf_t *cf, ngx_syslog_peer_t *peer)
+{
+    u_char      *p, *comma, c;
+    size_t       len;
+    ngx_str_t   *value, s;
+    ngx_url_t    u;
+    ngx_int_t    n;
+    ngx_uint_t   i;
+
+    value = cf->args->elts;
+
+    p = value[1].data + sizeof("syslog:") - 1;
+
+    for ( ;; ) {
+        comma = (u_char *) ngx_strchr(p, ',');
+
+        if (comma != NULL) {
+            len = comma - p;
+            *comma = '\0';
+
+        } else {
+            len = value[1].data + value[1].len - p;
+        }
+
+        if (ngx_strncmp(p, "server=", 7) == 0) {
+
+            if (peer->server.sockaddr != NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"server\"");
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&u, sizeof(ngx_url_t));
+
+            u.url.data = p + 7;
+            u.url.len = len - 7;
+            u.default_port = 514;
+
+            if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+                if (u.err) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "%s in syslog server \"%V\"",
+                                       u.err, &u.url);
+                }
+
+                return NGX_CONF_ERROR;
+            }
+
+            peer->server = u.addrs[0];
+
+        } else if (ngx_strncmp(p, "facility=", 9) == 0) {
+
+            if (peer->facility != NGX_CONF_UNSET_UINT) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"facility\"");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 0; facilities[i] != NULL; i++) {
+
+                if (ngx_strcmp(p + 9, facilities[i]) == 0) {
+                    peer->facility = i;
+                    goto next;
+                }
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog facility \"%s\"", p + 9);
+            return NGX_CONF_ERROR;
+
+        } else if (ngx_strncmp(p, "severity=", 9) == 0) {
+
+            if (peer->severity != NGX_CONF_UNSET_UINT) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"severity\"");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 0; severities[i] != NULL; i++) {
+
+                if (ngx_strcmp(p + 9, severities[i]) == 0) {
+                    peer->severity = i;
+                    goto next;
+                }
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog severity \"%s\"", p + 9);
+            return NGX_CONF_ERROR;
+
+        } else if (ngx_strncmp(p, "tag=", 4) == 0) {
+
+            if (peer->tag.data != NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate syslog \"tag\"");
+                return NGX_CONF_ERROR;
+            }
+
+            /*
+             * RFC 3164: the TAG is a string of ABNF alphanumeric characters
+             * that MUST NOT exceed 32 characters.
+             */
+
+            if (len - 4 > 32) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "syslog tag length exceeds 32");
+                return NGX_CONF_ERROR;
+            }
+
+            for (i = 4; i < len; i++) {
+                c = ngx_tolower(p[i]);
+
+                if (c < '0' || (c > '9' && c < 'a' && c != '_') || c > 'z') {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "syslog \"tag\" only allows "
+                                       "alphanumeric characters "
+                                       "and underscore");
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            peer->tag.data = p + 4;
+            peer->tag.len = len - 4;
+
+        } else if (ngx_strncmp(p, "batch=", 6) == 0) {
+
+            n = ngx_atoi(p + 6, len - 6);
+
+            if (n < 1 || n > NGX_SYSLOG_MAX_BATCH) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid syslog batch \"%s\"", p + 6);
+                return NGX_CONF_ERROR;
+            }
+
+            peer->batch = n;
+
+        } else if (ngx_strncmp(p, "flush=", 6) == 0) {
+
+            s.data = p + 6;
+            s.len = len - 6;
+
+            peer->flush = ngx_parse_time(&s, 0);
+
+            if (peer->flush == (ngx_msec_t) NGX_ERROR || peer->flush == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid syslog flush time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+        } else if (len == 10 && ngx_strncmp(p, "nohostname", 10) == 0) {
+            peer->nohostname = 1;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown syslog parameter \"%s\"", p);
+            return NGX_CONF_ERROR;
+        }
+
+    next:
+
+        if (comma == NULL) {
+            break;
+        }
+
+        p = comma + 1;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+u_char *
+ngx_syslog_add_header(ngx_syslog_peer_t *peer, u_char *buf)
+{
+    return ngx_syslog_header(peer, buf, peer->severity);
+}
+
+
+static u_char *
+ngx_syslog_header(ngx_syslog_peer_t *peer, u_char *buf, ngx_uint_t severity)
+{
+    ngx_uint_t  pri;
+
+    pri = peer->facility * 8 + severity;
+
+    /* the hostname is not known yet while the first cycle is created */
+
+    if (peer->nohostname || ngx_cycle->hostname.len == 0) {
+        return ngx_sprintf(buf, "<%ui>%V %V: ", pri,
+                           (ngx_str_t *) &ngx_cached_syslog_time, &peer->tag);
+    }
+
+    return ngx_sprintf(buf, "<%ui>%V %V %V: ", pri,
+                       (ngx_str_t *) &ngx_cached_syslog_time,
+                       &ngx_cycle->hostname, &peer->tag);
+}
+
+
+void
+ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    u_char             *p, msg[NGX_SYSLOG_MAX_STR];
+    ngx_uint_t          head_len;
+    ngx_syslog_peer_t  *peer;
+
+    peer = log->wdata;
+
+    if (peer->busy) {
+        return;
+    }
+
+    peer->busy = 1;
+
+    p = ngx_syslog_header(peer, msg, level ? level - 1 : 0);
+    head_len = p - msg;
+
+    /* the syslog header has its own time, skip the error log one */
+
+    if (len > ngx_cached_err_log_time.len + 1 + NGX_LINEFEED_SIZE) {
+        buf += ngx_cached_err_log_time.len + 1;
+        len -= ngx_cached_err_log_time.len + 1;
+    }
+
+    len -= NGX_LINEFEED_SIZE;
+
+    if (len > NGX_SYSLOG_MAX_STR - head_len) {
+        len = NGX_SYSLOG_MAX_STR - head_len;
+    }
+
+    p = ngx_cpymem(p, buf, len);
+
+    (void) ngx_syslog_send(peer, msg, p - msg);
+
+    peer->busy = 0;
+}
+
+
+ssize_t
+ngx_syslog_send(ngx_syslog_peer_t *peer, u_char *buf, size_t len)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    struct iovec  *iov;
+
+    if (peer->fd == (ngx_socket_t) -1) {
+        if (ngx_syslog_init_peer(peer) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (peer->batch > 1
+        && len <= (size_t) (peer->last - peer->start)
+        && ngx_syslog_batching(peer))
+    {
+        if (peer->nrecs == peer->batch
+            || len > (size_t) (peer->last - peer->pos))
+        {
+            ngx_syslog_flush(peer);
+        }
+
+        iov = &peer->iovs[peer->nrecs++];
+
+        iov->iov_base = (void *) peer->pos;
+        iov->iov_len = len;
+
+        peer->pos = ngx_cpymem(peer->pos, buf, len);
+
+        if (peer->nrecs == peer->batch) {
+            ngx_syslog_flush(peer);
+
+        } else if (!peer->event->timer_set) {
+            ngx_add_timer(peer->event, peer->flush);
+        }
+
+        return len;
+    }
+
+    /* the socket is nonblocking, the record is dropped on EAGAIN */
+
+    n = send(peer->fd, buf, len, 0);
+
+    if (n == -1) {
+        err = ngx_socket_errno;
+        ngx_syslog_drop(peer, err, 1);
+        return NGX_ERROR;
+    }
+
+    return n;
+}
+
+
+void
+ngx_syslog_flush(ngx_syslog_peer_t *peer)
+{
+    ngx_err_t   err;
+    ngx_uint_t  i, sent, busy;
+#if (NGX_HAVE_SENDMMSG)
+    int         n;
+#else
+    ssize_t     n;
+#endif
+
+    if (peer->event && peer->event->timer_set) {
+        ngx_del_timer(peer->event);
+    }
+
+    if (peer->nrecs == 0) {
+        return;
+    }
+
+    busy = peer->busy;
+    peer->busy = 1;
+
+    err = 0;
+    sent = 0;
+
+#if (NGX_HAVE_SENDMMSG)
+
+    for (i = 0; i < peer->nrecs; i++) {
+        peer->msgs[i].msg_hdr.msg_iov = &peer->iovs[i];
+        peer->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < peer->nrecs) {
+        n = sendmmsg(peer->fd, &peer->msgs[sent], peer->nrecs - sent, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        sent += n;
+    }
+
+#else
+
+    for (i = 0; i < peer->nrecs; i++) {
+        n = send(peer->fd, peer->iovs[i].iov_base, peer->iovs[i].iov_len, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+            break;
+        }
+
+        sent++;
+    }
+
+#endif
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "syslog flush: %ui of %ui", sent, peer->nrecs);
+
+    if (sent < peer->nrecs) {
+        ngx_syslog_drop(peer, err, peer->nrecs - sent);
+    }
+
+    peer->nrecs = 0;
+    peer->pos = peer->start;
+
+    peer->busy = busy;
+}
+
+
+static ngx_int_t
+ngx_syslog_init_peer(ngx_syslog_peer_t *peer)
+{
+    ngx_socket_t  fd;
+
+    fd = ngx_socket(peer->server.sockaddr->sa_family, SOCK_DGRAM, 0);
+
+    if (fd == (ngx_socket_t) -1) {
+        ngx_syslog_drop(peer, ngx_socket_errno, 1);
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(fd) == -1) {
+        ngx_syslog_drop(peer, ngx_socket_errno, 1);
+        goto failed;
+    }
+
+    if (connect(fd, peer->server.sockaddr, peer->server.socklen) == -1) {
+        ngx_syslog_drop(peer, ngx_socket_errno, 1);
+        goto failed;
+    }
+
+    peer->fd = fd;
+
+    return NGX_OK;
+
+failed:
+
+    (void) ngx_close_socket(fd);
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * records are batched only in a process that runs the event loop,
+ * the master process and the early worker initialization send them at once
+ */
+
+static ngx_int_t
+ngx_syslog_batching(ngx_syslog_peer_t *peer)
+{
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return 0;
+    }
+
+    return ngx_event_timer_ready();
+}
+
+
+static void
+ngx_syslog_drop(ngx_syslog_peer_t *peer, ngx_err_t err, ngx_uint_t n)
+{
+    time_t      now;
+    ngx_uint_t  busy;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_log_dropped, n);
+#endif
+
+    now = ngx_time();
+
+    if (now - peer->error_log_time < 60) {
+        return;
+    }
+
+    peer->error_log_time = now;
+
+    /* the error log may be this very peer */
+
+    busy = peer->busy;
+    peer->busy = 1;
+
+    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                  "%ui records to syslog server \"%V\" were dropped",
+                  n, &peer->server.name);
+
+    peer->busy = busy;
+}
+
+
+static void
+ngx_syslog_flush_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "syslog flush handler");
+
+    ngx_syslog_flush(ev->data);
+}
+
+
+static void
+ngx_syslog_cleanup(void *data)
+{
+    ngx_syslog_peer_t  *peer = data;
+
+    if (peer->fd == (ngx_socket_t) -1) {
+        return;
+    }
+
+    if (ngx_syslog_batching(peer)) {
+        ngx_syslog_flush(peer);
+    }
+
+    /* the flush timer is not deleted if the event loop is not running */
+
+    peer->nrecs = 0;
+
+    if (ngx_close_socket(peer->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+
+    peer->fd = (ngx_socket_t) -1;
+}
@@ -0,0 +1,61 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SYSLOG_H_INCLUDED_
+#define _NGX_SYSLOG_H_INCLUDED_
+
+
+#define NGX_SYSLOG_MAX_STR                                                    \
+    NGX_MAX_ERROR_STR + sizeof("<255>Jan 01 00:00:00 ") - 1                   \
+    + (NGX_MAXHOSTNAMELEN - 1) + 1 /* space */                                \
+    + 32 /* tag */ + 2 /* colon, space */
+
+#define NGX_SYSLOG_BUFFER_SIZE  65536
+
+
+typedef struct {
+    ngx_uint_t          facility;
+    ngx_uint_t          severity;
+    ngx_str_t           tag;
+
+    ngx_addr_t          server;
+    ngx_socket_t        fd;
+
+    /*
+     * 批量发送：各条日志记录先复制到缓冲区中，
+     * 攒够batch条或flush定时器到期后用一次sendmmsg()发送
+     */
+    ngx_uint_t          batch;
+    ngx_uint_t          nrecs;
+    ngx_msec_t          flush;
+    ngx_event_t        *event;
+
+    u_char             *start;
+    u_char             *pos;
+    u_char             *last;
+
+    struct iovec       *iovs;
+#if (NGX_HAVE_SENDMMSG)
+    struct mmsghdr     *msgs;
+#endif
+
+    time_t              error_log_time;
+
+    unsigned            busy:1;
+    unsigned            nohostname:1;
+} ngx_syslog_peer_t;
+
+
+char *ngx_syslog_process_conf(ngx_conf_t *cf, ngx_syslog_peer_t *peer);
+u_char *ngx_syslog_add_header(ngx_syslog_peer_t *peer, u_char *buf);
+void ngx_syslog_writer(ngx_log_t *log, ngx_uint_t level, u_char *buf,
+    size_t len);
+ssize_t ngx_syslog_send(ngx_syslog_peer_t *peer, u_char *buf, size_t len);
+void ngx_syslog_flush(ngx_syslog_peer_t *peer);
+
+
+#endif /* _NGX_SYSLOG_H_INCLUDED_ */
@@ -46,6 +46,8 @@ extern volatile ngx_str_t    ngx_cached_http_time;
 extern volatile ngx_str_t    ngx_cached_http_log_time;
 //以ISO 8601标准格式记录下的字符串形式的当前时间 
 extern volatile ngx_str_t    ngx_cached_http_log_iso8601;
+//用于syslog消息头部的当前时间字符串
+extern volatile ngx_str_t    ngx_cached_syslog_time;
 
 /*
  * milliseconds elapsed since epoch and truncated to ngx_msec_t,
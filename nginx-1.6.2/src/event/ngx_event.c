@@ -24,6 +24,8 @@ extern ngx_module_t ngx_select_module;
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+static void *ngx_event_alloc_array(ngx_cycle_t *cycle, size_t size,
+    ngx_flag_t huge);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -79,6 +81,9 @@ ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
 ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t  *ngx_stat_waiting = &ngx_stat_waiting0;
+//因发送缓冲区满或队列满而被丢弃的日志记录数(syslog、异步access_log)
+ngx_atomic_t   ngx_stat_log_dropped0;
+ngx_atomic_t  *ngx_stat_log_dropped = &ngx_stat_log_dropped0;
 
 #endif
 
@@ -521,7 +526,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl;         /* ngx_stat_log_dropped */
 
 #endif
 	//初始化描述共享内存的ngx_shm_t结构体
@@ -529,6 +535,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     shm.name.len = sizeof("nginx_shared_zone");
     shm.name.data = (u_char *) "nginx_shared_zone";
     shm.log = cycle->log;
+    shm.huge = 0;
 	//开辟一块共享内存，共享内存的大小为shm.size
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -570,6 +577,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_log_dropped = (ngx_atomic_t *) (shared + 10 * cl);
 
 #endif
 
@@ -704,15 +712,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
 
     cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
+        ngx_event_alloc_array(cycle, sizeof(ngx_connection_t)
+                                     * cycle->connection_n, ccf->huge_pages);
     if (cycle->connections == NULL) {
         return NGX_ERROR;
     }
 
     c = cycle->connections;
 
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
+    cycle->read_events = ngx_event_alloc_array(cycle, sizeof(ngx_event_t)
+                                                      * cycle->connection_n,
+                                               ccf->huge_pages);
     if (cycle->read_events == NULL) {
         return NGX_ERROR;
     }
@@ -727,8 +737,9 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
     }
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
+    cycle->write_events = ngx_event_alloc_array(cycle, sizeof(ngx_event_t)
+                                                       * cycle->connection_n,
+                                                ccf->huge_pages);
     if (cycle->write_events == NULL) {
         return NGX_ERROR;
     }
@@ -871,6 +882,25 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 }
 
 
+static void *
+ngx_event_alloc_array(ngx_cycle_t *cycle, size_t size, ngx_flag_t huge)
+{
+    void  *p;
+
+    /* the arrays live as long as the process, so they are never freed */
+
+    if (huge) {
+        p = ngx_huge_alloc(size, cycle->log);
+
+        if (p) {
+            return p;
+        }
+    }
+
+    return ngx_alloc(size, cycle->log);
+}
+
+
 ngx_int_t
 ngx_send_lowat(ngx_connection_t *c, size_t lowat)
 {
@@ -76,6 +76,8 @@ struct ngx_event_s {
     unsigned         timedout:1;
 	//为1时表示这个事件存在于定时器中
     unsigned         timer_set:1;
+	//为1时表示工作进程优雅退出时不必等待这个定时器
+    unsigned         cancelable:1;
 
 	//为1时表示需要延迟处理这个事件,仅用于限速功能
     unsigned         delayed:1;
@@ -544,6 +546,7 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_log_dropped;
 
 #endif
 
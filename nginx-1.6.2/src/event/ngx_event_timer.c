@@ -15,6 +15,398 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+static void ngx_event_timer_wheel_init(void);
+static void ngx_event_timer_wheel_advance(ngx_msec_t msec);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t n);
+static ngx_msec_t ngx_event_timer_wheel_next(void);
+static ngx_int_t ngx_event_timer_wheel_scan(uint64_t *map, ngx_uint_t size,
+    ngx_uint_t from);
+
+
+ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+/* the bit shift, the number of slots and the first slot of each level */
+
+static ngx_uint_t  ngx_timer_wheel_shift[] = { 0, 8, 14, 20, 26 };
+static ngx_uint_t  ngx_timer_wheel_size[] = { 256, 64, 64, 64, 64 };
+static ngx_uint_t  ngx_timer_wheel_base[] = { 0, 256, 320, 384, 448 };
+
+#define NGX_TIMER_WHEEL_MAX  (ngx_msec_t) 0xffffffff
+
+
+ngx_int_t
+ngx_event_timer_init(ngx_log_t *log)
+{
+    ngx_event_timer_wheel_init();
+
+    ngx_event_timer_wheel.ready = 1;
+
+#if (NGX_THREADS)
+
+    if (ngx_event_timer_mutex) {
+        ngx_event_timer_mutex->log = log;
+        return NGX_OK;
+    }
+
+    ngx_event_timer_mutex = ngx_mutex_init(log, 0);
+    if (ngx_event_timer_mutex == NULL) {
+        return NGX_ERROR;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_timer_wheel_init(void)
+{
+    ngx_uint_t          i;
+    ngx_rbtree_node_t  *head;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+        head = &ngx_event_timer_wheel.slots[i];
+
+        head->left = head;
+        head->right = head;
+    }
+
+    ngx_memzero(ngx_event_timer_wheel.map, sizeof(ngx_event_timer_wheel.map));
+
+    ngx_event_timer_wheel.msec = ngx_current_msec;
+    ngx_event_timer_wheel.count = 0;
+    ngx_event_timer_wheel.cancelable = 0;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t               n, level;
+    ngx_msec_t               key, delta;
+    ngx_event_t             *ev;
+    ngx_rbtree_node_t       *head;
+    ngx_event_timer_wheel_t *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if (w->slots[0].left == NULL) {
+        /* the master process adds timers without ngx_event_timer_init() */
+        ngx_event_timer_wheel_init();
+    }
+
+    if ((ngx_msec_int_t) (node->key - w->msec) < 0) {
+        /* already expired, it will be expired with the current slot */
+        delta = 0;
+
+    } else {
+        delta = node->key - w->msec;
+
+        if (delta > NGX_TIMER_WHEEL_MAX) {
+            /* it will be placed again into the wheel while cascading */
+            delta = NGX_TIMER_WHEEL_MAX;
+        }
+    }
+
+    key = w->msec + delta;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < ((ngx_msec_t) 1 << ngx_timer_wheel_shift[level + 1])) {
+            break;
+        }
+    }
+
+    n = ngx_timer_wheel_base[level]
+        + ((key >> ngx_timer_wheel_shift[level])
+           & (ngx_timer_wheel_size[level] - 1));
+
+    head = &w->slots[n];
+
+    node->left = head;
+    node->right = head->right;
+    node->parent = head;
+
+    head->right->left = node;
+    head->right = node;
+
+    w->map[n >> 6] |= (uint64_t) 1 << (n & 63);
+    w->count++;
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    if (ev->cancelable) {
+        w->cancelable++;
+    }
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t               n;
+    ngx_event_t             *ev;
+    ngx_rbtree_node_t       *head;
+    ngx_event_timer_wheel_t *w;
+
+    w = &ngx_event_timer_wheel;
+
+    node->right->left = node->left;
+    node->left->right = node->right;
+
+    head = node->parent;
+
+    if (head->left == head) {
+        n = head - w->slots;
+        w->map[n >> 6] &= ~((uint64_t) 1 << (n & 63));
+    }
+
+    w->count--;
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    if (ev->cancelable) {
+        w->cancelable--;
+    }
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    ngx_msec_int_t  timer;
+
+    if (ngx_event_timer_wheel.count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    timer = (ngx_msec_int_t) (ngx_event_timer_wheel_next() - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    ngx_msec_t               next;
+    ngx_event_t             *ev;
+    ngx_rbtree_node_t       *head, *node;
+    ngx_event_timer_wheel_t *w;
+
+    w = &ngx_event_timer_wheel;
+
+    for ( ;; ) {
+
+        if (w->count == 0) {
+            w->msec = ngx_current_msec + 1;
+            return;
+        }
+
+        next = ngx_event_timer_wheel_next();
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+
+            /* nothing expires or cascades until "next", skip empty slots */
+
+            if ((ngx_msec_int_t) (ngx_current_msec + 1 - w->msec) > 0) {
+                ngx_event_timer_wheel_advance(ngx_current_msec + 1);
+            }
+
+            return;
+        }
+
+        ngx_event_timer_wheel_advance(next);
+
+        head = &w->slots[next & 255];
+
+        while (head->left != head) {
+            node = head->left;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+
+        ngx_event_timer_wheel_advance(next + 1);
+    }
+}
+
+
+/*
+ * the slots of the upper levels periods are cascaded as soon as the wheel
+ * enters the period, from the highest level down, so the current slot of
+ * each upper level only holds the timers of its next round
+ */
+
+static void
+ngx_event_timer_wheel_advance(ngx_msec_t msec)
+{
+    ngx_uint_t               n, level, shift;
+    ngx_msec_t               old;
+    ngx_event_timer_wheel_t *w;
+
+    w = &ngx_event_timer_wheel;
+
+    old = w->msec;
+    w->msec = msec;
+
+    for (level = NGX_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        shift = ngx_timer_wheel_shift[level];
+
+        if ((msec >> shift) == (old >> shift)) {
+            continue;
+        }
+
+        n = (msec >> shift) & (ngx_timer_wheel_size[level] - 1);
+
+        ngx_event_timer_wheel_cascade(ngx_timer_wheel_base[level] + n);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t n)
+{
+    ngx_rbtree_node_t  *head, *node;
+
+    head = &ngx_event_timer_wheel.slots[n];
+
+    /* the timers of the slot go to the lower levels */
+
+    while (head->left != head) {
+        node = head->left;
+
+        ngx_event_timer_wheel_delete(node);
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+/*
+ * returns the nearest time when either a first level slot expires or
+ * the wheel enters the period of a non-empty upper level slot; it is
+ * the exact earliest timer unless the earliest timer is still in an
+ * upper level
+ */
+
+static ngx_msec_t
+ngx_event_timer_wheel_next(void)
+{
+    ngx_int_t                k;
+    ngx_uint_t               n, level, idx, shift, found;
+    ngx_msec_t               next, block, t;
+    ngx_event_timer_wheel_t *w;
+
+    w = &ngx_event_timer_wheel;
+
+    next = 0;
+    found = 0;
+
+    idx = w->msec & 255;
+
+    k = ngx_event_timer_wheel_scan(&w->map[0], 256, idx);
+
+    if (k != NGX_ERROR) {
+        next = w->msec + k;
+
+        if ((ngx_uint_t) k < 256 - idx) {
+            /* the upper levels do not cascade before the period end */
+            return next;
+        }
+
+        found = 1;
+    }
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = ngx_timer_wheel_shift[level];
+
+        /* the current slot was already cascaded and holds the next round */
+        block = (w->msec >> shift) + 1;
+
+        n = ngx_timer_wheel_base[level] >> 6;
+        k = ngx_event_timer_wheel_scan(&w->map[n], 64, block & 63);
+
+        if (k == NGX_ERROR) {
+            continue;
+        }
+
+        t = (block + k) << shift;
+
+        if (!found || (ngx_msec_int_t) (t - next) < 0) {
+            next = t;
+            found = 1;
+        }
+    }
+
+    return next;
+}
+
+
+/*
+ * finds the first set bit starting from the "from" bit and wrapping
+ * around the end of the map, returns its distance from "from"
+ */
+
+static ngx_int_t
+ngx_event_timer_wheel_scan(uint64_t *map, ngx_uint_t size, ngx_uint_t from)
+{
+    uint64_t    word;
+    ngx_uint_t  i, n, w, bit, pos;
+
+    n = size / 64;
+    w = from / 64;
+    bit = from % 64;
+
+    word = map[w] & ((uint64_t) -1 << bit);
+
+    for (i = 0; i <= n; i++) {
+
+        if (word) {
+
+#if (NGX_HAVE_GCC_BUILTIN_CTZ)
+            pos = __builtin_ctzll(word);
+#else
+            for (pos = 0; (word & 1) == 0; pos++) {
+                word >>= 1;
+            }
+#endif
+
+            return (ngx_int_t) ((w * 64 + pos - from) & (size - 1));
+        }
+
+        w = (w + 1) % n;
+        word = map[w];
+
+        if (i + 1 == n) {
+            /* the start word bits before "from" */
+            word &= ~((uint64_t) -1 << bit);
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+#else
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
@@ -156,3 +548,63 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+/*
+ * the timers are walked in the expiration order, so usually
+ * the walk stops at the first one which is not cancelable
+ */
+
+ngx_uint_t
+ngx_event_no_timers_left(void)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *root, *parent, *sentinel;
+
+    root = ngx_event_timer_rbtree.root;
+    sentinel = ngx_event_timer_rbtree.sentinel;
+
+    if (root == sentinel) {
+        return 1;
+    }
+
+    node = ngx_rbtree_min(root, sentinel);
+
+    while (node) {
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            return 0;
+        }
+
+        /*
+         * the next node in order; the root parent pointer is not reliable,
+         * ngx_rbtree_delete() does not reset it when a child becomes the root
+         */
+
+        if (node->right != sentinel) {
+            node = ngx_rbtree_min(node->right, sentinel);
+            continue;
+        }
+
+        for ( ;; ) {
+            if (node == root) {
+                node = NULL;
+                break;
+            }
+
+            parent = node->parent;
+
+            if (node == parent->left) {
+                node = parent;
+                break;
+            }
+
+            node = parent;
+        }
+    }
+
+    return 1;
+}
+
+#endif
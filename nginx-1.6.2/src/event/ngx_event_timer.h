@@ -29,8 +29,59 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * the hierarchical timer wheel: the first level has a slot per millisecond
+ * and covers 256 ms, each next level has 64 slots covering the whole
+ * previous level, so 5 levels cover 2^32 ms; the timer node links are
+ * reused for the doubly linked slot lists: "left" is the next node,
+ * "right" is the previous one and "parent" points to the slot head
+ */
+
+#define NGX_TIMER_WHEEL_LEVELS  5
+#define NGX_TIMER_WHEEL_SLOTS   (256 + 4 * 64)
+
+
+typedef struct {
+    ngx_msec_t          msec;      /* the first not yet expired time */
+    ngx_uint_t          count;
+    ngx_uint_t          cancelable;
+    ngx_uint_t          ready;
+    uint64_t            map[NGX_TIMER_WHEEL_SLOTS / 64];
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_SLOTS];
+} ngx_event_timer_wheel_t;
+
+
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node);
+
+extern ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+#define ngx_event_timer_insert(node)  ngx_event_timer_wheel_insert(node)
+#define ngx_event_timer_delete(node)  ngx_event_timer_wheel_delete(node)
+
+#define ngx_event_timer_ready()       ngx_event_timer_wheel.ready
+#define ngx_event_no_timers_left()                                            \
+    (ngx_event_timer_wheel.count == ngx_event_timer_wheel.cancelable)
+
+#else
+
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timer_insert(node)                                          \
+    ngx_rbtree_insert(&ngx_event_timer_rbtree, node)
+#define ngx_event_timer_delete(node)                                          \
+    ngx_rbtree_delete(&ngx_event_timer_rbtree, node)
+
+/* the sentinel is set by ngx_event_timer_init() in a process with events */
+#define ngx_event_timer_ready()                                               \
+    (ngx_event_timer_rbtree.sentinel != NULL)
+
+ngx_uint_t ngx_event_no_timers_left(void);
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -41,7 +92,7 @@ ngx_event_del_timer(ngx_event_t *ev)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_delete(&ev->timer);
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -91,7 +142,7 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_insert(&ev->timer);
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
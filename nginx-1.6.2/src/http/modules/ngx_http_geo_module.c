@@ -18,9 +18,9 @@ typedef struct {
 
 
 typedef struct {
-    ngx_radix_tree_t                *tree;
+    ngx_radix_trie_t                *trie;
 #if (NGX_HAVE_INET6)
-    ngx_radix_tree_t                *tree6;
+    ngx_radix_trie_t                *trie6;
 #endif
 } ngx_http_geo_trees_t;
 
@@ -28,6 +28,7 @@ typedef struct {
 typedef struct {
     ngx_http_geo_range_t           **low;
     ngx_http_variable_value_t       *default_value;
+    u_char                          *base;
 } ngx_http_geo_high_ranges_t;
 
 
@@ -40,6 +41,7 @@ typedef struct {
 
 typedef struct {
     ngx_http_variable_value_t       *value;
+    ngx_http_variable_value_t       *include_default;
     ngx_str_t                       *net;
     ngx_http_geo_high_ranges_t       high;
     ngx_radix_tree_t                *tree;
@@ -49,6 +51,7 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_array_t                     *proxies;
+    ngx_shared_table_t              *dynamic;
     ngx_pool_t                      *pool;
     ngx_pool_t                      *temp_pool;
 
@@ -62,6 +65,7 @@ typedef struct {
     unsigned                         outside_entries:1;
     unsigned                         allow_binary_include:1;
     unsigned                         binary_include:1;
+    unsigned                         including:1;
     unsigned                         proxy_recursive:1;
 } ngx_http_geo_conf_ctx_t;
 
@@ -75,6 +79,8 @@ typedef struct {
     ngx_array_t                     *proxies;
     unsigned                         proxy_recursive:1;
 
+    ngx_shared_table_t              *dynamic;
+
     ngx_int_t                        index;
 } ngx_http_geo_ctx_t;
 
@@ -83,6 +89,8 @@ static ngx_int_t ngx_http_geo_addr(ngx_http_request_t *r,
     ngx_http_geo_ctx_t *ctx, ngx_addr_t *addr);
 static ngx_int_t ngx_http_geo_real_addr(ngx_http_request_t *r,
     ngx_http_geo_ctx_t *ctx, ngx_addr_t *addr);
+static ngx_int_t ngx_http_geo_dynamic_find(ngx_http_request_t *r,
+    ngx_http_geo_ctx_t *ctx, ngx_addr_t *addr, ngx_http_variable_value_t *v);
 static char *ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_geo(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
 static char *ngx_http_geo_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
@@ -105,9 +113,14 @@ static char *ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name);
 static ngx_int_t ngx_http_geo_include_binary_base(ngx_conf_t *cf,
     ngx_http_geo_conf_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_http_geo_check_binary_base(u_char *base, size_t size);
+static void ngx_http_geo_close_binary_base(void *data);
 static void ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx);
 static u_char *ngx_http_geo_copy_values(u_char *base, u_char *p,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_geo_dynamic_entry(ngx_shared_table_t *st,
+    ngx_pool_t *pool, ngx_str_t *key, ngx_uint_t *class);
+static ngx_int_t ngx_http_geo_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_geo_commands[] = {
@@ -145,7 +158,7 @@ ngx_module_t  ngx_http_geo_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_geo_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -154,17 +167,48 @@ ngx_module_t  ngx_http_geo_module = {
 };
 
 
+/*
+ * the binary range base is position independent, so it is mapped
+ * read-only and shared by all processes and configuration cycles:
+ *
+ *     header
+ *     uint32_t index[0x10000]      offsets of range lists or 0
+ *     values                       length and data, aligned to 4 bytes
+ *     range lists                  terminated by a zero value offset
+ *
+ * all offsets are from the start of the file
+ */
+
+#define NGX_HTTP_GEO_BINARY_VERSION  1
+
+
 typedef struct {
     u_char    GEORNG[6];
     u_char    version;
-    u_char    ptr_size;
+    u_char    offset_size;
     uint32_t  endianness;
     uint32_t  crc32;
+    uint32_t  size;
+    uint32_t  default_value;
 } ngx_http_geo_header_t;
 
 
+typedef struct {
+    uint16_t  start;
+    uint16_t  end;
+    uint32_t  value;
+} ngx_http_geo_binary_range_t;
+
+
+typedef struct {
+    uint32_t  len;
+    u_char    data[1];
+} ngx_http_geo_binary_value_t;
+
+
 static ngx_http_geo_header_t  ngx_http_geo_header = {
-    { 'G', 'E', 'O', 'R', 'N', 'G' }, 0, sizeof(void *), 0x12345678, 0
+    { 'G', 'E', 'O', 'R', 'N', 'G' }, NGX_HTTP_GEO_BINARY_VERSION,
+    sizeof(uint32_t), 0x12345678, 0, 0, 0
 };
 
 
@@ -177,6 +221,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     ngx_http_geo_ctx_t *ctx = (ngx_http_geo_ctx_t *) data;
 
     in_addr_t                   inaddr;
+    ngx_int_t                   rc;
     ngx_addr_t                  addr;
     struct sockaddr_in         *sin;
     ngx_http_variable_value_t  *vv;
@@ -187,10 +232,18 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     if (ngx_http_geo_addr(r, ctx, &addr) != NGX_OK) {
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, INADDR_NONE);
+                  ngx_radix32trie_find(ctx->u.trees.trie, INADDR_NONE);
         goto done;
     }
 
+    if (ctx->dynamic) {
+        rc = ngx_http_geo_dynamic_find(r, ctx, &addr, v);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     switch (addr.sockaddr->sa_family) {
 
 #if (NGX_HAVE_INET6)
@@ -205,11 +258,11 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
             inaddr += p[15];
 
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                      ngx_radix32trie_find(ctx->u.trees.trie, inaddr);
 
         } else {
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix128tree_find(ctx->u.trees.tree6, p);
+                      ngx_radix128trie_find(ctx->u.trees.trie6, p);
         }
 
         break;
@@ -220,7 +273,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         inaddr = ntohl(sin->sin_addr.s_addr);
 
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                  ngx_radix32trie_find(ctx->u.trees.trie, inaddr);
 
         break;
     }
@@ -242,14 +295,18 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_geo_ctx_t *ctx = (ngx_http_geo_ctx_t *) data;
 
-    in_addr_t              inaddr;
-    ngx_addr_t             addr;
-    ngx_uint_t             n;
-    struct sockaddr_in    *sin;
-    ngx_http_geo_range_t  *range;
+    u_char                       *base;
+    uint32_t                      off;
+    in_addr_t                     inaddr;
+    ngx_addr_t                    addr;
+    ngx_uint_t                    n;
+    struct sockaddr_in           *sin;
+    ngx_http_geo_range_t         *range;
+    ngx_http_geo_binary_range_t  *br;
+    ngx_http_geo_binary_value_t  *bv;
 #if (NGX_HAVE_INET6)
-    u_char                *p;
-    struct in6_addr       *inaddr6;
+    u_char                       *p;
+    struct in6_addr              *inaddr6;
 #endif
 
     *v = *ctx->u.high.default_value;
@@ -301,6 +358,33 @@ ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
                 }
             } while ((++range)->value);
         }
+
+    } else if (ctx->u.high.base) {
+        base = ctx->u.high.base;
+
+        off = ((uint32_t *) (base + sizeof(ngx_http_geo_header_t)))
+                                                              [inaddr >> 16];
+
+        if (off) {
+            n = inaddr & 0xffff;
+
+            for (br = (ngx_http_geo_binary_range_t *) (base + off);
+                 br->value;
+                 br++)
+            {
+                if (n >= (ngx_uint_t) br->start && n <= (ngx_uint_t) br->end) {
+                    bv = (ngx_http_geo_binary_value_t *) (base + br->value);
+
+                    v->len = bv->len;
+                    v->valid = 1;
+                    v->no_cacheable = 0;
+                    v->not_found = 0;
+                    v->data = bv->data;
+
+                    break;
+                }
+            }
+        }
     }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -368,6 +452,110 @@ ngx_http_geo_real_addr(ngx_http_request_t *r, ngx_http_geo_ctx_t *ctx,
 }
 
 
+/*
+ * the dynamic entries are keyed by the prefix length and the masked
+ * network, so the prefixes present in the table are looked up from
+ * the longest one; the IPv6 lengths are biased by 64 to not mix them
+ * with the IPv4 ones
+ */
+
+static ngx_int_t
+ngx_http_geo_dynamic_find(ngx_http_request_t *r, ngx_http_geo_ctx_t *ctx,
+    ngx_addr_t *addr, ngx_http_variable_value_t *v)
+{
+    u_char                      *p, *data, key[1 + 16];
+    size_t                       len;
+    ngx_int_t                    rc, bits, n, rest;
+    ngx_str_t                    value;
+    ngx_uint_t                   base;
+    struct sockaddr_in          *sin;
+    ngx_shared_table_version_t  *tv;
+#if (NGX_HAVE_INET6)
+    struct in6_addr             *inaddr6;
+#endif
+
+    switch (addr->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) addr->sockaddr)->sin6_addr;
+        p = inaddr6->s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+            p += 12;
+            len = 4;
+            base = 0;
+
+        } else {
+            len = 16;
+            base = 64;
+        }
+
+        break;
+#endif
+
+    default: /* AF_INET */
+        sin = (struct sockaddr_in *) addr->sockaddr;
+        p = (u_char *) &sin->sin_addr.s_addr;
+        len = 4;
+        base = 0;
+        break;
+    }
+
+    rc = NGX_DECLINED;
+
+    tv = ngx_shared_table_enter(ctx->dynamic);
+
+    for (bits = len * 8; tv && bits >= 0; bits--) {
+
+        if (!ngx_shared_table_has_class(tv, base + bits)) {
+            continue;
+        }
+
+        key[0] = (u_char) (base + bits);
+
+        for (n = 0; n < (ngx_int_t) len; n++) {
+            rest = bits - n * 8;
+
+            key[1 + n] = (rest >= 8) ? p[n]
+                                     : (rest > 0) ? p[n] & (0xff << (8 - rest))
+                                                  : 0;
+        }
+
+        if (ngx_shared_table_get(tv, key, 1 + len, &value) != NGX_OK) {
+            continue;
+        }
+
+        data = ngx_pnalloc(r->pool, value.len);
+
+        if (data == NULL) {
+            rc = NGX_ERROR;
+            break;
+        }
+
+        ngx_memcpy(data, value.data, value.len);
+
+        v->len = value.len;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+        v->data = data;
+
+        rc = NGX_OK;
+        break;
+    }
+
+    ngx_shared_table_leave(ctx->dynamic);
+
+    if (rc == NGX_OK) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http geo dynamic: %v, prefix: %i", v, bits);
+    }
+
+    return rc;
+}
+
+
 static char *
 ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -446,8 +634,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx.pool = cf->pool;
     ctx.data_size = sizeof(ngx_http_geo_header_t)
-                  + sizeof(ngx_http_variable_value_t)
-                  + 0x10000 * sizeof(ngx_http_geo_range_t *);
+                  + 0x10000 * sizeof(uint32_t);
     ctx.allow_binary_include = 1;
 
     save = *cf;
@@ -462,14 +649,27 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     geo->proxies = ctx.proxies;
     geo->proxy_recursive = ctx.proxy_recursive;
+    geo->dynamic = ctx.dynamic;
 
     if (ctx.ranges) {
 
+        if (ctx.dynamic) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"dynamic\" parameter cannot be used "
+                               "with \"ranges\"");
+            return NGX_CONF_ERROR;
+        }
+
         if (ctx.high.low && !ctx.binary_include) {
             for (i = 0; i < 0x10000; i++) {
                 a = (ngx_array_t *) ctx.high.low[i];
 
-                if (a == NULL || a->nelts == 0) {
+                if (a == NULL) {
+                    continue;
+                }
+
+                if (a->nelts == 0) {
+                    ctx.high.low[i] = NULL;
                     continue;
                 }
 
@@ -482,7 +682,8 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
                 ngx_memcpy(ctx.high.low[i], a->elts, len);
                 ctx.high.low[i][a->nelts].value = NULL;
-                ctx.data_size += len + sizeof(void *);
+                ctx.data_size += (a->nelts + 1)
+                                 * sizeof(ngx_http_geo_binary_range_t);
             }
 
             if (ctx.allow_binary_include
@@ -508,31 +709,24 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     } else {
         if (ctx.tree == NULL) {
-            ctx.tree = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree = ngx_radix_tree_create(ctx.temp_pool, -1);
             if (ctx.tree == NULL) {
                 return NGX_CONF_ERROR;
             }
         }
 
-        geo->u.trees.tree = ctx.tree;
-
 #if (NGX_HAVE_INET6)
         if (ctx.tree6 == NULL) {
-            ctx.tree6 = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree6 = ngx_radix_tree_create(ctx.temp_pool, -1);
             if (ctx.tree6 == NULL) {
                 return NGX_CONF_ERROR;
             }
         }
-
-        geo->u.trees.tree6 = ctx.tree6;
 #endif
 
         var->get_handler = ngx_http_geo_cidr_variable;
         var->data = (uintptr_t) geo;
 
-        ngx_destroy_pool(ctx.temp_pool);
-        ngx_destroy_pool(pool);
-
         if (ngx_radix32tree_insert(ctx.tree, 0, 0,
                                    (uintptr_t) &ngx_http_variable_null_value)
             == NGX_ERROR)
@@ -550,6 +744,26 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             return NGX_CONF_ERROR;
         }
 #endif
+
+        /*
+         * the binary trees are built in the temporary pool,
+         * only the compiled tries are kept for lookups
+         */
+
+        geo->u.trees.trie = ngx_radix_trie_create(ctx.tree, cf->pool);
+        if (geo->u.trees.trie == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+#if (NGX_HAVE_INET6)
+        geo->u.trees.trie6 = ngx_radix_trie_create(ctx.tree6, cf->pool);
+        if (geo->u.trees.trie6 == NULL) {
+            return NGX_CONF_ERROR;
+        }
+#endif
+
+        ngx_destroy_pool(ctx.temp_pool);
+        ngx_destroy_pool(pool);
     }
 
     return rv;
@@ -596,6 +810,27 @@ ngx_http_geo(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
             rv = NGX_CONF_OK;
             goto done;
         }
+
+    } else if (cf->args->nelts > 2
+               && ngx_strcmp(value[0].data, "dynamic") == 0)
+    {
+        if (ctx->dynamic) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate \"dynamic\" parameter");
+            goto failed;
+        }
+
+        ctx->dynamic = ngx_shared_table_add(cf, &value[1],
+                                            cf->args->nelts - 1,
+                                            &ngx_http_geo_module);
+        if (ctx->dynamic == NULL) {
+            goto failed;
+        }
+
+        ctx->dynamic->entry = ngx_http_geo_dynamic_entry;
+
+        rv = NGX_CONF_OK;
+        goto done;
     }
 
     if (cf->args->nelts != 2) {
@@ -664,6 +899,10 @@ ngx_http_geo_range(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
             return NGX_CONF_ERROR;
         }
 
+        if (ctx->including) {
+            ctx->include_default = ctx->high.default_value;
+        }
+
         return NGX_CONF_OK;
     }
 
@@ -1021,7 +1260,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_cidr_t   cidr;
 
     if (ctx->tree == NULL) {
-        ctx->tree = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree = ngx_radix_tree_create(ctx->temp_pool, -1);
         if (ctx->tree == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1029,7 +1268,7 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
     if (ctx->tree6 == NULL) {
-        ctx->tree6 = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree6 = ngx_radix_tree_create(ctx->temp_pool, -1);
         if (ctx->tree6 == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1252,8 +1491,8 @@ ngx_http_geo_value(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
     ngx_rbtree_insert(&ctx->rbtree, &gvvn->sn.node);
 
-    ctx->data_size += ngx_align(sizeof(ngx_http_variable_value_t) + value->len,
-                                sizeof(void *));
+    ctx->data_size += ngx_align(offsetof(ngx_http_geo_binary_value_t, data)
+                                + value->len, sizeof(uint32_t));
 
     return val;
 }
@@ -1355,8 +1594,11 @@ ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
     ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
 
+    ctx->including = 1;
+
     rv = ngx_conf_parse(cf, &file);
 
+    ctx->including = 0;
     ctx->includes++;
     ctx->outside_entries = 0;
 
@@ -1368,31 +1610,22 @@ static ngx_int_t
 ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name)
 {
-    u_char                     *base, ch;
-    time_t                      mtime;
-    size_t                      size, len;
-    ssize_t                     n;
-    uint32_t                    crc32;
-    ngx_err_t                   err;
-    ngx_int_t                   rc;
-    ngx_uint_t                  i;
-    ngx_file_t                  file;
-    ngx_file_info_t             fi;
-    ngx_http_geo_range_t       *range, **ranges;
-    ngx_http_geo_header_t      *header;
-    ngx_http_variable_value_t  *vv;
-
-    ngx_memzero(&file, sizeof(ngx_file_t));
-    file.name = *name;
-    file.log = cf->log;
-
-    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, 0, 0);
-    if (file.fd == NGX_INVALID_FILE) {
-        err = ngx_errno;
-        if (err != NGX_ENOENT) {
-            ngx_conf_log_error(NGX_LOG_CRIT, cf, err,
-                               ngx_open_file_n " \"%s\" failed", name->data);
-        }
+    u_char                       *base, ch;
+    time_t                        mtime;
+    size_t                        size;
+    uint32_t                      crc32;
+    ngx_int_t                     rc;
+    ngx_file_info_t               fi;
+    ngx_pool_cleanup_t           *cln;
+    ngx_file_mapping_t            fm;
+    ngx_http_geo_header_t        *header;
+    ngx_http_variable_value_t    *vv;
+    ngx_http_geo_binary_value_t  *bv;
+
+    fm.name = name->data;
+    fm.log = cf->log;
+
+    if (ngx_open_file_mapping(&fm) != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -1412,115 +1645,101 @@ ngx_http_geo_include_binary_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         goto done;
     }
 
-    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+    if (ngx_fd_info(fm.fd, &fi) == NGX_FILE_ERROR) {
         ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
                            ngx_fd_info_n " \"%s\" failed", name->data);
         goto failed;
     }
 
-    size = (size_t) ngx_file_size(&fi);
     mtime = ngx_file_mtime(&fi);
 
     ch = name->data[name->len - 4];
     name->data[name->len - 4] = '\0';
 
     if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                           ngx_file_info_n " \"%s\" failed", name->data);
-        goto failed;
-    }
 
-    name->data[name->len - 4] = ch;
+        /* a base compiled by geo2bin.pl may be deployed without its source */
+
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                               ngx_file_info_n " \"%s\" failed", name->data);
+            name->data[name->len - 4] = ch;
+            goto failed;
+        }
 
-    if (mtime < ngx_file_mtime(&fi)) {
+    } else if (mtime < ngx_file_mtime(&fi)) {
+        name->data[name->len - 4] = ch;
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
                            "stale binary geo range base \"%s\"", name->data);
         goto failed;
     }
 
-    base = ngx_palloc(ctx->pool, size);
-    if (base == NULL) {
-        goto failed;
-    }
+    name->data[name->len - 4] = ch;
 
-    n = ngx_read_file(&file, base, size, 0);
+    base = fm.addr;
+    size = fm.size;
+    header = fm.addr;
 
-    if (n == NGX_ERROR) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
-                           ngx_read_file_n " \"%s\" failed", name->data);
+    if (size < sizeof(ngx_http_geo_header_t) + 0x10000 * sizeof(uint32_t)
+        || ngx_memcmp(&ngx_http_geo_header, header, 12) != 0
+        || header->size != size)
+    {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+             "incompatible binary geo range base \"%s\"", name->data);
         goto failed;
     }
 
-    if ((size_t) n != size) {
-        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
-            ngx_read_file_n " \"%s\" returned only %z bytes instead of %z",
-            name->data, n, size);
+    crc32 = ngx_crc32_long(base + sizeof(ngx_http_geo_header_t),
+                           size - sizeof(ngx_http_geo_header_t));
+
+    if (crc32 != header->crc32) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
         goto failed;
     }
 
-    header = (ngx_http_geo_header_t *) base;
-
-    if (size < 16 || ngx_memcmp(&ngx_http_geo_header, header, 12) != 0) {
+    if (ngx_http_geo_check_binary_base(base, size) != NGX_OK) {
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-             "incompatible binary geo range base \"%s\"", name->data);
+                           "corrupted binary geo range base \"%s\"",
+                           name->data);
         goto failed;
     }
 
-    ngx_crc32_init(crc32);
+    if (header->default_value) {
+        vv = ngx_palloc(ctx->pool, sizeof(ngx_http_variable_value_t));
+        if (vv == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
 
-    vv = (ngx_http_variable_value_t *) (base + sizeof(ngx_http_geo_header_t));
+        bv = (ngx_http_geo_binary_value_t *) (base + header->default_value);
 
-    while(vv->data) {
-        len = ngx_align(sizeof(ngx_http_variable_value_t) + vv->len,
-                        sizeof(void *));
-        ngx_crc32_update(&crc32, (u_char *) vv, len);
-        vv->data += (size_t) base;
-        vv = (ngx_http_variable_value_t *) ((u_char *) vv + len);
-    }
-    ngx_crc32_update(&crc32, (u_char *) vv, sizeof(ngx_http_variable_value_t));
-    vv++;
+        vv->len = bv->len;
+        vv->valid = 1;
+        vv->no_cacheable = 0;
+        vv->not_found = 0;
+        vv->data = bv->data;
 
-    ranges = (ngx_http_geo_range_t **) vv;
-
-    for (i = 0; i < 0x10000; i++) {
-        ngx_crc32_update(&crc32, (u_char *) &ranges[i], sizeof(void *));
-        if (ranges[i]) {
-            ranges[i] = (ngx_http_geo_range_t *)
-                            ((u_char *) ranges[i] + (size_t) base);
-        }
+        ctx->high.default_value = vv;
     }
 
-    range = (ngx_http_geo_range_t *) &ranges[0x10000];
-
-    while ((u_char *) range < base + size) {
-        while (range->value) {
-            ngx_crc32_update(&crc32, (u_char *) range,
-                             sizeof(ngx_http_geo_range_t));
-            range->value = (ngx_http_variable_value_t *)
-                               ((u_char *) range->value + (size_t) base);
-            range++;
-        }
-        ngx_crc32_update(&crc32, (u_char *) range, sizeof(void *));
-        range = (ngx_http_geo_range_t *) ((u_char *) range + sizeof(void *));
+    cln = ngx_pool_cleanup_add(ctx->pool, sizeof(ngx_file_mapping_t));
+    if (cln == NULL) {
+        rc = NGX_ERROR;
+        goto done;
     }
 
-    ngx_crc32_final(crc32);
-
-    if (crc32 != header->crc32) {
-        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-                  "CRC32 mismatch in binary geo range base \"%s\"", name->data);
-        goto failed;
-    }
+    ngx_memcpy(cln->data, &fm, sizeof(ngx_file_mapping_t));
+    cln->handler = ngx_http_geo_close_binary_base;
 
     ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
                        "using binary geo range base \"%s\"", name->data);
 
     ctx->include_name = *name;
     ctx->binary_include = 1;
-    ctx->high.low = ranges;
-    rc = NGX_OK;
+    ctx->high.base = base;
 
-    goto done;
+    return NGX_OK;
 
 failed:
 
@@ -1528,39 +1747,133 @@ failed:
 
 done:
 
-    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
-                      ngx_close_file_n " \"%s\" failed", name->data);
-    }
+    ngx_close_file_mapping(&fm);
 
     return rc;
 }
 
 
+#define ngx_http_geo_binary_value_valid(base, size, off)                      \
+    ((off) >= sizeof(ngx_http_geo_header_t) + 0x10000 * sizeof(uint32_t)      \
+     && (off) % sizeof(uint32_t) == 0                                         \
+     && (off) <= (size) - sizeof(uint32_t)                                    \
+     && ((ngx_http_geo_binary_value_t *) ((base) + (off)))->len               \
+        <= (size) - (off) - sizeof(uint32_t))
+
+
+/*
+ * checks that every offset stays within the base and every range list
+ * is terminated, so lookups need no bounds checks
+ */
+
+static ngx_int_t
+ngx_http_geo_check_binary_base(u_char *base, size_t size)
+{
+    size_t                        off;
+    uint32_t                     *index;
+    ngx_uint_t                    i;
+    ngx_http_geo_header_t        *header;
+    ngx_http_geo_binary_range_t  *br;
+
+    header = (ngx_http_geo_header_t *) base;
+
+    if (header->default_value
+        && !ngx_http_geo_binary_value_valid(base, size,
+                                            (size_t) header->default_value))
+    {
+        return NGX_ERROR;
+    }
+
+    index = (uint32_t *) (base + sizeof(ngx_http_geo_header_t));
+
+    for (i = 0; i < 0x10000; i++) {
+        off = index[i];
+
+        if (off == 0) {
+            continue;
+        }
+
+        if (off < sizeof(ngx_http_geo_header_t) + 0x10000 * sizeof(uint32_t)
+            || off % sizeof(uint32_t))
+        {
+            return NGX_ERROR;
+        }
+
+        for ( ;; ) {
+            if (off > size - sizeof(ngx_http_geo_binary_range_t)) {
+                return NGX_ERROR;
+            }
+
+            br = (ngx_http_geo_binary_range_t *) (base + off);
+
+            if (br->value == 0) {
+                break;
+            }
+
+            if (br->start > br->end
+                || !ngx_http_geo_binary_value_valid(base, size,
+                                                    (size_t) br->value))
+            {
+                return NGX_ERROR;
+            }
+
+            off += sizeof(ngx_http_geo_binary_range_t);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_geo_close_binary_base(void *data)
+{
+    ngx_file_mapping_t  *fm = data;
+
+    fm->log = ngx_cycle->log;
+
+    ngx_close_file_mapping(fm);
+}
+
+
 static void
 ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx)
 {
-    u_char                              *p;
-    uint32_t                             hash;
+    u_char                              *p, *name;
+    uint32_t                             hash, *index;
     ngx_str_t                            s;
     ngx_uint_t                           i;
     ngx_file_mapping_t                   fm;
-    ngx_http_geo_range_t                *r, *range, **ranges;
+    ngx_http_geo_range_t                *r;
     ngx_http_geo_header_t               *header;
+    ngx_http_geo_binary_range_t         *range;
     ngx_http_geo_variable_value_node_t  *gvvn;
 
-    fm.name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V.bin%Z", &ctx->include_name);
+
+    /*
+     * the base is written under a temporary name and renamed, because
+     * other configuration cycles may still have the old one mapped
+     */
+
+    fm.name = ngx_pnalloc(ctx->temp_pool,
+                          ctx->include_name.len + 5 + 1 + NGX_INT64_LEN);
     if (fm.name == NULL) {
         return;
     }
 
-    ngx_sprintf(fm.name, "%V.bin%Z", &ctx->include_name);
+    ngx_sprintf(fm.name, "%s.%P%Z", name, ngx_pid);
 
     fm.size = ctx->data_size;
     fm.log = ctx->pool->log;
 
     ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
-                  "creating binary geo range base \"%s\"", fm.name);
+                  "creating binary geo range base \"%s\"", name);
 
     if (ngx_create_file_mapping(&fm) != NGX_OK) {
         return;
@@ -1569,23 +1882,23 @@ ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx)
     p = ngx_cpymem(fm.addr, &ngx_http_geo_header,
                    sizeof(ngx_http_geo_header_t));
 
-    p = ngx_http_geo_copy_values(fm.addr, p, ctx->rbtree.root,
-                                 ctx->rbtree.sentinel);
+    index = (uint32_t *) p;
 
-    p += sizeof(ngx_http_variable_value_t);
+    p += 0x10000 * sizeof(uint32_t);
 
-    ranges = (ngx_http_geo_range_t **) p;
-
-    p += 0x10000 * sizeof(ngx_http_geo_range_t *);
+    p = ngx_http_geo_copy_values(fm.addr, p, ctx->rbtree.root,
+                                 ctx->rbtree.sentinel);
 
     for (i = 0; i < 0x10000; i++) {
         r = ctx->high.low[i];
+
         if (r == NULL) {
+            index[i] = 0;
             continue;
         }
 
-        range = (ngx_http_geo_range_t *) p;
-        ranges[i] = (ngx_http_geo_range_t *) (p - (u_char *) fm.addr);
+        range = (ngx_http_geo_binary_range_t *) p;
+        index[i] = (uint32_t) (p - (u_char *) fm.addr);
 
         do {
             s.len = r->value->len;
@@ -1594,24 +1907,50 @@ ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx)
             gvvn = (ngx_http_geo_variable_value_node_t *)
                         ngx_str_rbtree_lookup(&ctx->rbtree, &s, hash);
 
-            range->value = (ngx_http_variable_value_t *) gvvn->offset;
+            range->value = (uint32_t) gvvn->offset;
             range->start = r->start;
             range->end = r->end;
             range++;
 
         } while ((++r)->value);
 
-        range->value = NULL;
+        range->value = 0;
+        range->start = 0;
+        range->end = 0;
+        range++;
 
-        p = (u_char *) range + sizeof(void *);
+        p = (u_char *) range;
     }
 
     header = fm.addr;
+    header->size = (uint32_t) fm.size;
+
+    if (ctx->include_default) {
+        s.len = ctx->include_default->len;
+        s.data = ctx->include_default->data;
+        hash = ngx_crc32_long(s.data, s.len);
+        gvvn = (ngx_http_geo_variable_value_node_t *)
+                    ngx_str_rbtree_lookup(&ctx->rbtree, &s, hash);
+
+        header->default_value = (uint32_t) gvvn->offset;
+    }
+
     header->crc32 = ngx_crc32_long((u_char *) fm.addr
                                        + sizeof(ngx_http_geo_header_t),
                                    fm.size - sizeof(ngx_http_geo_header_t));
 
     ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(fm.name, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      fm.name, name);
+
+        if (ngx_delete_file(fm.name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", fm.name);
+        }
+    }
 }
 
 
@@ -1619,7 +1958,7 @@ static u_char *
 ngx_http_geo_copy_values(u_char *base, u_char *p, ngx_rbtree_node_t *node,
     ngx_rbtree_node_t *sentinel)
 {
-    ngx_http_variable_value_t           *vv;
+    ngx_http_geo_binary_value_t         *bv;
     ngx_http_geo_variable_value_node_t  *gvvn;
 
     if (node == sentinel) {
@@ -1629,16 +1968,90 @@ ngx_http_geo_copy_values(u_char *base, u_char *p, ngx_rbtree_node_t *node,
     gvvn = (ngx_http_geo_variable_value_node_t *) node;
     gvvn->offset = p - base;
 
-    vv = (ngx_http_variable_value_t *) p;
-    *vv = *gvvn->value;
-    p += sizeof(ngx_http_variable_value_t);
-    vv->data = (u_char *) (p - base);
+    bv = (ngx_http_geo_binary_value_t *) p;
+    bv->len = (uint32_t) gvvn->sn.str.len;
 
-    p = ngx_cpymem(p, gvvn->sn.str.data, gvvn->sn.str.len);
+    p = ngx_cpymem(bv->data, gvvn->sn.str.data, gvvn->sn.str.len);
 
-    p = ngx_align_ptr(p, sizeof(void *));
+    p = ngx_align_ptr(p, sizeof(uint32_t));
 
     p = ngx_http_geo_copy_values(base, p, node->left, sentinel);
 
     return ngx_http_geo_copy_values(base, p, node->right, sentinel);
 }
+
+
+static ngx_int_t
+ngx_http_geo_dynamic_entry(ngx_shared_table_t *st, ngx_pool_t *pool,
+    ngx_str_t *key, ngx_uint_t *class)
+{
+    u_char      *p, *m;
+    ngx_int_t    rc;
+    ngx_uint_t   bits, n;
+    ngx_cidr_t   cidr;
+
+    rc = ngx_ptocidr(key, &cidr);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    /* NGX_DONE: the low address bits are not zero, they are masked */
+
+    switch (cidr.family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        m = cidr.u.in6.mask.s6_addr;
+
+        for (bits = 0, n = 0; n < 16; n++) {
+            for (rc = 0x80; m[n] & rc; rc >>= 1) {
+                bits++;
+            }
+        }
+
+        p = ngx_pnalloc(pool, 1 + 16);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p[0] = (u_char) (64 + bits);
+        ngx_memcpy(p + 1, cidr.u.in6.addr.s6_addr, 16);
+
+        key->len = 1 + 16;
+        break;
+#endif
+
+    default: /* AF_INET */
+        m = (u_char *) &cidr.u.in.mask;
+
+        for (bits = 0, n = 0; n < 4; n++) {
+            for (rc = 0x80; m[n] & rc; rc >>= 1) {
+                bits++;
+            }
+        }
+
+        p = ngx_pnalloc(pool, 1 + 4);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p[0] = (u_char) bits;
+        ngx_memcpy(p + 1, &cidr.u.in.addr, 4);
+
+        key->len = 1 + 4;
+        break;
+    }
+
+    key->data = p;
+    *class = p[0];
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_geo_init_process(ngx_cycle_t *cycle)
+{
+    return ngx_shared_table_init_process(cycle, &ngx_http_geo_module);
+}
@@ -9,8 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_LIBGEOIP)
 #include <GeoIP.h>
 #include <GeoIPCity.h>
+#endif
 
 
 #define NGX_GEOIP_COUNTRY_CODE   0
@@ -18,16 +20,123 @@
 #define NGX_GEOIP_COUNTRY_NAME   2
 
 
+#define NGX_GEOIP_CITY_CONTINENT_CODE   0
+#define NGX_GEOIP_CITY_COUNTRY_CODE     1
+#define NGX_GEOIP_CITY_COUNTRY_CODE3    2
+#define NGX_GEOIP_CITY_COUNTRY_NAME     3
+#define NGX_GEOIP_CITY_REGION           4
+#define NGX_GEOIP_CITY_CITY             5
+#define NGX_GEOIP_CITY_POSTAL_CODE      6
+#define NGX_GEOIP_CITY_LATITUDE         7
+#define NGX_GEOIP_CITY_LONGITUDE        8
+#define NGX_GEOIP_CITY_DMA_CODE         9
+#define NGX_GEOIP_CITY_AREA_CODE        10
+
+
+/* MaxMind DB data types */
+
+#define NGX_GEOIP_MMDB_POINTER          1
+#define NGX_GEOIP_MMDB_UTF8             2
+#define NGX_GEOIP_MMDB_DOUBLE           3
+#define NGX_GEOIP_MMDB_BYTES            4
+#define NGX_GEOIP_MMDB_UINT16           5
+#define NGX_GEOIP_MMDB_UINT32           6
+#define NGX_GEOIP_MMDB_MAP              7
+#define NGX_GEOIP_MMDB_INT32            8
+#define NGX_GEOIP_MMDB_UINT64           9
+#define NGX_GEOIP_MMDB_UINT128          10
+#define NGX_GEOIP_MMDB_ARRAY            11
+#define NGX_GEOIP_MMDB_BOOLEAN          14
+#define NGX_GEOIP_MMDB_FLOAT            15
+
+
+/* record fields decoded in a single pass over a MaxMind DB record */
+
+#define NGX_GEOIP_MMDB_CONTINENT_CODE   0
+#define NGX_GEOIP_MMDB_COUNTRY_CODE     1
+#define NGX_GEOIP_MMDB_COUNTRY_NAME     2
+#define NGX_GEOIP_MMDB_REGION           3
+#define NGX_GEOIP_MMDB_REGION_NAME      4
+#define NGX_GEOIP_MMDB_CITY             5
+#define NGX_GEOIP_MMDB_POSTAL_CODE      6
+#define NGX_GEOIP_MMDB_LATITUDE         7
+#define NGX_GEOIP_MMDB_LONGITUDE        8
+#define NGX_GEOIP_MMDB_METRO_CODE       9
+#define NGX_GEOIP_MMDB_ORGANIZATION     10
+#define NGX_GEOIP_MMDB_ASN              11
+#define NGX_GEOIP_MMDB_AS_ORGANIZATION  12
+#define NGX_GEOIP_MMDB_FIELDS           13
+
+#define NGX_GEOIP_MMDB_NONE             -1
+
+#define NGX_GEOIP_MMDB_PATH             4
+#define NGX_GEOIP_MMDB_MAX_DEPTH        32
+#define NGX_GEOIP_MMDB_METADATA_MAX     (128 * 1024)
+
+/* country, org, and city */
+#define NGX_GEOIP_MMDB_DATABASES        3
+
+
+typedef struct {
+    ngx_file_mapping_t      fm;
+
+    u_char                 *tree;
+    u_char                 *data;
+    u_char                 *end;
+
+    ngx_uint_t              node_count;
+    ngx_uint_t              record_size;
+    ngx_uint_t              ip_version;
+
+    /* the node where the ::/96 subtree of IPv4 addresses starts */
+    ngx_uint_t              ipv4_start;
+} ngx_http_geoip_mmdb_t;
+
+
+typedef struct {
+    ngx_uint_t              type;
+    size_t                  size;
+    u_char                 *data;
+    unsigned                indirect:1;
+} ngx_http_geoip_mmdb_item_t;
+
+
+typedef struct {
+    ngx_str_t               path[NGX_GEOIP_MMDB_PATH];
+} ngx_http_geoip_mmdb_path_t;
+
+
+typedef struct {
+    ngx_http_geoip_mmdb_t       *db;
+    ngx_http_geoip_mmdb_item_t   value[NGX_GEOIP_MMDB_FIELDS];
+    unsigned                     found:1;
+} ngx_http_geoip_mmdb_record_t;
+
+
+typedef struct {
+#if (NGX_HAVE_LIBGEOIP)
+    GeoIPRecord                  *city;
+    unsigned                      city_done:1;
+#endif
+    ngx_http_geoip_mmdb_record_t  records[NGX_GEOIP_MMDB_DATABASES];
+} ngx_http_geoip_ctx_t;
+
+
 typedef struct {
-    GeoIP        *country;
-    GeoIP        *org;
-    GeoIP        *city;
-    ngx_array_t  *proxies;    /* array of ngx_cidr_t */
-    ngx_flag_t    proxy_recursive;
+#if (NGX_HAVE_LIBGEOIP)
+    GeoIP                  *country;
+    GeoIP                  *org;
+    GeoIP                  *city;
+#endif
+    ngx_http_geoip_mmdb_t  *country_mmdb;
+    ngx_http_geoip_mmdb_t  *org_mmdb;
+    ngx_http_geoip_mmdb_t  *city_mmdb;
+    ngx_array_t            *proxies;    /* array of ngx_cidr_t */
+    ngx_flag_t              proxy_recursive;
 #if (NGX_HAVE_GEOIP_V6)
-    unsigned      country_v6:1;
-    unsigned      org_v6:1;
-    unsigned      city_v6:1;
+    unsigned                country_v6:1;
+    unsigned                org_v6:1;
+    unsigned                city_v6:1;
 #endif
 } ngx_http_geoip_conf_t;
 
@@ -38,6 +147,8 @@ typedef struct {
 } ngx_http_geoip_var_t;
 
 
+#if (NGX_HAVE_LIBGEOIP)
+
 typedef const char *(*ngx_http_geoip_variable_handler_pt)(GeoIP *,
     u_long addr);
 
@@ -64,6 +175,68 @@ ngx_http_geoip_variable_handler_v6_pt ngx_http_geoip_country_v6_functions[] = {
 #endif
 
 
+static size_t  ngx_http_geoip_city_offsets[] = {
+    offsetof(GeoIPRecord, continent_code),
+    offsetof(GeoIPRecord, country_code),
+    offsetof(GeoIPRecord, country_code3),
+    offsetof(GeoIPRecord, country_name),
+    offsetof(GeoIPRecord, region),
+    offsetof(GeoIPRecord, city),
+    offsetof(GeoIPRecord, postal_code),
+    offsetof(GeoIPRecord, latitude),
+    offsetof(GeoIPRecord, longitude),
+    offsetof(GeoIPRecord, dma_code),
+    offsetof(GeoIPRecord, area_code)
+};
+
+#endif
+
+
+static ngx_http_geoip_mmdb_path_t  ngx_http_geoip_mmdb_paths[] = {
+    { { ngx_string("continent"), ngx_string("code") } },
+    { { ngx_string("country"), ngx_string("iso_code") } },
+    { { ngx_string("country"), ngx_string("names"), ngx_string("en") } },
+    { { ngx_string("subdivisions"), ngx_string("0"), ngx_string("iso_code") } },
+    { { ngx_string("subdivisions"), ngx_string("0"), ngx_string("names"),
+        ngx_string("en") } },
+    { { ngx_string("city"), ngx_string("names"), ngx_string("en") } },
+    { { ngx_string("postal"), ngx_string("code") } },
+    { { ngx_string("location"), ngx_string("latitude") } },
+    { { ngx_string("location"), ngx_string("longitude") } },
+    { { ngx_string("location"), ngx_string("metro_code") } },
+    { { ngx_string("organization") } },
+    { { ngx_string("autonomous_system_number") } },
+    { { ngx_string("autonomous_system_organization") } }
+};
+
+
+/*
+ * MaxMind databases have no three-letter country codes and no
+ * telephone area codes, these variables are never found there
+ */
+
+static ngx_int_t  ngx_http_geoip_country_mmdb_fields[] = {
+    NGX_GEOIP_MMDB_COUNTRY_CODE,
+    NGX_GEOIP_MMDB_NONE,
+    NGX_GEOIP_MMDB_COUNTRY_NAME
+};
+
+
+static ngx_int_t  ngx_http_geoip_city_mmdb_fields[] = {
+    NGX_GEOIP_MMDB_CONTINENT_CODE,
+    NGX_GEOIP_MMDB_COUNTRY_CODE,
+    NGX_GEOIP_MMDB_NONE,
+    NGX_GEOIP_MMDB_COUNTRY_NAME,
+    NGX_GEOIP_MMDB_REGION,
+    NGX_GEOIP_MMDB_CITY,
+    NGX_GEOIP_MMDB_POSTAL_CODE,
+    NGX_GEOIP_MMDB_LATITUDE,
+    NGX_GEOIP_MMDB_LONGITUDE,
+    NGX_GEOIP_MMDB_METRO_CODE,
+    NGX_GEOIP_MMDB_NONE
+};
+
+
 static ngx_int_t ngx_http_geoip_country_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_geoip_org_variable(ngx_http_request_t *r,
@@ -76,7 +249,31 @@ static ngx_int_t ngx_http_geoip_city_float_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_geoip_city_int_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_geoip_ctx_t *ngx_http_geoip_get_ctx(ngx_http_request_t *r);
+#if (NGX_HAVE_LIBGEOIP)
 static GeoIPRecord *ngx_http_geoip_get_city_record(ngx_http_request_t *r);
+static void ngx_http_geoip_city_record_cleanup(void *data);
+#endif
+
+static ngx_int_t ngx_http_geoip_mmdb_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, ngx_http_geoip_mmdb_t *db, ngx_int_t field);
+static ngx_int_t ngx_http_geoip_mmdb_value(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, ngx_http_geoip_mmdb_item_t *item);
+static ngx_http_geoip_mmdb_record_t *ngx_http_geoip_mmdb_record(
+    ngx_http_request_t *r, ngx_http_geoip_mmdb_t *db);
+static ngx_int_t ngx_http_geoip_mmdb_lookup(ngx_http_geoip_mmdb_t *db,
+    u_char *addr, ngx_uint_t bits, ngx_uint_t node, u_char **data);
+static ngx_uint_t ngx_http_geoip_mmdb_node(ngx_http_geoip_mmdb_t *db,
+    ngx_uint_t node, ngx_uint_t bit);
+static u_char *ngx_http_geoip_mmdb_extract(ngx_http_geoip_mmdb_t *db,
+    u_char *p, ngx_uint_t mask, ngx_uint_t depth,
+    ngx_http_geoip_mmdb_record_t *rec);
+static u_char *ngx_http_geoip_mmdb_decode(u_char *start, u_char *end,
+    u_char *p, ngx_http_geoip_mmdb_item_t *item);
+static u_char *ngx_http_geoip_mmdb_skip(u_char *start, u_char *end, u_char *p,
+    ngx_uint_t depth);
+static uint64_t ngx_http_geoip_mmdb_uint(ngx_http_geoip_mmdb_item_t *item);
+static double ngx_http_geoip_mmdb_double(ngx_http_geoip_mmdb_item_t *item);
 
 static ngx_int_t ngx_http_geoip_add_variables(ngx_conf_t *cf);
 static void *ngx_http_geoip_create_conf(ngx_conf_t *cf);
@@ -91,7 +288,14 @@ static char *ngx_http_geoip_proxy(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_geoip_cidr_value(ngx_conf_t *cf, ngx_str_t *net,
     ngx_cidr_t *cidr);
+static char *ngx_http_geoip_mmdb(ngx_conf_t *cf, ngx_http_geoip_conf_t *gcf,
+    ngx_http_geoip_mmdb_t **mmdb);
+static char *ngx_http_geoip_mmdb_init(ngx_http_geoip_mmdb_t *db);
+static void ngx_http_geoip_mmdb_cleanup(void *data);
+#if (NGX_HAVE_LIBGEOIP)
+static ngx_int_t ngx_http_geoip_is_mmdb(ngx_str_t *name);
 static void ngx_http_geoip_cleanup(void *data);
+#endif
 
 
 static ngx_command_t  ngx_http_geoip_commands[] = {
@@ -186,23 +390,23 @@ static ngx_http_variable_t  ngx_http_geoip_vars[] = {
 
     { ngx_string("geoip_city_continent_code"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, continent_code), 0, 0 },
+      NGX_GEOIP_CITY_CONTINENT_CODE, 0, 0 },
 
     { ngx_string("geoip_city_country_code"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, country_code), 0, 0 },
+      NGX_GEOIP_CITY_COUNTRY_CODE, 0, 0 },
 
     { ngx_string("geoip_city_country_code3"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, country_code3), 0, 0 },
+      NGX_GEOIP_CITY_COUNTRY_CODE3, 0, 0 },
 
     { ngx_string("geoip_city_country_name"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, country_name), 0, 0 },
+      NGX_GEOIP_CITY_COUNTRY_NAME, 0, 0 },
 
     { ngx_string("geoip_region"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, region), 0, 0 },
+      NGX_GEOIP_CITY_REGION, 0, 0 },
 
     { ngx_string("geoip_region_name"), NULL,
       ngx_http_geoip_region_name_variable,
@@ -210,49 +414,60 @@ static ngx_http_variable_t  ngx_http_geoip_vars[] = {
 
     { ngx_string("geoip_city"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, city), 0, 0 },
+      NGX_GEOIP_CITY_CITY, 0, 0 },
 
     { ngx_string("geoip_postal_code"), NULL,
       ngx_http_geoip_city_variable,
-      offsetof(GeoIPRecord, postal_code), 0, 0 },
+      NGX_GEOIP_CITY_POSTAL_CODE, 0, 0 },
 
     { ngx_string("geoip_latitude"), NULL,
       ngx_http_geoip_city_float_variable,
-      offsetof(GeoIPRecord, latitude), 0, 0 },
+      NGX_GEOIP_CITY_LATITUDE, 0, 0 },
 
     { ngx_string("geoip_longitude"), NULL,
       ngx_http_geoip_city_float_variable,
-      offsetof(GeoIPRecord, longitude), 0, 0 },
+      NGX_GEOIP_CITY_LONGITUDE, 0, 0 },
 
     { ngx_string("geoip_dma_code"), NULL,
       ngx_http_geoip_city_int_variable,
-      offsetof(GeoIPRecord, dma_code), 0, 0 },
+      NGX_GEOIP_CITY_DMA_CODE, 0, 0 },
 
     { ngx_string("geoip_area_code"), NULL,
       ngx_http_geoip_city_int_variable,
-      offsetof(GeoIPRecord, area_code), 0, 0 },
+      NGX_GEOIP_CITY_AREA_CODE, 0, 0 },
 
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
 
-static u_long
-ngx_http_geoip_addr(ngx_http_request_t *r, ngx_http_geoip_conf_t *gcf)
+static void
+ngx_http_geoip_real_addr(ngx_http_request_t *r, ngx_http_geoip_conf_t *gcf,
+    ngx_addr_t *addr)
 {
-    ngx_addr_t           addr;
-    ngx_array_t         *xfwd;
-    struct sockaddr_in  *sin;
+    ngx_array_t  *xfwd;
 
-    addr.sockaddr = r->connection->sockaddr;
-    addr.socklen = r->connection->socklen;
-    /* addr.name = r->connection->addr_text; */
+    addr->sockaddr = r->connection->sockaddr;
+    addr->socklen = r->connection->socklen;
+    /* addr->name = r->connection->addr_text; */
 
     xfwd = &r->headers_in.x_forwarded_for;
 
     if (xfwd->nelts > 0 && gcf->proxies != NULL) {
-        (void) ngx_http_get_forwarded_addr(r, &addr, xfwd, NULL,
+        (void) ngx_http_get_forwarded_addr(r, addr, xfwd, NULL,
                                            gcf->proxies, gcf->proxy_recursive);
     }
+}
+
+
+#if (NGX_HAVE_LIBGEOIP)
+
+static u_long
+ngx_http_geoip_addr(ngx_http_request_t *r, ngx_http_geoip_conf_t *gcf)
+{
+    ngx_addr_t           addr;
+    struct sockaddr_in  *sin;
+
+    ngx_http_geoip_real_addr(r, gcf, &addr);
 
 #if (NGX_HAVE_INET6)
 
@@ -292,22 +507,12 @@ static geoipv6_t
 ngx_http_geoip_addr_v6(ngx_http_request_t *r, ngx_http_geoip_conf_t *gcf)
 {
     ngx_addr_t            addr;
-    ngx_array_t          *xfwd;
     in_addr_t             addr4;
     struct in6_addr       addr6;
     struct sockaddr_in   *sin;
     struct sockaddr_in6  *sin6;
 
-    addr.sockaddr = r->connection->sockaddr;
-    addr.socklen = r->connection->socklen;
-    /* addr.name = r->connection->addr_text; */
-
-    xfwd = &r->headers_in.x_forwarded_for;
-
-    if (xfwd->nelts > 0 && gcf->proxies != NULL) {
-        (void) ngx_http_get_forwarded_addr(r, &addr, xfwd, NULL,
-                                           gcf->proxies, gcf->proxy_recursive);
-    }
+    ngx_http_geoip_real_addr(r, gcf, &addr);
 
     switch (addr.sockaddr->sa_family) {
 
@@ -336,11 +541,14 @@ ngx_http_geoip_addr_v6(ngx_http_request_t *r, ngx_http_geoip_conf_t *gcf)
 
 #endif
 
+#endif
+
 
 static ngx_int_t
 ngx_http_geoip_country_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
+#if (NGX_HAVE_LIBGEOIP)
     ngx_http_geoip_variable_handler_pt     handler =
         ngx_http_geoip_country_functions[data];
 #if (NGX_HAVE_GEOIP_V6)
@@ -349,10 +557,18 @@ ngx_http_geoip_country_variable(ngx_http_request_t *r,
 #endif
 
     const char             *val;
+#endif
     ngx_http_geoip_conf_t  *gcf;
 
     gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
 
+    if (gcf->country_mmdb) {
+        return ngx_http_geoip_mmdb_variable(r, v, gcf->country_mmdb,
+                                     ngx_http_geoip_country_mmdb_fields[data]);
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
+
     if (gcf->country == NULL) {
         goto not_found;
     }
@@ -379,6 +595,8 @@ ngx_http_geoip_country_variable(ngx_http_request_t *r,
 
 not_found:
 
+#endif
+
     v->not_found = 1;
 
     return NGX_OK;
@@ -389,12 +607,67 @@ static ngx_int_t
 ngx_http_geoip_org_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    size_t                  len;
-    char                   *val;
-    ngx_http_geoip_conf_t  *gcf;
+    size_t                         len;
+#if (NGX_HAVE_LIBGEOIP)
+    char                          *val;
+#endif
+    ngx_http_geoip_conf_t         *gcf;
+    ngx_http_geoip_mmdb_item_t    *asn, *name;
+    ngx_http_geoip_mmdb_record_t  *rec;
 
     gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
 
+    if (gcf->org_mmdb) {
+        rec = ngx_http_geoip_mmdb_record(r, gcf->org_mmdb);
+        if (rec == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (!rec->found) {
+            goto not_found;
+        }
+
+        name = &rec->value[NGX_GEOIP_MMDB_ORGANIZATION];
+
+        if (name->type == NGX_GEOIP_MMDB_UTF8) {
+            return ngx_http_geoip_mmdb_value(r, v, name);
+        }
+
+        /* ASN databases, formatted as "AS15169 Google Inc." */
+
+        name = &rec->value[NGX_GEOIP_MMDB_AS_ORGANIZATION];
+        asn = &rec->value[NGX_GEOIP_MMDB_ASN];
+
+        if (name->type != NGX_GEOIP_MMDB_UTF8) {
+            goto not_found;
+        }
+
+        if (asn->type != NGX_GEOIP_MMDB_UINT32
+            && asn->type != NGX_GEOIP_MMDB_UINT16)
+        {
+            return ngx_http_geoip_mmdb_value(r, v, name);
+        }
+
+        len = sizeof("AS ") - 1 + NGX_INT64_LEN + name->size;
+
+        v->data = ngx_pnalloc(r->pool, len);
+        if (v->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        v->len = ngx_sprintf(v->data, "AS%uL %*s",
+                             ngx_http_geoip_mmdb_uint(asn),
+                             name->size, name->data)
+                 - v->data;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+
+        return NGX_OK;
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
+
     if (gcf->org == NULL) {
         goto not_found;
     }
@@ -431,6 +704,8 @@ ngx_http_geoip_org_variable(ngx_http_request_t *r,
 
     return NGX_OK;
 
+#endif
+
 not_found:
 
     v->not_found = 1;
@@ -443,44 +718,45 @@ static ngx_int_t
 ngx_http_geoip_city_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    char         *val;
-    size_t        len;
-    GeoIPRecord  *gr;
+#if (NGX_HAVE_LIBGEOIP)
+    char                   *val;
+    GeoIPRecord            *gr;
+#endif
+    ngx_http_geoip_conf_t  *gcf;
+
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    if (gcf->city_mmdb) {
+        return ngx_http_geoip_mmdb_variable(r, v, gcf->city_mmdb,
+                                        ngx_http_geoip_city_mmdb_fields[data]);
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     gr = ngx_http_geoip_get_city_record(r);
     if (gr == NULL) {
         goto not_found;
     }
 
-    val = *(char **) ((char *) gr + data);
+    val = *(char **) ((char *) gr + ngx_http_geoip_city_offsets[data]);
     if (val == NULL) {
-        goto no_value;
-    }
-
-    len = ngx_strlen(val);
-    v->data = ngx_pnalloc(r->pool, len);
-    if (v->data == NULL) {
-        GeoIPRecord_delete(gr);
-        return NGX_ERROR;
+        goto not_found;
     }
 
-    ngx_memcpy(v->data, val, len);
+    /* the record is kept until the request pool is destroyed */
 
-    v->len = len;
+    v->len = ngx_strlen(val);
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
-
-    GeoIPRecord_delete(gr);
+    v->data = (u_char *) val;
 
     return NGX_OK;
 
-no_value:
-
-    GeoIPRecord_delete(gr);
-
 not_found:
 
+#endif
+
     v->not_found = 1;
 
     return NGX_OK;
@@ -491,9 +767,21 @@ static ngx_int_t
 ngx_http_geoip_region_name_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    size_t        len;
-    const char   *val;
-    GeoIPRecord  *gr;
+#if (NGX_HAVE_LIBGEOIP)
+    size_t                  len;
+    const char             *val;
+    GeoIPRecord            *gr;
+#endif
+    ngx_http_geoip_conf_t  *gcf;
+
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    if (gcf->city_mmdb) {
+        return ngx_http_geoip_mmdb_variable(r, v, gcf->city_mmdb,
+                                            NGX_GEOIP_MMDB_REGION_NAME);
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     gr = ngx_http_geoip_get_city_record(r);
     if (gr == NULL) {
@@ -502,8 +790,6 @@ ngx_http_geoip_region_name_variable(ngx_http_request_t *r,
 
     val = GeoIP_region_name_by_code(gr->country_code, gr->region);
 
-    GeoIPRecord_delete(gr);
-
     if (val == NULL) {
         goto not_found;
     }
@@ -525,6 +811,8 @@ ngx_http_geoip_region_name_variable(ngx_http_request_t *r,
 
 not_found:
 
+#endif
+
     v->not_found = 1;
 
     return NGX_OK;
@@ -535,8 +823,20 @@ static ngx_int_t
 ngx_http_geoip_city_float_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    float         val;
-    GeoIPRecord  *gr;
+#if (NGX_HAVE_LIBGEOIP)
+    float                   val;
+    GeoIPRecord            *gr;
+#endif
+    ngx_http_geoip_conf_t  *gcf;
+
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    if (gcf->city_mmdb) {
+        return ngx_http_geoip_mmdb_variable(r, v, gcf->city_mmdb,
+                                        ngx_http_geoip_city_mmdb_fields[data]);
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     gr = ngx_http_geoip_get_city_record(r);
     if (gr == NULL) {
@@ -546,17 +846,25 @@ ngx_http_geoip_city_float_variable(ngx_http_request_t *r,
 
     v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN + 5);
     if (v->data == NULL) {
-        GeoIPRecord_delete(gr);
         return NGX_ERROR;
     }
 
-    val = *(float *) ((char *) gr + data);
+    val = *(float *) ((char *) gr + ngx_http_geoip_city_offsets[data]);
 
     v->len = ngx_sprintf(v->data, "%.4f", val) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
 
-    GeoIPRecord_delete(gr);
+    return NGX_OK;
+
+#else
+
+    v->not_found = 1;
 
     return NGX_OK;
+
+#endif
 }
 
 
@@ -564,8 +872,20 @@ static ngx_int_t
 ngx_http_geoip_city_int_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    int           val;
-    GeoIPRecord  *gr;
+#if (NGX_HAVE_LIBGEOIP)
+    int                     val;
+    GeoIPRecord            *gr;
+#endif
+    ngx_http_geoip_conf_t  *gcf;
+
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    if (gcf->city_mmdb) {
+        return ngx_http_geoip_mmdb_variable(r, v, gcf->city_mmdb,
+                                        ngx_http_geoip_city_mmdb_fields[data]);
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     gr = ngx_http_geoip_get_city_record(r);
     if (gr == NULL) {
@@ -575,121 +895,815 @@ ngx_http_geoip_city_int_variable(ngx_http_request_t *r,
 
     v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN);
     if (v->data == NULL) {
-        GeoIPRecord_delete(gr);
         return NGX_ERROR;
     }
 
-    val = *(int *) ((char *) gr + data);
+    val = *(int *) ((char *) gr + ngx_http_geoip_city_offsets[data]);
 
     v->len = ngx_sprintf(v->data, "%d", val) - v->data;
-
-    GeoIPRecord_delete(gr);
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
 
     return NGX_OK;
-}
 
+#else
 
-static GeoIPRecord *
-ngx_http_geoip_get_city_record(ngx_http_request_t *r)
-{
-    ngx_http_geoip_conf_t  *gcf;
+    v->not_found = 1;
 
-    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+    return NGX_OK;
 
-    if (gcf->city) {
-#if (NGX_HAVE_GEOIP_V6)
-        return gcf->city_v6
-                   ? GeoIP_record_by_ipnum_v6(gcf->city,
-                                              ngx_http_geoip_addr_v6(r, gcf))
-                   : GeoIP_record_by_ipnum(gcf->city,
-                                           ngx_http_geoip_addr(r, gcf));
-#else
-        return GeoIP_record_by_ipnum(gcf->city, ngx_http_geoip_addr(r, gcf));
 #endif
-    }
-
-    return NULL;
 }
 
 
-static ngx_int_t
-ngx_http_geoip_add_variables(ngx_conf_t *cf)
+static ngx_http_geoip_ctx_t *
+ngx_http_geoip_get_ctx(ngx_http_request_t *r)
 {
-    ngx_http_variable_t  *var, *v;
+    ngx_http_geoip_ctx_t  *ctx;
 
-    for (v = ngx_http_geoip_vars; v->name.len; v++) {
-        var = ngx_http_add_variable(cf, &v->name, v->flags);
-        if (var == NULL) {
-            return NGX_ERROR;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_geoip_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_geoip_ctx_t));
+        if (ctx == NULL) {
+            return NULL;
         }
 
-        var->get_handler = v->get_handler;
-        var->data = v->data;
+        ngx_http_set_ctx(r, ctx, ngx_http_geoip_module);
     }
 
-    return NGX_OK;
+    return ctx;
 }
 
 
-static void *
-ngx_http_geoip_create_conf(ngx_conf_t *cf)
+#if (NGX_HAVE_LIBGEOIP)
+
+/*
+ * all city variables of a request share one record, it is looked up
+ * on the first use and deleted along with the request pool
+ */
+
+static GeoIPRecord *
+ngx_http_geoip_get_city_record(ngx_http_request_t *r)
 {
+    GeoIPRecord            *gr;
     ngx_pool_cleanup_t     *cln;
-    ngx_http_geoip_conf_t  *conf;
+    ngx_http_geoip_ctx_t   *ctx;
+    ngx_http_geoip_conf_t  *gcf;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_geoip_conf_t));
-    if (conf == NULL) {
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    if (gcf->city == NULL) {
         return NULL;
     }
 
-    conf->proxy_recursive = NGX_CONF_UNSET;
-
-    cln = ngx_pool_cleanup_add(cf->pool, 0);
-    if (cln == NULL) {
+    ctx = ngx_http_geoip_get_ctx(r);
+    if (ctx == NULL) {
         return NULL;
     }
 
-    cln->handler = ngx_http_geoip_cleanup;
-    cln->data = conf;
+    if (ctx->city_done) {
+        return ctx->city;
+    }
 
-    return conf;
-}
+#if (NGX_HAVE_GEOIP_V6)
+    gr = gcf->city_v6
+             ? GeoIP_record_by_ipnum_v6(gcf->city,
+                                        ngx_http_geoip_addr_v6(r, gcf))
+             : GeoIP_record_by_ipnum(gcf->city,
+                                     ngx_http_geoip_addr(r, gcf));
+#else
+    gr = GeoIP_record_by_ipnum(gcf->city, ngx_http_geoip_addr(r, gcf));
+#endif
 
+    if (gr) {
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            GeoIPRecord_delete(gr);
+            return NULL;
+        }
 
-static char *
-ngx_http_geoip_init_conf(ngx_conf_t *cf, void *conf)
-{
-    ngx_http_geoip_conf_t  *gcf = conf;
+        cln->handler = ngx_http_geoip_city_record_cleanup;
+        cln->data = gr;
+    }
 
-    ngx_conf_init_value(gcf->proxy_recursive, 0);
+    ctx->city = gr;
+    ctx->city_done = 1;
 
-    return NGX_CONF_OK;
+    return gr;
 }
 
 
-static char *
-ngx_http_geoip_country(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_http_geoip_city_record_cleanup(void *data)
 {
-    ngx_http_geoip_conf_t  *gcf = conf;
+    GeoIPRecord  *gr = data;
 
-    ngx_str_t  *value;
+    GeoIPRecord_delete(gr);
+}
 
-    if (gcf->country) {
-        return "is duplicate";
-    }
+#endif
 
-    value = cf->args->elts;
 
-    gcf->country = GeoIP_open((char *) value[1].data, GEOIP_MEMORY_CACHE);
+static ngx_int_t
+ngx_http_geoip_mmdb_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, ngx_http_geoip_mmdb_t *db, ngx_int_t field)
+{
+    ngx_http_geoip_mmdb_record_t  *rec;
 
-    if (gcf->country == NULL) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "GeoIP_open(\"%V\") failed", &value[1]);
+    if (field == NGX_GEOIP_MMDB_NONE) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
 
-        return NGX_CONF_ERROR;
+    rec = ngx_http_geoip_mmdb_record(r, db);
+    if (rec == NULL) {
+        return NGX_ERROR;
     }
 
-    if (cf->args->nelts == 3) {
+    if (!rec->found) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    return ngx_http_geoip_mmdb_value(r, v, &rec->value[field]);
+}
+
+
+static ngx_int_t
+ngx_http_geoip_mmdb_value(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, ngx_http_geoip_mmdb_item_t *item)
+{
+    double  d;
+
+    switch (item->type) {
+
+    case NGX_GEOIP_MMDB_UTF8:
+    case NGX_GEOIP_MMDB_BYTES:
+
+        /* strings are used directly from the mapped database */
+
+        v->len = item->size;
+        v->data = item->data;
+        break;
+
+    case NGX_GEOIP_MMDB_DOUBLE:
+    case NGX_GEOIP_MMDB_FLOAT:
+
+        d = ngx_http_geoip_mmdb_double(item);
+
+        /*
+         * "%f" prints the integer part as a 64-bit number, so NaN,
+         * infinities and too large values of a broken database are
+         * not found
+         */
+
+        if (!(d >= -1e15 && d <= 1e15)) {
+            v->not_found = 1;
+            return NGX_OK;
+        }
+
+        v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN + 5);
+        if (v->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        v->len = ngx_snprintf(v->data, NGX_INT64_LEN + 5, "%.4f", d)
+                 - v->data;
+        break;
+
+    case NGX_GEOIP_MMDB_UINT16:
+    case NGX_GEOIP_MMDB_UINT32:
+    case NGX_GEOIP_MMDB_UINT64:
+    case NGX_GEOIP_MMDB_INT32:
+    case NGX_GEOIP_MMDB_BOOLEAN:
+
+        v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN);
+        if (v->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (item->type == NGX_GEOIP_MMDB_INT32) {
+            v->len = ngx_sprintf(v->data, "%D",
+                                 (int32_t) ngx_http_geoip_mmdb_uint(item))
+                     - v->data;
+
+        } else {
+            v->len = ngx_sprintf(v->data, "%uL", ngx_http_geoip_mmdb_uint(item))
+                     - v->data;
+        }
+
+        break;
+
+    default:
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the search tree is walked once per request and database, and all
+ * fields the module knows of are extracted from the record in the same
+ * pass, so any number of variables costs a single lookup
+ */
+
+static ngx_http_geoip_mmdb_record_t *
+ngx_http_geoip_mmdb_record(ngx_http_request_t *r, ngx_http_geoip_mmdb_t *db)
+{
+    u_char                        *p, *data;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, bits, node;
+    ngx_addr_t                     addr;
+    struct sockaddr_in            *sin;
+    ngx_http_geoip_ctx_t          *ctx;
+    ngx_http_geoip_conf_t         *gcf;
+    ngx_http_geoip_mmdb_record_t  *rec;
+#if (NGX_HAVE_INET6)
+    struct in6_addr               *inaddr6;
+#endif
+
+    ctx = ngx_http_geoip_get_ctx(r);
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < NGX_GEOIP_MMDB_DATABASES - 1; i++) {
+        if (ctx->records[i].db == db || ctx->records[i].db == NULL) {
+            break;
+        }
+    }
+
+    rec = &ctx->records[i];
+
+    if (rec->db == db) {
+        return rec;
+    }
+
+    rec->db = db;
+
+    gcf = ngx_http_get_module_main_conf(r, ngx_http_geoip_module);
+
+    ngx_http_geoip_real_addr(r, gcf, &addr);
+
+    switch (addr.sockaddr->sa_family) {
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) addr.sockaddr;
+        p = (u_char *) &sin->sin_addr.s_addr;
+        bits = 32;
+        node = db->ipv4_start;
+        break;
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) addr.sockaddr)->sin6_addr;
+        p = inaddr6->s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+            p += 12;
+            bits = 32;
+            node = db->ipv4_start;
+            break;
+        }
+
+        if (db->ip_version == 4) {
+            return rec;
+        }
+
+        bits = 128;
+        node = 0;
+        break;
+#endif
+
+    default:
+        return rec;
+    }
+
+    rc = ngx_http_geoip_mmdb_lookup(db, p, bits, node, &data);
+
+    if (rc == NGX_DECLINED) {
+        return rec;
+    }
+
+    if (rc == NGX_OK) {
+        p = ngx_http_geoip_mmdb_extract(db, data,
+                                        (1 << NGX_GEOIP_MMDB_FIELDS) - 1, 0,
+                                        rec);
+        if (p) {
+            rec->found = 1;
+            return rec;
+        }
+
+        ngx_memzero(rec->value, sizeof(rec->value));
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "invalid data in MaxMind database \"%s\"", db->fm.name);
+
+    return rec;
+}
+
+
+static ngx_int_t
+ngx_http_geoip_mmdb_lookup(ngx_http_geoip_mmdb_t *db, u_char *addr,
+    ngx_uint_t bits, ngx_uint_t node, u_char **data)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < bits && node < db->node_count; i++) {
+        node = ngx_http_geoip_mmdb_node(db, node,
+                                        (addr[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+
+    if (node <= db->node_count) {
+        return NGX_DECLINED;
+    }
+
+    /* data section offsets are counted from the end of the search tree */
+
+    node -= db->node_count + 16;
+
+    if (node >= (ngx_uint_t) (db->end - db->data)) {
+        return NGX_ERROR;
+    }
+
+    *data = db->data + node;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_geoip_mmdb_node(ngx_http_geoip_mmdb_t *db, ngx_uint_t node,
+    ngx_uint_t bit)
+{
+    u_char  *p;
+
+    p = db->tree + node * (db->record_size / 4);
+
+    switch (db->record_size) {
+
+    case 24:
+        p += bit * 3;
+        return ((ngx_uint_t) p[0] << 16) | (p[1] << 8) | p[2];
+
+    case 28:
+        if (bit) {
+            return ((ngx_uint_t) (p[3] & 0x0f) << 24)
+                   | (p[4] << 16) | (p[5] << 8) | p[6];
+        }
+
+        return ((ngx_uint_t) (p[3] & 0xf0) << 20)
+               | (p[0] << 16) | (p[1] << 8) | p[2];
+
+    default: /* 32 */
+        p += bit * 4;
+        return ((ngx_uint_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+}
+
+
+/*
+ * "mask" holds the fields whose paths match the keys passed so far,
+ * a scalar value is stored to the fields whose paths end at "depth"
+ */
+
+static u_char *
+ngx_http_geoip_mmdb_extract(ngx_http_geoip_mmdb_t *db, u_char *p,
+    ngx_uint_t mask, ngx_uint_t depth, ngx_http_geoip_mmdb_record_t *rec)
+{
+    u_char                      *q;
+    ngx_int_t                    n;
+    ngx_str_t                   *path;
+    ngx_uint_t                   i, f, m, submask;
+    ngx_http_geoip_mmdb_item_t   item, key;
+
+    p = ngx_http_geoip_mmdb_decode(db->data, db->end, p, &item);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    if (item.type != NGX_GEOIP_MMDB_MAP && item.type != NGX_GEOIP_MMDB_ARRAY) {
+
+        for (f = 0, m = mask; m; f++, m >>= 1) {
+            if ((m & 1)
+                && (depth == NGX_GEOIP_MMDB_PATH
+                    || ngx_http_geoip_mmdb_paths[f].path[depth].len == 0))
+            {
+                rec->value[f] = item;
+            }
+        }
+
+        return p;
+    }
+
+    if (depth == NGX_GEOIP_MMDB_MAX_DEPTH) {
+        return NULL;
+    }
+
+    q = item.data;
+
+    for (i = 0; i < item.size; i++) {
+
+        submask = 0;
+
+        if (item.type == NGX_GEOIP_MMDB_MAP) {
+            q = ngx_http_geoip_mmdb_decode(db->data, db->end, q, &key);
+            if (q == NULL || key.type != NGX_GEOIP_MMDB_UTF8) {
+                return NULL;
+            }
+        }
+
+        for (f = 0, m = (depth < NGX_GEOIP_MMDB_PATH) ? mask : 0;
+             m;
+             f++, m >>= 1)
+        {
+            if (!(m & 1)) {
+                continue;
+            }
+
+            path = &ngx_http_geoip_mmdb_paths[f].path[depth];
+
+            if (path->len == 0) {
+                continue;
+            }
+
+            if (item.type == NGX_GEOIP_MMDB_MAP) {
+                if (path->len == key.size
+                    && path->data[0] == key.data[0]
+                    && ngx_strncmp(path->data, key.data, key.size) == 0)
+                {
+                    submask |= 1 << f;
+                }
+
+                continue;
+            }
+
+            n = ngx_atoi(path->data, path->len);
+
+            if (n >= 0 && (ngx_uint_t) n == i) {
+                submask |= 1 << f;
+            }
+        }
+
+        if (submask) {
+            q = ngx_http_geoip_mmdb_extract(db, q, submask, depth + 1, rec);
+
+        } else {
+            q = ngx_http_geoip_mmdb_skip(db->data, db->end, q, depth + 1);
+        }
+
+        if (q == NULL) {
+            return NULL;
+        }
+    }
+
+    return item.indirect ? p : q;
+}
+
+
+/*
+ * decodes the control bytes of a data field at "p", following a pointer;
+ * returns the position after the field, or after its control bytes for
+ * a map or an array stored in place, where their elements follow
+ */
+
+static u_char *
+ngx_http_geoip_mmdb_decode(u_char *start, u_char *end, u_char *p,
+    ngx_http_geoip_mmdb_item_t *item)
+{
+    size_t      len, off;
+    ngx_uint_t  ctrl, type, size;
+
+    if (p >= end) {
+        return NULL;
+    }
+
+    ctrl = *p++;
+    type = ctrl >> 5;
+
+    if (type == NGX_GEOIP_MMDB_POINTER) {
+        size = (ctrl >> 3) & 3;
+
+        if ((size_t) (end - p) < size + 1) {
+            return NULL;
+        }
+
+        switch (size) {
+
+        case 0:
+            off = ((ctrl & 7) << 8) | p[0];
+            break;
+
+        case 1:
+            off = (((ctrl & 7) << 16) | (p[0] << 8) | p[1]) + 2048;
+            break;
+
+        case 2:
+            off = (((size_t) (ctrl & 7) << 24) | (p[0] << 16) | (p[1] << 8)
+                   | p[2])
+                  + 526336;
+            break;
+
+        default: /* 3 */
+            off = ((size_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            break;
+        }
+
+        p += size + 1;
+
+        /* a pointer to a pointer is not allowed */
+
+        if (off >= (size_t) (end - start)
+            || (start[off] >> 5) == NGX_GEOIP_MMDB_POINTER)
+        {
+            return NULL;
+        }
+
+        if (ngx_http_geoip_mmdb_decode(start, end, start + off, item) == NULL) {
+            return NULL;
+        }
+
+        item->indirect = 1;
+
+        return p;
+    }
+
+    if (type == 0) {
+        if (p == end) {
+            return NULL;
+        }
+
+        type = 7 + *p++;
+    }
+
+    size = ctrl & 0x1f;
+
+    if (size >= 29) {
+        len = size - 28;
+
+        if ((size_t) (end - p) < len) {
+            return NULL;
+        }
+
+        switch (len) {
+
+        case 1:
+            size = 29 + p[0];
+            break;
+
+        case 2:
+            size = 285 + ((p[0] << 8) | p[1]);
+            break;
+
+        default: /* 3 */
+            size = 65821 + (((ngx_uint_t) p[0] << 16) | (p[1] << 8) | p[2]);
+            break;
+        }
+
+        p += len;
+    }
+
+    item->type = type;
+    item->size = size;
+    item->data = p;
+    item->indirect = 0;
+
+    switch (type) {
+
+    case NGX_GEOIP_MMDB_MAP:
+    case NGX_GEOIP_MMDB_ARRAY:
+    case NGX_GEOIP_MMDB_BOOLEAN:
+        return p;
+
+    case NGX_GEOIP_MMDB_UTF8:
+    case NGX_GEOIP_MMDB_BYTES:
+    case NGX_GEOIP_MMDB_UINT128:
+        break;
+
+    case NGX_GEOIP_MMDB_DOUBLE:
+        if (size != 8) {
+            return NULL;
+        }
+
+        break;
+
+    case NGX_GEOIP_MMDB_FLOAT:
+        if (size != 4) {
+            return NULL;
+        }
+
+        break;
+
+    case NGX_GEOIP_MMDB_UINT16:
+    case NGX_GEOIP_MMDB_UINT32:
+    case NGX_GEOIP_MMDB_INT32:
+    case NGX_GEOIP_MMDB_UINT64:
+        if (size > 8) {
+            return NULL;
+        }
+
+        break;
+
+    default:
+        return NULL;
+    }
+
+    if ((size_t) (end - p) < size) {
+        return NULL;
+    }
+
+    return p + size;
+}
+
+
+static u_char *
+ngx_http_geoip_mmdb_skip(u_char *start, u_char *end, u_char *p,
+    ngx_uint_t depth)
+{
+    ngx_uint_t                  n;
+    ngx_http_geoip_mmdb_item_t  item;
+
+    p = ngx_http_geoip_mmdb_decode(start, end, p, &item);
+    if (p == NULL || item.indirect) {
+        return p;
+    }
+
+    switch (item.type) {
+
+    case NGX_GEOIP_MMDB_MAP:
+        n = item.size * 2;
+        break;
+
+    case NGX_GEOIP_MMDB_ARRAY:
+        n = item.size;
+        break;
+
+    default:
+        return p;
+    }
+
+    if (depth == NGX_GEOIP_MMDB_MAX_DEPTH) {
+        return NULL;
+    }
+
+    while (n--) {
+        p = ngx_http_geoip_mmdb_skip(start, end, p, depth + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+
+    return p;
+}
+
+
+static uint64_t
+ngx_http_geoip_mmdb_uint(ngx_http_geoip_mmdb_item_t *item)
+{
+    size_t     i;
+    uint64_t   n;
+
+    if (item->type == NGX_GEOIP_MMDB_BOOLEAN) {
+        return item->size;
+    }
+
+    n = 0;
+
+    for (i = 0; i < item->size; i++) {
+        n = (n << 8) | item->data[i];
+    }
+
+    return n;
+}
+
+
+static double
+ngx_http_geoip_mmdb_double(ngx_http_geoip_mmdb_item_t *item)
+{
+    float     f;
+    double    d;
+    uint32_t  n32;
+    uint64_t  n;
+
+    n = ngx_http_geoip_mmdb_uint(item);
+
+    if (item->type == NGX_GEOIP_MMDB_FLOAT) {
+        n32 = (uint32_t) n;
+        ngx_memcpy(&f, &n32, sizeof(float));
+        return f;
+    }
+
+    ngx_memcpy(&d, &n, sizeof(double));
+
+    return d;
+}
+
+
+static ngx_int_t
+ngx_http_geoip_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_geoip_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_geoip_create_conf(ngx_conf_t *cf)
+{
+#if (NGX_HAVE_LIBGEOIP)
+    ngx_pool_cleanup_t     *cln;
+#endif
+    ngx_http_geoip_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_geoip_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->proxy_recursive = NGX_CONF_UNSET;
+
+#if (NGX_HAVE_LIBGEOIP)
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_geoip_cleanup;
+    cln->data = conf;
+
+#endif
+
+    return conf;
+}
+
+
+static char *
+ngx_http_geoip_init_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_geoip_conf_t  *gcf = conf;
+
+    ngx_conf_init_value(gcf->proxy_recursive, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_geoip_country(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_geoip_conf_t  *gcf = conf;
+
+#if (NGX_HAVE_LIBGEOIP)
+    ngx_str_t  *value;
+
+    if (gcf->country) {
+        return "is duplicate";
+    }
+#endif
+
+    if (gcf->country_mmdb) {
+        return "is duplicate";
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
+
+    value = cf->args->elts;
+
+    if (ngx_http_geoip_is_mmdb(&value[1])) {
+        return ngx_http_geoip_mmdb(cf, gcf, &gcf->country_mmdb);
+    }
+
+    gcf->country = GeoIP_open((char *) value[1].data, GEOIP_MEMORY_CACHE);
+
+    if (gcf->country == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "GeoIP_open(\"%V\") failed", &value[1]);
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset (gcf->country, GEOIP_CHARSET_UTF8);
 
@@ -719,6 +1733,12 @@ ngx_http_geoip_country(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                            &value[1], gcf->country->databaseType);
         return NGX_CONF_ERROR;
     }
+
+#else
+
+    return ngx_http_geoip_mmdb(cf, gcf, &gcf->country_mmdb);
+
+#endif
 }
 
 
@@ -727,14 +1747,26 @@ ngx_http_geoip_org(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_geoip_conf_t  *gcf = conf;
 
+#if (NGX_HAVE_LIBGEOIP)
     ngx_str_t  *value;
 
     if (gcf->org) {
         return "is duplicate";
     }
+#endif
+
+    if (gcf->org_mmdb) {
+        return "is duplicate";
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     value = cf->args->elts;
 
+    if (ngx_http_geoip_is_mmdb(&value[1])) {
+        return ngx_http_geoip_mmdb(cf, gcf, &gcf->org_mmdb);
+    }
+
     gcf->org = GeoIP_open((char *) value[1].data, GEOIP_MEMORY_CACHE);
 
     if (gcf->org == NULL) {
@@ -780,6 +1812,12 @@ ngx_http_geoip_org(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                            &value[1], gcf->org->databaseType);
         return NGX_CONF_ERROR;
     }
+
+#else
+
+    return ngx_http_geoip_mmdb(cf, gcf, &gcf->org_mmdb);
+
+#endif
 }
 
 
@@ -788,14 +1826,26 @@ ngx_http_geoip_city(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_geoip_conf_t  *gcf = conf;
 
+#if (NGX_HAVE_LIBGEOIP)
     ngx_str_t  *value;
 
     if (gcf->city) {
         return "is duplicate";
     }
+#endif
+
+    if (gcf->city_mmdb) {
+        return "is duplicate";
+    }
+
+#if (NGX_HAVE_LIBGEOIP)
 
     value = cf->args->elts;
 
+    if (ngx_http_geoip_is_mmdb(&value[1])) {
+        return ngx_http_geoip_mmdb(cf, gcf, &gcf->city_mmdb);
+    }
+
     gcf->city = GeoIP_open((char *) value[1].data, GEOIP_MEMORY_CACHE);
 
     if (gcf->city == NULL) {
@@ -837,6 +1887,12 @@ ngx_http_geoip_city(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                            &value[1], gcf->city->databaseType);
         return NGX_CONF_ERROR;
     }
+
+#else
+
+    return ngx_http_geoip_mmdb(cf, gcf, &gcf->city_mmdb);
+
+#endif
 }
 
 
@@ -900,6 +1956,257 @@ ngx_http_geoip_cidr_value(ngx_conf_t *cf, ngx_str_t *net, ngx_cidr_t *cidr)
 }
 
 
+/*
+ * the same MaxMind database may be used for several directives,
+ * e.g. a city database for both countries and cities, it is mapped
+ * once and looked up once per request then
+ */
+
+static char *
+ngx_http_geoip_mmdb(ngx_conf_t *cf, ngx_http_geoip_conf_t *gcf,
+    ngx_http_geoip_mmdb_t **mmdb)
+{
+    char                   *err;
+    ngx_int_t               rc;
+    ngx_str_t              *value, name;
+    ngx_uint_t              i;
+    ngx_pool_cleanup_t     *cln;
+    ngx_http_geoip_mmdb_t  *db, *dbs[NGX_GEOIP_MMDB_DATABASES];
+
+    value = cf->args->elts;
+
+    /* MaxMind DB strings are always in UTF-8 */
+
+    if (cf->args->nelts == 3 && ngx_strcmp(value[2].data, "utf8") != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    name = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    dbs[0] = gcf->country_mmdb;
+    dbs[1] = gcf->org_mmdb;
+    dbs[2] = gcf->city_mmdb;
+
+    for (i = 0; i < NGX_GEOIP_MMDB_DATABASES; i++) {
+        if (dbs[i] && ngx_strcmp(dbs[i]->fm.name, name.data) == 0) {
+            *mmdb = dbs[i];
+            return NGX_CONF_OK;
+        }
+    }
+
+    db = ngx_pcalloc(cf->pool, sizeof(ngx_http_geoip_mmdb_t));
+    if (db == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    db->fm.name = name.data;
+    db->fm.log = cf->log;
+
+    rc = ngx_open_file_mapping(&db->fm);
+
+    if (rc == NGX_DECLINED) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, NGX_ENOENT,
+                           ngx_open_file_n " \"%s\" failed", name.data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_close_file_mapping(&db->fm);
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_geoip_mmdb_cleanup;
+    cln->data = db;
+
+    err = ngx_http_geoip_mmdb_init(db);
+
+    if (err) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid MaxMind database \"%s\": %s",
+                           name.data, err);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "geoip mmdb \"%s\" nodes:%ui record:%ui ipv%ui",
+                   name.data, db->node_count, db->record_size,
+                   db->ip_version);
+
+    *mmdb = db;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_geoip_mmdb_init(ngx_http_geoip_mmdb_t *db)
+{
+    u_char                      *start, *end, *p, *last, *q;
+    size_t                       size;
+    uint64_t                     n;
+    ngx_uint_t                   i, major, bits, node;
+    ngx_http_geoip_mmdb_item_t   item, key, val;
+
+    static u_char  marker[] = "\xab\xcd\xef" "MaxMind.com";
+
+    start = db->fm.addr;
+    end = start + db->fm.size;
+
+    if (db->fm.size < sizeof(marker) - 1) {
+        return "no metadata";
+    }
+
+    /* the metadata follow the last marker within the last 128K */
+
+    last = (db->fm.size > NGX_GEOIP_MMDB_METADATA_MAX)
+           ? end - NGX_GEOIP_MMDB_METADATA_MAX : start;
+
+    for (p = end - (sizeof(marker) - 1); /* void */ ; p--) {
+
+        if (ngx_memcmp(p, marker, sizeof(marker) - 1) == 0) {
+            break;
+        }
+
+        if (p == last) {
+            return "no metadata";
+        }
+    }
+
+    q = p + sizeof(marker) - 1;
+
+    q = ngx_http_geoip_mmdb_decode(q, end, q, &item);
+    if (q == NULL || item.type != NGX_GEOIP_MMDB_MAP) {
+        return "invalid metadata";
+    }
+
+    major = 0;
+
+    for (i = 0; i < item.size; i++) {
+
+        q = ngx_http_geoip_mmdb_decode(p + sizeof(marker) - 1, end, q, &key);
+        if (q == NULL || key.type != NGX_GEOIP_MMDB_UTF8) {
+            return "invalid metadata";
+        }
+
+        if (ngx_http_geoip_mmdb_decode(p + sizeof(marker) - 1, end, q, &val)
+            == NULL)
+        {
+            return "invalid metadata";
+        }
+
+        if (val.type == NGX_GEOIP_MMDB_UINT16
+            || val.type == NGX_GEOIP_MMDB_UINT32
+            || val.type == NGX_GEOIP_MMDB_UINT64)
+        {
+            n = ngx_http_geoip_mmdb_uint(&val);
+
+        } else {
+            n = 0;
+        }
+
+        if (key.size == sizeof("node_count") - 1
+            && ngx_strncmp(key.data, "node_count", key.size) == 0)
+        {
+            db->node_count = (ngx_uint_t) n;
+
+        } else if (key.size == sizeof("record_size") - 1
+                   && ngx_strncmp(key.data, "record_size", key.size) == 0)
+        {
+            db->record_size = (ngx_uint_t) n;
+
+        } else if (key.size == sizeof("ip_version") - 1
+                   && ngx_strncmp(key.data, "ip_version", key.size) == 0)
+        {
+            db->ip_version = (ngx_uint_t) n;
+
+        } else if (key.size == sizeof("binary_format_major_version") - 1
+                   && ngx_strncmp(key.data, "binary_format_major_version",
+                                  key.size)
+                      == 0)
+        {
+            major = (ngx_uint_t) n;
+        }
+
+        q = ngx_http_geoip_mmdb_skip(p + sizeof(marker) - 1, end, q, 0);
+        if (q == NULL) {
+            return "invalid metadata";
+        }
+    }
+
+    if (major != 2) {
+        return "unsupported binary format version";
+    }
+
+    if (db->record_size != 24 && db->record_size != 28
+        && db->record_size != 32)
+    {
+        return "unsupported record size";
+    }
+
+    if (db->ip_version != 4 && db->ip_version != 6) {
+        return "unsupported IP version";
+    }
+
+    size = p - start;
+
+    if (db->node_count == 0 || size < 16
+        || db->node_count > (size - 16) / (db->record_size / 4))
+    {
+        return "invalid node count";
+    }
+
+    db->tree = start;
+    db->data = start + db->node_count * (db->record_size / 4) + 16;
+    db->end = p;
+
+    if (db->ip_version == 6) {
+        node = 0;
+
+        for (bits = 0; bits < 96 && node < db->node_count; bits++) {
+            node = ngx_http_geoip_mmdb_node(db, node, 0);
+        }
+
+        db->ipv4_start = node;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_geoip_mmdb_cleanup(void *data)
+{
+    ngx_http_geoip_mmdb_t  *db = data;
+
+    db->fm.log = ngx_cycle->log;
+
+    ngx_close_file_mapping(&db->fm);
+}
+
+
+#if (NGX_HAVE_LIBGEOIP)
+
+static ngx_int_t
+ngx_http_geoip_is_mmdb(ngx_str_t *name)
+{
+    return name->len > sizeof(".mmdb") - 1
+           && ngx_strncasecmp(name->data + name->len - (sizeof(".mmdb") - 1),
+                              (u_char *) ".mmdb", sizeof(".mmdb") - 1)
+              == 0;
+}
+
+
 static void
 ngx_http_geoip_cleanup(void *data)
 {
@@ -917,3 +2224,5 @@ ngx_http_geoip_cleanup(void *data)
         GeoIP_delete(gcf->city);
     }
 }
+
+#endif
@@ -26,8 +26,15 @@ typedef struct {
 
 typedef struct {
     ngx_rbtree_t       *rbtree;
-    ngx_int_t           index;
-    ngx_str_t           var;
+    ngx_slab_pool_t    *shpool;
+} ngx_http_limit_conn_shard_t;
+
+
+typedef struct {
+    ngx_http_limit_conn_shard_t  *shards;
+    ngx_uint_t                    nshards;
+    ngx_int_t                     index;
+    ngx_str_t                     var;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -83,7 +90,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -166,6 +173,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
     ngx_http_limit_conn_node_t     *lc;
     ngx_http_limit_conn_conf_t     *lccf;
     ngx_http_limit_conn_limit_t    *limits;
+    ngx_http_limit_conn_shard_t    *shard;
     ngx_http_limit_conn_cleanup_t  *lccln;
 
     if (r->main->limit_conn_set) {
@@ -202,11 +210,12 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
+        shard = &ctx->shards[hash % ctx->nshards];
+        shpool = shard->shpool;
 
         ngx_shmtx_lock(&shpool->mutex);
 
-        node = ngx_http_limit_conn_lookup(ctx->rbtree, vv, hash);
+        node = ngx_http_limit_conn_lookup(shard->rbtree, vv, hash);
 
         if (node == NULL) {
 
@@ -229,7 +238,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             lc->conn = 1;
             ngx_memcpy(lc->data, vv->data, len);
 
-            ngx_rbtree_insert(ctx->rbtree, node);
+            ngx_rbtree_insert(shard->rbtree, node);
 
         } else {
 
@@ -358,16 +367,21 @@ ngx_http_limit_conn_cleanup(void *data)
 {
     ngx_http_limit_conn_cleanup_t  *lccln = data;
 
-    ngx_slab_pool_t             *shpool;
-    ngx_rbtree_node_t           *node;
-    ngx_http_limit_conn_ctx_t   *ctx;
-    ngx_http_limit_conn_node_t  *lc;
+    ngx_slab_pool_t              *shpool;
+    ngx_rbtree_node_t            *node;
+    ngx_http_limit_conn_ctx_t    *ctx;
+    ngx_http_limit_conn_node_t   *lc;
+    ngx_http_limit_conn_shard_t  *shard;
 
     ctx = lccln->shm_zone->data;
-    shpool = (ngx_slab_pool_t *) lccln->shm_zone->shm.addr;
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
 
+    /* the node key is the hash the shard has been selected by */
+
+    shard = &ctx->shards[node->key % ctx->nshards];
+    shpool = shard->shpool;
+
     ngx_shmtx_lock(&shpool->mutex);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, lccln->shm_zone->shm.log, 0,
@@ -376,7 +390,7 @@ ngx_http_limit_conn_cleanup(void *data)
     lc->conn--;
 
     if (lc->conn == 0) {
-        ngx_rbtree_delete(ctx->rbtree, node);
+        ngx_rbtree_delete(shard->rbtree, node);
         ngx_slab_free_locked(shpool, node);
     }
 
@@ -405,10 +419,12 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_conn_ctx_t  *octx = data;
 
-    size_t                      len;
-    ngx_slab_pool_t            *shpool;
-    ngx_rbtree_node_t          *sentinel;
-    ngx_http_limit_conn_ctx_t  *ctx;
+    size_t                        len;
+    ngx_uint_t                    i;
+    ngx_slab_pool_t              *shpool;
+    ngx_rbtree_node_t            *sentinel;
+    ngx_http_limit_conn_ctx_t    *ctx;
+    ngx_http_limit_conn_shard_t  *shard;
 
     ctx = shm_zone->data;
 
@@ -421,7 +437,15 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->rbtree = octx->rbtree;
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        ctx->shards = octx->shards;
 
         return NGX_OK;
     }
@@ -429,25 +453,19 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+        ctx->shards = shpool->data;
 
         return NGX_OK;
     }
 
-    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
-    if (ctx->rbtree == NULL) {
-        return NGX_ERROR;
-    }
+    len = ctx->nshards * sizeof(ngx_http_limit_conn_shard_t);
 
-    shpool->data = ctx->rbtree;
-
-    sentinel = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_node_t));
-    if (sentinel == NULL) {
+    ctx->shards = ngx_slab_alloc(shpool, len);
+    if (ctx->shards == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_rbtree_init(ctx->rbtree, sentinel,
-                    ngx_http_limit_conn_rbtree_insert_value);
+    shpool->data = ctx->shards;
 
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
 
@@ -459,6 +477,43 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(shpool->log_ctx, " in limit_conn_zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    /*
+     * each shard has its own slab pool and mutex,
+     * a single shard lives in the pool of the zone itself;
+     * the data of the zone pool always points to the shards
+     */
+
+    len = (shpool->pfree / ctx->nshards) << ngx_pagesize_shift;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        shard = &ctx->shards[i];
+
+        if (ctx->nshards == 1) {
+            shard->shpool = shpool;
+
+        } else {
+            shard->shpool = ngx_slab_create_pool(shpool, len);
+            if (shard->shpool == NULL) {
+                return NGX_ERROR;
+            }
+
+            shard->shpool->log_ctx = shpool->log_ctx;
+        }
+
+        shard->rbtree = ngx_slab_alloc(shard->shpool, sizeof(ngx_rbtree_t));
+        if (shard->rbtree == NULL) {
+            return NGX_ERROR;
+        }
+
+        sentinel = ngx_slab_alloc(shard->shpool, sizeof(ngx_rbtree_node_t));
+        if (sentinel == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(shard->rbtree, sentinel,
+                        ngx_http_limit_conn_rbtree_insert_value);
+    }
+
     return NGX_OK;
 }
 
@@ -510,6 +565,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                     *p;
     ssize_t                     size;
     ngx_str_t                  *value, name, s;
+    ngx_int_t                   shards;
     ngx_uint_t                  i;
     ngx_shm_zone_t             *shm_zone;
     ngx_http_limit_conn_ctx_t  *ctx;
@@ -518,6 +574,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
+    shards = 1;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -556,6 +613,19 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > 256) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -595,6 +665,15 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (size / shards < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->nshards = shards;
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_conn_module);
     if (shm_zone == NULL) {
@@ -649,6 +728,7 @@ ngx_http_limit_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->var = value[2];
+    ctx->nshards = 1;
 
     n = ngx_parse_size(&value[3]);
 
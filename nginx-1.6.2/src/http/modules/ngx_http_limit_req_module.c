@@ -10,6 +10,27 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_LIMIT_REQ_MAX_RATES   4
+#define NGX_HTTP_LIMIT_REQ_SKETCH_ROWS  4
+
+
+#define ngx_http_limit_req_node_size(ctx, len)                               \
+    (ngx_align(offsetof(ngx_http_limit_req_node_t, data) + (len),            \
+               sizeof(uintptr_t))                                            \
+     + (ctx)->nwindows * sizeof(ngx_http_limit_req_window_t))
+
+#define ngx_http_limit_req_node_windows(lr)                                  \
+    ((ngx_http_limit_req_window_t *)                                         \
+         ngx_align_ptr((lr)->data + (lr)->len, sizeof(uintptr_t)))
+
+
+typedef struct {
+    ngx_msec_t                   start;
+    ngx_uint_t                   prev;
+    ngx_uint_t                   count;
+} ngx_http_limit_req_window_t;
+
+
 typedef struct {
     u_char                       color;
     u_char                       dummy;
@@ -23,21 +44,55 @@ typedef struct {
 } ngx_http_limit_req_node_t;
 
 
+/*
+ * a count-min sketch cell holds the same state as a node,
+ * but is shared by all keys hashed into it
+ */
+
+typedef struct {
+    ngx_msec_t                   last;
+    ngx_uint_t                   excess;
+    ngx_http_limit_req_window_t  windows[1];
+} ngx_http_limit_req_cell_t;
+
+
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+    u_char                       *sketch;
+    ngx_uint_t                    width;
 } ngx_http_limit_req_shctx_t;
 
 
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
+} ngx_http_limit_req_shard_t;
+
+
+typedef struct {
+    ngx_msec_t                   period;
+    ngx_uint_t                   limit;
+} ngx_http_limit_req_rate_t;
+
+
+typedef struct {
+    ngx_http_limit_req_shard_t  *shards;
+    ngx_uint_t                   nshards;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
+    /* sliding windows of the second and further rates */
+    ngx_http_limit_req_rate_t    windows[NGX_HTTP_LIMIT_REQ_MAX_RATES - 1];
+    ngx_uint_t                   nwindows;
+    ngx_uint_t                   approximate;  /* unsigned  approximate:1 */
+    size_t                       cell_size;
     ngx_int_t                    index;
     ngx_str_t                    var;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_shard_t  *shard;
+    ngx_http_limit_req_cell_t   *cells[NGX_HTTP_LIMIT_REQ_SKETCH_ROWS];
+    ngx_uint_t                   held;      // sketch 模式下已通过检查、待记账
 } ngx_http_limit_req_ctx_t;
 
 
@@ -64,7 +119,20 @@ static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n);
+static ngx_int_t ngx_http_limit_req_sketch_lookup(
+    ngx_http_limit_req_limit_t *limit, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account);
+static ngx_uint_t ngx_http_limit_req_sketch_account(
+    ngx_http_limit_req_ctx_t *ctx, ngx_msec_t now);
+static ngx_uint_t ngx_http_limit_req_window_count(
+    ngx_http_limit_req_window_t *w, ngx_msec_t period, ngx_msec_t now);
+static ngx_int_t ngx_http_limit_req_window_test(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now);
+static void ngx_http_limit_req_window_add(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now);
+static ngx_uint_t ngx_http_limit_req_window_idle(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now);
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -93,7 +161,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_2MORE,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -211,12 +279,14 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ctx->shard = &ctx->shards[hash % ctx->nshards];
+
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
         rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
                                        (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -245,15 +315,17 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         while (n--) {
             ctx = limits[n].shm_zone->data;
 
+            ctx->held = 0;
+
             if (ctx->node == NULL) {
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
             ctx->node = NULL;
         }
@@ -367,22 +439,31 @@ static ngx_int_t
 ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     u_char *data, size_t len, ngx_uint_t *ep, ngx_uint_t account)
 {
-    size_t                      size;
-    ngx_int_t                   rc, excess;
-    ngx_time_t                 *tp;
-    ngx_msec_t                  now;
-    ngx_msec_int_t              ms;
-    ngx_rbtree_node_t          *node, *sentinel;
-    ngx_http_limit_req_ctx_t   *ctx;
-    ngx_http_limit_req_node_t  *lr;
+    size_t                       size;
+    ngx_int_t                    rc, excess;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_msec_int_t               ms;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_shard_t  *shard;
+    ngx_http_limit_req_window_t *w;
+
+    ctx = limit->shm_zone->data;
+
+    if (ctx->approximate) {
+        return ngx_http_limit_req_sketch_lookup(limit, hash, data, len, ep,
+                                                account);
+    }
 
     tp = ngx_timeofday();
     now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
 
-    ctx = limit->shm_zone->data;
+    shard = ctx->shard;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = shard->sh->rbtree.root;
+    sentinel = shard->sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -404,7 +485,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -420,9 +501,16 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
                 return NGX_BUSY;
             }
 
+            w = ngx_http_limit_req_node_windows(lr);
+
+            if (ngx_http_limit_req_window_test(ctx, w, now) != NGX_OK) {
+                return NGX_BUSY;
+            }
+
             if (account) {
                 lr->excess = excess;
                 lr->last = now;
+                ngx_http_limit_req_window_add(ctx, w, now);
                 return NGX_OK;
             }
 
@@ -439,20 +527,19 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     *ep = 0;
 
     size = offsetof(ngx_rbtree_node_t, color)
-           + offsetof(ngx_http_limit_req_node_t, data)
-           + len;
+           + ngx_http_limit_req_node_size(ctx, len);
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, shard, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = ngx_slab_alloc_locked(shard->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, shard, 0);
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_alloc_locked(shard->shpool, size);
         if (node == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", ctx->shpool->log_ctx);
+                          "could not allocate node%s", shard->shpool->log_ctx);
             return NGX_ERROR;
         }
     }
@@ -461,18 +548,22 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     lr = (ngx_http_limit_req_node_t *) &node->color;
 
-    lr->len = (u_char) len;
+    lr->len = (u_short) len;
     lr->excess = 0;
 
     ngx_memcpy(lr->data, data, len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    w = ngx_http_limit_req_node_windows(lr);
+    ngx_memzero(w, ctx->nwindows * sizeof(ngx_http_limit_req_window_t));
+
+    ngx_rbtree_insert(&shard->sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
     if (account) {
         lr->last = now;
         lr->count = 0;
+        ngx_http_limit_req_window_add(ctx, w, now);
         return NGX_OK;
     }
 
@@ -510,30 +601,41 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         ctx = limits[n].shm_zone->data;
         lr = ctx->node;
 
-        if (lr == NULL) {
+        if (lr == NULL && !ctx->held) {
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
         tp = ngx_timeofday();
 
         now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
-        ms = (ngx_msec_int_t) (now - lr->last);
 
-        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+        if (ctx->held) {
+            excess = ngx_http_limit_req_sketch_account(ctx, now);
 
-        if (excess < 0) {
-            excess = 0;
-        }
+        } else {
+            ms = (ngx_msec_int_t) (now - lr->last);
 
-        lr->last = now;
-        lr->excess = excess;
-        lr->count--;
+            excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+            if (excess < 0) {
+                excess = 0;
+            }
+
+            lr->last = now;
+            lr->excess = excess;
+            lr->count--;
+
+            ngx_http_limit_req_window_add(ctx,
+                                          ngx_http_limit_req_node_windows(lr),
+                                          now);
+        }
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
         ctx->node = NULL;
+        ctx->held = 0;
 
         if (limits[n].nodelay) {
             continue;
@@ -552,8 +654,240 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_sketch_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_uint_t hash, u_char *data, size_t len, ngx_uint_t *ep,
+    ngx_uint_t account)
+{
+    uint32_t                     h1, h2;
+    ngx_int_t                    excess, min;
+    ngx_uint_t                   i, k, count, est;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_msec_int_t               ms;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_cell_t   *cell;
+    ngx_http_limit_req_shctx_t  *sh;
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    ctx = limit->shm_zone->data;
+    sh = ctx->shard->sh;
+
+    /*
+     * the low bits of the crc32 hash already selected the shard,
+     * so rows are indexed by double hashing its high bits
+     * together with the murmur hash of the key
+     */
+
+    h1 = ngx_murmur_hash2(data, len);
+    h2 = ((uint32_t) hash >> 8) | 1;
+
+    min = NGX_MAX_INT32_VALUE;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+        cell = (ngx_http_limit_req_cell_t *)
+                   (sh->sketch + (i * sh->width + (h1 + i * h2) % sh->width)
+                                 * ctx->cell_size);
+
+        ctx->cells[i] = cell;
+
+        ms = (ngx_msec_int_t) (now - cell->last);
+
+        excess = cell->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+        if (excess < 0) {
+            excess = 0;
+        }
+
+        if (excess < min) {
+            min = excess;
+        }
+    }
+
+    *ep = min;
+
+    if ((ngx_uint_t) min > limit->burst) {
+        return NGX_BUSY;
+    }
+
+    for (k = 0; k < ctx->nwindows; k++) {
+
+        est = NGX_MAX_UINT32_VALUE;
+
+        for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+            count = ngx_http_limit_req_window_count(&ctx->cells[i]->windows[k],
+                                                    ctx->windows[k].period,
+                                                    now);
+            if (count < est) {
+                est = count;
+            }
+        }
+
+        if (est >= ctx->windows[k].limit) {
+            return NGX_BUSY;
+        }
+    }
+
+    if (account) {
+        ngx_http_limit_req_sketch_account(ctx, now);
+        return NGX_OK;
+    }
+
+    ctx->held = 1;
+
+    return NGX_AGAIN;
+}
+
+
+/*
+ * conservative update: only the cells holding the minimum are raised,
+ * so keys sharing a cell do not inflate each other beyond it
+ */
+
+static ngx_uint_t
+ngx_http_limit_req_sketch_account(ngx_http_limit_req_ctx_t *ctx,
+    ngx_msec_t now)
+{
+    ngx_int_t                   excess[NGX_HTTP_LIMIT_REQ_SKETCH_ROWS], min;
+    ngx_uint_t                  i, k, count[NGX_HTTP_LIMIT_REQ_SKETCH_ROWS],
+                                est;
+    ngx_msec_int_t              ms;
+    ngx_http_limit_req_cell_t  *cell;
+
+    min = NGX_MAX_INT32_VALUE;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+        cell = ctx->cells[i];
+
+        ms = (ngx_msec_int_t) (now - cell->last);
+
+        excess[i] = cell->excess - ctx->rate * ngx_abs(ms) / 1000;
+
+        if (excess[i] < 0) {
+            excess[i] = 0;
+        }
+
+        if (excess[i] < min) {
+            min = excess[i];
+        }
+    }
+
+    min += 1000;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+        cell = ctx->cells[i];
+
+        cell->excess = ngx_max(excess[i], min);
+        cell->last = now;
+    }
+
+    for (k = 0; k < ctx->nwindows; k++) {
+
+        est = NGX_MAX_UINT32_VALUE;
+
+        for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+            count[i] = ngx_http_limit_req_window_count(
+                                                &ctx->cells[i]->windows[k],
+                                                ctx->windows[k].period, now);
+            if (count[i] < est) {
+                est = count[i];
+            }
+        }
+
+        for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+            if (count[i] == est) {
+                ctx->cells[i]->windows[k].count++;
+            }
+        }
+    }
+
+    return min;
+}
+
+
+/*
+ * a sliding window is approximated by two fixed ones: the count of
+ * the previous period is weighted by the part of it still covered
+ */
+
+static ngx_uint_t
+ngx_http_limit_req_window_count(ngx_http_limit_req_window_t *w,
+    ngx_msec_t period, ngx_msec_t now)
+{
+    ngx_msec_t  start;
+
+    start = now - now % period;
+
+    if (w->start != start) {
+        w->prev = (start - w->start == period) ? w->count : 0;
+        w->count = 0;
+        w->start = start;
+    }
+
+    return w->count + w->prev * (period - (now - start)) / period;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_window_test(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now)
+{
+    ngx_uint_t  k;
+
+    for (k = 0; k < ctx->nwindows; k++) {
+        if (ngx_http_limit_req_window_count(&w[k], ctx->windows[k].period, now)
+            >= ctx->windows[k].limit)
+        {
+            return NGX_BUSY;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_req_window_add(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now)
+{
+    ngx_uint_t  k;
+
+    for (k = 0; k < ctx->nwindows; k++) {
+        (void) ngx_http_limit_req_window_count(&w[k], ctx->windows[k].period,
+                                               now);
+        w[k].count++;
+    }
+}
+
+
+/*
+ * the node is idle when no window counts a request any longer:
+ * a deleted node would lose the requests of the longer periods
+ */
+
+static ngx_uint_t
+ngx_http_limit_req_window_idle(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_window_t *w, ngx_msec_t now)
+{
+    ngx_uint_t  k;
+
+    for (k = 0; k < ctx->nwindows; k++) {
+        if (ngx_http_limit_req_window_count(&w[k], ctx->windows[k].period, now)
+            != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_time_t                 *tp;
@@ -575,11 +909,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&shard->sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&shard->sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -607,6 +941,13 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
             if (excess > 0) {
                 return;
             }
+
+            if (!ngx_http_limit_req_window_idle(ctx,
+                                          ngx_http_limit_req_node_windows(lr),
+                                          now))
+            {
+                return;
+            }
         }
 
         ngx_queue_remove(q);
@@ -614,9 +955,9 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&shard->sh->rbtree, node);
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        ngx_slab_free_locked(shard->shpool, node);
     }
 }
 
@@ -626,8 +967,15 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
-    size_t                     len;
-    ngx_http_limit_req_ctx_t  *ctx;
+    u_char                      *p;
+    size_t                       len, size;
+    ngx_uint_t                   i, n;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_limit_req_ctx_t    *ctx;
+    ngx_http_limit_req_cell_t   *cell;
+    ngx_http_limit_req_shard_t  *shard;
 
     ctx = shm_zone->data;
 
@@ -640,43 +988,126 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->sh = octx->sh;
-        ctx->shpool = octx->shpool;
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        if (ctx->nwindows != octx->nwindows
+            || ctx->approximate != octx->approximate)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui rates%s "
+                          "while previously it used %ui rates%s",
+                          &shm_zone->shm.name, ctx->nwindows + 1,
+                          ctx->approximate ? " approximately" : "",
+                          octx->nwindows + 1,
+                          octx->approximate ? " approximately" : "");
+            return NGX_ERROR;
+        }
+
+        ctx->shards = octx->shards;
 
         return NGX_OK;
     }
 
-    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+        ctx->shards = shpool->data;
 
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
-    if (ctx->sh == NULL) {
+    len = ctx->nshards * sizeof(ngx_http_limit_req_shard_t);
+
+    ctx->shards = ngx_slab_alloc(shpool, len);
+    if (ctx->shards == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->shpool->data = ctx->sh;
-
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
-
-    ngx_queue_init(&ctx->sh->queue);
+    shpool->data = ctx->shards;
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
-    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
-    if (ctx->shpool->log_ctx == NULL) {
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_sprintf(ctx->shpool->log_ctx, " in limit_req zone \"%V\"%Z",
+    ngx_sprintf(shpool->log_ctx, " in limit_req zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
-    ctx->shpool->log_nomem = 0;
+    shpool->log_nomem = 0;
+
+    /*
+     * each shard has its own slab pool and mutex,
+     * a single shard lives in the pool of the zone itself;
+     * the data of the zone pool always points to the shards
+     */
+
+    len = (shpool->pfree / ctx->nshards) << ngx_pagesize_shift;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        shard = &ctx->shards[i];
+
+        if (ctx->nshards == 1) {
+            shard->shpool = shpool;
+
+        } else {
+            shard->shpool = ngx_slab_create_pool(shpool, len);
+            if (shard->shpool == NULL) {
+                return NGX_ERROR;
+            }
+
+            shard->shpool->log_ctx = shpool->log_ctx;
+            shard->shpool->log_nomem = 0;
+        }
+
+        shard->sh = ngx_slab_alloc(shard->shpool,
+                                   sizeof(ngx_http_limit_req_shctx_t));
+        if (shard->sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shard->sh->rbtree, &shard->sh->sentinel,
+                        ngx_http_limit_req_rbtree_insert_value);
+
+        ngx_queue_init(&shard->sh->queue);
+
+        if (!ctx->approximate) {
+            continue;
+        }
+
+        /* the sketch takes the whole shard, so its memory never grows */
+
+        size = shard->shpool->pfree << ngx_pagesize_shift;
+
+        shard->sh->sketch = ngx_slab_alloc(shard->shpool, size);
+        if (shard->sh->sketch == NULL) {
+            return NGX_ERROR;
+        }
+
+        shard->sh->width = size / (NGX_HTTP_LIMIT_REQ_SKETCH_ROWS
+                                   * ctx->cell_size);
+
+        ngx_memzero(shard->sh->sketch, size);
+
+        tp = ngx_timeofday();
+        now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+        n = NGX_HTTP_LIMIT_REQ_SKETCH_ROWS * shard->sh->width;
+        p = shard->sh->sketch;
+
+        while (n--) {
+            cell = (ngx_http_limit_req_cell_t *) p;
+            cell->last = now;
+            p += ctx->cell_size;
+        }
+    }
 
     return NGX_OK;
 }
@@ -735,8 +1166,9 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                     len;
     ssize_t                    size;
     ngx_str_t                 *value, name, s;
-    ngx_int_t                  rate, scale;
-    ngx_uint_t                 i;
+    ngx_int_t                  rate, scale, shards;
+    ngx_uint_t                 i, n, approximate;
+    ngx_http_limit_req_rate_t  rates[NGX_HTTP_LIMIT_REQ_MAX_RATES];
     ngx_shm_zone_t            *shm_zone;
     ngx_http_limit_req_ctx_t  *ctx;
 
@@ -744,8 +1176,9 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
-    rate = 1;
-    scale = 1;
+    n = 0;
+    shards = 1;
+    approximate = 0;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -786,6 +1219,14 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
         if (ngx_strncmp(value[i].data, "rate=", 5) == 0) {
 
+            if (n == NGX_HTTP_LIMIT_REQ_MAX_RATES) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "too many rates, at most %d are allowed",
+                                   NGX_HTTP_LIMIT_REQ_MAX_RATES);
+                return NGX_CONF_ERROR;
+            }
+
+            scale = 1;
             len = value[i].len;
             p = value[i].data + len - 3;
 
@@ -796,6 +1237,10 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             } else if (ngx_strncmp(p, "r/m", 3) == 0) {
                 scale = 60;
                 len -= 3;
+
+            } else if (ngx_strncmp(p, "r/h", 3) == 0) {
+                scale = 3600;
+                len -= 3;
             }
 
             rate = ngx_atoi(value[i].data + 5, len - 5);
@@ -805,6 +1250,42 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
 
+            /*
+             * the first rate drives the leaky bucket and keeps
+             * the burst and nodelay semantics, the others are
+             * sliding windows of "rate" requests per second,
+             * minute or hour
+             */
+
+            if (n == 0 && rate * 1000 / scale == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "first rate \"%V\" is too low",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            rates[n].period = scale * 1000;
+            rates[n].limit = rate;
+            n++;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "approximate") == 0) {
+            approximate = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0 || shards > 256) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
             continue;
         }
 
@@ -847,7 +1328,28 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    ctx->rate = rate * 1000 / scale;
+    if (size / shards < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    if (n == 0) {
+        rates[0].period = 1000;
+        rates[0].limit = 1;
+        n = 1;
+    }
+
+    ctx->rate = rates[0].limit * 1000 * 1000 / rates[0].period;
+    ctx->nwindows = n - 1;
+    ngx_memcpy(ctx->windows, &rates[1],
+               ctx->nwindows * sizeof(ngx_http_limit_req_rate_t));
+
+    ctx->approximate = approximate;
+    ctx->cell_size = offsetof(ngx_http_limit_req_cell_t, windows)
+                     + ctx->nwindows * sizeof(ngx_http_limit_req_window_t);
+    ctx->nshards = shards;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
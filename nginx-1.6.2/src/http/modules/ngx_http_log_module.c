@@ -13,6 +13,10 @@
 #include <zlib.h>
 #endif
 
+#if (NGX_HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 
 typedef struct ngx_http_log_op_s  ngx_http_log_op_t;
 
@@ -35,15 +39,38 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
 } ngx_http_log_fmt_t;
 
 
+/*
+ * a binary log record is a varint length of the record followed by fields,
+ * each field is a type byte followed by a varint value, or by a varint
+ * length and raw bytes for strings; varints are little-endian base 128
+ */
+
+#define NGX_HTTP_LOG_BINARY_NULL      0
+#define NGX_HTTP_LOG_BINARY_STRING    1
+#define NGX_HTTP_LOG_BINARY_UINT      2
+#define NGX_HTTP_LOG_BINARY_TIME      3     /* seconds since epoch */
+#define NGX_HTTP_LOG_BINARY_MSEC      4     /* milliseconds since epoch */
+#define NGX_HTTP_LOG_BINARY_DURATION  5     /* milliseconds */
+
+#define NGX_HTTP_LOG_VARINT_LEN       10
+#define NGX_HTTP_LOG_BINARY_LEN       (1 + NGX_HTTP_LOG_VARINT_LEN)
+
+
 typedef struct {
     ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t */
     ngx_uint_t                  combined_used; /* unsigned  combined_used:1 */
+#if (NGX_HAVE_PTHREAD)
+    ngx_array_t                 asyncs;     /* array of ngx_http_log_async_t * */
+#endif
 } ngx_http_log_main_conf_t;
 
 
+typedef struct ngx_http_log_async_s  ngx_http_log_async_t;
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,9 +79,61 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+#if (NGX_HAVE_PTHREAD)
+    /* access_log指定了async参数时，缓冲区由写日志线程异步刷新到磁盘 */
+    ngx_http_log_async_t       *async;
+#endif
 } ngx_http_log_buf_t;
 
 
+#if (NGX_HAVE_PTHREAD)
+
+#define NGX_HTTP_LOG_OVERFLOW_BLOCK  0
+#define NGX_HTTP_LOG_OVERFLOW_DROP   1
+
+#define NGX_HTTP_LOG_ASYNC_IOVS      64
+
+
+typedef struct {
+    u_char                     *start;
+    size_t                      len;
+} ngx_http_log_chunk_t;
+
+
+/*
+ * single producer, single consumer ring of filled buffers: the worker
+ * advances "head" after filling a chunk, the log thread advances "tail"
+ * after the chunk has been written out
+ */
+
+struct ngx_http_log_async_s {
+    ngx_open_file_t            *file;
+    ngx_http_log_buf_t         *buffer;
+
+    ngx_http_log_chunk_t       *chunks;
+    ngx_uint_t                  nchunks;
+    size_t                      size;
+
+    ngx_atomic_t                head;
+    ngx_atomic_t                tail;
+
+    ngx_uint_t                  overflow;
+    ngx_uint_t                  dropped;
+    ngx_uint_t                  reported;
+    time_t                      error_log_time;
+
+    /* 以下字段由写日志线程设置，worker进程读取后记录到error_log */
+    ngx_atomic_t                err;
+    ngx_atomic_t                incomplete;
+
+    /* 写日志线程正在处理该队列，否则缓冲区同步写入 */
+    ngx_uint_t                  running;    /* unsigned  running:1; */
+};
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -66,6 +145,8 @@ typedef struct {
     ngx_http_log_script_t      *script;
     time_t                      disk_full_time;
     time_t                      error_log_time;
+    //日志发送到syslog服务器时不为NULL，此时file为NULL
+    ngx_syslog_peer_t          *syslog_peer;
     ngx_http_log_fmt_t         *format;
 } ngx_http_log_t;
 
@@ -85,6 +166,8 @@ typedef struct {
     ngx_str_t                   name;
     size_t                      len;
     ngx_http_log_op_run_pt      run;
+    size_t                      binary_len;
+    ngx_http_log_op_run_pt      binary;
 } ngx_http_log_var_t;
 
 
@@ -104,6 +187,15 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_log_async_publish(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log, ngx_uint_t block);
+static void ngx_http_log_async_drain(ngx_http_log_async_t *async);
+static void ngx_http_log_async_report(ngx_http_log_async_t *async,
+    ngx_log_t *log);
+static void *ngx_http_log_thread_cycle(void *data);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -124,13 +216,37 @@ static u_char *ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 
 static ngx_int_t ngx_http_log_variable_compile(ngx_conf_t *cf,
-    ngx_http_log_op_t *op, ngx_str_t *value);
+    ngx_http_log_op_t *op, ngx_str_t *value, ngx_uint_t binary);
 static size_t ngx_http_log_variable_getlen(ngx_http_request_t *r,
     uintptr_t data);
 static u_char *ngx_http_log_variable(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static uintptr_t ngx_http_log_escape(u_char *dst, u_char *src, size_t size);
 
+static u_char *ngx_http_log_binary_record(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_fmt_t *fmt);
+static u_char *ngx_http_log_varint(u_char *p, uint64_t n);
+static u_char *ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_time(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_length(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static size_t ngx_http_log_binary_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_binary_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_log_create_loc_conf(ngx_conf_t *cf);
@@ -141,11 +257,20 @@ static char *ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
-    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+    ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s,
+    ngx_uint_t binary);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
 
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_log_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_log_init_process(ngx_cycle_t *cycle);
+static void ngx_http_log_exit_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_log_thread_start(ngx_cycle_t *cycle);
+static void ngx_http_log_thread_stop(ngx_log_t *log);
+#endif
+
 
 static ngx_command_t  ngx_http_log_commands[] = {
 
@@ -196,16 +321,45 @@ ngx_module_t  ngx_http_log_module = {
     ngx_http_log_commands,                 /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_init_module,              /* init module */
+    ngx_http_log_init_process,             /* init process */
+#else
     NULL,                                  /* init module */
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_exit_process,             /* exit process */
+#else
     NULL,                                  /* exit process */
+#endif
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static pthread_t        ngx_http_log_tid;
+static pthread_mutex_t  ngx_http_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 有新的已填满缓冲区等待写入 */
+static pthread_cond_t   ngx_http_log_cond = PTHREAD_COND_INITIALIZER;
+/* 写日志线程写完了一批缓冲区 */
+static pthread_cond_t   ngx_http_log_done = PTHREAD_COND_INITIALIZER;
+
+static ngx_uint_t       ngx_http_log_thread_running;
+static ngx_uint_t       ngx_http_log_thread_quit;
+/* 写日志线程处理的队列数组，属于启动线程时的cycle */
+static ngx_array_t     *ngx_http_log_thread_asyncs;
+/* 单进程模式下已调用过init_process，重新加载配置时需要重启线程 */
+static ngx_uint_t       ngx_http_log_process_inited;
+
+#endif
+
+
 static ngx_str_t  ngx_http_access_log = ngx_string(NGX_HTTP_LOG_PATH);
 
 
@@ -216,22 +370,35 @@ static ngx_str_t  ngx_http_combined_fmt =
 
 
 static ngx_http_log_var_t  ngx_http_log_vars[] = {
-    { ngx_string("pipe"), 1, ngx_http_log_pipe },
+    { ngx_string("pipe"), 1, ngx_http_log_pipe,
+                          3, ngx_http_log_binary_pipe },
     { ngx_string("time_local"), sizeof("28/Sep/1970:12:00:00 +0600") - 1,
-                          ngx_http_log_time },
+                          ngx_http_log_time,
+                          NGX_HTTP_LOG_BINARY_LEN, ngx_http_log_binary_time },
     { ngx_string("time_iso8601"), sizeof("1970-09-28T12:00:00+06:00") - 1,
-                          ngx_http_log_iso8601 },
-    { ngx_string("msec"), NGX_TIME_T_LEN + 4, ngx_http_log_msec },
+                          ngx_http_log_iso8601,
+                          NGX_HTTP_LOG_BINARY_LEN, ngx_http_log_binary_time },
+    { ngx_string("msec"), NGX_TIME_T_LEN + 4, ngx_http_log_msec,
+                          NGX_HTTP_LOG_BINARY_LEN, ngx_http_log_binary_msec },
     { ngx_string("request_time"), NGX_TIME_T_LEN + 4,
-                          ngx_http_log_request_time },
-    { ngx_string("status"), NGX_INT_T_LEN, ngx_http_log_status },
-    { ngx_string("bytes_sent"), NGX_OFF_T_LEN, ngx_http_log_bytes_sent },
+                          ngx_http_log_request_time,
+                          NGX_HTTP_LOG_BINARY_LEN,
+                          ngx_http_log_binary_request_time },
+    { ngx_string("status"), NGX_INT_T_LEN, ngx_http_log_status,
+                          NGX_HTTP_LOG_BINARY_LEN, ngx_http_log_binary_status },
+    { ngx_string("bytes_sent"), NGX_OFF_T_LEN, ngx_http_log_bytes_sent,
+                          NGX_HTTP_LOG_BINARY_LEN,
+                          ngx_http_log_binary_bytes_sent },
     { ngx_string("body_bytes_sent"), NGX_OFF_T_LEN,
-                          ngx_http_log_body_bytes_sent },
+                          ngx_http_log_body_bytes_sent,
+                          NGX_HTTP_LOG_BINARY_LEN,
+                          ngx_http_log_binary_body_bytes_sent },
     { ngx_string("request_length"), NGX_SIZE_T_LEN,
-                          ngx_http_log_request_length },
+                          ngx_http_log_request_length,
+                          NGX_HTTP_LOG_BINARY_LEN,
+                          ngx_http_log_binary_request_length },
 
-    { ngx_null_string, 0, NULL }
+    { ngx_null_string, 0, NULL, 0, NULL }
 };
 
 
@@ -282,12 +449,52 @@ ngx_http_log_handler(ngx_http_request_t *r)
             }
         }
 
-        len += NGX_LINEFEED_SIZE;
+        if (log[l].syslog_peer) {
+
+            /* length of syslog's PRI and HEADER message parts */
+            len += sizeof("<255>Jan 01 00:00:00 ") - 1
+                   + ngx_cycle->hostname.len + 1
+                   + log[l].syslog_peer->tag.len + 2;
+
+            goto alloc_line;
+        }
+
+        len += log[l].format->binary ? NGX_HTTP_LOG_VARINT_LEN
+                                     : NGX_LINEFEED_SIZE;
 
         buffer = log[l].file ? log[l].file->data : NULL;
 
         if (buffer) {
 
+#if (NGX_HAVE_PTHREAD)
+
+            if (buffer->async
+                && buffer->async->running
+                && len > (size_t) (buffer->last - buffer->pos)
+                && ngx_http_log_async_publish(buffer, r->connection->log, 0)
+                   != NGX_OK)
+            {
+                /* all buffers are queued and "overflow=drop" is set */
+                buffer->async->dropped++;
+#if (NGX_STAT_STUB)
+                (void) ngx_atomic_fetch_add(ngx_stat_log_dropped, 1);
+#endif
+                continue;
+            }
+
+            if (buffer->async
+                && buffer->async->running
+                && len > (size_t) (buffer->last - buffer->pos))
+            {
+                /*
+                 * 记录比一个缓冲区还大，将被同步写入，
+                 * 先等待队列中较早的记录写完以保持顺序
+                 */
+                ngx_http_log_async_drain(buffer->async);
+            }
+
+#endif
+
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
                 ngx_http_log_write(r, &log[l], buffer->start,
@@ -304,11 +511,16 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     ngx_add_timer(buffer->event, buffer->flush);
                 }
 
-                for (i = 0; i < log[l].format->ops->nelts; i++) {
-                    p = op[i].run(r, p, &op[i]);
-                }
+                if (log[l].format->binary) {
+                    p = ngx_http_log_binary_record(r, p, log[l].format);
+
+                } else {
+                    for (i = 0; i < log[l].format->ops->nelts; i++) {
+                        p = op[i].run(r, p, &op[i]);
+                    }
 
-                ngx_linefeed(p);
+                    ngx_linefeed(p);
+                }
 
                 buffer->pos = p;
 
@@ -320,6 +532,8 @@ ngx_http_log_handler(ngx_http_request_t *r)
             }
         }
 
+    alloc_line:
+
         line = ngx_pnalloc(r->pool, len);
         if (line == NULL) {
             return NGX_ERROR;
@@ -327,11 +541,29 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         p = line;
 
-        for (i = 0; i < log[l].format->ops->nelts; i++) {
-            p = op[i].run(r, p, &op[i]);
+        if (log[l].syslog_peer) {
+            p = ngx_syslog_add_header(log[l].syslog_peer, line);
+
+            for (i = 0; i < log[l].format->ops->nelts; i++) {
+                p = op[i].run(r, p, &op[i]);
+            }
+
+            /* failures are accounted and reported by the syslog peer */
+            (void) ngx_syslog_send(log[l].syslog_peer, line, p - line);
+
+            continue;
         }
 
-        ngx_linefeed(p);
+        if (log[l].format->binary) {
+            p = ngx_http_log_binary_record(r, p, log[l].format);
+
+        } else {
+            for (i = 0; i < log[l].format->ops->nelts; i++) {
+                p = op[i].run(r, p, &op[i]);
+            }
+
+            ngx_linefeed(p);
+        }
 
         ngx_http_log_write(r, &log[l], line, p - line);
     }
@@ -657,6 +889,16 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 
     buffer = file->data;
 
+#if (NGX_HAVE_PTHREAD)
+
+    if (buffer->async && buffer->async->running) {
+        (void) ngx_http_log_async_publish(buffer, log, 1);
+        ngx_http_log_async_drain(buffer->async);
+        return;
+    }
+
+#endif
+
     len = buffer->pos - buffer->start;
 
     if (len == 0) {
@@ -695,13 +937,246 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 static void
 ngx_http_log_flush_handler(ngx_event_t *ev)
 {
+#if (NGX_HAVE_PTHREAD)
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#endif
+
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "http log buffer flush handler");
 
+#if (NGX_HAVE_PTHREAD)
+
+    file = ev->data;
+    buffer = file->data;
+
+    if (buffer->async && buffer->async->running) {
+
+        if (ngx_http_log_async_publish(buffer, ev->log, 0) != NGX_OK) {
+            /* the queue is full, try again later */
+            ngx_add_timer(ev, buffer->flush);
+        }
+
+        return;
+    }
+
+#endif
+
     ngx_http_log_flush(ev->data, ev->log);
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_log_async_publish(ngx_http_log_buf_t *buffer, ngx_log_t *log,
+    ngx_uint_t block)
+{
+    size_t                 len;
+    ngx_http_log_async_t  *async;
+    ngx_http_log_chunk_t  *chunk;
+
+    async = buffer->async;
+
+    ngx_http_log_async_report(async, log);
+
+    len = buffer->pos - buffer->start;
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    /* one chunk is always kept for the worker to fill */
+
+    if (async->head - async->tail >= async->nchunks - 1) {
+
+        if (!block && async->overflow == NGX_HTTP_LOG_OVERFLOW_DROP) {
+            return NGX_AGAIN;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http log queue of \"%s\" is full, waiting",
+                       async->file->name.data);
+
+        (void) pthread_mutex_lock(&ngx_http_log_mutex);
+
+        while (async->head - async->tail >= async->nchunks - 1) {
+            (void) pthread_cond_wait(&ngx_http_log_done, &ngx_http_log_mutex);
+        }
+
+        (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+    }
+
+    async->chunks[async->head % async->nchunks].len = len;
+
+    ngx_memory_barrier();
+
+    async->head++;
+
+    (void) pthread_mutex_lock(&ngx_http_log_mutex);
+    (void) pthread_cond_signal(&ngx_http_log_cond);
+    (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+
+    chunk = &async->chunks[async->head % async->nchunks];
+
+    buffer->start = chunk->start;
+    buffer->pos = chunk->start;
+    buffer->last = chunk->start + async->size;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_async_drain(ngx_http_log_async_t *async)
+{
+    (void) pthread_mutex_lock(&ngx_http_log_mutex);
+
+    while (async->tail != async->head) {
+        (void) pthread_cond_wait(&ngx_http_log_done, &ngx_http_log_mutex);
+    }
+
+    (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+}
+
+
+static void
+ngx_http_log_async_report(ngx_http_log_async_t *async, ngx_log_t *log)
+{
+    time_t     now;
+    ngx_err_t  err;
+
+    now = ngx_time();
+
+    if (now - async->error_log_time < 60) {
+        return;
+    }
+
+    if (async->err) {
+        err = (ngx_err_t) async->err;
+        async->err = 0;
+
+        ngx_log_error(NGX_LOG_ALERT, log, err,
+                      "writev() to \"%s\" failed", async->file->name.data);
+
+        async->error_log_time = now;
+    }
+
+    if (async->incomplete) {
+        async->incomplete = 0;
+
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "writev() to \"%s\" was incomplete",
+                      async->file->name.data);
+
+        async->error_log_time = now;
+    }
+
+    if (async->dropped != async->reported) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%ui records of access log \"%s\" were dropped "
+                      "because the queue was full",
+                      async->dropped - async->reported,
+                      async->file->name.data);
+
+        async->reported = async->dropped;
+        async->error_log_time = now;
+    }
+}
+
+
+static void *
+ngx_http_log_thread_cycle(void *data)
+{
+    ngx_array_t *asyncs = data;
+
+    size_t                  size;
+    ssize_t                 n;
+    ngx_uint_t              i, k, head, tail, work;
+    struct iovec            iov[NGX_HTTP_LOG_ASYNC_IOVS];
+    ngx_http_log_chunk_t   *chunk;
+    ngx_http_log_async_t  **async;
+
+    async = asyncs->elts;
+
+    for ( ;; ) {
+
+        work = 0;
+
+        for (i = 0; i < asyncs->nelts; i++) {
+
+            head = async[i]->head;
+            tail = async[i]->tail;
+
+            if (head == tail) {
+                continue;
+            }
+
+            ngx_memory_barrier();
+
+            size = 0;
+
+            for (k = 0; tail + k != head && k < NGX_HTTP_LOG_ASYNC_IOVS; k++) {
+                chunk = &async[i]->chunks[(tail + k) % async[i]->nchunks];
+
+                iov[k].iov_base = (void *) chunk->start;
+                iov[k].iov_len = chunk->len;
+                size += chunk->len;
+            }
+
+            n = writev(async[i]->file->fd, iov, (int) k);
+
+            if (n == -1) {
+                async[i]->err = (ngx_atomic_uint_t) ngx_errno;
+
+            } else if ((size_t) n != size) {
+                async[i]->incomplete = 1;
+            }
+
+            ngx_memory_barrier();
+
+            async[i]->tail = tail + k;
+
+            work = 1;
+        }
+
+        (void) pthread_mutex_lock(&ngx_http_log_mutex);
+
+        if (work) {
+            (void) pthread_cond_broadcast(&ngx_http_log_done);
+            (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+            continue;
+        }
+
+        for (i = 0; i < asyncs->nelts; i++) {
+            if (async[i]->head != async[i]->tail) {
+                work = 1;
+                break;
+            }
+        }
+
+        if (!work) {
+            if (ngx_http_log_thread_quit) {
+                (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+                break;
+            }
+
+            (void) pthread_cond_wait(&ngx_http_log_cond, &ngx_http_log_mutex);
+        }
+
+        (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+    }
+
+    return NULL;
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -847,7 +1322,7 @@ ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
 
 static ngx_int_t
 ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
-    ngx_str_t *value)
+    ngx_str_t *value, ngx_uint_t binary)
 {
     ngx_int_t  index;
 
@@ -857,8 +1332,16 @@ ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
     }
 
     op->len = 0;
-    op->getlen = ngx_http_log_variable_getlen;
-    op->run = ngx_http_log_variable;
+
+    if (binary) {
+        op->getlen = ngx_http_log_binary_variable_getlen;
+        op->run = ngx_http_log_binary_variable;
+
+    } else {
+        op->getlen = ngx_http_log_variable_getlen;
+        op->run = ngx_http_log_variable;
+    }
+
     op->data = index;
 
     return NGX_OK;
@@ -966,36 +1449,238 @@ ngx_http_log_escape(u_char *dst, u_char *src, size_t size)
 }
 
 
-static void *
-ngx_http_log_create_main_conf(ngx_conf_t *cf)
+static u_char *
+ngx_http_log_binary_record(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_fmt_t *fmt)
 {
-    ngx_http_log_main_conf_t  *conf;
+    u_char             *p, *start;
+    ngx_uint_t          i;
+    ngx_http_log_op_t  *op;
 
-    ngx_http_log_fmt_t  *fmt;
+    /*
+     * the record length is not known in advance, so the fields are written
+     * after the room for the longest varint and are moved back afterwards
+     */
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_main_conf_t));
-    if (conf == NULL) {
-        return NULL;
-    }
+    start = buf + NGX_HTTP_LOG_VARINT_LEN;
+    p = start;
 
-    if (ngx_array_init(&conf->formats, cf->pool, 4, sizeof(ngx_http_log_fmt_t))
-        != NGX_OK)
-    {
-        return NULL;
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+        p = op[i].run(r, p, &op[i]);
     }
 
-    fmt = ngx_array_push(&conf->formats);
-    if (fmt == NULL) {
-        return NULL;
-    }
+    buf = ngx_http_log_varint(buf, p - start);
 
-    ngx_str_set(&fmt->name, "combined");
+    return ngx_movemem(buf, start, p - start);
+}
 
-    fmt->flushes = NULL;
 
-    fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
-    if (fmt->ops == NULL) {
-        return NULL;
+static u_char *
+ngx_http_log_varint(u_char *p, uint64_t n)
+{
+    while (n >= 0x80) {
+        *p++ = (u_char) (n | 0x80);
+        n >>= 7;
+    }
+
+    *p++ = (u_char) n;
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    *buf++ = NGX_HTTP_LOG_BINARY_STRING;
+    *buf++ = 1;
+    *buf++ = r->pipeline ? 'p' : '.';
+
+    return buf;
+}
+
+
+static u_char *
+ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    *buf++ = NGX_HTTP_LOG_BINARY_TIME;
+
+    return ngx_http_log_varint(buf, (uint64_t) ngx_time());
+}
+
+
+static u_char *
+ngx_http_log_binary_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    *buf++ = NGX_HTTP_LOG_BINARY_MSEC;
+
+    return ngx_http_log_varint(buf, (uint64_t) tp->sec * 1000 + tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    *buf++ = NGX_HTTP_LOG_BINARY_DURATION;
+
+    return ngx_http_log_varint(buf, (uint64_t) ms);
+}
+
+
+static u_char *
+ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else if (r->headers_out.status) {
+        status = r->headers_out.status;
+
+    } else if (r->http_version == NGX_HTTP_VERSION_9) {
+        status = 9;
+
+    } else {
+        status = 0;
+    }
+
+    *buf++ = NGX_HTTP_LOG_BINARY_UINT;
+
+    return ngx_http_log_varint(buf, status);
+}
+
+
+static u_char *
+ngx_http_log_binary_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    *buf++ = NGX_HTTP_LOG_BINARY_UINT;
+
+    return ngx_http_log_varint(buf, (uint64_t) r->connection->sent);
+}
+
+
+static u_char *
+ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    *buf++ = NGX_HTTP_LOG_BINARY_UINT;
+
+    return ngx_http_log_varint(buf, length > 0 ? (uint64_t) length : 0);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    *buf++ = NGX_HTTP_LOG_BINARY_UINT;
+
+    return ngx_http_log_varint(buf, (uint64_t) r->request_length);
+}
+
+
+static size_t
+ngx_http_log_binary_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return NGX_HTTP_LOG_BINARY_LEN + value->len;
+}
+
+
+static u_char *
+ngx_http_log_binary_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf = NGX_HTTP_LOG_BINARY_NULL;
+        return buf + 1;
+    }
+
+    /* the values are not escaped in binary logs */
+
+    *buf++ = NGX_HTTP_LOG_BINARY_STRING;
+    buf = ngx_http_log_varint(buf, value->len);
+
+    return ngx_cpymem(buf, value->data, value->len);
+}
+
+
+static void *
+ngx_http_log_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_log_main_conf_t  *conf;
+
+    ngx_http_log_fmt_t  *fmt;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_main_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&conf->formats, cf->pool, 4, sizeof(ngx_http_log_fmt_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+#if (NGX_HAVE_PTHREAD)
+    if (ngx_array_init(&conf->asyncs, cf->pool, 1,
+                       sizeof(ngx_http_log_async_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+#endif
+
+    fmt = ngx_array_push(&conf->formats);
+    if (fmt == NULL) {
+        return NULL;
+    }
+
+    ngx_str_set(&fmt->name, "combined");
+
+    fmt->flushes = NULL;
+    fmt->binary = 0;
+
+    fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
+    if (fmt->ops == NULL) {
+        return NULL;
     }
 
     return conf;
@@ -1093,8 +1778,14 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_t             *log;
     ngx_http_log_buf_t         *buffer;
     ngx_http_log_fmt_t         *fmt;
+    ngx_syslog_peer_t          *peer;
     ngx_http_log_main_conf_t   *lmcf;
     ngx_http_script_compile_t   sc;
+#if (NGX_HAVE_PTHREAD)
+    ngx_int_t                   nchunks;
+    ngx_uint_t                  overflow;
+    ngx_http_log_async_t       *async, **a;
+#endif
 
     value = cf->args->elts;
 
@@ -1125,6 +1816,22 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ngx_memzero(log, sizeof(ngx_http_log_t));
 
+    if (ngx_strncmp(value[1].data, "syslog:", 7) == 0) {
+
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_syslog_peer_t));
+        if (peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_syslog_process_conf(cf, peer) != NGX_CONF_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->syslog_peer = peer;
+
+        goto process_formats;
+    }
+
     n = ngx_http_script_variables_count(&value[1]);
 
     if (n == 0) {
@@ -1158,6 +1865,8 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+process_formats:
+
     if (cf->args->nelts >= 3) {
         name = value[2];
 
@@ -1189,6 +1898,10 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_HAVE_PTHREAD)
+    nchunks = 0;
+    overflow = NGX_HTTP_LOG_OVERFLOW_BLOCK;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1255,11 +1968,96 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_HAVE_PTHREAD)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 5) {
+                nchunks = 8;
+                continue;
+            }
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            nchunks = ngx_atoi(s.data, s.len);
+
+            if (nchunks < 2) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of async buffers \"%V\"",
+                                   &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without pthreads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+#if (NGX_HAVE_PTHREAD)
+
+        if (ngx_strncmp(value[i].data, "overflow=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            if (s.len == 4 && ngx_strncmp(s.data, "drop", 4) == 0) {
+                overflow = NGX_HTTP_LOG_OVERFLOW_DROP;
+                continue;
+            }
+
+            if (s.len == 5 && ngx_strncmp(s.data, "block", 5) == 0) {
+                overflow = NGX_HTTP_LOG_OVERFLOW_BLOCK;
+                continue;
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid overflow mode \"%V\"", &s);
+            return NGX_CONF_ERROR;
+        }
+
+#endif
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HAVE_PTHREAD)
+
+    if (nchunks && gzip) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"async\" cannot be used with \"gzip\"");
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
+    if (log->syslog_peer) {
+
+        if (size || flush) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs to syslog cannot be buffered");
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->format->binary) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary log format cannot be used "
+                               "with syslog");
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1289,6 +2087,21 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
 
+#if (NGX_HAVE_PTHREAD)
+
+            if ((buffer->async ? (ngx_int_t) buffer->async->nchunks : 0)
+                != nchunks
+                || (buffer->async && buffer->async->overflow != overflow))
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "access_log \"%V\" already defined "
+                                   "with conflicting parameters",
+                                   &value[1]);
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
             return NGX_CONF_OK;
         }
 
@@ -1320,6 +2133,37 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
         buffer->gzip = gzip;
 
+#if (NGX_HAVE_PTHREAD)
+
+        if (nchunks) {
+            async = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_async_t));
+            if (async == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            /*
+             * the chunks are allocated by each worker process
+             * in ngx_http_log_thread_start()
+             */
+
+            async->file = log->file;
+            async->buffer = buffer;
+            async->nchunks = nchunks;
+            async->size = size;
+            async->overflow = overflow;
+
+            a = ngx_array_push(&lmcf->asyncs);
+            if (a == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *a = async;
+
+            buffer->async = async;
+        }
+
+#endif
+
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
     }
@@ -1374,13 +2218,31 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
+    fmt->binary = 0;
+
+    if (value[2].len == 6 && ngx_strcmp(value[2].data, "binary") == 0) {
+
+        if (cf->args->nelts == 3) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "no fields in binary \"log_format\" \"%V\"",
+                               &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        fmt->binary = 1;
+
+        return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops,
+                                           cf->args, 3, 1);
+    }
+
+    return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2,
+                                       0);
 }
 
 
 static char *
 ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
-    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s)
+    ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s, ngx_uint_t binary)
 {
     u_char              *data, *p, ch;
     size_t               i, len;
@@ -1461,16 +2323,18 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     if (v->name.len == var.len
                         && ngx_strncmp(v->name.data, var.data, var.len) == 0)
                     {
-                        op->len = v->len;
+                        op->len = binary ? v->binary_len : v->len;
                         op->getlen = NULL;
-                        op->run = v->run;
+                        op->run = binary ? v->binary : v->run;
                         op->data = 0;
 
                         goto found;
                     }
                 }
 
-                if (ngx_http_log_variable_compile(cf, op, &var) != NGX_OK) {
+                if (ngx_http_log_variable_compile(cf, op, &var, binary)
+                    != NGX_OK)
+                {
                     return NGX_CONF_ERROR;
                 }
 
@@ -1497,6 +2361,12 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             len = &value[s].data[i] - data;
 
+            if (binary) {
+                /* text between variables only separates binary fields */
+                ops->nelts--;
+                continue;
+            }
+
             if (len) {
 
                 op->len = len;
@@ -1669,7 +2539,7 @@ ngx_http_log_init(ngx_conf_t *cf)
         *value = ngx_http_combined_fmt;
         fmt = lmcf->formats.elts;
 
-        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0)
+        if (ngx_http_log_compile_format(cf, NULL, fmt->ops, &a, 0, 0)
             != NGX_CONF_OK)
         {
             return NGX_ERROR;
@@ -1687,3 +2557,167 @@ ngx_http_log_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_log_init_module(ngx_cycle_t *cycle)
+{
+    /*
+     * 单进程模式下重新加载配置不会调用init_process，
+     * 写日志线程仍在处理旧cycle的文件，因此在新cycle中重启线程
+     */
+
+    if (!ngx_http_log_process_inited) {
+        return NGX_OK;
+    }
+
+    ngx_http_log_thread_stop(cycle->log);
+
+    return ngx_http_log_thread_start(cycle);
+}
+
+
+static ngx_int_t
+ngx_http_log_init_process(ngx_cycle_t *cycle)
+{
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_process == NGX_PROCESS_SINGLE) {
+        ngx_http_log_process_inited = 1;
+    }
+
+    return ngx_http_log_thread_start(cycle);
+}
+
+
+static void
+ngx_http_log_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_log_thread_stop(cycle->log);
+}
+
+
+static ngx_int_t
+ngx_http_log_thread_start(ngx_cycle_t *cycle)
+{
+    int                        err;
+    u_char                    *p;
+    sigset_t                   set, old;
+    ngx_uint_t                 i, k;
+    ngx_http_log_buf_t        *buffer;
+    ngx_http_log_async_t     **async;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->asyncs.nelts == 0) {
+        return NGX_OK;
+    }
+
+    async = lmcf->asyncs.elts;
+
+    for (i = 0; i < lmcf->asyncs.nelts; i++) {
+
+        async[i]->chunks = ngx_palloc(cycle->pool, async[i]->nchunks
+                                             * sizeof(ngx_http_log_chunk_t));
+        if (async[i]->chunks == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_pnalloc(cycle->pool, async[i]->nchunks * async[i]->size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (k = 0; k < async[i]->nchunks; k++) {
+            async[i]->chunks[k].start = p;
+            async[i]->chunks[k].len = 0;
+            p += async[i]->size;
+        }
+
+        async[i]->head = 0;
+        async[i]->tail = 0;
+    }
+
+    ngx_http_log_thread_quit = 0;
+
+    /* the log thread must not handle any signal */
+
+    (void) sigfillset(&set);
+    (void) pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    err = pthread_create(&ngx_http_log_tid, NULL, ngx_http_log_thread_cycle,
+                         &lmcf->asyncs);
+
+    (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                      "pthread_create() failed, "
+                      "access logs will be written synchronously");
+        return NGX_OK;
+    }
+
+    for (i = 0; i < lmcf->asyncs.nelts; i++) {
+        buffer = async[i]->buffer;
+
+        buffer->start = async[i]->chunks[0].start;
+        buffer->pos = buffer->start;
+        buffer->last = buffer->start + async[i]->size;
+
+        async[i]->running = 1;
+    }
+
+    ngx_http_log_thread_asyncs = &lmcf->asyncs;
+    ngx_http_log_thread_running = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_thread_stop(ngx_log_t *log)
+{
+    ngx_uint_t              i;
+    ngx_http_log_async_t  **async;
+
+    if (!ngx_http_log_thread_running) {
+        return;
+    }
+
+    async = ngx_http_log_thread_asyncs->elts;
+
+    for (i = 0; i < ngx_http_log_thread_asyncs->nelts; i++) {
+        (void) ngx_http_log_async_publish(async[i]->buffer, log, 1);
+        ngx_http_log_async_drain(async[i]);
+
+        async[i]->error_log_time = 0;
+        ngx_http_log_async_report(async[i], log);
+    }
+
+    (void) pthread_mutex_lock(&ngx_http_log_mutex);
+
+    ngx_http_log_thread_quit = 1;
+    (void) pthread_cond_signal(&ngx_http_log_cond);
+
+    (void) pthread_mutex_unlock(&ngx_http_log_mutex);
+
+    (void) pthread_join(ngx_http_log_tid, NULL);
+
+    /* the buffers of the old cycle are written synchronously from now on */
+
+    for (i = 0; i < ngx_http_log_thread_asyncs->nelts; i++) {
+        async[i]->running = 0;
+    }
+
+    ngx_http_log_thread_asyncs = NULL;
+    ngx_http_log_thread_running = 0;
+}
+
+#endif
@@ -26,6 +26,7 @@ typedef struct {
 #endif
 
     ngx_http_variable_value_t  *default_value;
+    ngx_shared_table_t         *dynamic;
     ngx_conf_t                 *cf;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_conf_ctx_t;
@@ -35,6 +36,7 @@ typedef struct {
     ngx_http_map_t              map;
     ngx_http_complex_value_t    value;
     ngx_http_variable_value_t  *default_value;
+    ngx_shared_table_t         *dynamic;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_ctx_t;
 
@@ -44,6 +46,9 @@ static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static ngx_int_t ngx_http_map_dynamic_entry(ngx_shared_table_t *st,
+    ngx_pool_t *pool, ngx_str_t *key, ngx_uint_t *class);
+static ngx_int_t ngx_http_map_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
@@ -95,7 +100,7 @@ ngx_module_t  ngx_http_map_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_map_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -110,7 +115,9 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_map_ctx_t  *map = (ngx_http_map_ctx_t *) data;
 
-    ngx_str_t                   val;
+    u_char                     *low;
+    ngx_int_t                   rc;
+    ngx_str_t                   val, dval;
     ngx_http_variable_value_t  *value;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -124,6 +131,38 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         val.len--;
     }
 
+    if (map->dynamic) {
+
+        /* the dynamic entries are exact and override the static ones */
+
+        low = ngx_pnalloc(r->pool, val.len);
+        if (low == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_strlow(low, val.data, val.len);
+
+        rc = ngx_shared_table_lookup(map->dynamic, r->pool, low, val.len,
+                                     &dval);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_OK) {
+            v->len = dval.len;
+            v->valid = 1;
+            v->no_cacheable = 0;
+            v->not_found = 0;
+            v->data = dval.data;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http map dynamic: \"%V\" \"%v\"", &val, v);
+
+            return NGX_OK;
+        }
+    }
+
     value = ngx_http_map_find(r, &map->map, &val);
 
     if (value == NULL) {
@@ -264,6 +303,7 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
 
     ctx.default_value = NULL;
+    ctx.dynamic = NULL;
     ctx.cf = &save;
     ctx.hostnames = 0;
 
@@ -286,6 +326,7 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                                              &ngx_http_variable_null_value;
 
     map->hostnames = ctx.hostnames;
+    map->dynamic = ctx.dynamic;
 
     hash.key = ngx_hash_key_lc;
     hash.max_size = mcf->hash_max_size;
@@ -391,6 +432,26 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         ctx->hostnames = 1;
         return NGX_CONF_OK;
 
+    } else if (cf->args->nelts > 2
+               && ngx_strcmp(value[0].data, "dynamic") == 0)
+    {
+        if (ctx->dynamic) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate \"dynamic\" parameter");
+            return NGX_CONF_ERROR;
+        }
+
+        ctx->dynamic = ngx_shared_table_add(cf, &value[1],
+                                            cf->args->nelts - 1,
+                                            &ngx_http_map_module);
+        if (ctx->dynamic == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ctx->dynamic->entry = ngx_http_map_dynamic_entry;
+
+        return NGX_CONF_OK;
+
     } else if (cf->args->nelts != 2) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid number of the map parameters");
@@ -565,3 +626,20 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+static ngx_int_t
+ngx_http_map_dynamic_entry(ngx_shared_table_t *st, ngx_pool_t *pool,
+    ngx_str_t *key, ngx_uint_t *class)
+{
+    ngx_strlow(key->data, key->data, key->len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_map_init_process(ngx_cycle_t *cycle)
+{
+    return ngx_shared_table_init_process(cycle, &ngx_http_map_module);
+}
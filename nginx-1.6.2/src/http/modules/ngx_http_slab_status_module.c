@@ -0,0 +1,261 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_SLAB_STATUS_ZONE_LEN                                         \
+    (sizeof("zone \"\" size  pages  free  runs  largest  large \n") - 1       \
+     + NGX_SIZE_T_LEN + 5 * NGX_INT_T_LEN)
+
+#define NGX_HTTP_SLAB_STATUS_POOL_LEN                                         \
+    (sizeof("  pool  size  pages  free  runs  largest  large \n") - 1         \
+     + NGX_SIZE_T_LEN + 6 * NGX_INT_T_LEN)
+
+#define NGX_HTTP_SLAB_STATUS_SLOT_LEN                                         \
+    (sizeof("     pages  total  used  reqs  fails \n") - 1                    \
+     + NGX_SIZE_T_LEN + 5 * NGX_INT_T_LEN)
+
+
+static ngx_int_t ngx_http_slab_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_slab_status_slots(u_char *p, ngx_slab_usage_t *u,
+    char *indent);
+static char *ngx_http_slab_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_slab_status_commands[] = {
+
+    { ngx_string("slab_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_slab_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_slab_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_slab_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_slab_status_module_ctx,      /* module context */
+    ngx_http_slab_status_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * the output lists every shared zone of the current cycle, followed by
+ * the pools created in it, such as the shards of limit_req zones:
+ *
+ *   zone "one" size 1048576 pages 253 free 1 runs 1 largest 1 large 248
+ *     8 pages 0 total 0 used 0 reqs 0 fails 0
+ *     16 pages 1 total 252 used 3 reqs 17 fails 0
+ *     ...
+ *     pool 1 size 253952 pages 61 free 58 runs 1 largest 58 large 0
+ *       8 pages 0 total 0 used 0 reqs 0 fails 0
+ *       ...
+ */
+
+static ngx_int_t
+ngx_http_slab_status_handler(ngx_http_request_t *r)
+{
+    size_t                  size;
+    ngx_int_t               rc;
+    ngx_buf_t              *b;
+    ngx_uint_t              i, n;
+    ngx_chain_t             out;
+    ngx_list_part_t        *part;
+    ngx_shm_zone_t         *shm_zone;
+    ngx_slab_pool_t        *sp, *pool;
+    ngx_slab_usage_t        u;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    size = 0;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += NGX_HTTP_SLAB_STATUS_ZONE_LEN + shm_zone[i].shm.name.len
+                + NGX_SLAB_MAX_SLOTS * NGX_HTTP_SLAB_STATUS_SLOT_LEN;
+
+        /* the pools are created when a zone is initialized */
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        for (pool = sp->pools; pool; pool = pool->next) {
+            size += NGX_HTTP_SLAB_STATUS_POOL_LEN
+                    + NGX_SLAB_MAX_SLOTS * NGX_HTTP_SLAB_STATUS_SLOT_LEN;
+        }
+    }
+
+    if (size == 0) {
+        size = sizeof("no shared zones\n") - 1;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        ngx_slab_usage(sp, &u);
+
+        b->last = ngx_sprintf(b->last,
+                              "zone \"%V\" size %uz pages %ui free %ui "
+                              "runs %ui largest %ui large %ui\n",
+                              &shm_zone[i].shm.name, shm_zone[i].shm.size,
+                              u.pages, u.free_pages, u.free_runs,
+                              u.max_free_run, u.large_pages);
+
+        b->last = ngx_http_slab_status_slots(b->last, &u, "  ");
+
+        n = 0;
+
+        for (pool = sp->pools; pool; pool = pool->next) {
+
+            ngx_slab_usage(pool, &u);
+
+            b->last = ngx_sprintf(b->last,
+                                  "  pool %ui size %uz pages %ui free %ui "
+                                  "runs %ui largest %ui large %ui\n",
+                                  ++n, (size_t) (pool->end - (u_char *) pool),
+                                  u.pages, u.free_pages, u.free_runs,
+                                  u.max_free_run, u.large_pages);
+
+            b->last = ngx_http_slab_status_slots(b->last, &u, "    ");
+        }
+    }
+
+    if (b->last == b->pos) {
+        b->last = ngx_cpymem(b->last, "no shared zones\n",
+                             sizeof("no shared zones\n") - 1);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_slab_status_slots(u_char *p, ngx_slab_usage_t *u, char *indent)
+{
+    ngx_uint_t              n;
+    ngx_slab_slot_usage_t  *slot;
+
+    for (n = 0; n < u->nslots; n++) {
+        slot = &u->slots[n];
+
+        p = ngx_sprintf(p, "%s%uz pages %ui total %ui used %ui "
+                        "reqs %ui fails %ui\n",
+                        indent, slot->size, slot->pages, slot->total,
+                        slot->used, slot->reqs, slot->fails);
+    }
+
+    return p;
+}
+
+
+static char *
+ngx_http_slab_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_slab_status_handler;
+
+    return NGX_CONF_OK;
+}
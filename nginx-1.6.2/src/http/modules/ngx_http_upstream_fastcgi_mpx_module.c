@@ -0,0 +1,1516 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * FastCGI connection multiplexing.
+ *
+ * Every request gets a stream: a fake connection which is handed to the
+ * upstream module as a cached peer connection.  The fastcgi module builds
+ * and parses records as usual, the stream send_chain() sends its buffers
+ * to the shared backend connection as they are, only the record headers
+ * with request ids and the FCGI_KEEP_CONN flag are rewritten on the way,
+ * and the records read from the backend connection are split by request id
+ * into the streams' input buffers.
+ *
+ * A new connection asks the backend for FCGI_MPXS_CONNS and carries
+ * one request at a time until the backend reports that it multiplexes.
+ */
+
+
+/* the buffers sent to the backend connection in one send_chain() call */
+#define NGX_HTTP_FASTCGI_MPX_LINKS            16
+
+#define NGX_HTTP_FASTCGI_MPX_VERSION          1
+#define NGX_HTTP_FASTCGI_MPX_KEEP_CONN        1
+#define NGX_HTTP_FASTCGI_MPX_BEGIN_REQUEST    1
+#define NGX_HTTP_FASTCGI_MPX_ABORT_REQUEST    2
+#define NGX_HTTP_FASTCGI_MPX_END_REQUEST      3
+#define NGX_HTTP_FASTCGI_MPX_GET_VALUES       9
+#define NGX_HTTP_FASTCGI_MPX_GET_VALUES_RESULT  10
+
+
+typedef struct ngx_http_fastcgi_mpx_conn_s    ngx_http_fastcgi_mpx_conn_t;
+typedef struct ngx_http_fastcgi_mpx_stream_s  ngx_http_fastcgi_mpx_stream_t;
+
+
+/*
+ * a record being sent to the backend: the header and the FCGI_BEGIN_REQUEST
+ * body are rewritten, so they are kept here while the content is sent from
+ * the request buffers
+ */
+
+typedef struct {
+    u_char                             header[8];
+    ngx_uint_t                         header_len;
+    u_char                             body[8];
+    size_t                             rest;
+    size_t                             offset;
+} ngx_http_fastcgi_mpx_record_t;
+
+
+typedef struct {
+	//每个后端服务器最多建立的复用连接个数
+    ngx_uint_t                         max_connections;
+	//每个复用连接上最多同时进行的请求个数
+    ngx_uint_t                         max_streams;
+
+    ngx_queue_t                        connections;
+    ngx_queue_t                        free_connections;
+    ngx_queue_t                        free_streams;
+
+    ngx_http_upstream_init_pt          original_init_upstream;
+    ngx_http_upstream_init_peer_pt     original_init_peer;
+
+} ngx_http_fastcgi_mpx_srv_conf_t;
+
+
+struct ngx_http_fastcgi_mpx_conn_s {
+    ngx_queue_t                        queue;
+    ngx_http_fastcgi_mpx_srv_conf_t   *conf;
+
+    ngx_connection_t                  *connection;
+
+    ngx_str_t                         *name;
+    socklen_t                          socklen;
+    u_char                             sockaddr[NGX_SOCKADDRLEN];
+	//按请求id索引的流，值为ngx_http_fastcgi_mpx_aborted表示该id已发送FCGI_ABORT_REQUEST，正在等待FCGI_END_REQUEST
+    ngx_http_fastcgi_mpx_stream_t    **streams;
+    ngx_uint_t                         nstreams;
+    ngx_uint_t                         aborted;
+	//该连接上允许同时进行的请求个数，后端确认支持FCGI_MPXS_CONNS之前为1
+    ngx_uint_t                         max_streams;
+	//待发送给后端的数据，即连接自己生成的记录，如FCGI_GET_VALUES和FCGI_ABORT_REQUEST
+    ngx_http_upstream_mpx_bufs_t       out;
+	//正在发送记录的流，记录发送完之前其它流不能发送
+    ngx_http_fastcgi_mpx_stream_t     *writer;
+	//等待发送的流的个数
+    ngx_uint_t                         waiting;
+	//缓存的数据超过限制的流的个数，不为0时停止从后端读取
+    ngx_uint_t                         blocked;
+
+    /* the record being read from the backend */
+
+    u_char                             header[8];
+    ngx_uint_t                         header_len;
+    size_t                             rest;
+    ngx_http_fastcgi_mpx_stream_t     *stream;
+
+    /* the FCGI_GET_VALUES_RESULT content */
+
+    u_char                             values[64];
+    size_t                             nvalues;
+
+    unsigned                           connected:1;
+};
+
+
+struct ngx_http_fastcgi_mpx_stream_s {
+	//共享的流部分，必须是第一个成员；缓存的数据超过limit时停止从后端连接读取
+    ngx_http_upstream_mpx_stream_t     stream;
+    ngx_queue_t                        queue;
+
+    ngx_http_fastcgi_mpx_srv_conf_t   *conf;
+    ngx_http_fastcgi_mpx_conn_t       *mpx;
+    ngx_uint_t                         id;
+
+    ngx_http_fastcgi_mpx_record_t      record;
+
+    unsigned                           waiting:1;
+};
+
+
+typedef struct {
+    ngx_http_fastcgi_mpx_srv_conf_t   *conf;
+
+    ngx_http_fastcgi_mpx_stream_t     *stream;
+    size_t                             limit;
+
+    void                              *data;
+
+    ngx_event_get_peer_pt              original_get_peer;
+    ngx_event_free_peer_pt             original_free_peer;
+
+} ngx_http_fastcgi_mpx_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_fastcgi_mpx(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_fastcgi_mpx_peer(
+    ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_fastcgi_mpx_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_fastcgi_mpx_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+
+static ngx_http_fastcgi_mpx_conn_t *ngx_http_fastcgi_mpx_connect(
+    ngx_http_fastcgi_mpx_srv_conf_t *conf, ngx_peer_connection_t *pc);
+static void ngx_http_fastcgi_mpx_read_handler(ngx_event_t *rev);
+static void ngx_http_fastcgi_mpx_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_fastcgi_mpx_demultiplex(
+    ngx_http_fastcgi_mpx_conn_t *mpx, u_char *p, u_char *last);
+static void ngx_http_fastcgi_mpx_get_values(ngx_http_fastcgi_mpx_conn_t *mpx);
+static ngx_int_t ngx_http_fastcgi_mpx_flush(ngx_http_fastcgi_mpx_conn_t *mpx);
+static void ngx_http_fastcgi_mpx_close(ngx_http_fastcgi_mpx_conn_t *mpx);
+
+static ngx_http_fastcgi_mpx_stream_t *ngx_http_fastcgi_mpx_create_stream(
+    ngx_http_fastcgi_mpx_conn_t *mpx, ngx_log_t *log);
+static void ngx_http_fastcgi_mpx_close_stream(
+    ngx_http_fastcgi_mpx_stream_t *s);
+static void ngx_http_fastcgi_mpx_wake_writers(ngx_http_fastcgi_mpx_conn_t *mpx);
+static void ngx_http_fastcgi_mpx_unblock(ngx_http_upstream_mpx_stream_t *us);
+
+static ngx_chain_t *ngx_http_fastcgi_mpx_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static size_t ngx_http_fastcgi_mpx_parse(ngx_http_fastcgi_mpx_stream_t *s,
+    ngx_http_fastcgi_mpx_record_t *rec, u_char *p, size_t len, u_char **copy);
+
+static void *ngx_http_fastcgi_mpx_create_conf(ngx_conf_t *cf);
+static char *ngx_http_fastcgi_mpx(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_fastcgi_mpx_commands[] = {
+
+    { ngx_string("fastcgi_multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_fastcgi_mpx,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_fastcgi_mpx_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_fastcgi_mpx_create_conf,      /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_fastcgi_mpx_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_fastcgi_mpx_module_ctx, /* module context */
+    ngx_http_upstream_fastcgi_mpx_commands,  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_mpx_init_process,    /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_fastcgi_mpx_stream_t  ngx_http_fastcgi_mpx_aborted;
+
+
+static ngx_int_t
+ngx_http_upstream_init_fastcgi_mpx(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_fastcgi_mpx_srv_conf_t  *mcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init fastcgi multiplex");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_fastcgi_mpx_module);
+
+    /*
+     * a wrapper installed later, e.g. keepalive, would cache or close
+     * the fake stream connections itself
+     */
+
+    if (us->peer.init_upstream != ngx_http_upstream_init_fastcgi_mpx) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "\"fastcgi_multiplex\" must be the last balancer "
+                      "directive in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mcf->original_init_peer = us->peer.init;
+
+    us->peer.init = ngx_http_upstream_init_fastcgi_mpx_peer;
+
+    ngx_queue_init(&mcf->connections);
+    ngx_queue_init(&mcf->free_connections);
+    ngx_queue_init(&mcf->free_streams);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_fastcgi_mpx_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_fastcgi_mpx_srv_conf_t   *mcf;
+    ngx_http_fastcgi_mpx_peer_data_t  *mp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init fastcgi multiplex peer");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_fastcgi_mpx_module);
+
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_fastcgi_mpx_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mp->conf = mcf;
+    mp->stream = NULL;
+
+    /* a stream keeps no more than the buffers the request would use */
+
+    mp->limit = r->upstream->conf->buffer_size;
+
+    if (r->upstream->buffering) {
+        mp->limit += r->upstream->conf->bufs.num
+                     * r->upstream->conf->bufs.size;
+    }
+    mp->data = r->upstream->peer.data;
+    mp->original_get_peer = r->upstream->peer.get;
+    mp->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = mp;
+    r->upstream->peer.get = ngx_http_upstream_get_fastcgi_mpx_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_fastcgi_mpx_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_fastcgi_mpx_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_fastcgi_mpx_peer_data_t  *mp = data;
+
+    ngx_int_t                       rc;
+    ngx_uint_t                      n;
+    ngx_queue_t                    *q;
+    ngx_http_fastcgi_mpx_conn_t    *mpx, *best;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get fastcgi multiplex peer");
+
+    /* ask balancer */
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK || ngx_http_upstream_mpx_disabled) {
+        return rc;
+    }
+
+    /* find the least loaded connection to the server */
+
+    best = NULL;
+    n = 0;
+
+    for (q = ngx_queue_head(&mp->conf->connections);
+         q != ngx_queue_sentinel(&mp->conf->connections);
+         q = ngx_queue_next(q))
+    {
+        mpx = ngx_queue_data(q, ngx_http_fastcgi_mpx_conn_t, queue);
+
+        if (ngx_memn2cmp(mpx->sockaddr, (u_char *) pc->sockaddr,
+                         mpx->socklen, pc->socklen)
+            != 0)
+        {
+            continue;
+        }
+
+        n++;
+
+        if (mpx->nstreams >= mpx->max_streams) {
+            continue;
+        }
+
+        if (best == NULL || mpx->nstreams < best->nstreams) {
+            best = mpx;
+        }
+    }
+
+    if (best == NULL) {
+
+        if (n >= mp->conf->max_connections) {
+
+            /* all connections are busy, use a dedicated one */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "fastcgi multiplex: all streams are busy");
+            return NGX_OK;
+        }
+
+        best = ngx_http_fastcgi_mpx_connect(mp->conf, pc);
+
+        if (best == NULL) {
+            return NGX_OK;
+        }
+    }
+
+    s = ngx_http_fastcgi_mpx_create_stream(best, pc->log);
+    if (s == NULL) {
+        return NGX_OK;
+    }
+
+    s->stream.limit = mp->limit;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "fastcgi multiplex: request id %ui on %p",
+                   s->id, best->connection);
+
+    mp->stream = s;
+
+    /*
+     * only an established connection is like a cached one, failures
+     * of a new connection should count against the upstream tries
+     */
+
+    pc->connection = &s->stream.connection;
+    pc->cached = best->connected;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_upstream_free_fastcgi_mpx_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_fastcgi_mpx_peer_data_t  *mp = data;
+
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free fastcgi multiplex peer");
+
+    s = mp->stream;
+
+    if (s && pc->connection == &s->stream.connection) {
+        mp->stream = NULL;
+        pc->connection = NULL;
+
+        ngx_http_fastcgi_mpx_close_stream(s);
+    }
+
+    mp->original_free_peer(pc, mp->data, state);
+}
+
+
+static ngx_http_fastcgi_mpx_conn_t *
+ngx_http_fastcgi_mpx_connect(ngx_http_fastcgi_mpx_srv_conf_t *conf,
+    ngx_peer_connection_t *pc)
+{
+    u_char                        record[32];
+    ngx_int_t                     rc;
+    ngx_queue_t                  *q;
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mpx_conn_t  *mpx;
+
+    if (pc->socklen > NGX_SOCKADDRLEN) {
+        return NULL;
+    }
+
+    rc = ngx_http_upstream_mpx_connect(pc, &c);
+
+    if (rc == NGX_ERROR) {
+        return NULL;
+    }
+
+    if (!ngx_queue_empty(&conf->free_connections)) {
+        q = ngx_queue_head(&conf->free_connections);
+        ngx_queue_remove(q);
+
+        mpx = ngx_queue_data(q, ngx_http_fastcgi_mpx_conn_t, queue);
+
+    } else {
+        mpx = ngx_pcalloc(ngx_cycle->pool,
+                          sizeof(ngx_http_fastcgi_mpx_conn_t));
+        if (mpx == NULL) {
+            goto failed;
+        }
+
+        mpx->streams = ngx_pcalloc(ngx_cycle->pool,
+                                   conf->max_streams * sizeof(void *));
+        if (mpx->streams == NULL) {
+            goto failed;
+        }
+
+        mpx->conf = conf;
+    }
+
+    mpx->connection = c;
+    mpx->name = pc->name;
+    mpx->socklen = pc->socklen;
+    ngx_memcpy(mpx->sockaddr, pc->sockaddr, pc->socklen);
+    c->sockaddr = (struct sockaddr *) mpx->sockaddr;
+    c->socklen = mpx->socklen;
+    mpx->nstreams = 0;
+    mpx->aborted = 0;
+    mpx->max_streams = 1;
+    mpx->out.first = NULL;
+    mpx->out.last = NULL;
+    mpx->writer = NULL;
+    mpx->waiting = 0;
+    mpx->blocked = 0;
+    mpx->header_len = 0;
+    mpx->rest = 0;
+    mpx->stream = NULL;
+    mpx->nvalues = 0;
+    mpx->connected = (rc == NGX_OK);
+
+    ngx_queue_insert_tail(&conf->connections, &mpx->queue);
+
+    /* FCGI_GET_VALUES with the FCGI_MPXS_CONNS name, padded to 8 bytes */
+
+    ngx_memzero(record, sizeof(record));
+
+    record[0] = NGX_HTTP_FASTCGI_MPX_VERSION;
+    record[1] = NGX_HTTP_FASTCGI_MPX_GET_VALUES;
+    record[5] = 2 + sizeof("FCGI_MPXS_CONNS") - 1;
+    record[6] = 7;
+    record[8] = sizeof("FCGI_MPXS_CONNS") - 1;
+    ngx_memcpy(&record[10], "FCGI_MPXS_CONNS", sizeof("FCGI_MPXS_CONNS") - 1);
+
+    c->data = mpx;
+    c->read->handler = ngx_http_fastcgi_mpx_read_handler;
+    c->write->handler = ngx_http_fastcgi_mpx_write_handler;
+
+    if (ngx_http_upstream_mpx_write(&mpx->out, record, 32) != NGX_OK) {
+        ngx_http_fastcgi_mpx_close(mpx);
+        return NULL;
+    }
+
+    return mpx;
+
+failed:
+
+    ngx_close_connection(c);
+
+    return NULL;
+}
+
+
+static void
+ngx_http_fastcgi_mpx_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mpx_conn_t  *mpx;
+
+    c = rev->data;
+    mpx = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                   "fastcgi multiplex read handler");
+
+    if (c->close) {
+        c->close = 0;
+
+        /* the worker is exiting, requests in progress keep the connection */
+
+        if (mpx->nstreams == mpx->aborted) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+    }
+
+    if (!mpx->connected) {
+        if (ngx_http_upstream_mpx_test_connect(c, mpx->name) != NGX_OK) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+
+        mpx->connected = 1;
+
+        if (ngx_http_fastcgi_mpx_flush(mpx) != NGX_OK) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+    }
+
+    /*
+     * FastCGI has no flow control, so a stream which has buffered its limit
+     * stops reading of the whole connection until the request reads
+     * the data, as a slow client would stop a dedicated connection
+     */
+
+    while (rev->ready && mpx->blocked == 0) {
+
+        n = c->recv(c, ngx_http_upstream_mpx_buffer,
+                    NGX_HTTP_UPSTREAM_MPX_BUFSIZE);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (n == 0 && mpx->nstreams != mpx->aborted) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream %V closed multiplexed connection "
+                              "with %ui requests in progress",
+                              mpx->name, mpx->nstreams - mpx->aborted);
+            }
+
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+
+        if (ngx_http_fastcgi_mpx_demultiplex(mpx, ngx_http_upstream_mpx_buffer,
+                                             ngx_http_upstream_mpx_buffer + n)
+            != NGX_OK)
+        {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_fastcgi_mpx_close(mpx);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mpx_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mpx_conn_t  *mpx;
+
+    c = wev->data;
+    mpx = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "fastcgi multiplex write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream %V timed out while connecting", mpx->name);
+        ngx_http_fastcgi_mpx_close(mpx);
+        return;
+    }
+
+    if (!mpx->connected) {
+        if (ngx_http_upstream_mpx_test_connect(c, mpx->name) != NGX_OK) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return;
+        }
+
+        mpx->connected = 1;
+    }
+
+    if (ngx_http_fastcgi_mpx_flush(mpx) != NGX_OK) {
+        ngx_http_fastcgi_mpx_close(mpx);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mpx_demultiplex(ngx_http_fastcgi_mpx_conn_t *mpx, u_char *p,
+    u_char *last)
+{
+    u_char                          header[8];
+    size_t                          n, len;
+    ngx_uint_t                      id;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    while (p < last) {
+
+        if (mpx->header_len < 8) {
+            mpx->header[mpx->header_len++] = *p++;
+
+            if (mpx->header_len < 8) {
+                continue;
+            }
+
+            if (mpx->header[0] != NGX_HTTP_FASTCGI_MPX_VERSION) {
+                ngx_log_error(NGX_LOG_ERR, mpx->connection->log, 0,
+                              "upstream %V sent unsupported FastCGI "
+                              "protocol version: %d",
+                              mpx->name, mpx->header[0]);
+                return NGX_ERROR;
+            }
+
+            id = (mpx->header[2] << 8) + mpx->header[3];
+
+            /* management records and unknown ids are dropped */
+
+            s = (id && id <= mpx->conf->max_streams)
+                ? mpx->streams[id - 1] : NULL;
+
+            if (s && s != &ngx_http_fastcgi_mpx_aborted) {
+
+                /* the fastcgi module expects its own request id */
+
+                ngx_memcpy(header, mpx->header, 8);
+                header[2] = 0;
+                header[3] = 1;
+
+                if (ngx_http_upstream_mpx_deliver(&s->stream, header, 8)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            mpx->stream = s;
+            mpx->rest = (mpx->header[4] << 8) + mpx->header[5]
+                        + mpx->header[6];
+            mpx->nvalues = 0;
+
+        } else {
+            n = ngx_min((size_t) (last - p), mpx->rest);
+
+            s = mpx->stream;
+
+            if (s && s != &ngx_http_fastcgi_mpx_aborted) {
+                if (ngx_http_upstream_mpx_deliver(&s->stream, p, n) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+            } else if (mpx->header[1]
+                       == NGX_HTTP_FASTCGI_MPX_GET_VALUES_RESULT)
+            {
+                len = ngx_min(n, sizeof(mpx->values) - mpx->nvalues);
+
+                ngx_memcpy(&mpx->values[mpx->nvalues], p, len);
+                mpx->nvalues += len;
+            }
+
+            p += n;
+            mpx->rest -= n;
+        }
+
+        s = mpx->stream;
+
+        if (s && s != &ngx_http_fastcgi_mpx_aborted
+            && !s->stream.blocked && s->stream.size >= s->stream.limit)
+        {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, mpx->connection->log, 0,
+                           "fastcgi multiplex: request id %ui buffered %uz",
+                           s->id, s->stream.size);
+
+            s->stream.blocked = 1;
+            mpx->blocked++;
+        }
+
+        if (mpx->rest) {
+            continue;
+        }
+
+        /* the record is complete */
+
+        mpx->header_len = 0;
+
+        if (mpx->header[1] == NGX_HTTP_FASTCGI_MPX_GET_VALUES_RESULT
+            && mpx->stream == NULL)
+        {
+            ngx_http_fastcgi_mpx_get_values(mpx);
+            continue;
+        }
+
+        if (mpx->header[1] != NGX_HTTP_FASTCGI_MPX_END_REQUEST
+            || mpx->stream == NULL)
+        {
+            continue;
+        }
+
+        id = (mpx->header[2] << 8) + mpx->header[3];
+
+        if (mpx->stream == &ngx_http_fastcgi_mpx_aborted) {
+            mpx->streams[id - 1] = NULL;
+            mpx->nstreams--;
+            mpx->aborted--;
+
+        } else {
+            mpx->stream->stream.done = 1;
+        }
+
+        mpx->stream = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * the FCGI_GET_VALUES_RESULT name-value pairs, the lengths are one byte
+ * or four bytes with the high bit set
+ */
+
+static void
+ngx_http_fastcgi_mpx_get_values(ngx_http_fastcgi_mpx_conn_t *mpx)
+{
+    u_char                            *p, *last;
+    size_t                             len[2];
+    ngx_uint_t                         i;
+    ngx_http_fastcgi_mpx_srv_conf_t   *conf;
+
+    conf = mpx->conf;
+
+    p = mpx->values;
+    last = p + ngx_min((size_t) ((mpx->header[4] << 8) + mpx->header[5]),
+                       mpx->nvalues);
+
+    while (p < last) {
+
+        for (i = 0; i < 2; i++) {
+
+            if (p < last && !(*p & 0x80)) {
+                len[i] = *p++;
+
+            } else if (last - p >= 4) {
+                len[i] = ((p[0] & 0x7f) << 24) + (p[1] << 16) + (p[2] << 8)
+                         + p[3];
+                p += 4;
+
+            } else {
+                goto done;
+            }
+        }
+
+        if ((size_t) (last - p) < len[0] + len[1]) {
+            break;
+        }
+
+        if (len[0] == sizeof("FCGI_MPXS_CONNS") - 1
+            && ngx_strncmp(p, "FCGI_MPXS_CONNS", len[0]) == 0)
+        {
+            if (len[1] && p[len[0]] == '1') {
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mpx->connection->log, 0,
+                               "fastcgi multiplex: %V multiplexes",
+                               mpx->name);
+
+                mpx->max_streams = conf->max_streams;
+                return;
+            }
+
+            break;
+        }
+
+        p += len[0] + len[1];
+    }
+
+done:
+
+    ngx_log_error(NGX_LOG_INFO, mpx->connection->log, 0,
+                  "upstream %V does not multiplex FastCGI connections, "
+                  "one request per connection is used", mpx->name);
+}
+
+
+/*
+ * the connection records are sent only between the records of the
+ * streams, a stream that has started a record owns the connection until
+ * the record is sent
+ */
+
+static ngx_int_t
+ngx_http_fastcgi_mpx_flush(ngx_http_fastcgi_mpx_conn_t *mpx)
+{
+    ngx_connection_t  *c;
+
+    c = mpx->connection;
+
+    if (!mpx->connected) {
+        return NGX_OK;
+    }
+
+    if (mpx->writer) {
+        if (c->write->ready) {
+            ngx_http_fastcgi_mpx_wake_writers(mpx);
+        }
+
+        return NGX_OK;
+    }
+
+    if (ngx_http_upstream_mpx_send(c, &mpx->out) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (mpx->out.first == NULL && c->write->ready) {
+        ngx_http_fastcgi_mpx_wake_writers(mpx);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mpx_close(ngx_http_fastcgi_mpx_conn_t *mpx)
+{
+    ngx_uint_t                      i;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    /* requests in progress see an error once their data are read */
+
+    for (i = 0; i < mpx->conf->max_streams; i++) {
+        s = mpx->streams[i];
+
+        if (s == NULL) {
+            continue;
+        }
+
+        mpx->streams[i] = NULL;
+
+        if (s == &ngx_http_fastcgi_mpx_aborted) {
+            continue;
+        }
+
+        s->mpx = NULL;
+        s->waiting = 0;
+        s->stream.error = 1;
+        s->stream.blocked = 0;
+        s->stream.connection.fd = (ngx_socket_t) -1;
+
+        ngx_http_upstream_mpx_wake_stream(&s->stream);
+    }
+
+    ngx_queue_remove(&mpx->queue);
+    ngx_queue_insert_head(&mpx->conf->free_connections, &mpx->queue);
+
+    ngx_http_upstream_mpx_close(mpx->connection, &mpx->out);
+
+    mpx->connection = NULL;
+}
+
+
+static ngx_http_fastcgi_mpx_stream_t *
+ngx_http_fastcgi_mpx_create_stream(ngx_http_fastcgi_mpx_conn_t *mpx,
+    ngx_log_t *log)
+{
+    ngx_uint_t                        i;
+    ngx_queue_t                      *q;
+    ngx_http_fastcgi_mpx_stream_t    *s;
+    ngx_http_fastcgi_mpx_srv_conf_t  *conf;
+
+    conf = mpx->conf;
+
+    for (i = 0; i < conf->max_streams; i++) {
+        if (mpx->streams[i] == NULL) {
+            break;
+        }
+    }
+
+    if (i == conf->max_streams) {
+        return NULL;
+    }
+
+    if (!ngx_queue_empty(&conf->free_streams)) {
+        q = ngx_queue_head(&conf->free_streams);
+        ngx_queue_remove(q);
+
+        s = ngx_queue_data(q, ngx_http_fastcgi_mpx_stream_t, queue);
+
+    } else {
+        s = ngx_palloc(ngx_cycle->pool, sizeof(ngx_http_fastcgi_mpx_stream_t));
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(s, sizeof(ngx_http_fastcgi_mpx_stream_t));
+
+    s->conf = conf;
+    s->mpx = mpx;
+    s->id = i + 1;
+
+    mpx->streams[i] = s;
+    mpx->nstreams++;
+
+    ngx_http_upstream_mpx_init_stream(&s->stream, mpx->connection, log);
+
+    s->stream.connection.send_chain = ngx_http_fastcgi_mpx_send_chain;
+    s->stream.drain = ngx_http_fastcgi_mpx_unblock;
+
+    return s;
+}
+
+
+static void
+ngx_http_fastcgi_mpx_close_stream(ngx_http_fastcgi_mpx_stream_t *s)
+{
+    u_char                        header[8];
+    size_t                        n;
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mpx_conn_t  *mpx;
+
+    c = &s->stream.connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close fastcgi multiplex request id %ui", s->id);
+
+    ngx_http_upstream_mpx_close_stream(&s->stream);
+
+    mpx = s->mpx;
+
+    if (mpx == NULL) {
+        goto free;
+    }
+
+    if (s->waiting) {
+        mpx->waiting--;
+    }
+
+    if (s->stream.blocked) {
+        s->stream.blocked = 0;
+        ngx_http_fastcgi_mpx_unblock(&s->stream);
+    }
+
+    if (mpx->writer == s) {
+
+        /* the record being sent is completed with zeroes */
+
+        mpx->writer = NULL;
+
+        if (s->record.header_len < 8) {
+            goto failed;
+        }
+
+        ngx_memzero(header, 8);
+
+        while (s->record.rest) {
+            n = ngx_min(s->record.rest, 8);
+
+            if (ngx_http_upstream_mpx_write(&mpx->out, header, n) != NGX_OK) {
+                goto failed;
+            }
+
+            s->record.rest -= n;
+        }
+    }
+
+    if (s->stream.done || c->sent == 0) {
+
+        /* the backend has finished or has not seen the request */
+
+        mpx->streams[s->id - 1] = NULL;
+        mpx->nstreams--;
+
+        if (ngx_http_fastcgi_mpx_flush(mpx) != NGX_OK) {
+            ngx_http_fastcgi_mpx_close(mpx);
+        }
+
+        goto free;
+    }
+
+    /* the backend is still busy with the request */
+
+    header[0] = NGX_HTTP_FASTCGI_MPX_VERSION;
+    header[1] = NGX_HTTP_FASTCGI_MPX_ABORT_REQUEST;
+    header[2] = (u_char) ((s->id >> 8) & 0xff);
+    header[3] = (u_char) (s->id & 0xff);
+    header[4] = 0;
+    header[5] = 0;
+    header[6] = 0;
+    header[7] = 0;
+
+    mpx->streams[s->id - 1] = &ngx_http_fastcgi_mpx_aborted;
+    mpx->aborted++;
+
+    if (mpx->stream == s) {
+        mpx->stream = &ngx_http_fastcgi_mpx_aborted;
+    }
+
+    if (ngx_http_upstream_mpx_write(&mpx->out, header, 8) != NGX_OK
+        || ngx_http_fastcgi_mpx_flush(mpx) != NGX_OK)
+    {
+        ngx_http_fastcgi_mpx_close(mpx);
+    }
+
+    goto free;
+
+failed:
+
+    mpx->streams[s->id - 1] = NULL;
+    mpx->nstreams--;
+
+    ngx_http_fastcgi_mpx_close(mpx);
+
+free:
+
+    ngx_queue_insert_head(&s->conf->free_streams, &s->queue);
+}
+
+
+static void
+ngx_http_fastcgi_mpx_wake_writers(ngx_http_fastcgi_mpx_conn_t *mpx)
+{
+    ngx_uint_t                      i;
+    ngx_event_t                    *wev;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    if (mpx->writer) {
+        wev = &mpx->writer->stream.write;
+        wev->ready = 1;
+        ngx_post_event(wev, &ngx_posted_events);
+        return;
+    }
+
+    for (i = 0; mpx->waiting && i < mpx->conf->max_streams; i++) {
+        s = mpx->streams[i];
+
+        if (s == NULL || s == &ngx_http_fastcgi_mpx_aborted || !s->waiting) {
+            continue;
+        }
+
+        s->waiting = 0;
+        mpx->waiting--;
+
+        wev = &s->stream.write;
+        wev->ready = 1;
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+}
+
+
+/* a stream has drained below its limit */
+
+static void
+ngx_http_fastcgi_mpx_unblock(ngx_http_upstream_mpx_stream_t *us)
+{
+    ngx_event_t                    *rev;
+    ngx_http_fastcgi_mpx_conn_t    *mpx;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+
+    s = (ngx_http_fastcgi_mpx_stream_t *) us;
+
+    mpx = s->mpx;
+    rev = mpx->connection->read;
+
+    if (--mpx->blocked == 0 && rev->ready) {
+        ngx_post_event(rev, &ngx_posted_events);
+    }
+}
+
+
+/*
+ * the request buffers are sent to the backend connection as they are,
+ * only the rewritten record headers and FCGI_BEGIN_REQUEST bodies are sent
+ * from the stream copies; the records of different requests interleave
+ * only as a whole, and the buffers are advanced by what the connection
+ * has actually sent, so the upstream module waits for the stream write
+ * event as with a usual connection
+ */
+
+static ngx_chain_t *
+ngx_http_fastcgi_mpx_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    u_char                         *p, *copy;
+    off_t                           sent, size, pos;
+    size_t                          n;
+    ngx_buf_t                      *b;
+    ngx_uint_t                      i;
+    ngx_chain_t                    *cl, *rc;
+    ngx_connection_t               *mc;
+    ngx_http_fastcgi_mpx_conn_t    *mpx;
+    ngx_http_fastcgi_mpx_record_t   rec;
+    ngx_http_fastcgi_mpx_stream_t  *s;
+    u_char                          copies[NGX_HTTP_FASTCGI_MPX_LINKS][8];
+    ngx_buf_t                       bufs[NGX_HTTP_FASTCGI_MPX_LINKS];
+    ngx_chain_t                     links[NGX_HTTP_FASTCGI_MPX_LINKS];
+
+    s = (ngx_http_fastcgi_mpx_stream_t *) ngx_http_upstream_mpx_stream(c);
+
+    mpx = s->mpx;
+
+    if (mpx == NULL || s->stream.error) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    mc = mpx->connection;
+
+    for ( ;; ) {
+
+        while (in && ngx_buf_size(in->buf) == 0) {
+            in = in->next;
+        }
+
+        if (in == NULL) {
+            return NULL;
+        }
+
+        if (mpx->writer != s
+            && (mpx->writer || mpx->out.first || !mpx->connected))
+        {
+            break;
+        }
+
+        if (!mc->write->ready) {
+            break;
+        }
+
+        /* the links of the rewritten and of the request buffers */
+
+        rec = s->record;
+        i = 0;
+
+        for (cl = in; cl && i < NGX_HTTP_FASTCGI_MPX_LINKS; cl = cl->next) {
+            b = cl->buf;
+
+            if (ngx_buf_special(b)) {
+                continue;
+            }
+
+            if (ngx_buf_in_memory(b)) {
+
+                for (p = b->pos;
+                     p < b->last && i < NGX_HTTP_FASTCGI_MPX_LINKS;
+                     p += n)
+                {
+                    n = ngx_http_fastcgi_mpx_parse(s, &rec, p, b->last - p,
+                                                   &copy);
+
+                    ngx_memzero(&bufs[i], sizeof(ngx_buf_t));
+
+                    if (copy) {
+                        ngx_memcpy(copies[i], copy, n);
+                        bufs[i].pos = copies[i];
+
+                    } else {
+                        bufs[i].pos = p;
+                    }
+
+                    bufs[i].last = bufs[i].pos + n;
+                    bufs[i].memory = 1;
+
+                    links[i].buf = &bufs[i];
+                    links[i].next = &links[i + 1];
+                    i++;
+                }
+
+                continue;
+            }
+
+            /* the request body in a file is always the record content */
+
+            for (pos = b->file_pos;
+                 pos < b->file_last && i < NGX_HTTP_FASTCGI_MPX_LINKS;
+                 pos += n)
+            {
+                if (rec.header_len < 8
+                    || (rec.header[1] == NGX_HTTP_FASTCGI_MPX_BEGIN_REQUEST
+                        && rec.offset < 8))
+                {
+                    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                                  "file buf outside of FastCGI record "
+                                  "content in multiplexed request");
+                    return NGX_CHAIN_ERROR;
+                }
+
+                size = b->file_last - pos;
+
+                n = ngx_http_fastcgi_mpx_parse(s, &rec, NULL,
+                                               (size_t) ngx_min(size,
+                                                                0x10000),
+                                               &copy);
+
+                ngx_memzero(&bufs[i], sizeof(ngx_buf_t));
+
+                bufs[i].file = b->file;
+                bufs[i].file_pos = pos;
+                bufs[i].file_last = pos + n;
+                bufs[i].in_file = 1;
+
+                links[i].buf = &bufs[i];
+                links[i].next = &links[i + 1];
+                i++;
+            }
+        }
+
+        if (i == 0) {
+            return NULL;
+        }
+
+        links[i - 1].next = NULL;
+
+        sent = mc->sent;
+
+        rc = mc->send_chain(mc, links, limit);
+
+        if (rc == NGX_CHAIN_ERROR) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return NGX_CHAIN_ERROR;
+        }
+
+        sent = mc->sent - sent;
+
+        c->sent += sent;
+
+        /* advance the request buffers by the bytes sent */
+
+        for (cl = in; cl && sent; cl = cl->next) {
+            b = cl->buf;
+
+            if (ngx_buf_special(b)) {
+                continue;
+            }
+
+            while (sent && ngx_buf_size(b)) {
+
+                if (ngx_buf_in_memory(b)) {
+                    size = b->last - b->pos;
+                    p = b->pos;
+
+                } else {
+                    size = b->file_last - b->file_pos;
+                    p = NULL;
+                }
+
+                n = ngx_http_fastcgi_mpx_parse(s, &s->record, p,
+                                               (size_t) ngx_min(size, sent),
+                                               &copy);
+
+                if (ngx_buf_in_memory(b)) {
+                    b->pos += n;
+                }
+
+                if (b->in_file) {
+                    b->file_pos += n;
+                }
+
+                sent -= n;
+            }
+        }
+
+        if (ngx_handle_write_event(mc->write, 0) != NGX_OK) {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return NGX_CHAIN_ERROR;
+        }
+
+        mpx->writer = s->record.header_len ? s : NULL;
+
+        /* the connection records and the waiting streams go next */
+
+        if (mpx->writer == NULL
+            && (mpx->out.first || mpx->waiting)
+            && ngx_http_fastcgi_mpx_flush(mpx) != NGX_OK)
+        {
+            ngx_http_fastcgi_mpx_close(mpx);
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (limit) {
+            break;
+        }
+    }
+
+    /* the stream is woken up by ngx_http_fastcgi_mpx_wake_writers() */
+
+    if (mpx->writer != s && !s->waiting) {
+        s->waiting = 1;
+        mpx->waiting++;
+    }
+
+    c->write->ready = 0;
+
+    return in;
+}
+
+
+/*
+ * parses up to "len" bytes of the request records, returns the number of
+ * bytes that are either record content, or rewritten header or
+ * FCGI_BEGIN_REQUEST body bytes pointed to by "copy"; "p" is NULL for
+ * the content in a file
+ */
+
+static size_t
+ngx_http_fastcgi_mpx_parse(ngx_http_fastcgi_mpx_stream_t *s,
+    ngx_http_fastcgi_mpx_record_t *rec, u_char *p, size_t len, u_char **copy)
+{
+    u_char      ch;
+    size_t      i, n;
+    ngx_uint_t  k;
+
+    if (rec->header_len < 8 && p) {
+        n = ngx_min(len, 8 - rec->header_len);
+
+        *copy = &rec->header[rec->header_len];
+
+        for (i = 0; i < n; i++) {
+            k = rec->header_len++;
+            ch = p[i];
+
+            if (k == 2) {
+                ch = (u_char) ((s->id >> 8) & 0xff);
+
+            } else if (k == 3) {
+                ch = (u_char) (s->id & 0xff);
+            }
+
+            rec->header[k] = ch;
+        }
+
+        if (rec->header_len == 8) {
+            rec->rest = (rec->header[4] << 8) + rec->header[5]
+                        + rec->header[6];
+            rec->offset = 0;
+
+            if (rec->rest == 0) {
+                rec->header_len = 0;
+            }
+        }
+
+        return n;
+    }
+
+    if (rec->header[1] == NGX_HTTP_FASTCGI_MPX_BEGIN_REQUEST
+        && rec->offset < 8 && p)
+    {
+        /* the backend must not close the shared connection */
+
+        n = ngx_min(len, 8 - rec->offset);
+        n = ngx_min(n, rec->rest);
+
+        *copy = &rec->body[rec->offset];
+
+        for (i = 0; i < n; i++) {
+            k = rec->offset++;
+            ch = p[i];
+
+            if (k == 2) {
+                ch |= NGX_HTTP_FASTCGI_MPX_KEEP_CONN;
+            }
+
+            rec->body[k] = ch;
+        }
+
+    } else {
+        n = ngx_min(len, rec->rest);
+
+        *copy = NULL;
+
+        rec->offset += n;
+    }
+
+    rec->rest -= n;
+
+    if (rec->rest == 0) {
+        rec->header_len = 0;
+    }
+
+    return n;
+}
+
+
+static void *
+ngx_http_fastcgi_mpx_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_fastcgi_mpx_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_mpx_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->original_init_upstream = NULL;
+     *     conf->original_init_peer = NULL;
+     */
+
+    conf->max_connections = 1;
+    conf->max_streams = 32;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_fastcgi_mpx(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_fastcgi_mpx_srv_conf_t  *mcf = conf;
+
+    ngx_int_t                      n;
+    ngx_str_t                     *value;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (mcf->original_init_upstream) {
+        return "is duplicate";
+    }
+
+    mcf->original_init_upstream = uscf->peer.init_upstream
+                                  ? uscf->peer.init_upstream
+                                  : ngx_http_upstream_init_round_robin;
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_fastcgi_mpx;
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->max_connections = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "requests=", 9) == 0) {
+
+            n = ngx_atoi(&value[i].data[9], value[i].len - 9);
+
+            if (n == NGX_ERROR || n == 0 || n > 65535) {
+                goto invalid;
+            }
+
+            mcf->max_streams = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
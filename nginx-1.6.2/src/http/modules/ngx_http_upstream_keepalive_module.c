@@ -10,19 +10,56 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_INTERVAL  1000
+#define NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_MAX_DELAY 60000
+#define NGX_HTTP_UPSTREAM_KEEPALIVE_CONNECT_TIMEOUT   5000
+
+
 typedef struct {
 	//最大缓存连接个数，keepalive的参数指定
     ngx_uint_t                         max_cached;
-	//长连接队列，其中cache为缓存连接池，free为空闲连接池，初始化时根据keepalive指令的参数初始化free队列，后续有连接过来从free队列取连接，请求处理结束后将长连接缓存到cache队列，连接被断开（或超时）再从cache队列放入free队列
-    ngx_queue_t                        cache;
+	//空闲连接的超时时间，keepalive_timeout指令指定，0表示不限制
+    ngx_msec_t                         timeout;
+	//一个连接最多处理的请求数，keepalive_requests指令指定，0表示不限制
+    ngx_uint_t                         requests;
+	//每个后端服务器预先建立的空闲连接个数，keepalive_prewarm指令指定
+    ngx_uint_t                         prewarm;
+	//free为空闲item队列，初始化时根据keepalive指令的参数初始化free队列，请求处理结束后从free队列取item缓存长连接，连接被断开（或超时）再放回free队列
     ngx_queue_t                        free;
-	
+	//按后端服务器地址划分的缓存连接池队列，元素为ngx_http_upstream_keepalive_peer_cache_t
+    ngx_queue_t                        peers;
+	//原始负载均衡模块的轮询peers，用于预建连接
+    ngx_http_upstream_rr_peers_t      *rr_peers;
+	//预建连接使用的日志，只记录crit及以上级别，连接失败由本模块以info级别记录
+    ngx_log_t                         *prewarm_log;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
 } ngx_http_upstream_keepalive_srv_conf_t;
 
 
+typedef struct {
+    ngx_queue_t                        queue;
+	//该后端服务器的缓存连接队列，最近使用的连接在队列头部
+    ngx_queue_t                        cache;
+    ngx_uint_t                         cached;
+	//正在预建立的连接个数
+    ngx_uint_t                         connecting;
+	//对应的轮询peer，预建连接失败计入它的fails
+    ngx_http_upstream_rr_peer_t       *rr;
+	//预建连接连续失败后的退避时间，以及下次允许预建连接的时间
+    ngx_msec_t                         prewarm_delay;
+    ngx_msec_t                         prewarm_next;
+
+    ngx_str_t                         *name;
+	//后端服务器的地址，后续就是根据相同的socket地址来找出对应的连接池
+    socklen_t                          socklen;
+    u_char                             sockaddr[NGX_SOCKADDRLEN];
+
+} ngx_http_upstream_keepalive_peer_cache_t;
+
+
 typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
 
@@ -46,9 +83,8 @@ typedef struct {
 
     ngx_queue_t                        queue;
     ngx_connection_t                  *connection;
-	//缓存连接池中保存的后端服务器的地址，后续就是根据相同的socket地址来找出对应的连接，并使用该连接 
-    socklen_t                          socklen;
-    u_char                             sockaddr[NGX_SOCKADDRLEN];
+	//该连接所属的后端服务器连接池
+    ngx_http_upstream_keepalive_peer_cache_t  *peer;
 
 } ngx_http_upstream_keepalive_cache_t;
 
@@ -63,6 +99,21 @@ static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
+static void ngx_http_upstream_keepalive_release(
+    ngx_http_upstream_keepalive_cache_t *item);
+static ngx_http_upstream_keepalive_peer_cache_t *
+    ngx_http_upstream_keepalive_peer_cache(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, struct sockaddr *sockaddr,
+    socklen_t socklen, ngx_str_t *name, ngx_uint_t create);
+
+static void ngx_http_upstream_keepalive_prewarm_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_keepalive_prewarm_connect(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_peer_cache_t *peer);
+static void ngx_http_upstream_keepalive_prewarm_connected(ngx_event_t *ev);
+static void ngx_http_upstream_keepalive_prewarm_failed(
+    ngx_http_upstream_keepalive_peer_cache_t *peer, ngx_err_t err,
+    char *text);
 
 
 #if (NGX_HTTP_SSL)
@@ -72,6 +123,7 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
     void *data);
 #endif
 
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -86,6 +138,27 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       0,
       NULL },
 
+    { ngx_string("keepalive_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, timeout),
+      NULL },
+
+    { ngx_string("keepalive_requests"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
+      NULL },
+
+    { ngx_string("keepalive_prewarm"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, prewarm),
+      NULL },
+
       ngx_null_command
 };
 
@@ -112,7 +185,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -143,6 +216,17 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
 	//新钩子
     us->peer.init = ngx_http_upstream_init_keepalive_peer;
 
+    ngx_conf_init_msec_value(kcf->timeout, 60000);
+    ngx_conf_init_uint_value(kcf->requests, 100);
+    ngx_conf_init_uint_value(kcf->prewarm, 0);
+
+    /*
+     * all balancers of this tree keep round robin peers in us->peer.data,
+     * they are only used to know which servers to prewarm
+     */
+
+    kcf->rr_peers = us->peer.data;
+
     /* allocate cache items and add to free queue */
 
     cached = ngx_pcalloc(cf->pool,
@@ -151,8 +235,8 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_queue_init(&kcf->cache);
     ngx_queue_init(&kcf->free);
+    ngx_queue_init(&kcf->peers);
 
     for (i = 0; i < kcf->max_cached; i++) {
         ngx_queue_insert_head(&kcf->free, &cached[i].queue);
@@ -212,9 +296,10 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_int_t          rc;
-    ngx_queue_t       *q, *cache;
-    ngx_connection_t  *c;
+    ngx_int_t                                  rc;
+    ngx_queue_t                               *q;
+    ngx_connection_t                          *c;
+    ngx_http_upstream_keepalive_peer_cache_t  *peer;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer");
@@ -229,39 +314,46 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 
     /* search cache for suitable connection */
 
-    cache = &kp->conf->cache;
+    peer = ngx_http_upstream_keepalive_peer_cache(kp->conf, pc->sockaddr,
+                                                  pc->socklen, pc->name, 0);
 
-    for (q = ngx_queue_head(cache);
-         q != ngx_queue_sentinel(cache);
-         q = ngx_queue_next(q))
-    {
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
-        c = item->connection;
-		//对比缓冲中的地址与请求的地址是否一致，若一致则得到并返回NGX_DONE，上层调用就不会获取新的连接
-        if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr,
-                         item->socklen, pc->socklen)
-            == 0)
-        {
-            ngx_queue_remove(q);
-            ngx_queue_insert_head(&kp->conf->free, q);
+    if (peer == NULL || ngx_queue_empty(&peer->cache)) {
+        return NGX_OK;
+    }
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                           "get keepalive peer: using connection %p", c);
+    /* the most recently used connection is the least likely to be closed */
 
-            c->idle = 0;
-            c->log = pc->log;
-            c->read->log = pc->log;
-            c->write->log = pc->log;
-            c->pool->log = pc->log;
+    q = ngx_queue_head(&peer->cache);
+    ngx_queue_remove(q);
+    peer->cached--;
 
-            pc->connection = c;
-            pc->cached = 1;
+    ngx_queue_insert_head(&kp->conf->free, q);
 
-            return NGX_DONE;
-        }
+    item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+    c = item->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get keepalive peer: using connection %p", c);
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
     }
 
-    return NGX_OK;
+    c->idle = 0;
+    c->log = pc->log;
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+
+    /* a prewarmed connection gets its pool in ngx_http_upstream_connect() */
+
+    if (c->pool) {
+        c->pool->log = pc->log;
+    }
+
+    pc->connection = c;
+    pc->cached = 1;
+
+    return NGX_DONE;
 }
 
 
@@ -272,9 +364,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_queue_t          *q;
-    ngx_connection_t     *c;
-    ngx_http_upstream_t  *u;
+    ngx_queue_t                               *q;
+    ngx_connection_t                          *c;
+    ngx_http_upstream_t                       *u;
+    ngx_http_upstream_keepalive_peer_cache_t  *peer, *p, *victim;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer");
@@ -299,18 +392,51 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+    c->requests++;
+
+    if (kp->conf->requests && c->requests >= kp->conf->requests) {
+        goto invalid;
+    }
+
     if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
         goto invalid;
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                   "free keepalive peer: saving connection %p", c);
+    peer = ngx_http_upstream_keepalive_peer_cache(kp->conf, pc->sockaddr,
+                                                  pc->socklen, pc->name, 1);
+    if (peer == NULL) {
+        goto invalid;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free keepalive peer: saving connection %p, requests %ui",
+                   c, c->requests);
 	//如果free队列中可用cache
-	//items为空，则从cache队列取一个最近最少使用item，将该item对应的那个连接关闭，该item用于保存当前需要释放的连接
+	//items为空，则从缓存连接最多的后端服务器连接池中取最久未使用的item，将该item对应的那个连接关闭，该item用于保存当前需要释放的连接
     if (ngx_queue_empty(&kp->conf->free)) {
 
-        q = ngx_queue_last(&kp->conf->cache);
+        victim = peer;
+
+        for (q = ngx_queue_head(&kp->conf->peers);
+             q != ngx_queue_sentinel(&kp->conf->peers);
+             q = ngx_queue_next(q))
+        {
+            p = ngx_queue_data(q, ngx_http_upstream_keepalive_peer_cache_t,
+                               queue);
+
+            if (p->cached > victim->cached) {
+                victim = p;
+            }
+        }
+
+        if (victim->cached == 0) {
+            /* all items are busy with prewarmed connections */
+            goto invalid;
+        }
+
+        q = ngx_queue_last(&victim->cache);
         ngx_queue_remove(q);
+        victim->cached--;
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
@@ -324,7 +450,9 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     }
 	//缓存当前连接，将item插入cache队列，然后将pc->connection置空，防止上层调用ngx_http_upstream_finalize_request关闭该连接
     item->connection = c;
-    ngx_queue_insert_head(&kp->conf->cache, q);
+    item->peer = peer;
+    ngx_queue_insert_head(&peer->cache, q);
+    peer->cached++;
 
     pc->connection = NULL;
 
@@ -344,9 +472,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     c->read->log = ngx_cycle->log;
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
-	//保存socket地址相关信息，后续就是通过查找相同的socket地址来复用该连接 
-    item->socklen = pc->socklen;
-    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
+
+    if (kp->conf->timeout) {
+        ngx_add_timer(c->read, kp->conf->timeout);
+    }
 
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
@@ -369,9 +498,6 @@ ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev)
 static void
 ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 {
-    ngx_http_upstream_keepalive_srv_conf_t  *conf;
-    ngx_http_upstream_keepalive_cache_t     *item;
-
     int                n;
     char               buf[1];
     ngx_connection_t  *c;
@@ -381,7 +507,7 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close) {
+    if (c->close || ev->timedout) {
         goto close;
     }
 
@@ -399,13 +525,19 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
 close:
 
-    item = c->data;
-    conf = item->conf;
+    ngx_http_upstream_keepalive_release(c->data);
 
     ngx_http_upstream_keepalive_close(c);
+}
+
 
+static void
+ngx_http_upstream_keepalive_release(ngx_http_upstream_keepalive_cache_t *item)
+{
     ngx_queue_remove(&item->queue);
-    ngx_queue_insert_head(&conf->free, &item->queue);
+    item->peer->cached--;
+
+    ngx_queue_insert_head(&item->conf->free, &item->queue);
 }
 
 
@@ -427,11 +559,328 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 
 #endif
 
-    ngx_destroy_pool(c->pool);
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
     ngx_close_connection(c);
 }
 
 
+static ngx_http_upstream_keepalive_peer_cache_t *
+ngx_http_upstream_keepalive_peer_cache(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, struct sockaddr *sockaddr,
+    socklen_t socklen, ngx_str_t *name, ngx_uint_t create)
+{
+    ngx_queue_t                               *q;
+    ngx_http_upstream_keepalive_peer_cache_t  *peer;
+
+    for (q = ngx_queue_head(&kcf->peers);
+         q != ngx_queue_sentinel(&kcf->peers);
+         q = ngx_queue_next(q))
+    {
+        peer = ngx_queue_data(q, ngx_http_upstream_keepalive_peer_cache_t,
+                              queue);
+
+        if (ngx_memn2cmp(peer->sockaddr, (u_char *) sockaddr,
+                         peer->socklen, socklen)
+            == 0)
+        {
+            return peer;
+        }
+    }
+
+    if (!create || socklen > NGX_SOCKADDRLEN) {
+        return NULL;
+    }
+
+    /* the number of servers in an upstream is fixed, so is the list */
+
+    peer = ngx_palloc(ngx_cycle->pool,
+                      sizeof(ngx_http_upstream_keepalive_peer_cache_t));
+    if (peer == NULL) {
+        return NULL;
+    }
+
+    ngx_queue_init(&peer->cache);
+    peer->cached = 0;
+    peer->connecting = 0;
+    peer->rr = NULL;
+    peer->prewarm_delay = 0;
+    peer->prewarm_next = 0;
+    peer->name = name;
+    peer->socklen = socklen;
+    ngx_memcpy(peer->sockaddr, sockaddr, socklen);
+
+    ngx_queue_insert_tail(&kcf->peers, &peer->queue);
+
+    return peer;
+}
+
+
+static void
+ngx_http_upstream_keepalive_prewarm_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_keepalive_srv_conf_t *kcf = ev->data;
+
+    time_t                                     now;
+    ngx_uint_t                                 i;
+    ngx_http_upstream_rr_peer_t               *rr;
+    ngx_http_upstream_keepalive_peer_cache_t  *peer;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    now = ngx_time();
+
+    for (i = 0; i < kcf->rr_peers->number; i++) {
+
+        rr = &kcf->rr_peers->peer[i];
+
+        if (rr->down) {
+            continue;
+        }
+
+        if (rr->max_fails
+            && rr->fails >= rr->max_fails
+            && now - rr->checked <= rr->fail_timeout)
+        {
+            continue;
+        }
+
+        peer = ngx_http_upstream_keepalive_peer_cache(kcf, rr->sockaddr,
+                                                      rr->socklen, &rr->name,
+                                                      1);
+        if (peer == NULL) {
+            break;
+        }
+
+        peer->rr = rr;
+
+        if (peer->prewarm_delay
+            && (ngx_msec_int_t) (peer->prewarm_next - ngx_current_msec) > 0)
+        {
+            continue;
+        }
+
+        while (peer->cached + peer->connecting < kcf->prewarm
+               && !ngx_queue_empty(&kcf->free))
+        {
+            if (ngx_http_upstream_keepalive_prewarm_connect(kcf, peer)
+                != NGX_OK)
+            {
+                break;
+            }
+        }
+    }
+
+    ngx_add_timer(ev, NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_INTERVAL);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_prewarm_connect(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_peer_cache_t *peer)
+{
+    ngx_int_t                             rc;
+    ngx_queue_t                          *q;
+    ngx_connection_t                     *c;
+    ngx_peer_connection_t                 pc;
+    ngx_http_upstream_keepalive_cache_t  *item;
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = (struct sockaddr *) peer->sockaddr;
+    pc.socklen = peer->socklen;
+    pc.name = peer->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = kcf->prewarm_log;
+    pc.log_error = NGX_ERROR_INFO;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "keepalive prewarm connect to %V: %i", peer->name, rc);
+
+    if (rc == NGX_DECLINED) {
+        ngx_http_upstream_keepalive_prewarm_failed(peer, ngx_socket_errno,
+                                                   "connect() failed");
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY) {
+        return NGX_ERROR;
+    }
+
+    c = pc.connection;
+
+    q = ngx_queue_head(&kcf->free);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+    item->connection = c;
+    item->peer = peer;
+    peer->connecting++;
+
+    c->data = item;
+    c->idle = 1;
+    c->read->handler = ngx_http_upstream_keepalive_prewarm_connected;
+    c->write->handler = ngx_http_upstream_keepalive_prewarm_connected;
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_keepalive_prewarm_connected(c->write);
+        return NGX_OK;
+    }
+
+    /* rc == NGX_AGAIN */
+
+    ngx_add_timer(c->write, NGX_HTTP_UPSTREAM_KEEPALIVE_CONNECT_TIMEOUT);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_prewarm_connected(ngx_event_t *ev)
+{
+    int                                       err;
+    socklen_t                                 len;
+    ngx_connection_t                         *c;
+    ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_srv_conf_t   *kcf;
+
+    c = ev->data;
+    item = c->data;
+    kcf = item->conf;
+
+    if (c->close) {
+        goto failed;
+    }
+
+    if (ev->timedout) {
+        ngx_http_upstream_keepalive_prewarm_failed(item->peer, NGX_ETIMEDOUT,
+                                                   "connect() timed out");
+        goto failed;
+    }
+
+    err = 0;
+    len = sizeof(int);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        ngx_http_upstream_keepalive_prewarm_failed(item->peer, err,
+                                                   "connect() failed");
+        goto failed;
+    }
+
+    if (!ev->write) {
+        /* an idle http server has nothing to say */
+        goto failed;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK
+        || ngx_handle_read_event(c->read, 0) != NGX_OK)
+    {
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive prewarm: saving connection %p", c);
+
+    item->peer->connecting--;
+    item->peer->prewarm_delay = 0;
+
+    ngx_queue_insert_head(&item->peer->cache, &item->queue);
+    item->peer->cached++;
+
+    c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
+    c->read->handler = ngx_http_upstream_keepalive_close_handler;
+
+    if (kcf->timeout) {
+        ngx_add_timer(c->read, kcf->timeout);
+    }
+
+    return;
+
+failed:
+
+    item->peer->connecting--;
+
+    ngx_queue_insert_head(&kcf->free, &item->queue);
+
+    ngx_close_connection(c);
+}
+
+
+/*
+ * a failed prewarm connection counts as a failed attempt of the round robin
+ * peer, so max_fails and fail_timeout apply to prewarming as they do to
+ * requests; the next attempts to a failing server are also delayed,
+ * doubling the delay up to a minute
+ */
+
+static void
+ngx_http_upstream_keepalive_prewarm_failed(
+    ngx_http_upstream_keepalive_peer_cache_t *peer, ngx_err_t err, char *text)
+{
+    time_t                        now;
+    ngx_http_upstream_rr_peer_t  *rr;
+
+    rr = peer->rr;
+
+    if (rr) {
+        now = ngx_time();
+
+        rr->fails++;
+        rr->accessed = now;
+        rr->checked = now;
+
+        if (rr->max_fails) {
+            rr->effective_weight -= rr->weight / rr->max_fails;
+        }
+
+        if (rr->effective_weight < 0) {
+            rr->effective_weight = 0;
+        }
+    }
+
+    if (peer->prewarm_delay
+        && (ngx_msec_int_t) (peer->prewarm_next - ngx_current_msec) > 0)
+    {
+        /* another connection of the same attempt */
+        return;
+    }
+
+    if (peer->prewarm_delay == 0) {
+        peer->prewarm_delay = NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_INTERVAL;
+
+    } else if (peer->prewarm_delay
+               < NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_MAX_DELAY / 2)
+    {
+        peer->prewarm_delay *= 2;
+
+    } else {
+        peer->prewarm_delay = NGX_HTTP_UPSTREAM_KEEPALIVE_PREWARM_MAX_DELAY;
+    }
+
+    peer->prewarm_next = ngx_current_msec + peer->prewarm_delay;
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, err,
+                  "keepalive prewarm %s to %V, next attempt in %Mms",
+                  text, peer->name, peer->prewarm_delay);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -455,6 +904,80 @@ ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc, void *data)
 #endif
 
 
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                               i;
+    ngx_event_t                             *ev;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                          ngx_http_upstream_keepalive_module);
+
+        if (kcf->original_init_upstream == NULL
+            || kcf->prewarm == 0
+            || kcf->rr_peers == NULL)
+        {
+            continue;
+        }
+
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        /*
+         * ngx_event_connect_peer() logs the refused connections at
+         * the error level, the prewarm connections log only the critical
+         * errors and the failures are logged at the info level instead
+         */
+
+        kcf->prewarm_log = ngx_palloc(cycle->pool, sizeof(ngx_log_t));
+        if (kcf->prewarm_log == NULL) {
+            return NGX_ERROR;
+        }
+
+        *kcf->prewarm_log = *cycle->log;
+
+        if (kcf->prewarm_log->log_level > NGX_LOG_CRIT
+            && kcf->prewarm_log->log_level <= NGX_LOG_DEBUG)
+        {
+            kcf->prewarm_log->log_level = NGX_LOG_CRIT;
+        }
+
+        ev->handler = ngx_http_upstream_keepalive_prewarm_handler;
+        ev->data = kcf;
+        ev->log = cycle->log;
+
+        ngx_http_upstream_keepalive_prewarm_handler(ev);
+    }
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 {
@@ -474,6 +997,9 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      */
 
     conf->max_cached = 1;
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->requests = NGX_CONF_UNSET_UINT;
+    conf->prewarm = NGX_CONF_UNSET_UINT;
 
     return conf;
 }
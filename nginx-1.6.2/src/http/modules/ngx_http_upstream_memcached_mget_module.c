@@ -0,0 +1,1182 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Memcached multi-get.
+ *
+ * Every request gets a stream: a fake connection which is handed to the
+ * upstream module as a cached peer connection.  The "get key" command
+ * the memcached module sends to a stream is queued on a shared backend
+ * connection, and all keys queued during one event loop iteration go to
+ * the backend as a single "get k1 k2 ..." command.  Commands are
+ * pipelined, so the backend answers them in order: a "VALUE" block is
+ * copied to each stream waiting for the key and followed by "END", the
+ * streams whose keys were not found get just "END".
+ */
+
+
+#define NGX_HTTP_MEMCACHED_MGET_LINE      512
+#define NGX_HTTP_MEMCACHED_MGET_KEY_LEN   250
+
+
+typedef struct ngx_http_memcached_mget_conn_s    ngx_http_memcached_mget_conn_t;
+typedef struct ngx_http_memcached_mget_stream_s  ngx_http_memcached_mget_stream_t;
+
+
+typedef struct {
+	//每个后端服务器最多建立的共享连接个数
+    ngx_uint_t                         max_connections;
+	//一条get命令中最多包含的key个数
+    ngx_uint_t                         max_keys;
+
+    ngx_queue_t                        connections;
+    ngx_queue_t                        free_connections;
+    ngx_queue_t                        free_streams;
+
+    ngx_http_upstream_init_pt          original_init_upstream;
+    ngx_http_upstream_init_peer_pt     original_init_peer;
+
+} ngx_http_memcached_mget_srv_conf_t;
+
+
+struct ngx_http_memcached_mget_conn_s {
+    ngx_queue_t                        queue;
+    ngx_http_memcached_mget_srv_conf_t  *conf;
+
+    ngx_connection_t                  *connection;
+
+    ngx_str_t                         *name;
+    socklen_t                          socklen;
+    u_char                             sockaddr[NGX_SOCKADDRLEN];
+
+    ngx_uint_t                         nstreams;
+	//已分配到该连接、尚未发送key或已收到响应的请求队列
+    ngx_queue_t                        idle;
+	//等待合并发送的请求队列
+    ngx_queue_t                        pending;
+	//已发送、正在等待响应的请求队列，按发送顺序排列，last标志位标记每条get命令的最后一个请求
+    ngx_queue_t                        inflight;
+	//合并发送的事件，在本轮事件循环的最后被处理
+    ngx_event_t                        flush;
+
+    ngx_http_upstream_mpx_bufs_t       out;
+
+    /* the response being read from the backend */
+
+    u_char                             line[NGX_HTTP_MEMCACHED_MGET_LINE];
+    ngx_uint_t                         line_len;
+    size_t                             rest;
+
+    unsigned                           connected:1;
+    unsigned                           value:1;
+};
+
+
+struct ngx_http_memcached_mget_stream_s {
+	//共享的流部分，必须是第一个成员
+    ngx_http_upstream_mpx_stream_t     stream;
+    ngx_queue_t                        queue;
+
+    ngx_http_memcached_mget_srv_conf_t  *conf;
+    ngx_http_memcached_mget_conn_t    *mconn;
+
+    u_char                             key[NGX_HTTP_MEMCACHED_MGET_LINE];
+    ngx_uint_t                         key_len;
+
+    unsigned                           pending:1;
+    unsigned                           sent:1;
+    unsigned                           last:1;
+    unsigned                           receiving:1;
+    unsigned                           answered:1;
+    unsigned                           closed:1;
+};
+
+
+typedef struct {
+    ngx_http_memcached_mget_srv_conf_t  *conf;
+
+    ngx_http_memcached_mget_stream_t  *stream;
+
+    void                              *data;
+
+    ngx_event_get_peer_pt              original_get_peer;
+    ngx_event_free_peer_pt             original_free_peer;
+
+} ngx_http_memcached_mget_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_memcached_mget(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_memcached_mget_peer(
+    ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_memcached_mget_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_memcached_mget_peer(
+    ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
+
+static ngx_http_memcached_mget_conn_t *ngx_http_memcached_mget_connect(
+    ngx_http_memcached_mget_srv_conf_t *conf, ngx_peer_connection_t *pc);
+static void ngx_http_memcached_mget_read_handler(ngx_event_t *rev);
+static void ngx_http_memcached_mget_write_handler(ngx_event_t *wev);
+static void ngx_http_memcached_mget_flush_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_memcached_mget_parse(
+    ngx_http_memcached_mget_conn_t *mconn, u_char *p, u_char *last);
+static ngx_int_t ngx_http_memcached_mget_process_line(
+    ngx_http_memcached_mget_conn_t *mconn);
+static ngx_int_t ngx_http_memcached_mget_deliver(
+    ngx_http_memcached_mget_conn_t *mconn, u_char *data, size_t len,
+    ngx_uint_t receiving);
+static ngx_int_t ngx_http_memcached_mget_finish_command(
+    ngx_http_memcached_mget_conn_t *mconn, u_char *data, size_t len);
+static ngx_int_t ngx_http_memcached_mget_send(
+    ngx_http_memcached_mget_conn_t *mconn);
+static void ngx_http_memcached_mget_close(
+    ngx_http_memcached_mget_conn_t *mconn);
+
+static ngx_http_memcached_mget_stream_t *ngx_http_memcached_mget_create_stream(
+    ngx_http_memcached_mget_conn_t *mconn, ngx_log_t *log);
+static void ngx_http_memcached_mget_close_stream(
+    ngx_http_memcached_mget_stream_t *s);
+
+static ngx_chain_t *ngx_http_memcached_mget_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
+static void *ngx_http_memcached_mget_create_conf(ngx_conf_t *cf);
+static char *ngx_http_memcached_mget(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_memcached_mget_commands[] = {
+
+    { ngx_string("memcached_multiget"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_memcached_mget,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_memcached_mget_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_memcached_mget_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_memcached_mget_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_memcached_mget_module_ctx, /* module context */
+    ngx_http_upstream_memcached_mget_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_mpx_init_process,    /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_memcached_mget(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_memcached_mget_srv_conf_t  *mcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init memcached multiget");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                      ngx_http_upstream_memcached_mget_module);
+
+    if (us->peer.init_upstream != ngx_http_upstream_init_memcached_mget) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "\"memcached_multiget\" must be the last balancer "
+                      "directive in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mcf->original_init_peer = us->peer.init;
+
+    us->peer.init = ngx_http_upstream_init_memcached_mget_peer;
+
+    ngx_queue_init(&mcf->connections);
+    ngx_queue_init(&mcf->free_connections);
+    ngx_queue_init(&mcf->free_streams);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_memcached_mget_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_memcached_mget_srv_conf_t   *mcf;
+    ngx_http_memcached_mget_peer_data_t  *mp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init memcached multiget peer");
+
+    mcf = ngx_http_conf_upstream_srv_conf(us,
+                                      ngx_http_upstream_memcached_mget_module);
+
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_memcached_mget_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (mcf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    mp->conf = mcf;
+    mp->stream = NULL;
+    mp->data = r->upstream->peer.data;
+    mp->original_get_peer = r->upstream->peer.get;
+    mp->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = mp;
+    r->upstream->peer.get = ngx_http_upstream_get_memcached_mget_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_memcached_mget_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_memcached_mget_peer(ngx_peer_connection_t *pc,
+    void *data)
+{
+    ngx_http_memcached_mget_peer_data_t  *mp = data;
+
+    ngx_int_t                          rc;
+    ngx_uint_t                         n;
+    ngx_queue_t                       *q;
+    ngx_http_memcached_mget_conn_t    *mconn, *best;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get memcached multiget peer");
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK || ngx_http_upstream_mpx_disabled) {
+        return rc;
+    }
+
+    best = NULL;
+    n = 0;
+
+    for (q = ngx_queue_head(&mp->conf->connections);
+         q != ngx_queue_sentinel(&mp->conf->connections);
+         q = ngx_queue_next(q))
+    {
+        mconn = ngx_queue_data(q, ngx_http_memcached_mget_conn_t, queue);
+
+        if (ngx_memn2cmp(mconn->sockaddr, (u_char *) pc->sockaddr,
+                         mconn->socklen, pc->socklen)
+            != 0)
+        {
+            continue;
+        }
+
+        n++;
+
+        if (best == NULL || mconn->nstreams < best->nstreams) {
+            best = mconn;
+        }
+    }
+
+    /* requests are spread over the pool before they are pipelined */
+
+    if (best == NULL
+        || (best->nstreams && n < mp->conf->max_connections))
+    {
+        mconn = ngx_http_memcached_mget_connect(mp->conf, pc);
+
+        if (mconn) {
+            best = mconn;
+
+        } else if (best == NULL) {
+            return NGX_OK;
+        }
+    }
+
+    s = ngx_http_memcached_mget_create_stream(best, pc->log);
+    if (s == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "memcached multiget: stream on %p", best->connection);
+
+    mp->stream = s;
+
+    pc->connection = &s->stream.connection;
+    pc->cached = best->connected;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_upstream_free_memcached_mget_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_memcached_mget_peer_data_t  *mp = data;
+
+    ngx_http_memcached_mget_stream_t  *s;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free memcached multiget peer");
+
+    s = mp->stream;
+
+    if (s && pc->connection == &s->stream.connection) {
+        mp->stream = NULL;
+        pc->connection = NULL;
+
+        ngx_http_memcached_mget_close_stream(s);
+    }
+
+    mp->original_free_peer(pc, mp->data, state);
+}
+
+
+static ngx_http_memcached_mget_conn_t *
+ngx_http_memcached_mget_connect(ngx_http_memcached_mget_srv_conf_t *conf,
+    ngx_peer_connection_t *pc)
+{
+    ngx_int_t                        rc;
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_memcached_mget_conn_t  *mconn;
+
+    if (pc->socklen > NGX_SOCKADDRLEN) {
+        return NULL;
+    }
+
+    rc = ngx_http_upstream_mpx_connect(pc, &c);
+
+    if (rc == NGX_ERROR) {
+        return NULL;
+    }
+
+    if (!ngx_queue_empty(&conf->free_connections)) {
+        q = ngx_queue_head(&conf->free_connections);
+        ngx_queue_remove(q);
+
+        mconn = ngx_queue_data(q, ngx_http_memcached_mget_conn_t, queue);
+
+    } else {
+        mconn = ngx_pcalloc(ngx_cycle->pool,
+                            sizeof(ngx_http_memcached_mget_conn_t));
+        if (mconn == NULL) {
+            ngx_close_connection(c);
+            return NULL;
+        }
+
+        mconn->conf = conf;
+    }
+
+    mconn->connection = c;
+    mconn->name = pc->name;
+    mconn->socklen = pc->socklen;
+    ngx_memcpy(mconn->sockaddr, pc->sockaddr, pc->socklen);
+    c->sockaddr = (struct sockaddr *) mconn->sockaddr;
+    c->socklen = mconn->socklen;
+    mconn->nstreams = 0;
+    ngx_queue_init(&mconn->idle);
+    ngx_queue_init(&mconn->pending);
+    ngx_queue_init(&mconn->inflight);
+    mconn->out.first = NULL;
+    mconn->out.last = NULL;
+    mconn->line_len = 0;
+    mconn->rest = 0;
+    mconn->value = 0;
+    mconn->connected = (rc == NGX_OK);
+
+    ngx_memzero(&mconn->flush, sizeof(ngx_event_t));
+    mconn->flush.handler = ngx_http_memcached_mget_flush_handler;
+    mconn->flush.data = mconn;
+    mconn->flush.log = ngx_cycle->log;
+
+    ngx_queue_insert_tail(&conf->connections, &mconn->queue);
+
+    c->data = mconn;
+    c->read->handler = ngx_http_memcached_mget_read_handler;
+    c->write->handler = ngx_http_memcached_mget_write_handler;
+
+    return mconn;
+}
+
+
+static void
+ngx_http_memcached_mget_read_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_connection_t                *c;
+    ngx_http_memcached_mget_conn_t  *mconn;
+
+    c = rev->data;
+    mconn = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, rev->log, 0,
+                   "memcached multiget read handler");
+
+    if (c->close) {
+        c->close = 0;
+
+        if (mconn->nstreams == 0) {
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+    }
+
+    if (!mconn->connected) {
+        if (ngx_http_upstream_mpx_test_connect(c, mconn->name) != NGX_OK) {
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+
+        mconn->connected = 1;
+
+        if (ngx_http_memcached_mget_send(mconn) != NGX_OK) {
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+    }
+
+    while (rev->ready) {
+
+        n = c->recv(c, ngx_http_upstream_mpx_buffer,
+                    NGX_HTTP_UPSTREAM_MPX_BUFSIZE);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (n == 0 && !ngx_queue_empty(&mconn->inflight)) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream %V closed shared connection "
+                              "with commands in progress", mconn->name);
+            }
+
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+
+        if (ngx_http_memcached_mget_parse(mconn,
+                                          ngx_http_upstream_mpx_buffer,
+                                          ngx_http_upstream_mpx_buffer + n)
+            != NGX_OK)
+        {
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_memcached_mget_close(mconn);
+    }
+}
+
+
+static void
+ngx_http_memcached_mget_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t                *c;
+    ngx_http_memcached_mget_conn_t  *mconn;
+
+    c = wev->data;
+    mconn = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "memcached multiget write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream %V timed out while connecting", mconn->name);
+        ngx_http_memcached_mget_close(mconn);
+        return;
+    }
+
+    if (!mconn->connected) {
+        if (ngx_http_upstream_mpx_test_connect(c, mconn->name) != NGX_OK) {
+            ngx_http_memcached_mget_close(mconn);
+            return;
+        }
+
+        mconn->connected = 1;
+    }
+
+    if (ngx_http_memcached_mget_send(mconn) != NGX_OK) {
+        ngx_http_memcached_mget_close(mconn);
+    }
+}
+
+
+/*
+ * the keys queued during an event loop iteration are coalesced
+ * into "get" commands of up to max_keys distinct keys
+ */
+
+static void
+ngx_http_memcached_mget_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_memcached_mget_conn_t *mconn = ev->data;
+
+    ngx_uint_t                         n, dup;
+    ngx_queue_t                       *q, *dq;
+    ngx_http_memcached_mget_stream_t  *s, *first, *ds;
+
+    while (!ngx_queue_empty(&mconn->pending)) {
+
+        if (ngx_http_upstream_mpx_write(&mconn->out, (u_char *) "get", 3)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+
+        first = NULL;
+        s = NULL;
+        n = 0;
+
+        while (n < mconn->conf->max_keys && !ngx_queue_empty(&mconn->pending))
+        {
+            q = ngx_queue_head(&mconn->pending);
+            ngx_queue_remove(q);
+            ngx_queue_insert_tail(&mconn->inflight, q);
+
+            s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+            s->pending = 0;
+            s->sent = 1;
+
+            if (first == NULL) {
+                first = s;
+            }
+
+            dup = 0;
+
+            for (dq = &first->queue; dq != q; dq = ngx_queue_next(dq)) {
+                ds = ngx_queue_data(dq, ngx_http_memcached_mget_stream_t,
+                                    queue);
+
+                if (ds->key_len == s->key_len
+                    && ngx_strncmp(ds->key, s->key, s->key_len) == 0)
+                {
+                    dup = 1;
+                    break;
+                }
+            }
+
+            if (dup) {
+                continue;
+            }
+
+            if (ngx_http_upstream_mpx_write(&mconn->out, (u_char *) " ", 1)
+                    != NGX_OK
+                || ngx_http_upstream_mpx_write(&mconn->out, s->key,
+                                                 s->key_len)
+                   != NGX_OK)
+            {
+                goto failed;
+            }
+
+            n++;
+        }
+
+        s->last = 1;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                       "memcached multiget: get of %ui keys", n);
+
+        if (ngx_http_upstream_mpx_write(&mconn->out, (u_char *) CRLF, 2)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    if (ngx_http_memcached_mget_send(mconn) == NGX_OK) {
+        return;
+    }
+
+failed:
+
+    ngx_http_memcached_mget_close(mconn);
+}
+
+
+static ngx_int_t
+ngx_http_memcached_mget_parse(ngx_http_memcached_mget_conn_t *mconn,
+    u_char *p, u_char *last)
+{
+    size_t  n;
+
+    while (p < last) {
+
+        if (mconn->rest) {
+
+            /* a value block with its trailing CRLF */
+
+            n = ngx_min((size_t) (last - p), mconn->rest);
+
+            if (ngx_http_memcached_mget_deliver(mconn, p, n, 1) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            p += n;
+            mconn->rest -= n;
+
+            if (mconn->rest == 0
+                && ngx_http_memcached_mget_deliver(mconn, (u_char *) "END" CRLF,
+                                                   sizeof("END" CRLF) - 1, 1)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+        if (mconn->line_len == NGX_HTTP_MEMCACHED_MGET_LINE) {
+            ngx_log_error(NGX_LOG_ERR, mconn->connection->log, 0,
+                          "upstream %V sent too long line", mconn->name);
+            return NGX_ERROR;
+        }
+
+        mconn->line[mconn->line_len++] = *p++;
+
+        if (mconn->line[mconn->line_len - 1] != LF) {
+            continue;
+        }
+
+        if (ngx_http_memcached_mget_process_line(mconn) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        mconn->line_len = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_memcached_mget_process_line(ngx_http_memcached_mget_conn_t *mconn)
+{
+    u_char                            *p, *last, *key, *bytes;
+    size_t                             key_len;
+    ssize_t                            len;
+    ngx_uint_t                         matched;
+    ngx_queue_t                       *q;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    p = mconn->line;
+    last = mconn->line + mconn->line_len;
+
+    if (ngx_queue_empty(&mconn->inflight)) {
+        ngx_log_error(NGX_LOG_ERR, mconn->connection->log, 0,
+                      "upstream %V sent unexpected response", mconn->name);
+        return NGX_ERROR;
+    }
+
+    if (last - p == sizeof("END" CRLF) - 1
+        && ngx_strncmp(p, "END" CRLF, sizeof("END" CRLF) - 1) == 0)
+    {
+        return ngx_http_memcached_mget_finish_command(mconn, p, last - p);
+    }
+
+    if (ngx_strncmp(p, "VALUE ", sizeof("VALUE ") - 1) != 0) {
+
+        /* errors end the command, they are passed to the requests */
+
+        return ngx_http_memcached_mget_finish_command(mconn, p, last - p);
+    }
+
+    /* "VALUE <key> <flags> <bytes> [<cas unique>]" */
+
+    key = p + sizeof("VALUE ") - 1;
+
+    for (p = key; p < last && *p != ' '; p++) { /* void */ }
+
+    key_len = p - key;
+
+    for (p++; p < last && *p != ' '; p++) { /* void */ }
+
+    bytes = ++p;
+
+    for ( /* void */ ; p < last && *p >= '0' && *p <= '9'; p++) { /* void */ }
+
+    len = ngx_atosz(bytes, p - bytes);
+
+    if (len == NGX_ERROR || p >= last) {
+        ngx_log_error(NGX_LOG_ERR, mconn->connection->log, 0,
+                      "upstream %V sent invalid value line", mconn->name);
+        return NGX_ERROR;
+    }
+
+    matched = 0;
+
+    for (q = ngx_queue_head(&mconn->inflight);
+         q != ngx_queue_sentinel(&mconn->inflight);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+        s->receiving = 0;
+
+        if (!s->answered
+            && s->key_len == key_len
+            && ngx_strncmp(s->key, key, key_len) == 0)
+        {
+            s->receiving = 1;
+            s->answered = 1;
+            matched = 1;
+        }
+
+        if (s->last) {
+            break;
+        }
+    }
+
+    if (!matched) {
+        ngx_log_error(NGX_LOG_WARN, mconn->connection->log, 0,
+                      "upstream %V sent unrequested key \"%*s\"",
+                      mconn->name, key_len, key);
+    }
+
+    mconn->rest = len + sizeof(CRLF) - 1;
+
+    return ngx_http_memcached_mget_deliver(mconn, mconn->line,
+                                           mconn->line_len, 1);
+}
+
+
+static ngx_int_t
+ngx_http_memcached_mget_deliver(ngx_http_memcached_mget_conn_t *mconn,
+    u_char *data, size_t len, ngx_uint_t receiving)
+{
+    ngx_queue_t                       *q;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    for (q = ngx_queue_head(&mconn->inflight);
+         q != ngx_queue_sentinel(&mconn->inflight);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+        if ((receiving ? s->receiving : !s->answered) && !s->closed) {
+            if (ngx_http_upstream_mpx_deliver(&s->stream, data, len)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        if (s->last) {
+            break;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_memcached_mget_finish_command(ngx_http_memcached_mget_conn_t *mconn,
+    u_char *data, size_t len)
+{
+    ngx_uint_t                         last;
+    ngx_queue_t                       *q;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    /* keys not found, or the error line */
+
+    if (ngx_http_memcached_mget_deliver(mconn, data, len, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    do {
+        q = ngx_queue_head(&mconn->inflight);
+        ngx_queue_remove(q);
+
+        s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+        last = s->last;
+
+        s->sent = 0;
+        s->stream.done = 1;
+
+        if (s->closed) {
+            ngx_queue_insert_head(&s->conf->free_streams, &s->queue);
+
+        } else {
+            ngx_queue_insert_tail(&mconn->idle, &s->queue);
+        }
+
+    } while (!last);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_memcached_mget_send(ngx_http_memcached_mget_conn_t *mconn)
+{
+    if (!mconn->connected) {
+        return NGX_OK;
+    }
+
+    return ngx_http_upstream_mpx_send(mconn->connection, &mconn->out);
+}
+
+
+static void
+ngx_http_memcached_mget_close(ngx_http_memcached_mget_conn_t *mconn)
+{
+    ngx_queue_t                       *q;
+    ngx_event_t                       *ev;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    ev = &mconn->flush;
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+
+    /* requests in progress see an error once their data are read */
+
+    while (!ngx_queue_empty(&mconn->inflight)) {
+        q = ngx_queue_head(&mconn->inflight);
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&mconn->idle, q);
+    }
+
+    while (!ngx_queue_empty(&mconn->pending)) {
+        q = ngx_queue_head(&mconn->pending);
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&mconn->idle, q);
+    }
+
+    while (!ngx_queue_empty(&mconn->idle)) {
+        q = ngx_queue_head(&mconn->idle);
+        ngx_queue_remove(q);
+
+        s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+        s->pending = 0;
+        s->sent = 0;
+
+        if (s->closed) {
+            ngx_queue_insert_head(&s->conf->free_streams, &s->queue);
+            continue;
+        }
+
+        s->mconn = NULL;
+        s->stream.error = 1;
+        s->stream.connection.fd = (ngx_socket_t) -1;
+
+        ngx_http_upstream_mpx_wake_stream(&s->stream);
+    }
+
+    ngx_queue_remove(&mconn->queue);
+    ngx_queue_insert_head(&mconn->conf->free_connections, &mconn->queue);
+
+    ngx_http_upstream_mpx_close(mconn->connection, &mconn->out);
+
+    mconn->connection = NULL;
+}
+
+
+static ngx_http_memcached_mget_stream_t *
+ngx_http_memcached_mget_create_stream(ngx_http_memcached_mget_conn_t *mconn,
+    ngx_log_t *log)
+{
+    ngx_queue_t                         *q;
+    ngx_http_memcached_mget_stream_t    *s;
+    ngx_http_memcached_mget_srv_conf_t  *conf;
+
+    conf = mconn->conf;
+
+    if (!ngx_queue_empty(&conf->free_streams)) {
+        q = ngx_queue_head(&conf->free_streams);
+        ngx_queue_remove(q);
+
+        s = ngx_queue_data(q, ngx_http_memcached_mget_stream_t, queue);
+
+    } else {
+        s = ngx_palloc(ngx_cycle->pool,
+                       sizeof(ngx_http_memcached_mget_stream_t));
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+
+    ngx_memzero(s, sizeof(ngx_http_memcached_mget_stream_t));
+
+    s->conf = conf;
+    s->mconn = mconn;
+
+    ngx_queue_insert_tail(&mconn->idle, &s->queue);
+    mconn->nstreams++;
+
+    ngx_http_upstream_mpx_init_stream(&s->stream, mconn->connection, log);
+
+    s->stream.connection.send_chain = ngx_http_memcached_mget_send_chain;
+
+    return s;
+}
+
+
+static void
+ngx_http_memcached_mget_close_stream(ngx_http_memcached_mget_stream_t *s)
+{
+    ngx_http_memcached_mget_conn_t  *mconn;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, s->stream.connection.log, 0,
+                   "close memcached multiget stream");
+
+    ngx_http_upstream_mpx_close_stream(&s->stream);
+
+    mconn = s->mconn;
+
+    if (mconn) {
+        mconn->nstreams--;
+
+        if (s->sent) {
+
+            /* the stream keeps its place until the command is answered */
+
+            s->closed = 1;
+            return;
+        }
+
+        ngx_queue_remove(&s->queue);
+    }
+
+    ngx_queue_insert_head(&s->conf->free_streams, &s->queue);
+}
+
+
+/*
+ * the "get <key>" command of a request is taken apart here, the key
+ * is queued and sent later along with the keys of other requests
+ */
+
+static ngx_chain_t *
+ngx_http_memcached_mget_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    u_char                            *p, *last;
+    ngx_uint_t                         i;
+    ngx_event_t                       *ev;
+    ngx_http_memcached_mget_conn_t    *mconn;
+    ngx_http_memcached_mget_stream_t  *s;
+
+    s = (ngx_http_memcached_mget_stream_t *) ngx_http_upstream_mpx_stream(c);
+
+    mconn = s->mconn;
+
+    if (mconn == NULL || s->stream.error) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+
+        if (ngx_buf_special(in->buf)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(in->buf)) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "file buf in memcached multiget request");
+            return NGX_CHAIN_ERROR;
+        }
+
+        p = in->buf->pos;
+        last = in->buf->last;
+
+        while (p < last) {
+
+            if (s->pending || s->sent || s->stream.done
+                || s->key_len == NGX_HTTP_MEMCACHED_MGET_LINE)
+            {
+                goto invalid;
+            }
+
+            s->key[s->key_len++] = *p++;
+
+            if (s->key[s->key_len - 1] != LF) {
+                continue;
+            }
+
+            /* "get <key>" CRLF */
+
+            if (s->key_len < sizeof("get " CRLF)
+                || ngx_strncmp(s->key, "get ", sizeof("get ") - 1) != 0
+                || s->key[s->key_len - 2] != CR)
+            {
+                goto invalid;
+            }
+
+            s->key_len -= sizeof("get " CRLF) - 1;
+
+            if (s->key_len > NGX_HTTP_MEMCACHED_MGET_KEY_LEN) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "memcached key is too long");
+                return NGX_CHAIN_ERROR;
+            }
+
+            ngx_memmove(s->key, s->key + sizeof("get ") - 1, s->key_len);
+
+            for (i = 0; i < s->key_len; i++) {
+                if (s->key[i] <= ' ') {
+                    goto invalid;
+                }
+            }
+
+            ngx_queue_remove(&s->queue);
+            ngx_queue_insert_tail(&mconn->pending, &s->queue);
+
+            s->pending = 1;
+
+            ev = &mconn->flush;
+
+            if (ev->prev == NULL) {
+                ngx_post_event(ev, &ngx_posted_events);
+            }
+        }
+
+        c->sent += last - in->buf->pos;
+        in->buf->pos = last;
+    }
+
+    return NULL;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "unexpected memcached multiget request");
+
+    return NGX_CHAIN_ERROR;
+}
+
+
+static void *
+ngx_http_memcached_mget_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_memcached_mget_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_mget_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->original_init_upstream = NULL;
+     *     conf->original_init_peer = NULL;
+     */
+
+    conf->max_connections = 1;
+    conf->max_keys = 64;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_memcached_mget(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_memcached_mget_srv_conf_t  *mcf = conf;
+
+    ngx_int_t                      n;
+    ngx_str_t                     *value;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (mcf->original_init_upstream) {
+        return "is duplicate";
+    }
+
+    mcf->original_init_upstream = uscf->peer.init_upstream
+                                  ? uscf->peer.init_upstream
+                                  : ngx_http_upstream_init_round_robin;
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_memcached_mget;
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    mcf->max_connections = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "keys=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            mcf->max_keys = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
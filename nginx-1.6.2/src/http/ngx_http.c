@@ -28,11 +28,9 @@ static ngx_int_t ngx_http_add_server(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_conf_addr_t *addr);
 
 static char *ngx_http_merge_servers(ngx_conf_t *cf,
-    ngx_http_core_main_conf_t *cmcf, ngx_http_module_t *module,
-    ngx_uint_t ctx_index);
+    ngx_http_core_main_conf_t *cmcf);
 static char *ngx_http_merge_locations(ngx_conf_t *cf,
-    ngx_queue_t *locations, void **loc_conf, ngx_http_module_t *module,
-    ngx_uint_t ctx_index);
+    ngx_queue_t *locations, void **loc_conf);
 static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_core_loc_conf_t *pclcf);
 static ngx_int_t ngx_http_init_static_location_trees(ngx_conf_t *cf,
@@ -119,6 +117,7 @@ static char *
 ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char                        *rv;
+    uint64_t                     start;
     ngx_uint_t                   mi, m, s;
     ngx_conf_t                   pcf;
     ngx_http_module_t           *module;
@@ -247,6 +246,8 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
      * and its location{}s' loc_conf's
      */
 
+    start = ngx_conf_profile_time();
+
     cmcf = ctx->main_conf[ngx_http_core_module.ctx_index];
     cscfp = cmcf->servers.elts;
 
@@ -266,16 +267,21 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 goto failed;
             }
         }
+    }
 
-        rv = ngx_http_merge_servers(cf, cmcf, module, mi);
-        if (rv != NGX_CONF_OK) {
-            goto failed;
-        }
+    rv = ngx_http_merge_servers(cf, cmcf);
+    if (rv != NGX_CONF_OK) {
+        goto failed;
     }
 
 
+    ngx_conf_profile_phase("http merge", start);
+
+
     /* create location trees */
 
+    start = ngx_conf_profile_time();
+
     for (s = 0; s < cmcf->servers.nelts; s++) {
 
         clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
@@ -289,6 +295,9 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    ngx_conf_profile_phase("http locations", start);
+    start = ngx_conf_profile_time();
+
 	//初始化http可以处理的7个阶段
     if (ngx_http_init_phases(cf, cmcf) != NGX_OK) {
         return NGX_CONF_ERROR;
@@ -330,12 +339,19 @@ ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
 
+    ngx_conf_profile_phase("http postconfiguration", start);
+
+
     /* optimize the lists of ports, addresses and server names */
 
+    start = ngx_conf_profile_time();
+
     if (ngx_http_optimize_servers(cf, cmcf, cmcf->ports) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_profile_phase("http servers", start);
+
     return NGX_CONF_OK;
 
 failed:
@@ -559,12 +575,18 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 }
 
 
+/*
+ * all the modules are merged at once for a server{} or a location{}:
+ * the module confs of a location are allocated together, so this touches
+ * each of them once rather than walking all the locations per module
+ */
+
 static char *
-ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
-    ngx_http_module_t *module, ngx_uint_t ctx_index)
+ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
 {
     char                        *rv;
-    ngx_uint_t                   s;
+    ngx_uint_t                   s, m, mi;
+    ngx_http_module_t           *module;
     ngx_http_conf_ctx_t         *ctx, saved;
     ngx_http_core_loc_conf_t    *clcf;
     ngx_http_core_srv_conf_t   **cscfp;
@@ -576,40 +598,46 @@ ngx_http_merge_servers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
 
     for (s = 0; s < cmcf->servers.nelts; s++) {
 
-        /* merge the server{}s' srv_conf's */
-
         ctx->srv_conf = cscfp[s]->ctx->srv_conf;
+        ctx->loc_conf = cscfp[s]->ctx->loc_conf;
 
-        if (module->merge_srv_conf) {
-            rv = module->merge_srv_conf(cf, saved.srv_conf[ctx_index],
-                                        cscfp[s]->ctx->srv_conf[ctx_index]);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
+        for (m = 0; ngx_modules[m]; m++) {
+            if (ngx_modules[m]->type != NGX_HTTP_MODULE) {
+                continue;
             }
-        }
 
-        if (module->merge_loc_conf) {
+            module = ngx_modules[m]->ctx;
+            mi = ngx_modules[m]->ctx_index;
 
-            /* merge the server{}'s loc_conf */
+            /* merge the server{}s' srv_conf's */
 
-            ctx->loc_conf = cscfp[s]->ctx->loc_conf;
+            if (module->merge_srv_conf) {
+                rv = module->merge_srv_conf(cf, saved.srv_conf[mi],
+                                            cscfp[s]->ctx->srv_conf[mi]);
+                if (rv != NGX_CONF_OK) {
+                    goto failed;
+                }
+            }
 
-            rv = module->merge_loc_conf(cf, saved.loc_conf[ctx_index],
-                                        cscfp[s]->ctx->loc_conf[ctx_index]);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
+            /* merge the server{}'s loc_conf */
+
+            if (module->merge_loc_conf) {
+                rv = module->merge_loc_conf(cf, saved.loc_conf[mi],
+                                            cscfp[s]->ctx->loc_conf[mi]);
+                if (rv != NGX_CONF_OK) {
+                    goto failed;
+                }
             }
+        }
 
-            /* merge the locations{}' loc_conf's */
+        /* merge the locations{}' loc_conf's */
 
-            clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
+        clcf = cscfp[s]->ctx->loc_conf[ngx_http_core_module.ctx_index];
 
-            rv = ngx_http_merge_locations(cf, clcf->locations,
-                                          cscfp[s]->ctx->loc_conf,
-                                          module, ctx_index);
-            if (rv != NGX_CONF_OK) {
-                goto failed;
-            }
+        rv = ngx_http_merge_locations(cf, clcf->locations,
+                                      cscfp[s]->ctx->loc_conf);
+        if (rv != NGX_CONF_OK) {
+            goto failed;
         }
     }
 
@@ -623,10 +651,12 @@ failed:
 
 static char *
 ngx_http_merge_locations(ngx_conf_t *cf, ngx_queue_t *locations,
-    void **loc_conf, ngx_http_module_t *module, ngx_uint_t ctx_index)
+    void **loc_conf)
 {
     char                       *rv;
+    ngx_uint_t                  m, mi;
     ngx_queue_t                *q;
+    ngx_http_module_t          *module;
     ngx_http_conf_ctx_t        *ctx, saved;
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_location_queue_t  *lq;
@@ -647,14 +677,25 @@ ngx_http_merge_locations(ngx_conf_t *cf, ngx_queue_t *locations,
         clcf = lq->exact ? lq->exact : lq->inclusive;
         ctx->loc_conf = clcf->loc_conf;
 
-        rv = module->merge_loc_conf(cf, loc_conf[ctx_index],
-                                    clcf->loc_conf[ctx_index]);
-        if (rv != NGX_CONF_OK) {
-            return rv;
+        for (m = 0; ngx_modules[m]; m++) {
+            if (ngx_modules[m]->type != NGX_HTTP_MODULE) {
+                continue;
+            }
+
+            module = ngx_modules[m]->ctx;
+            mi = ngx_modules[m]->ctx_index;
+
+            if (module->merge_loc_conf == NULL) {
+                continue;
+            }
+
+            rv = module->merge_loc_conf(cf, loc_conf[mi], clcf->loc_conf[mi]);
+            if (rv != NGX_CONF_OK) {
+                return rv;
+            }
         }
 
-        rv = ngx_http_merge_locations(cf, clcf->locations, clcf->loc_conf,
-                                      module, ctx_index);
+        rv = ngx_http_merge_locations(cf, clcf->locations, clcf->loc_conf);
         if (rv != NGX_CONF_OK) {
             return rv;
         }
@@ -774,6 +815,7 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         }
 
         pclcf->regex_locations = clcfp;
+        pclcf->nregex_locations = r;
 
         for (q = regex;
              q != ngx_queue_sentinel(locations);
@@ -1002,62 +1044,68 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
+/*
+ * the locations of the same level are walked in a loop rather than by
+ * the tail recursion, so a server with many locations does not need
+ * a stack frame per location
+ */
+
 static void
 ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
 {
     u_char                     *name;
     size_t                      len;
-    ngx_queue_t                *x, tail;
+    ngx_queue_t                *x, *next, tail;
     ngx_http_location_queue_t  *lq, *lx;
 
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
-
-    lq = (ngx_http_location_queue_t *) q;
+    while (q != ngx_queue_last(locations)) {
 
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
-    }
+        lq = (ngx_http_location_queue_t *) q;
 
-    len = lq->name->len;
-    name = lq->name->data;
+        if (lq->inclusive == NULL) {
+            q = ngx_queue_next(q);
+            continue;
+        }
 
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
-    {
-        lx = (ngx_http_location_queue_t *) x;
+        len = lq->name->len;
+        name = lq->name->data;
 
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
+        for (x = ngx_queue_next(q);
+             x != ngx_queue_sentinel(locations);
+             x = ngx_queue_next(x))
         {
-            break;
+            lx = (ngx_http_location_queue_t *) x;
+
+            if (len > lx->name->len
+                || ngx_filename_cmp(name, lx->name->data, len) != 0)
+            {
+                break;
+            }
         }
-    }
 
-    q = ngx_queue_next(q);
+        next = ngx_queue_next(q);
 
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
-    }
+        if (next == x) {
+            q = x;
+            continue;
+        }
 
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
+        ngx_queue_split(locations, next, &tail);
+        ngx_queue_add(&lq->list, &tail);
 
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-        return;
-    }
+        if (x == ngx_queue_sentinel(locations)) {
+            ngx_http_create_locations_list(&lq->list,
+                                           ngx_queue_head(&lq->list));
+            return;
+        }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
+        ngx_queue_split(&lq->list, x, &tail);
+        ngx_queue_add(locations, &tail);
 
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
 
-    ngx_http_create_locations_list(locations, x);
+        q = x;
+    }
 }
 
 
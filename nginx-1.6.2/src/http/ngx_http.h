@@ -45,6 +45,9 @@ typedef u_char *(*ngx_http_log_handler_pt)(ngx_http_request_t *r,
 #if (NGX_HTTP_CACHE)
 #include <ngx_http_cache.h>
 #endif
+#if (NGX_HTTP_UPSTREAM_MPX)
+#include <ngx_http_upstream_mpx.h>
+#endif
 #if (NGX_HTTP_SSI)
 #include <ngx_http_ssi_filter_module.h>
 #endif
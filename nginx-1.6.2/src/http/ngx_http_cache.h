@@ -46,13 +46,18 @@ typedef struct {
     unsigned                         exists:1;
     unsigned                         updating:1;
     unsigned                         deleting:1;
-                                     /* 11 unused bits */
+    unsigned                         filling:1;
+                                     /* 10 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
     time_t                           valid_sec;
     size_t                           body_start;
     off_t                            fs_size;
+
+	//正在写入的临时文件的序号及已写入的长度，供其他请求边写边读
+    uint32_t                         fill_number;
+    off_t                            fill_length;
 } ngx_http_file_cache_node_t;
 
 
@@ -85,10 +90,20 @@ struct ngx_http_cache_s {
     ngx_msec_t                       wait_time;
 
     ngx_event_t                      wait_event;
+	//在本进程中等待同一缓存节点更新完成的请求队列，挂在ngx_http_file_cache_t的waiters上
+    ngx_queue_t                      wait_queue;
+
+    ngx_path_t                      *temp_path;
+    uint32_t                         fill_number;
+    off_t                            fill_length;
 
     unsigned                         lock:1;
     unsigned                         waiting:1;
 
+    unsigned                         stream:1;
+    unsigned                         streaming:1;
+    unsigned                         filling:1;
+
     unsigned                         updated:1;
     unsigned                         updating:1;
     unsigned                         exists:1;
@@ -135,6 +150,8 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       loader_threshold;
 
     ngx_shm_zone_t                  *shm_zone;
+
+    ngx_queue_t                      waiters;
 };
 
 
@@ -144,6 +161,7 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 void ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
@@ -21,9 +21,42 @@ typedef struct {
 #define NGX_HTTP_REQUEST_BODY_FILE_CLEAN  2
 
 
+#if (NGX_PCRE)
+
+/*
+ * the per-process cache of regex location lookups: a URI maps to the index
+ * of the matched regex location, so a repeated URI is matched against one
+ * regex only, or against none if no location matched
+ */
+
+#define NGX_HTTP_REGEX_CACHE_SIZE         1024
+#define NGX_HTTP_REGEX_CACHE_URI_LEN      96
+
+/* fewer regex locations are cheaper to test than to look up */
+#define NGX_HTTP_REGEX_CACHE_MIN          8
+
+typedef struct {
+    ngx_http_core_loc_conf_t  **locations;
+    ngx_uint_t                  hash;
+    ngx_uint_t                  match;      /* index + 1, 0 if none */
+    size_t                      len;
+    u_char                      uri[NGX_HTTP_REGEX_CACHE_URI_LEN];
+} ngx_http_regex_cache_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_core_find_location(ngx_http_request_t *r);
 static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node);
+#if (NGX_PCRE)
+static ngx_http_regex_cache_t *ngx_http_core_regex_cache(
+    ngx_http_request_t *r, ngx_http_core_loc_conf_t **locations,
+    ngx_uint_t *hit);
+static void ngx_http_core_regex_cache_set(ngx_http_request_t *r,
+    ngx_http_regex_cache_t *rc, ngx_http_core_loc_conf_t **locations,
+    ngx_uint_t match);
+#endif
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static void *ngx_http_core_create_main_conf(ngx_conf_t *cf);
@@ -1547,7 +1580,8 @@ ngx_http_core_find_location(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *pclcf;
 #if (NGX_PCRE)
     ngx_int_t                  n;
-    ngx_uint_t                 noregex;
+    ngx_uint_t                 noregex, hit;
+    ngx_http_regex_cache_t    *cache;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
 
     noregex = 0;
@@ -1580,7 +1614,28 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        clcfp = pclcf->regex_locations;
+        cache = NULL;
+
+        if (pclcf->nregex_locations >= NGX_HTTP_REGEX_CACHE_MIN) {
+            cache = ngx_http_core_regex_cache(r, clcfp, &hit);
+
+            if (hit) {
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "regex location cache hit: %ui", cache->match);
+
+                if (cache->match == 0) {
+                    return rc;
+                }
+
+                /* the location is tested again to set the captures */
+
+                clcfp += cache->match - 1;
+                cache = NULL;
+            }
+        }
+
+        for ( /* void */ ; *clcfp; clcfp++) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
@@ -1588,6 +1643,13 @@ ngx_http_core_find_location(ngx_http_request_t *r)
             n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
 
             if (n == NGX_OK) {
+                if (cache) {
+                    ngx_http_core_regex_cache_set(r, cache,
+                                                  pclcf->regex_locations,
+                                                  clcfp - pclcf->regex_locations
+                                                  + 1);
+                }
+
                 r->loc_conf = (*clcfp)->loc_conf;
 
                 /* look up nested locations */
@@ -1603,6 +1665,10 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
             return NGX_ERROR;
         }
+
+        if (cache) {
+            ngx_http_core_regex_cache_set(r, cache, pclcf->regex_locations, 0);
+        }
     }
 #endif
 
@@ -1610,6 +1676,74 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 }
 
 
+#if (NGX_PCRE)
+
+static ngx_http_regex_cache_t *
+ngx_http_core_regex_cache(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t **locations, ngx_uint_t *hit)
+{
+    ngx_uint_t               hash;
+    ngx_http_regex_cache_t  *rc;
+
+    static ngx_http_regex_cache_t  *cache;
+    static ngx_cycle_t             *cycle;
+
+    *hit = 0;
+
+    if (r->uri.len > NGX_HTTP_REGEX_CACHE_URI_LEN) {
+        return NULL;
+    }
+
+    if (cycle != ngx_cycle) {
+
+        /* the locations of a previous cycle may share the addresses */
+
+        if (cache == NULL) {
+            cache = ngx_alloc(NGX_HTTP_REGEX_CACHE_SIZE
+                              * sizeof(ngx_http_regex_cache_t),
+                              r->connection->log);
+            if (cache == NULL) {
+                return NULL;
+            }
+        }
+
+        ngx_memzero(cache,
+                    NGX_HTTP_REGEX_CACHE_SIZE * sizeof(ngx_http_regex_cache_t));
+
+        cycle = (ngx_cycle_t *) ngx_cycle;
+    }
+
+    hash = ngx_hash_key(r->uri.data, r->uri.len) ^ (uintptr_t) locations;
+
+    rc = &cache[hash % NGX_HTTP_REGEX_CACHE_SIZE];
+
+    if (rc->locations == locations
+        && rc->hash == hash
+        && rc->len == r->uri.len
+        && ngx_memcmp(rc->uri, r->uri.data, r->uri.len) == 0)
+    {
+        *hit = 1;
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_core_regex_cache_set(ngx_http_request_t *r,
+    ngx_http_regex_cache_t *rc, ngx_http_core_loc_conf_t **locations,
+    ngx_uint_t match)
+{
+    rc->locations = locations;
+    rc->hash = ngx_hash_key(r->uri.data, r->uri.len) ^ (uintptr_t) locations;
+    rc->match = match;
+    rc->len = r->uri.len;
+    ngx_memcpy(rc->uri, r->uri.data, r->uri.len);
+}
+
+#endif
+
+
 /*
  * NGX_OK       - exact match
  * NGX_DONE     - auto redirect
@@ -348,6 +348,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_uint_t                       nregex_locations;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -14,6 +14,13 @@
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_lock_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static ngx_int_t ngx_http_file_cache_stream_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_stream_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_stream_writer(ngx_http_request_t *r);
+static void ngx_http_file_cache_stream_send(ngx_http_request_t *r);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -369,6 +376,13 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 done:
 
     if (rv == NGX_DECLINED) {
+
+        rc = ngx_http_file_cache_stream_open(r, c);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
         return ngx_http_file_cache_lock(r, c);
     }
 
@@ -417,6 +431,14 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->wait_event.log = r->connection->log;
     }
 
+    /*
+     * a request of this worker which updates the node wakes the waiters
+     * up as soon as it is done, the timer is only needed to notice
+     * the updates made by other workers
+     */
+
+    ngx_queue_insert_tail(&cache->waiters, &c->wait_queue);
+
     timer = c->wait_time - now;
 
     ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
@@ -456,7 +478,7 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    if (c->node->updating) {
+    if (c->node->updating && !(c->stream && c->node->filling)) {
         wait = 1;
     }
 
@@ -469,12 +491,418 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 
 wakeup:
 
+    ngx_queue_remove(&c->wait_queue);
+
     c->waiting = 0;
     r->main->blocked--;
     r->connection->write->handler(r->connection->write);
 }
 
 
+static void
+ngx_http_file_cache_lock_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_queue_t       *q;
+    ngx_event_t       *ev;
+    ngx_http_cache_t  *c;
+
+    for (q = ngx_queue_head(&cache->waiters);
+         q != ngx_queue_sentinel(&cache->waiters);
+         q = ngx_queue_next(q))
+    {
+        c = ngx_queue_data(q, ngx_http_cache_t, wait_queue);
+
+        if (c->node != fcn) {
+            continue;
+        }
+
+        ev = &c->wait_event;
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                       "http file cache lock wakeup");
+
+        if (ev->timer_set) {
+            ngx_del_timer(ev);
+        }
+
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+}
+
+
+/*
+ * a request which misses a node that another request is filling right now
+ * opens the temporary file of the fill and sends the response from it
+ * as the data land there, instead of waiting for the whole file or
+ * going to the upstream itself
+ */
+
+static ngx_int_t
+ngx_http_file_cache_stream_open(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                    len;
+    u_char                   *name;
+    uint32_t                  number;
+    ngx_fd_t                  fd;
+    ngx_int_t                 rc;
+    ngx_str_t                 cache_name;
+    ngx_path_t               *path;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_file_cache_t    *cache;
+    ngx_pool_cleanup_file_t  *clnf;
+
+    if (!c->stream || c->updating || c->temp_path == NULL) {
+        return NGX_DECLINED;
+    }
+
+    cache = c->file_cache;
+    number = 0;
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (c->node->filling && !c->node->exists) {
+        number = c->node->fill_number;
+        rc = NGX_OK;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_DECLINED;
+    }
+
+    /* the same name as ngx_create_temp_file() has given to the file */
+
+    path = c->temp_path;
+    len = path->name.len + 1 + path->len + 10;
+
+    name = ngx_pnalloc(r->pool, len + 1);
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    (void) ngx_sprintf(name + path->name.len + 1 + path->len, "%010uD%Z",
+                       number);
+
+    ngx_create_hashed_filename(path, name, len);
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+
+        /*
+         * the fill has just ended or it is done by a location
+         * with another temporary path
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, ngx_errno,
+                       "http file cache stream \"%s\" not opened, fill:%uD",
+                       name, number);
+
+        return NGX_DECLINED;
+    }
+
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
+
+    clnf->fd = fd;
+    clnf->name = name;
+    clnf->log = r->pool->log;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: \"%s\" fd:%d", name, fd);
+
+    cache_name = c->file.name;
+
+    c->file.fd = fd;
+    c->file.name.data = name;
+    c->file.name.len = len;
+    c->file.log = r->connection->log;
+
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->fill_number = number;
+    c->streaming = 1;
+
+    c->wait_event.handler = ngx_http_file_cache_stream_handler;
+    c->wait_event.data = r;
+    c->wait_event.log = r->connection->log;
+
+    ngx_queue_insert_tail(&cache->waiters, &c->wait_queue);
+
+    rc = ngx_http_file_cache_read(r, c);
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    ngx_queue_remove(&c->wait_queue);
+
+    c->streaming = 0;
+    c->buf = NULL;
+
+    ngx_pool_run_cleanup_file(r->pool, fd);
+
+    c->file.fd = NGX_INVALID_FILE;
+    c->file.name = cache_name;
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_file_cache_stream_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+    ngx_http_log_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ctx = c->log->data;
+    ctx->current_request = r;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache stream handler: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (!r->header_sent) {
+        /* the cached header is still being read */
+        return;
+    }
+
+    ngx_http_file_cache_stream_send(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_file_cache_stream_writer(ngx_http_request_t *r)
+{
+    ngx_event_t               *wev;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    wev = r->connection->write;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "http file cache stream writer: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (wev->timedout) {
+        if (!wev->delayed) {
+            ngx_log_error(NGX_LOG_INFO, wev->log, NGX_ETIMEDOUT,
+                          "client timed out");
+            r->connection->timedout = 1;
+
+            ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+            return;
+        }
+
+        wev->timedout = 0;
+        wev->delayed = 0;
+    }
+
+    if (wev->delayed || r->aio) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_http_file_cache_stream_send(r);
+}
+
+
+/*
+ * c->length is the file offset up to which the response has been passed
+ * to the output filters, the fill is over when the node is not filled
+ * anymore or is filled from another temporary file
+ */
+
+static void
+ngx_http_file_cache_stream_send(ngx_http_request_t *r)
+{
+    off_t                        length;
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   done, exists;
+    ngx_event_t                 *wev, *ev;
+    ngx_chain_t                  out;
+    ngx_file_uniq_t              uniq;
+    ngx_file_info_t              fi;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+    wev = r->connection->write;
+
+    r->write_event_handler = ngx_http_file_cache_stream_writer;
+
+    if (r->buffered || r->connection->buffered) {
+
+        rc = ngx_http_output_filter(r, NULL);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+
+        if (r->buffered || r->connection->buffered) {
+            goto blocked;
+        }
+    }
+
+    cache = c->file_cache;
+
+    length = 0;
+    done = 0;
+    exists = 0;
+    uniq = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = c->node;
+
+    if (fcn->filling && fcn->fill_number == c->fill_number) {
+        length = fcn->fill_length;
+
+    } else {
+        done = 1;
+        exists = fcn->exists;
+        uniq = fcn->uniq;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (done) {
+
+        /* a successful fill has renamed our file into the cache */
+
+        if (ngx_fd_info(c->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed", c->file.name.data);
+
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (!exists || uniq != ngx_file_uniq(&fi)) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "cache file \"%s\" was not completed",
+                          c->file.name.data);
+
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        length = ngx_file_size(&fi);
+
+    } else if (length <= c->length) {
+        goto wait;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: %O-%O done:%ui",
+                   c->length, length, done);
+
+    /*
+     * the buffer of the cached header is not needed anymore,
+     * and it is not busy when nothing is buffered
+     */
+
+    b = c->buf;
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->file = &c->file;
+    b->file_pos = c->length;
+    b->file_last = length;
+    b->in_file = (length > c->length) ? 1 : 0;
+
+    if (done) {
+        b->last_buf = (r == r->main) ? 1 : 0;
+        b->last_in_chain = 1;
+
+        if (!b->in_file && !b->last_buf) {
+            b->sync = 1;
+        }
+
+    } else {
+        b->flush = 1;
+    }
+
+    c->length = length;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_output_filter(r, &out);
+
+    if (done || rc == NGX_ERROR) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    if (r->buffered || r->connection->buffered) {
+        goto blocked;
+    }
+
+wait:
+
+    if (wev->timer_set && !wev->delayed) {
+        ngx_del_timer(wev);
+    }
+
+    /*
+     * a fill of this worker posts the event as soon as new data are
+     * written, the timer is only needed to notice the fills made
+     * by other workers
+     */
+
+    ev = &c->wait_event;
+
+    if (!ev->timer_set) {
+        ngx_add_timer(ev, 100);
+    }
+
+    return;
+
+blocked:
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (!wev->delayed && !wev->timer_set) {
+        ngx_add_timer(wev, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -522,6 +950,11 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     r->cached = 1;
 
+    if (c->streaming) {
+        /* the node is still being filled and is neither stale nor cold */
+        return NGX_OK;
+    }
+
     cache = c->file_cache;
 
     if (cache->sh->cold) {
@@ -966,9 +1399,70 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         c->node->exists = 1;
     }
 
+    if (c->filling) {
+        c->node->filling = 0;
+        c->filling = 0;
+    }
+
     c->node->updating = 0;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_file_cache_lock_wakeup(cache, c->node);
+}
+
+
+void
+ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    ngx_int_t               n;
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    c = r->cache;
+
+    if (!c->stream
+        || c->updated
+        || tf->file.fd == NGX_INVALID_FILE
+        || tf->offset == c->fill_length)
+    {
+        return;
+    }
+
+    n = 0;
+
+    if (!c->filling) {
+        n = ngx_atoi(tf->file.name.data + tf->file.name.len - 10, 10);
+
+        if (n == NGX_ERROR) {
+            return;
+        }
+    }
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (!c->filling && !c->node->filling && !c->node->exists) {
+        c->node->filling = 1;
+        c->node->fill_number = (uint32_t) n;
+        c->filling = 1;
+    }
+
+    if (c->filling) {
+        c->node->fill_length = tf->offset;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->fill_length = tf->offset;
+
+    if (c->filling) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache fill: %O", tf->offset);
+
+        ngx_http_file_cache_lock_wakeup(cache, c->node);
+    }
 }
 
 
@@ -1087,6 +1581,7 @@ ngx_http_cache_send(ngx_http_request_t *r)
 {
     ngx_int_t          rc;
     ngx_buf_t         *b;
+    ngx_event_t       *ev;
     ngx_chain_t        out;
     ngx_http_cache_t  *c;
 
@@ -1095,6 +1590,21 @@ ngx_http_cache_send(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache send: %s", c->file.name.data);
 
+    if (c->streaming) {
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        c->length = c->body_start;
+
+        ev = &c->wait_event;
+        ngx_post_event(ev, &ngx_posted_events);
+
+        return NGX_DONE;
+    }
+
     if (r != r->main && c->length - c->body_start == 0) {
         return ngx_http_send_header(r);
     }
@@ -1138,6 +1648,8 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
+    ngx_uint_t                   wakeup;
+    ngx_event_t                 *ev;
     ngx_http_file_cache_t       *cache;
     ngx_http_file_cache_node_t  *fcn;
 
@@ -1146,6 +1658,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     }
 
     cache = c->file_cache;
+    wakeup = 0;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
@@ -1157,6 +1670,13 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     if (c->updating) {
         fcn->updating = 0;
+        wakeup = 1;
+    }
+
+    if (c->filling) {
+        fcn->filling = 0;
+        c->filling = 0;
+        wakeup = 1;
     }
 
     if (c->error) {
@@ -1176,6 +1696,10 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (wakeup) {
+        ngx_http_file_cache_lock_wakeup(cache, fcn);
+    }
+
     c->updated = 1;
     c->updating = 0;
 
@@ -1193,6 +1717,17 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         }
     }
 
+    if (c->streaming) {
+        ngx_queue_remove(&c->wait_queue);
+
+        if (c->wait_event.prev) {
+            ev = &c->wait_event;
+            ngx_delete_posted_event(ev);
+        }
+
+        c->streaming = 0;
+    }
+
     if (c->wait_event.timer_set) {
         ngx_del_timer(&c->wait_event);
     }
@@ -1714,6 +2249,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_queue_init(&cache->waiters);
+
     cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
     if (cache->path == NULL) {
         return NGX_CONF_ERROR;
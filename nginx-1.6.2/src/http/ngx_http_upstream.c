@@ -10,6 +10,45 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_str_node_t                     sn;
+    ngx_pool_t                        *pool;
+    ngx_uint_t                         count;
+
+    ngx_queue_t                        followers;
+
+    ngx_http_headers_out_t             headers_out;
+
+    ngx_chain_t                       *out;
+    ngx_chain_t                      **last_out;
+    size_t                             size;
+
+    ngx_int_t                          rc;
+
+    unsigned                           linked:1;
+    unsigned                           header:1;
+    unsigned                           done:1;
+    unsigned                           failed:1;
+} ngx_http_upstream_collapse_node_t;
+
+
+struct ngx_http_upstream_collapse_s {
+    ngx_queue_t                        queue;
+    ngx_http_upstream_collapse_node_t *node;
+    ngx_http_request_t                *request;
+
+    ngx_chain_t                       *sent;
+
+    ngx_event_pipe_input_filter_pt     pipe_input_filter;
+    ngx_int_t                        (*input_filter)(void *data, ssize_t bytes);
+    void                              *input_filter_ctx;
+
+    unsigned                           leader:1;
+    unsigned                           waiting:1;
+    unsigned                           fallback:1;
+};
+
+
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -22,6 +61,31 @@ static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_collapse(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_collapse_key(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_str_t *key);
+static void ngx_http_upstream_collapse_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_collapse_copy_headers(ngx_pool_t *pool,
+    ngx_http_headers_out_t *dst, ngx_http_headers_out_t *src, ngx_uint_t deep);
+static ngx_table_elt_t *ngx_http_upstream_collapse_header_line(
+    ngx_list_t *list, ngx_table_elt_t *h, ngx_table_elt_t *elts);
+static ngx_int_t ngx_http_upstream_collapse_copy_str(ngx_pool_t *pool,
+    ngx_str_t *s);
+static ngx_int_t ngx_http_upstream_collapse_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_collapse_pipe_filter(ngx_event_pipe_t *p,
+    ngx_buf_t *buf);
+static ngx_int_t ngx_http_upstream_collapse_non_buffered_filter(void *data,
+    ssize_t bytes);
+static ngx_int_t ngx_http_upstream_collapse_add(
+    ngx_http_upstream_collapse_t *col, ngx_chain_t *in);
+static void ngx_http_upstream_collapse_wakeup(
+    ngx_http_upstream_collapse_node_t *node);
+static void ngx_http_upstream_collapse_detach(ngx_http_upstream_collapse_t *col,
+    ngx_int_t rc);
+static ngx_uint_t ngx_http_upstream_collapse_shared(ngx_http_upstream_t *u);
+static void ngx_http_upstream_collapse_cleanup(void *data);
 static void ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
 static void ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r);
@@ -336,6 +400,10 @@ ngx_module_t  ngx_http_upstream_module = {
 };
 
 
+static ngx_rbtree_t        ngx_http_upstream_collapse_tree;
+static ngx_rbtree_node_t   ngx_http_upstream_collapse_sentinel;
+
+
 static ngx_http_variable_t  ngx_http_upstream_vars[] = {
 
     { ngx_string("upstream_addr"), NULL,
@@ -518,6 +586,21 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
 
 #endif
 
+    if (u->conf->collapse && u->collapse == NULL) {
+        ngx_int_t  rc;
+
+        rc = ngx_http_upstream_collapse(r, u);
+
+        if (rc == NGX_DONE) {
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+    }
+
     u->store = (u->conf->store || u->conf->store_lengths);
 
     if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
@@ -677,216 +760,1098 @@ found:
         return;
     }
 
-    ngx_http_upstream_connect(r, u);
-}
+    ngx_http_upstream_connect(r, u);
+}
+
+
+#if (NGX_HTTP_CACHE)
+
+static ngx_int_t
+ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t          rc;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    if (c == NULL) {
+
+        if (!(r->method & u->conf->cache_methods)) {
+            return NGX_DECLINED;
+        }
+
+        if (r->method & NGX_HTTP_HEAD) {
+            u->method = ngx_http_core_get_method;
+        }
+
+        if (ngx_http_file_cache_new(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (u->create_key(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /* TODO: add keys */
+
+        ngx_http_file_cache_create_key(r);
+
+        if (r->cache->header_start + 256 >= u->conf->buffer_size) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "%V_buffer_size %uz is not enough for cache key, "
+                          "it should be increased to at least %uz",
+                          &u->conf->module, u->conf->buffer_size,
+                          ngx_align(r->cache->header_start + 256, 1024));
+
+            r->cache = NULL;
+            return NGX_DECLINED;
+        }
+
+        u->cacheable = 1;
+
+        switch (ngx_http_test_predicates(r, u->conf->cache_bypass)) {
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        case NGX_DECLINED:
+            u->cache_status = NGX_HTTP_CACHE_BYPASS;
+            return NGX_DECLINED;
+
+        default: /* NGX_OK */
+            break;
+        }
+
+        c = r->cache;
+
+        c->min_uses = u->conf->cache_min_uses;
+        c->body_start = u->conf->buffer_size;
+        c->file_cache = u->conf->cache->data;
+
+        c->lock = u->conf->cache_lock;
+        c->lock_timeout = u->conf->cache_lock_timeout;
+
+        c->stream = u->conf->cache_stream;
+        c->temp_path = u->conf->temp_path;
+
+        u->cache_status = NGX_HTTP_CACHE_MISS;
+    }
+
+    rc = ngx_http_file_cache_open(r);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache: %i", rc);
+
+    switch (rc) {
+
+    case NGX_HTTP_CACHE_UPDATING:
+
+        if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
+            u->cache_status = rc;
+            rc = NGX_OK;
+
+        } else {
+            rc = NGX_HTTP_CACHE_STALE;
+        }
+
+        break;
+
+    case NGX_OK:
+        u->cache_status = NGX_HTTP_CACHE_HIT;
+    }
+
+    switch (rc) {
+
+    case NGX_OK:
+
+        rc = ngx_http_upstream_cache_send(r, u);
+
+        if (rc != NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+            return rc;
+        }
+
+        break;
+
+    case NGX_HTTP_CACHE_STALE:
+
+        c->valid_sec = 0;
+        u->buffer.start = NULL;
+        u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+
+        break;
+
+    case NGX_DECLINED:
+
+        if ((size_t) (u->buffer.end - u->buffer.start) < u->conf->buffer_size) {
+            u->buffer.start = NULL;
+
+        } else {
+            u->buffer.pos = u->buffer.start + c->header_start;
+            u->buffer.last = u->buffer.pos;
+        }
+
+        break;
+
+    case NGX_HTTP_CACHE_SCARCE:
+
+        u->cacheable = 0;
+
+        break;
+
+    case NGX_AGAIN:
+
+        return NGX_BUSY;
+
+    case NGX_ERROR:
+
+        return NGX_ERROR;
+
+    default:
+
+        /* cached NGX_HTTP_BAD_GATEWAY, NGX_HTTP_GATEWAY_TIME_OUT, etc. */
+
+        u->cache_status = NGX_HTTP_CACHE_HIT;
+
+        return rc;
+    }
+
+    r->cached = 0;
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t          rc;
+    ngx_http_cache_t  *c;
+
+    r->cached = 1;
+    c = r->cache;
+
+    if (c->header_start == c->body_start) {
+        r->http_version = NGX_HTTP_VERSION_9;
+        return ngx_http_cache_send(r);
+    }
+
+    /* TODO: cache stack */
+
+    u->buffer = *c->buf;
+    u->buffer.pos += c->header_start;
+
+    ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
+    u->headers_in.content_length_n = -1;
+
+    if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = u->process_header(r);
+
+    if (rc == NGX_OK) {
+
+        if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
+            return NGX_DONE;
+        }
+
+        return ngx_http_cache_send(r);
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    /* rc == NGX_HTTP_UPSTREAM_INVALID_HEADER */
+
+    /* TODO: delete file */
+
+    return rc;
+}
+
+#endif
+
+
+/*
+ * collapsed forwarding: identical concurrent GET requests of a location
+ * are sent to the upstream once, the first request (leader) passes its
+ * response to the others (followers) as it arrives; requests with
+ * credentials are never collapsed, and a response which is private or
+ * sets cookies is not shared: the followers go to the upstream themselves
+ */
+
+static ngx_int_t
+ngx_http_upstream_collapse(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    uint32_t                            hash;
+    ngx_str_t                           key;
+    ngx_pool_t                         *pool;
+    ngx_pool_cleanup_t                 *cln;
+    ngx_http_upstream_collapse_t       *col;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    if (r != r->main
+        || r->method != NGX_HTTP_GET
+        || r->post_action
+        || u->store
+        || r->headers_in.range
+        || r->headers_in.if_modified_since
+        || r->headers_in.if_unmodified_since
+        || r->headers_in.if_match
+        || r->headers_in.if_none_match
+        || r->headers_in.authorization
+        || r->headers_in.cookies.nelts
+        || r->headers_in.content_length_n > 0
+        || r->headers_in.chunked)
+    {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_CACHE)
+    if (u->conf->cache) {
+        return NGX_DECLINED;
+    }
+#endif
+
+#if (NGX_HTTP_SPDY)
+    if (r->spdy_stream) {
+        return NGX_DECLINED;
+    }
+#endif
+
+    if (ngx_http_upstream_collapse_key(r, u, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    if (ngx_http_upstream_collapse_tree.root == NULL) {
+        ngx_rbtree_init(&ngx_http_upstream_collapse_tree,
+                        &ngx_http_upstream_collapse_sentinel,
+                        ngx_str_rbtree_insert_value);
+    }
+
+    col = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_collapse_t));
+    if (col == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    node = (ngx_http_upstream_collapse_node_t *)
+               ngx_str_rbtree_lookup(&ngx_http_upstream_collapse_tree, &key,
+                                     hash);
+
+    if (node == NULL) {
+        pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+        if (pool == NULL) {
+            return NGX_ERROR;
+        }
+
+        node = ngx_pcalloc(pool, sizeof(ngx_http_upstream_collapse_node_t));
+        if (node == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+
+        node->sn.str.data = ngx_pstrdup(pool, &key);
+        if (node->sn.str.data == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_ERROR;
+        }
+
+        node->sn.str.len = key.len;
+        node->sn.node.key = hash;
+        node->pool = pool;
+        node->last_out = &node->out;
+        node->linked = 1;
+
+        ngx_queue_init(&node->followers);
+
+        ngx_rbtree_insert(&ngx_http_upstream_collapse_tree, &node->sn.node);
+
+        col->leader = 1;
+
+    } else {
+        ngx_queue_insert_tail(&node->followers, &col->queue);
+        col->waiting = 1;
+    }
+
+    node->count++;
+
+    col->node = node;
+    col->request = r;
+
+    cln->handler = ngx_http_upstream_collapse_cleanup;
+    cln->data = col;
+
+    u->collapse = col;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream collapse \"%V\" leader:%d",
+                   &key, col->leader);
+
+    if (col->leader) {
+        return NGX_DECLINED;
+    }
+
+    if (!u->conf->ignore_client_abort) {
+        r->read_event_handler = ngx_http_upstream_rd_check_broken_connection;
+    }
+
+    r->write_event_handler = ngx_http_upstream_collapse_handler;
+
+    return NGX_DONE;
+}
+
+
+/*
+ * the requests match on the location, the Host, and the key the cache
+ * would use, "proxy_cache_key" or "fastcgi_cache_key", even if the
+ * location is not cached; without the key it is the request URI.
+ * The Host is always matched: a location may serve several server names
+ * and the key, such as the default "$scheme$proxy_host$request_uri",
+ * need not include it
+ */
+
+static ngx_int_t
+ngx_http_upstream_collapse_key(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_str_t *key)
+{
+    u_char      *p;
+    size_t       len;
+    ngx_str_t   *keys;
+    ngx_uint_t   i, n;
+#if (NGX_HTTP_CACHE)
+    ngx_int_t          rc;
+    ngx_http_cache_t  *c;
+#endif
+
+    keys = NULL;
+    n = 0;
+
+#if (NGX_HTTP_CACHE)
+
+    if (u->create_key) {
+
+        /* create_key() puts the key parts to r->cache->keys */
+
+        c = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_t));
+        if (c == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_array_init(&c->keys, r->pool, 4, sizeof(ngx_str_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        r->cache = c;
+
+        rc = u->create_key(r);
+
+        r->cache = NULL;
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        keys = c->keys.elts;
+
+        for (i = 0; i < c->keys.nelts; i++) {
+            if (keys[i].len) {
+                n = c->keys.nelts;
+                break;
+            }
+        }
+    }
+
+#endif
+
+    len = NGX_PTR_SIZE * 2 + sizeof(" ") - 1 + r->headers_in.server.len
+          + sizeof(" ") - 1;
+
+    if (n) {
+        for (i = 0; i < n; i++) {
+            len += keys[i].len;
+        }
+
+    } else {
+        len += r->unparsed_uri.len;
+    }
+
+    key->data = ngx_pnalloc(r->pool, len);
+    if (key->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_sprintf(key->data, "%p %V ", u->conf, &r->headers_in.server);
+
+    if (n) {
+        for (i = 0; i < n; i++) {
+            p = ngx_copy(p, keys[i].data, keys[i].len);
+        }
+
+    } else {
+        p = ngx_copy(p, r->unparsed_uri.data, r->unparsed_uri.len);
+    }
+
+    key->len = p - key->data;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_collapse_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                           rc;
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl, *ln, *out, **ll;
+    ngx_event_t                        *wev;
+    ngx_connection_t                   *c;
+    ngx_http_upstream_t                *u;
+    ngx_http_core_loc_conf_t           *clcf;
+    ngx_http_upstream_collapse_t       *col;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    c = r->connection;
+    u = r->upstream;
+    col = u->collapse;
+    node = col->node;
+    wev = c->write;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream collapse handler");
+
+    if (wev->timedout) {
+        c->timedout = 1;
+        ngx_connection_error(c, NGX_ETIMEDOUT, "client timed out");
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (!u->header_sent) {
+
+        if (node->failed) {
+
+            /* the leader got no response to share, go to the upstream */
+
+            ngx_http_upstream_collapse_detach(col, NGX_DECLINED);
+            col->fallback = 1;
+
+            r->write_event_handler = ngx_http_request_empty_handler;
+
+            ngx_http_upstream_init_request(r);
+            return;
+        }
+
+        if (!node->header) {
+            return;
+        }
+
+        if (ngx_http_upstream_collapse_copy_headers(r->pool, &r->headers_out,
+                                                    &node->headers_out, 0)
+            != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+
+        u->header_sent = 1;
+
+        if (r->header_only) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+    }
+
+    out = NULL;
+    ll = &out;
+    b = NULL;
+
+    for (cl = col->sent ? col->sent->next : node->out; cl; cl = cl->next) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        b->pos = cl->buf->pos;
+        b->last = cl->buf->last;
+        b->memory = 1;
+
+        ln = ngx_alloc_chain_link(r->pool);
+        if (ln == NULL) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+
+        ln->buf = b;
+        ln->next = NULL;
+
+        *ll = ln;
+        ll = &ln->next;
+
+        col->sent = cl;
+    }
+
+    if (b) {
+        b->flush = 1;
+    }
+
+    if (out || c->buffered) {
+        rc = ngx_http_output_filter(r, out);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+    }
+
+    if (node->done) {
+        ngx_http_upstream_finalize_request(r, u, node->rc);
+        return;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+        return;
+    }
+
+    if (wev->active && !wev->ready) {
+        ngx_add_timer(wev, clcf->send_timeout);
+
+    } else if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+}
+
+
+static ngx_uint_t  ngx_http_upstream_collapse_header_ptrs[] = {
+    offsetof(ngx_http_headers_out_t, server),
+    offsetof(ngx_http_headers_out_t, date),
+    offsetof(ngx_http_headers_out_t, content_length),
+    offsetof(ngx_http_headers_out_t, content_encoding),
+    offsetof(ngx_http_headers_out_t, location),
+    offsetof(ngx_http_headers_out_t, refresh),
+    offsetof(ngx_http_headers_out_t, last_modified),
+    offsetof(ngx_http_headers_out_t, content_range),
+    offsetof(ngx_http_headers_out_t, accept_ranges),
+    offsetof(ngx_http_headers_out_t, www_authenticate),
+    offsetof(ngx_http_headers_out_t, expires),
+    offsetof(ngx_http_headers_out_t, etag)
+};
+
+
+/*
+ * the header lines are copied along with the pointers to them,
+ * "deep" also copies the strings: the leader's ones are freed
+ * when the leader is done
+ */
+
+static ngx_int_t
+ngx_http_upstream_collapse_copy_headers(ngx_pool_t *pool,
+    ngx_http_headers_out_t *dst, ngx_http_headers_out_t *src, ngx_uint_t deep)
+{
+    ngx_uint_t         i, n;
+    ngx_list_part_t   *part;
+    ngx_table_elt_t   *h, *elts, **ph, **sph;
+
+    *dst = *src;
+
+    n = 0;
+
+    for (part = &src->headers.part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    if (ngx_list_init(&dst->headers, pool, n ? n : 1, sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    elts = dst->headers.part.elts;
+
+    for (part = &src->headers.part; part; part = part->next) {
+        h = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            if (ngx_list_push(&dst->headers) == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        ngx_memcpy(&elts[dst->headers.part.nelts - part->nelts], h,
+                   part->nelts * sizeof(ngx_table_elt_t));
+    }
+
+    /* the pointers to the header lines */
+
+    for (i = 0; i < sizeof(ngx_http_upstream_collapse_header_ptrs)
+                    / sizeof(ngx_uint_t); i++)
+    {
+        ph = (ngx_table_elt_t **)
+                 ((char *) dst + ngx_http_upstream_collapse_header_ptrs[i]);
+
+        *ph = ngx_http_upstream_collapse_header_line(&src->headers, *ph, elts);
+    }
+
+    ngx_memzero(&dst->cache_control, sizeof(ngx_array_t));
+
+    if (src->cache_control.nelts) {
+        if (ngx_array_init(&dst->cache_control, pool,
+                           src->cache_control.nelts, sizeof(ngx_table_elt_t *))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        sph = src->cache_control.elts;
+
+        for (i = 0; i < src->cache_control.nelts; i++) {
+            h = ngx_http_upstream_collapse_header_line(&src->headers, sph[i],
+                                                       elts);
+            if (h == NULL) {
+                continue;
+            }
+
+            ph = ngx_array_push(&dst->cache_control);
+            *ph = h;
+        }
+    }
+
+    if (!deep) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        h = &elts[i];
+
+        if (ngx_http_upstream_collapse_copy_str(pool, &h->key) != NGX_OK
+            || ngx_http_upstream_collapse_copy_str(pool, &h->value) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (h->lowcase_key) {
+            h->lowcase_key = ngx_pstrdup(pool, &h->key);
+            if (h->lowcase_key == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_strlow(h->lowcase_key, h->key.data, h->key.len);
+        }
+    }
+
+    if (ngx_http_upstream_collapse_copy_str(pool, &dst->status_line) != NGX_OK
+        || ngx_http_upstream_collapse_copy_str(pool, &dst->content_type)
+           != NGX_OK
+        || ngx_http_upstream_collapse_copy_str(pool, &dst->charset) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    dst->content_type_lowcase = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_table_elt_t *
+ngx_http_upstream_collapse_header_line(ngx_list_t *list, ngx_table_elt_t *h,
+    ngx_table_elt_t *elts)
+{
+    ngx_uint_t        n;
+    ngx_list_part_t  *part;
+
+    if (h == NULL) {
+        return NULL;
+    }
+
+    n = 0;
+
+    for (part = &list->part; part; part = part->next) {
+
+        if (h >= (ngx_table_elt_t *) part->elts
+            && h < (ngx_table_elt_t *) part->elts + part->nelts)
+        {
+            return &elts[n + (h - (ngx_table_elt_t *) part->elts)];
+        }
+
+        n += part->nelts;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_collapse_copy_str(ngx_pool_t *pool, ngx_str_t *s)
+{
+    u_char  *p;
+
+    if (s->len == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(pool, s->len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, s->data, s->len);
+    s->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_collapse_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    u_char                             *p, *last;
+    ngx_uint_t                          i;
+    ngx_list_part_t                    *part;
+    ngx_table_elt_t                    *h, **ph;
+    ngx_http_upstream_collapse_t       *col;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    col = u->collapse;
+    node = col->node;
+
+    if (r->headers_out.content_length_n > (off_t) u->conf->collapse_max_size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream collapse: response of %O bytes "
+                       "is too large", r->headers_out.content_length_n);
+
+        ngx_http_upstream_collapse_detach(col, NGX_DECLINED);
+
+        return NGX_OK;
+    }
+
+    ph = r->headers_out.cache_control.elts;
 
+    for (i = 0; i < r->headers_out.cache_control.nelts; i++) {
+        p = ph[i]->value.data;
+        last = p + ph[i]->value.len;
 
-#if (NGX_HTTP_CACHE)
+        if (ngx_strlcasestrn(p, last, (u_char *) "no-store", 8 - 1) != NULL
+            || ngx_strlcasestrn(p, last, (u_char *) "private", 7 - 1) != NULL)
+        {
+            goto private;
+        }
+    }
 
-static ngx_int_t
-ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
-{
-    ngx_int_t          rc;
-    ngx_http_cache_t  *c;
+    part = &r->headers_out.headers.part;
+    h = part->elts;
 
-    c = r->cache;
+    for (i = 0; /* void */ ; i++) {
 
-    if (c == NULL) {
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
 
-        if (!(r->method & u->conf->cache_methods)) {
-            return NGX_DECLINED;
+            part = part->next;
+            h = part->elts;
+            i = 0;
         }
 
-        if (r->method & NGX_HTTP_HEAD) {
-            u->method = ngx_http_core_get_method;
+        if (h[i].hash == 0) {
+            continue;
         }
 
-        if (ngx_http_file_cache_new(r) != NGX_OK) {
-            return NGX_ERROR;
+        if ((h[i].key.len == sizeof("Set-Cookie") - 1
+             && ngx_strncasecmp(h[i].key.data, (u_char *) "Set-Cookie",
+                                sizeof("Set-Cookie") - 1) == 0)
+            || (h[i].key.len == sizeof("Vary") - 1
+                && ngx_strncasecmp(h[i].key.data, (u_char *) "Vary",
+                                   sizeof("Vary") - 1) == 0))
+        {
+            goto private;
         }
+    }
 
-        if (u->create_key(r) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (ngx_http_upstream_collapse_copy_headers(node->pool, &node->headers_out,
+                                                &r->headers_out, 1)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-        /* TODO: add keys */
+    node->header = 1;
 
-        ngx_http_file_cache_create_key(r);
+    ngx_http_upstream_collapse_wakeup(node);
 
-        if (r->cache->header_start + 256 >= u->conf->buffer_size) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "%V_buffer_size %uz is not enough for cache key, "
-                          "it should be increased to at least %uz",
-                          &u->conf->module, u->conf->buffer_size,
-                          ngx_align(r->cache->header_start + 256, 1024));
+    return NGX_OK;
 
-            r->cache = NULL;
-            return NGX_DECLINED;
-        }
+private:
 
-        u->cacheable = 1;
+    /*
+     * the response is meant for the leader's client only: the leader
+     * goes on as a usual request, the followers go to the upstream
+     */
 
-        switch (ngx_http_test_predicates(r, u->conf->cache_bypass)) {
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream collapse: response is not shared");
 
-        case NGX_ERROR:
-            return NGX_ERROR;
+    ngx_http_upstream_collapse_detach(col, NGX_DECLINED);
 
-        case NGX_DECLINED:
-            u->cache_status = NGX_HTTP_CACHE_BYPASS;
-            return NGX_DECLINED;
+    return NGX_OK;
+}
 
-        default: /* NGX_OK */
-            break;
-        }
 
-        c = r->cache;
+static ngx_int_t
+ngx_http_upstream_collapse_pipe_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    ngx_int_t                      rc;
+    ngx_chain_t                   *in, **last_in;
+    ngx_http_request_t            *r;
+    ngx_http_upstream_collapse_t  *col;
 
-        c->min_uses = u->conf->cache_min_uses;
-        c->body_start = u->conf->buffer_size;
-        c->file_cache = u->conf->cache->data;
+    r = p->output_ctx;
+    col = r->upstream->collapse;
 
-        c->lock = u->conf->cache_lock;
-        c->lock_timeout = u->conf->cache_lock_timeout;
+    in = p->in;
+    last_in = p->last_in;
 
-        u->cache_status = NGX_HTTP_CACHE_MISS;
-    }
+    rc = col->pipe_input_filter(p, buf);
 
-    rc = ngx_http_file_cache_open(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http upstream cache: %i", rc);
+    return ngx_http_upstream_collapse_add(col, in ? *last_in : p->in);
+}
 
-    switch (rc) {
 
-    case NGX_HTTP_CACHE_UPDATING:
+static ngx_int_t
+ngx_http_upstream_collapse_non_buffered_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t  *r = data;
 
-        if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
-            u->cache_status = rc;
-            rc = NGX_OK;
+    ngx_chain_t                   *cl, **ll;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_collapse_t  *col;
 
-        } else {
-            rc = NGX_HTTP_CACHE_STALE;
-        }
+    u = r->upstream;
+    col = u->collapse;
 
-        break;
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
 
-    case NGX_OK:
-        u->cache_status = NGX_HTTP_CACHE_HIT;
+    if (col->input_filter(col->input_filter_ctx, bytes) == NGX_ERROR) {
+        return NGX_ERROR;
     }
 
-    switch (rc) {
+    return ngx_http_upstream_collapse_add(col, *ll);
+}
 
-    case NGX_OK:
 
-        rc = ngx_http_upstream_cache_send(r, u);
+static ngx_int_t
+ngx_http_upstream_collapse_add(ngx_http_upstream_collapse_t *col,
+    ngx_chain_t *in)
+{
+    size_t                              size, max;
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl;
+    ngx_http_upstream_collapse_node_t  *node;
 
-        if (rc != NGX_HTTP_UPSTREAM_INVALID_HEADER) {
-            return rc;
-        }
+    node = col->node;
 
-        break;
+    if (!col->leader) {
+        /* the response is no longer shared */
+        return NGX_OK;
+    }
 
-    case NGX_HTTP_CACHE_STALE:
+    if (ngx_queue_empty(&node->followers)) {
 
-        c->valid_sec = 0;
-        u->buffer.start = NULL;
-        u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+        /*
+         * nobody waits for the response when the body starts, so it is
+         * not shared: later requests go to the upstream themselves
+         */
 
-        break;
+        if (node->linked) {
+            ngx_rbtree_delete(&ngx_http_upstream_collapse_tree,
+                              &node->sn.node);
+            node->linked = 0;
+        }
 
-    case NGX_DECLINED:
+        return NGX_OK;
+    }
 
-        if ((size_t) (u->buffer.end - u->buffer.start) < u->conf->buffer_size) {
-            u->buffer.start = NULL;
+    max = col->request->upstream->conf->collapse_max_size;
 
-        } else {
-            u->buffer.pos = u->buffer.start + c->header_start;
-            u->buffer.last = u->buffer.pos;
-        }
+    for ( /* void */ ; in; in = in->next) {
 
-        break;
+        size = in->buf->last - in->buf->pos;
 
-    case NGX_HTTP_CACHE_SCARCE:
+        if (size == 0 || !ngx_buf_in_memory(in->buf)) {
+            continue;
+        }
 
-        u->cacheable = 0;
+        if (node->size + size > max) {
+            /*
+             * the whole body is kept until the last follower is done,
+             * so a body of unknown length which grows too large is not
+             * shared any further: the followers are cut off the same way
+             * as if the upstream failed, later requests go to the upstream
+             */
 
-        break;
+            ngx_log_error(NGX_LOG_WARN, col->request->connection->log, 0,
+                          "collapsed response exceeds %uz bytes, "
+                          "the waiting requests are cut off", max);
 
-    case NGX_AGAIN:
+            ngx_http_upstream_collapse_detach(col, NGX_ERROR);
 
-        return NGX_BUSY;
+            return NGX_OK;
+        }
 
-    case NGX_ERROR:
+        node->size += size;
 
-        return NGX_ERROR;
+        b = ngx_create_temp_buf(node->pool, size);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    default:
+        b->last = ngx_cpymem(b->pos, in->buf->pos, size);
 
-        /* cached NGX_HTTP_BAD_GATEWAY, NGX_HTTP_GATEWAY_TIME_OUT, etc. */
+        cl = ngx_alloc_chain_link(node->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
 
-        u->cache_status = NGX_HTTP_CACHE_HIT;
+        cl->buf = b;
+        cl->next = NULL;
 
-        return rc;
+        *node->last_out = cl;
+        node->last_out = &cl->next;
     }
 
-    r->cached = 0;
+    ngx_http_upstream_collapse_wakeup(node);
 
-    return NGX_DECLINED;
+    return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
+static void
+ngx_http_upstream_collapse_wakeup(ngx_http_upstream_collapse_node_t *node)
 {
-    ngx_int_t          rc;
-    ngx_http_cache_t  *c;
+    ngx_queue_t                   *q;
+    ngx_event_t                   *wev;
+    ngx_http_upstream_collapse_t  *col;
 
-    r->cached = 1;
-    c = r->cache;
+    for (q = ngx_queue_head(&node->followers);
+         q != ngx_queue_sentinel(&node->followers);
+         q = ngx_queue_next(q))
+    {
+        col = ngx_queue_data(q, ngx_http_upstream_collapse_t, queue);
 
-    if (c->header_start == c->body_start) {
-        r->http_version = NGX_HTTP_VERSION_9;
-        return ngx_http_cache_send(r);
+        wev = col->request->connection->write;
+
+        ngx_post_event(wev, &ngx_posted_events);
     }
+}
 
-    /* TODO: cache stack */
 
-    u->buffer = *c->buf;
-    u->buffer.pos += c->header_start;
+static void
+ngx_http_upstream_collapse_detach(ngx_http_upstream_collapse_t *col,
+    ngx_int_t rc)
+{
+    ngx_http_upstream_collapse_node_t  *node;
 
-    ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
-    u->headers_in.content_length_n = -1;
+    node = col->node;
 
-    if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
-                      sizeof(ngx_table_elt_t))
-        != NGX_OK)
-    {
-        return NGX_ERROR;
+    if (col->waiting) {
+        ngx_queue_remove(&col->queue);
+        col->waiting = 0;
+        return;
     }
 
-    rc = u->process_header(r);
+    if (!col->leader) {
+        return;
+    }
 
-    if (rc == NGX_OK) {
+    col->leader = 0;
 
-        if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
-            return NGX_DONE;
-        }
+    /* the response is complete, new requests go to the upstream again */
 
-        return ngx_http_cache_send(r);
+    if (node->linked) {
+        ngx_rbtree_delete(&ngx_http_upstream_collapse_tree, &node->sn.node);
+        node->linked = 0;
     }
 
-    if (rc == NGX_ERROR) {
-        return NGX_ERROR;
+    /*
+     * the followers which have not sent the response header yet go to
+     * the upstream themselves unless the response is complete, the
+     * others are cut off the same way the leader's client is
+     */
+
+    if (node->header && rc != NGX_DECLINED) {
+        node->done = 1;
+        node->rc = (rc == 0) ? 0 : NGX_ERROR;
     }
 
-    /* rc == NGX_HTTP_UPSTREAM_INVALID_HEADER */
+    if (!node->done || node->rc != 0) {
+        node->failed = 1;
+    }
 
-    /* TODO: delete file */
+    ngx_http_upstream_collapse_wakeup(node);
+}
 
-    return rc;
+
+/*
+ * the leader whose client is gone goes on reading the response while
+ * there are followers, the same way a response being cached is read
+ */
+
+static ngx_uint_t
+ngx_http_upstream_collapse_shared(ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_collapse_t  *col;
+
+    col = u->collapse;
+
+    return col && col->leader && u->header_sent
+           && !ngx_queue_empty(&col->node->followers);
 }
 
-#endif
+
+static void
+ngx_http_upstream_collapse_cleanup(void *data)
+{
+    ngx_http_upstream_collapse_t  *col = data;
+
+    ngx_http_upstream_collapse_node_t  *node;
+
+    node = col->node;
+
+    ngx_http_upstream_collapse_detach(col, NGX_ERROR);
+
+    if (--node->count == 0) {
+        ngx_destroy_pool(node->pool);
+    }
+}
 
 
 static void
@@ -1030,7 +1995,7 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             }
         }
 
-        if (!u->cacheable) {
+        if (!u->cacheable && !ngx_http_upstream_collapse_shared(u)) {
             ngx_http_upstream_finalize_request(r, u,
                                                NGX_HTTP_CLIENT_CLOSED_REQUEST);
         }
@@ -1059,7 +2024,9 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             ev->error = 1;
         }
 
-        if (!u->cacheable && u->peer.connection) {
+        if (!u->cacheable && !ngx_http_upstream_collapse_shared(u)
+            && u->peer.connection)
+        {
             ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
                           "kevent() reported that client prematurely closed "
                           "connection, so upstream connection is closed too");
@@ -1108,7 +2075,9 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             ev->error = 1;
         }
 
-        if (!u->cacheable && u->peer.connection) {
+        if (!u->cacheable && !ngx_http_upstream_collapse_shared(u)
+            && u->peer.connection)
+        {
             ngx_log_error(NGX_LOG_INFO, ev->log, err,
                         "epoll_wait() reported that client prematurely closed "
                         "connection, so upstream connection is closed too");
@@ -1171,7 +2140,9 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
     ev->eof = 1;
     c->error = 1;
 
-    if (!u->cacheable && u->peer.connection) {
+    if (!u->cacheable && !ngx_http_upstream_collapse_shared(u)
+        && u->peer.connection)
+    {
         ngx_log_error(NGX_LOG_INFO, ev->log, err,
                       "client prematurely closed connection, "
                       "so upstream connection is closed too");
@@ -2210,6 +3181,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
 
+    if (u->collapse && u->collapse->leader
+        && ngx_http_upstream_collapse_header(r, u) != NGX_OK)
+    {
+        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+        return;
+    }
+
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->post_action) {
@@ -2271,6 +3249,14 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return;
         }
 
+        if (u->collapse && u->collapse->leader) {
+            u->collapse->input_filter = u->input_filter;
+            u->collapse->input_filter_ctx = u->input_filter_ctx;
+
+            u->input_filter = ngx_http_upstream_collapse_non_buffered_filter;
+            u->input_filter_ctx = r;
+        }
+
         if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
             ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
 
@@ -2497,6 +3483,11 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
+    if (u->collapse && u->collapse->leader) {
+        u->collapse->pipe_input_filter = p->input_filter;
+        p->input_filter = ngx_http_upstream_collapse_pipe_filter;
+    }
+
     u->read_event_handler = ngx_http_upstream_process_upstream;
     r->write_event_handler = ngx_http_upstream_process_downstream;
 
@@ -2799,8 +3790,14 @@ ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
     if (wev->timedout) {
         c->timedout = 1;
         ngx_connection_error(c, NGX_ETIMEDOUT, "client timed out");
-        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
-        return;
+
+        if (!ngx_http_upstream_collapse_shared(u)) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_REQUEST_TIME_OUT);
+            return;
+        }
+
+        c->error = 1;
     }
 	//调用方法向客户端发送响应包体，第2个参数是1，和upstream发送响应包体的不一样
     ngx_http_upstream_process_non_buffered_request(r, 1);
@@ -2839,6 +3836,7 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
     ssize_t                    n;
     ngx_buf_t                 *b;
     ngx_int_t                  rc;
+    ngx_chain_t               *cl;
     ngx_connection_t          *downstream, *upstream;
     ngx_http_upstream_t       *u;
     ngx_http_core_loc_conf_t  *clcf;
@@ -2859,8 +3857,21 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
                 rc = ngx_http_output_filter(r, u->out_bufs);
 
                 if (rc == NGX_ERROR) {
-                    ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
-                    return;
+
+                    if (!ngx_http_upstream_collapse_shared(u)) {
+                        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                        return;
+                    }
+
+                    /* the client is gone, read the response for followers */
+
+                    for (cl = u->busy_bufs; cl; cl = cl->next) {
+                        cl->buf->pos = cl->buf->last;
+                    }
+
+                    for (cl = u->out_bufs; cl; cl = cl->next) {
+                        cl->buf->pos = cl->buf->last;
+                    }
                 }
 
                 ngx_chain_update_chains(r->pool, &u->free_bufs, &u->busy_bufs,
@@ -2925,7 +3936,7 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    if (downstream->data == r) {
+    if (downstream->data == r && !downstream->error) {
         if (ngx_handle_write_event(downstream->write, clcf->send_lowat)
             != NGX_OK)
         {
@@ -2934,7 +3945,9 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
         }
     }
 
-    if (downstream->write->active && !downstream->write->ready) {
+    if (downstream->write->active && !downstream->write->ready
+        && !downstream->error)
+    {
         ngx_add_timer(downstream->write, clcf->send_timeout);
 
     } else if (downstream->write->timer_set) {
@@ -3156,6 +4169,9 @@ ngx_http_upstream_process_request(ngx_http_request_t *r)
 
             } else if (p->upstream_error) {
                 ngx_http_file_cache_free(r->cache, p->temp_file);
+
+            } else {
+                ngx_http_file_cache_fill(r, p->temp_file);
             }
         }
 
@@ -3186,7 +4202,10 @@ ngx_http_upstream_process_request(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http upstream downstream error");
 
-        if (!u->cacheable && !u->store && u->peer.connection) {
+        if (!u->cacheable && !u->store
+            && !ngx_http_upstream_collapse_shared(u)
+            && u->peer.connection)
+        {
             ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
         }
     }
@@ -3431,6 +4450,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         u->cleanup = NULL;
     }
 
+    if (u->collapse) {
+        ngx_http_upstream_collapse_detach(u->collapse, rc);
+    }
+
     if (u->resolved && u->resolved->ctx) {
         ngx_resolve_name_done(u->resolved->ctx);
         u->resolved->ctx = NULL;
@@ -179,6 +179,10 @@ typedef struct {
     ngx_flag_t                       pass_request_body;
 	//为1,表示与上游服务器交互时将不检查nginx与下游客户端间的连接是否断开。也即是说，即使下游客户端主动关闭了连接，也不会中断与上游服务器间的交互
     ngx_flag_t                       ignore_client_abort;
+	//为1时，同一location中并发的相同GET请求只向上游服务器转发一次，响应同时发送给所有请求
+    ngx_flag_t                       collapse;
+	//共享给这些请求的响应包体在内存中的最大长度，超过时不再共享
+    size_t                           collapse_max_size;
 	//当解析上游响应的包头时，如果解析后设置到headers_in结构体中的status_n错误码大于400,则会试图把它与error_page中指定的错误码相匹配，如果匹配上，则发送error_page中指定的响应，否则继续返回上游服务器的错误码。 ngx_http_upstream_intercept_errors
     ngx_flag_t                       intercept_errors;
 	//buffering为1时转发响应时才有意义。这时，如果此值为1,则会试图复用临时文件中已经使用过的空间。不建议设置为1
@@ -203,6 +207,7 @@ typedef struct {
 
     ngx_flag_t                       cache_lock;
     ngx_msec_t                       cache_lock_timeout;
+    ngx_flag_t                       cache_stream;
 
     ngx_flag_t                       cache_revalidate;
 
@@ -296,6 +301,8 @@ typedef struct {
 typedef void (*ngx_http_upstream_handler_pt)(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 
+typedef struct ngx_http_upstream_collapse_s  ngx_http_upstream_collapse_t;
+
 
 struct ngx_http_upstream_s {
 	//处理读事件的回调方法，每一个阶段都有不同的read_event_handler
@@ -366,6 +373,8 @@ struct ngx_http_upstream_s {
     ngx_str_t                        uri;
 	//目前它仅用于表示是否需要清理资源，相当于一个标志位，实际不会调用到它所指向的方法
     ngx_http_cleanup_pt             *cleanup;
+	//合并转发时指向本请求的合并状态，为NULL表示未参与合并
+    ngx_http_upstream_collapse_t    *collapse;
 	//是否指定文件缓存路径的标志位
     unsigned                         store:1;
 	//是否启用文件缓存
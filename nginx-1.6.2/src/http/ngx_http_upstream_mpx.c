@@ -0,0 +1,485 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The streams and the backend connections shared by the upstream
+ * balancers which run several requests over one connection, such as
+ * fastcgi_multiplex and memcached_multiget.
+ *
+ * A module reads its backend connection, splits the data between its
+ * streams with ngx_http_upstream_mpx_deliver(), and provides the stream
+ * send_chain() which puts the request to the backend connection.  The
+ * upstream module reads a stream as a usual connection.
+ */
+
+
+#define NGX_HTTP_UPSTREAM_MPX_FREE_BUFS  64
+
+
+static ssize_t ngx_http_upstream_mpx_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_upstream_mpx_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in);
+static ssize_t ngx_http_upstream_mpx_send_buf(ngx_connection_t *c,
+    u_char *buf, size_t size);
+
+
+ngx_uint_t           ngx_http_upstream_mpx_disabled;
+
+u_char               ngx_http_upstream_mpx_buffer[
+                                            NGX_HTTP_UPSTREAM_MPX_BUFSIZE];
+
+static ngx_chain_t  *ngx_http_upstream_mpx_free;
+static ngx_uint_t    ngx_http_upstream_mpx_nfree;
+
+
+ngx_int_t
+ngx_http_upstream_mpx_connect(ngx_peer_connection_t *pc, ngx_connection_t **cp)
+{
+    ngx_int_t               rc;
+    ngx_peer_connection_t   peer;
+
+    ngx_memzero(&peer, sizeof(ngx_peer_connection_t));
+
+    peer.sockaddr = pc->sockaddr;
+    peer.socklen = pc->socklen;
+    peer.name = pc->name;
+    peer.get = ngx_event_get_peer;
+    peer.local = pc->local;
+    peer.log = ngx_cycle->log;
+    peer.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&peer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "upstream shared connect to %V: %i", pc->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        return NGX_ERROR;
+    }
+
+    *cp = peer.connection;
+
+    peer.connection->idle = 1;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(peer.connection->write,
+                      NGX_HTTP_UPSTREAM_MPX_CONNECT_TIMEOUT);
+    }
+
+    return rc;
+}
+
+
+ngx_int_t
+ngx_http_upstream_mpx_test_connect(ngx_connection_t *c, ngx_str_t *name)
+{
+    int        err;
+    socklen_t  len;
+
+    err = 0;
+    len = sizeof(int);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        ngx_log_error(NGX_LOG_ERR, c->log, err,
+                      "connect() to %V failed", name);
+        return NGX_ERROR;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_upstream_mpx_send(ngx_connection_t *c,
+    ngx_http_upstream_mpx_bufs_t *out)
+{
+    ngx_chain_t  *cl;
+
+    if (out->first == NULL) {
+        return NGX_OK;
+    }
+
+    cl = c->send_chain(c, out->first, 0);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_upstream_mpx_free_bufs(out, cl);
+
+    return ngx_handle_write_event(c->write, 0);
+}
+
+
+void
+ngx_http_upstream_mpx_close(ngx_connection_t *c,
+    ngx_http_upstream_mpx_bufs_t *out)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close upstream shared connection %p", c);
+
+    ngx_http_upstream_mpx_free_bufs(out, NULL);
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    ngx_close_connection(c);
+}
+
+
+void
+ngx_http_upstream_mpx_init_stream(ngx_http_upstream_mpx_stream_t *s,
+    ngx_connection_t *c, ngx_log_t *log)
+{
+    ngx_connection_t  *sc;
+
+    sc = &s->connection;
+
+    sc->read = &s->read;
+    sc->write = &s->write;
+    sc->fd = c->fd;
+    sc->log = log;
+
+    sc->recv = ngx_http_upstream_mpx_recv;
+    sc->send = ngx_http_upstream_mpx_send_buf;
+    sc->recv_chain = ngx_http_upstream_mpx_recv_chain;
+
+    sc->sockaddr = c->sockaddr;
+    sc->socklen = c->socklen;
+    sc->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    /*
+     * the events are never added to the event method: they are "active"
+     * to keep ngx_handle_read_event() and ngx_handle_write_event() away,
+     * and are posted when the data arrive or the backend connection
+     * can be written to
+     */
+
+    s->read.data = sc;
+    s->read.log = log;
+    s->read.active = 1;
+    s->read.index = NGX_INVALID_INDEX;
+
+    s->write.data = sc;
+    s->write.log = log;
+    s->write.write = 1;
+    s->write.active = 1;
+    s->write.ready = 1;
+    s->write.index = NGX_INVALID_INDEX;
+}
+
+
+void
+ngx_http_upstream_mpx_close_stream(ngx_http_upstream_mpx_stream_t *s)
+{
+    ngx_event_t       *rev, *wev;
+    ngx_connection_t  *c;
+
+    c = &s->connection;
+    rev = c->read;
+    wev = c->write;
+
+    if (rev->timer_set) {
+        ngx_del_timer(rev);
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (rev->prev) {
+        ngx_delete_posted_event(rev);
+    }
+
+    if (wev->prev) {
+        ngx_delete_posted_event(wev);
+    }
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+        c->pool = NULL;
+    }
+
+    ngx_http_upstream_mpx_free_bufs(&s->in, NULL);
+    s->size = 0;
+}
+
+
+ngx_int_t
+ngx_http_upstream_mpx_deliver(ngx_http_upstream_mpx_stream_t *s, u_char *data,
+    size_t len)
+{
+    if (ngx_http_upstream_mpx_write(&s->in, data, len) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->size += len;
+
+    ngx_http_upstream_mpx_wake_stream(s);
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_upstream_mpx_wake_stream(ngx_http_upstream_mpx_stream_t *s)
+{
+    ngx_event_t  *rev;
+
+    rev = &s->read;
+
+    rev->ready = 1;
+
+    ngx_post_event(rev, &ngx_posted_events);
+}
+
+
+static ssize_t
+ngx_http_upstream_mpx_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                           n;
+    ssize_t                          total;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     *cl;
+    ngx_http_upstream_mpx_stream_t  *s;
+
+    s = ngx_http_upstream_mpx_stream(c);
+
+    total = 0;
+
+    for (cl = s->in.first; cl && size; cl = cl->next) {
+        b = cl->buf;
+
+        n = ngx_min((size_t) (b->last - b->pos), size);
+
+        buf = ngx_cpymem(buf, b->pos, n);
+        b->pos += n;
+
+        size -= n;
+        total += n;
+
+        if (b->pos != b->last) {
+            break;
+        }
+    }
+
+    ngx_http_upstream_mpx_free_bufs(&s->in, cl);
+
+    s->size -= total;
+
+    if (s->blocked && s->size < s->limit) {
+        s->blocked = 0;
+        s->drain(s);
+    }
+
+    if (s->in.first) {
+        return total;
+    }
+
+    if (total) {
+        if (!s->done && !s->error) {
+            c->read->ready = 0;
+        }
+
+        return total;
+    }
+
+    if (s->done) {
+        c->read->eof = 1;
+        return 0;
+    }
+
+    if (s->error) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    c->read->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_upstream_mpx_recv_chain(ngx_connection_t *c, ngx_chain_t *in)
+{
+    ssize_t     n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (b->last == b->end) {
+            continue;
+        }
+
+        n = ngx_http_upstream_mpx_recv(c, b->last, b->end - b->last);
+
+        if (n <= 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if (b->last + n < b->end) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ssize_t
+ngx_http_upstream_mpx_send_buf(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_buf_t     b;
+    ngx_chain_t   cl;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.pos = buf;
+    b.last = buf + size;
+    b.memory = 1;
+
+    cl.buf = &b;
+    cl.next = NULL;
+
+    if (c->send_chain(c, &cl, 0) == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (b.pos == buf) {
+        return NGX_AGAIN;
+    }
+
+    return b.pos - buf;
+}
+
+
+ngx_int_t
+ngx_http_upstream_mpx_write(ngx_http_upstream_mpx_bufs_t *bufs, u_char *data,
+    size_t len)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (len) {
+        cl = bufs->last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            if (ngx_http_upstream_mpx_free) {
+                cl = ngx_http_upstream_mpx_free;
+                ngx_http_upstream_mpx_free = cl->next;
+                ngx_http_upstream_mpx_nfree--;
+
+            } else {
+                cl = ngx_alloc(sizeof(ngx_chain_t) + sizeof(ngx_buf_t)
+                               + NGX_HTTP_UPSTREAM_MPX_BUFSIZE,
+                               ngx_cycle->log);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                b = (ngx_buf_t *) (cl + 1);
+
+                ngx_memzero(b, sizeof(ngx_buf_t));
+
+                b->start = (u_char *) (b + 1);
+                b->end = b->start + NGX_HTTP_UPSTREAM_MPX_BUFSIZE;
+                b->temporary = 1;
+
+                cl->buf = b;
+            }
+
+            cl->buf->pos = cl->buf->start;
+            cl->buf->last = cl->buf->start;
+            cl->next = NULL;
+
+            if (bufs->last) {
+                bufs->last->next = cl;
+
+            } else {
+                bufs->first = cl;
+            }
+
+            bufs->last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min((size_t) (b->end - b->last), len);
+
+        b->last = ngx_cpymem(b->last, data, n);
+
+        data += n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_upstream_mpx_free_bufs(ngx_http_upstream_mpx_bufs_t *bufs,
+    ngx_chain_t *upto)
+{
+    ngx_chain_t  *cl, *next;
+
+    for (cl = bufs->first; cl != upto; cl = next) {
+        next = cl->next;
+
+        if (ngx_http_upstream_mpx_nfree >= NGX_HTTP_UPSTREAM_MPX_FREE_BUFS) {
+            ngx_free(cl);
+            continue;
+        }
+
+        cl->next = ngx_http_upstream_mpx_free;
+        ngx_http_upstream_mpx_free = cl;
+        ngx_http_upstream_mpx_nfree++;
+    }
+
+    bufs->first = upto;
+
+    if (upto == NULL) {
+        bufs->last = NULL;
+    }
+}
+
+
+/* the init process handler of the modules using the streams */
+
+ngx_int_t
+ngx_http_upstream_mpx_init_process(ngx_cycle_t *cycle)
+{
+    /* the stream events rely on ngx_handle_read_event() being a no-op */
+
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        ngx_http_upstream_mpx_disabled = 1;
+    }
+
+    return NGX_OK;
+}
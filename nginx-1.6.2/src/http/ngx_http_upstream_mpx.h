@@ -0,0 +1,90 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_UPSTREAM_MPX_H_INCLUDED_
+#define _NGX_HTTP_UPSTREAM_MPX_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_MPX_BUFSIZE          8192
+#define NGX_HTTP_UPSTREAM_MPX_CONNECT_TIMEOUT  60000
+
+
+typedef struct ngx_http_upstream_mpx_stream_s  ngx_http_upstream_mpx_stream_t;
+
+typedef void (*ngx_http_upstream_mpx_drain_pt)(
+    ngx_http_upstream_mpx_stream_t *s);
+
+
+typedef struct {
+    ngx_chain_t                       *first;
+    ngx_chain_t                       *last;
+} ngx_http_upstream_mpx_bufs_t;
+
+
+/*
+ * a stream is a fake connection which is handed to the upstream module
+ * as a cached peer connection while the requests share a backend
+ * connection; a module stream starts with it
+ */
+
+struct ngx_http_upstream_mpx_stream_s {
+    ngx_connection_t                   connection;
+    ngx_event_t                        read;
+    ngx_event_t                        write;
+	//已从后端读到但还没有被upstream模块读走的数据，size为其大小
+    ngx_http_upstream_mpx_bufs_t       in;
+    size_t                             size;
+	//模块在size超过limit时设置blocked，size降到limit以下时清除blocked并调用drain
+    size_t                             limit;
+    ngx_http_upstream_mpx_drain_pt     drain;
+
+    unsigned                           done:1;
+    unsigned                           error:1;
+    unsigned                           blocked:1;
+};
+
+
+#define ngx_http_upstream_mpx_stream(c)                                       \
+    ((ngx_http_upstream_mpx_stream_t *)                                       \
+         ((u_char *) (c) - offsetof(ngx_http_upstream_mpx_stream_t,           \
+                                    connection)))
+
+
+ngx_int_t ngx_http_upstream_mpx_connect(ngx_peer_connection_t *pc,
+    ngx_connection_t **cp);
+ngx_int_t ngx_http_upstream_mpx_test_connect(ngx_connection_t *c,
+    ngx_str_t *name);
+ngx_int_t ngx_http_upstream_mpx_send(ngx_connection_t *c,
+    ngx_http_upstream_mpx_bufs_t *out);
+void ngx_http_upstream_mpx_close(ngx_connection_t *c,
+    ngx_http_upstream_mpx_bufs_t *out);
+
+void ngx_http_upstream_mpx_init_stream(ngx_http_upstream_mpx_stream_t *s,
+    ngx_connection_t *c, ngx_log_t *log);
+void ngx_http_upstream_mpx_close_stream(ngx_http_upstream_mpx_stream_t *s);
+ngx_int_t ngx_http_upstream_mpx_deliver(ngx_http_upstream_mpx_stream_t *s,
+    u_char *data, size_t len);
+void ngx_http_upstream_mpx_wake_stream(ngx_http_upstream_mpx_stream_t *s);
+
+ngx_int_t ngx_http_upstream_mpx_write(ngx_http_upstream_mpx_bufs_t *bufs,
+    u_char *data, size_t len);
+void ngx_http_upstream_mpx_free_bufs(ngx_http_upstream_mpx_bufs_t *bufs,
+    ngx_chain_t *upto);
+
+ngx_int_t ngx_http_upstream_mpx_init_process(ngx_cycle_t *cycle);
+
+
+extern ngx_uint_t  ngx_http_upstream_mpx_disabled;
+extern u_char      ngx_http_upstream_mpx_buffer[];
+
+
+#endif /* _NGX_HTTP_UPSTREAM_MPX_H_INCLUDED_ */
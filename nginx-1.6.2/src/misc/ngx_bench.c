@@ -0,0 +1,1189 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * the microbenchmarks of the core primitives, built by "make bench":
+ *
+ *   objs/nginx_bench [-b name] [-t msec] [-r requests] [-u uris]
+ *                    [-s server_names] [-H headers]
+ *
+ * the inputs are the built-in samples of request lines, URIs, server
+ * names and request header names, or the files with one entry per line;
+ * every benchmark is calibrated to run for about "-t" milliseconds and
+ * the best of several runs is reported, cycles are the TSC ticks
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_md5.h>
+#include <nginx.h>
+#include <ngx_event.h>
+#include <ngx_event_connect.h>
+#include <ngx_event_pipe.h>
+
+#include <ngx_http.h>
+
+#include <ngx_mail.h>
+#include <ngx_mail_pop3_module.h>
+#include <ngx_mail_imap_module.h>
+#include <ngx_mail_smtp_module.h>
+
+
+#define NGX_BENCH_ROUNDS      5
+#define NGX_BENCH_RBTREE      1024
+#define NGX_BENCH_SLAB        (4 * 1024 * 1024)
+#define NGX_BENCH_SLAB_ALLOCS 256
+#define NGX_BENCH_POOL_ALLOCS 64
+
+
+typedef struct ngx_bench_s  ngx_bench_t;
+
+typedef ngx_int_t (*ngx_bench_init_pt)(ngx_bench_t *b);
+typedef void (*ngx_bench_run_pt)(ngx_bench_t *b, ngx_uint_t n);
+
+
+struct ngx_bench_s {
+    char                 *name;
+    ngx_bench_init_pt     init;
+    ngx_bench_run_pt      run;
+    size_t                size;
+    void                 *data;
+};
+
+
+typedef struct {
+    ngx_hash_t            hash;
+    ngx_str_t            *keys;
+    ngx_uint_t           *hashes;
+    ngx_uint_t            nkeys;
+} ngx_bench_hash_t;
+
+
+typedef struct {
+    ngx_rbtree_t          tree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_rbtree_node_t    *nodes;
+    ngx_msec_t            now;
+    ngx_uint_t            next;
+} ngx_bench_rbtree_t;
+
+
+static ngx_int_t ngx_bench_options(int argc, char *const *argv);
+static ngx_int_t ngx_bench_corpus(ngx_array_t *a, char *file, char **samples);
+static void ngx_bench_measure(ngx_bench_t *b);
+static uint64_t ngx_bench_time(void);
+static uint64_t ngx_bench_cycles(void);
+
+static ngx_int_t ngx_bench_hash_init(ngx_bench_hash_t *bh, ngx_array_t *names,
+    ngx_array_t *lookups, ngx_uint_t max_size);
+static ngx_int_t ngx_bench_server_names_init(ngx_bench_t *b);
+static ngx_int_t ngx_bench_headers_in_init(ngx_bench_t *b);
+static void ngx_bench_hash_find(ngx_bench_t *b, ngx_uint_t n);
+static ngx_int_t ngx_bench_request_line_init(ngx_bench_t *b);
+static void ngx_bench_request_line(ngx_bench_t *b, ngx_uint_t n);
+static ngx_int_t ngx_bench_rbtree_init(ngx_bench_t *b);
+static void ngx_bench_rbtree(ngx_bench_t *b, ngx_uint_t n);
+static ngx_int_t ngx_bench_slab_init(ngx_bench_t *b);
+static void ngx_bench_slab(ngx_bench_t *b, ngx_uint_t n);
+static void ngx_bench_palloc(ngx_bench_t *b, ngx_uint_t n);
+static ngx_int_t ngx_bench_escape_uri_init(ngx_bench_t *b);
+static void ngx_bench_escape_uri(ngx_bench_t *b, ngx_uint_t n);
+static ngx_int_t ngx_bench_buffer_init(ngx_bench_t *b);
+static void ngx_bench_vslprintf_log(ngx_bench_t *b, ngx_uint_t n);
+static void ngx_bench_vslprintf_numbers(ngx_bench_t *b, ngx_uint_t n);
+static void ngx_bench_md5(ngx_bench_t *b, ngx_uint_t n);
+static void ngx_bench_crc32_short(ngx_bench_t *b, ngx_uint_t n);
+static void ngx_bench_crc32_long(ngx_bench_t *b, ngx_uint_t n);
+
+
+static char *ngx_bench_request_samples[] = {
+    "GET / HTTP/1.1",
+    "GET /index.html HTTP/1.1",
+    "GET /favicon.ico HTTP/1.1",
+    "GET /static/js/app.3f9a1c27.min.js HTTP/1.1",
+    "GET /static/css/main.css?v=20141021 HTTP/1.1",
+    "GET /images/products/2014/10/thumb_118271_320x240.jpg HTTP/1.1",
+    "POST /api/v1/sessions HTTP/1.1",
+    "GET /api/v1/users/1029384/orders?page=2&per_page=50&sort=-created_at"
+        " HTTP/1.1",
+    "GET /search?q=nginx+reverse+proxy&lang=en&utm_source=newsletter"
+        "&utm_medium=email&utm_campaign=oct14 HTTP/1.1",
+    "HEAD /healthcheck HTTP/1.0",
+    "GET /wp-content/themes/twentyfourteen/style.css?ver=4.0 HTTP/1.1",
+    "GET /download/nginx-1.6.2.tar.gz HTTP/1.1",
+    "PUT /api/v1/carts/7781/items/22 HTTP/1.1",
+    "GET /docs/./guide/../reference/index.html HTTP/1.1",
+    "GET /%D0%BA%D0%B0%D1%82%D0%B0%D0%BB%D0%BE%D0%B3/%D0%BE%D0%B1%D1%83"
+        "%D0%B2%D1%8C HTTP/1.1",
+    "GET http://www.example.com/proxy/path?x=1 HTTP/1.1",
+    "GET /robots.txt HTTP/1.1",
+    "DELETE /api/v1/sessions/current HTTP/1.1",
+    "GET /feed.xml HTTP/1.1",
+    "GET /assets/fonts/opensans-regular-webfont.woff HTTP/1.1",
+    NULL
+};
+
+
+static char *ngx_bench_uri_samples[] = {
+    "/",
+    "/index.html",
+    "/static/js/app.3f9a1c27.min.js",
+    "/images/products/2014/10/thumb_118271_320x240.jpg",
+    "/api/v1/users/1029384/orders",
+    "/files/Annual Report 2014 (final).pdf",
+    "/search/caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9\x65",
+    "/\xd0\xba\xd0\xb0\xd1\x82\xd0\xb0\xd0\xbb\xd0\xbe\xd0\xb3/"
+        "\xd0\xbe\xd0\xb1\xd1\x83\xd0\xb2\xd1\x8c",
+    "/wiki/C++ \"templates\" <advanced>",
+    "/photos/IMG_2041 copy#2.JPG",
+    "/download/nginx-1.6.2.tar.gz",
+    "/docs/guide/reference/index.html",
+    NULL
+};
+
+
+static char *ngx_bench_server_name_samples[] = {
+    "example.com", "www.example.com", "api.example.com", "m.example.com",
+    "static.example.com", "img.example.com", "cdn1.example.net",
+    "cdn2.example.net", "shop.example.org", "blog.example.org",
+    "mail.example.com", "status.example.com", "auth.example.com",
+    "admin.example.com", "dev.example.com", "staging.example.com",
+    "www.example.co.uk", "www.example.de", "www.example.fr",
+    "www.example.jp", "news.example.info", "forum.example.org",
+    "support.example.com", "docs.example.com", "download.example.com",
+    "media.example.net", "video.example.net", "assets.example.com",
+    "www.customer-site.com", "customer-site.com", "www.another-shop.net",
+    "another-shop.net", "intranet.corp.example", "git.corp.example",
+    "jira.corp.example", "wiki.corp.example", "localhost",
+    NULL
+};
+
+
+static char *ngx_bench_header_samples[] = {
+    "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding",
+    "Referer", "Cookie", "Connection", "Cache-Control", "If-Modified-Since",
+    "If-None-Match", "X-Forwarded-For", "X-Real-IP", "DNT", "Origin",
+    "Content-Type", "Content-Length", "X-Requested-With", "Pragma",
+    "Authorization", "Range", "If-Range", "Keep-Alive", "Via",
+    NULL
+};
+
+
+static ngx_bench_hash_t     ngx_bench_server_names;
+static ngx_bench_hash_t     ngx_bench_headers_in;
+static ngx_bench_rbtree_t   ngx_bench_timers;
+
+
+static ngx_bench_t  ngx_bench_benchmarks[] = {
+
+    { "hash_find/server_names", ngx_bench_server_names_init,
+      ngx_bench_hash_find, 0, &ngx_bench_server_names },
+
+    { "hash_find/headers_in", ngx_bench_headers_in_init,
+      ngx_bench_hash_find, 0, &ngx_bench_headers_in },
+
+    { "parse_request_line", ngx_bench_request_line_init,
+      ngx_bench_request_line, 0, NULL },
+
+    { "rbtree_insert+delete/timers", ngx_bench_rbtree_init,
+      ngx_bench_rbtree, 0, &ngx_bench_timers },
+
+    { "slab_alloc+free", ngx_bench_slab_init,
+      ngx_bench_slab, 0, NULL },
+
+    { "pool_create+palloc+destroy", NULL,
+      ngx_bench_palloc, 0, NULL },
+
+    { "escape_uri", ngx_bench_escape_uri_init,
+      ngx_bench_escape_uri, 0, NULL },
+
+    { "vslprintf/access_log", NULL,
+      ngx_bench_vslprintf_log, 0, NULL },
+
+    { "vslprintf/numbers", NULL,
+      ngx_bench_vslprintf_numbers, 0, NULL },
+
+    { "md5/64", ngx_bench_buffer_init, ngx_bench_md5, 64, NULL },
+
+    { "md5/1024", ngx_bench_buffer_init, ngx_bench_md5, 1024, NULL },
+
+    { "md5/16384", ngx_bench_buffer_init, ngx_bench_md5, 16384, NULL },
+
+    { "crc32_short/server_names", NULL,
+      ngx_bench_crc32_short, 0, NULL },
+
+    { "crc32_long/1024", ngx_bench_buffer_init,
+      ngx_bench_crc32_long, 1024, NULL },
+
+    { "crc32_long/16384", ngx_bench_buffer_init,
+      ngx_bench_crc32_long, 16384, NULL },
+
+    { NULL, NULL, NULL, 0, NULL }
+};
+
+
+static ngx_pool_t          *ngx_bench_pool;
+static ngx_log_t            ngx_bench_log;
+static ngx_open_file_t      ngx_bench_log_file;
+static ngx_cycle_t          ngx_bench_cycle;
+
+static ngx_array_t          ngx_bench_requests;
+static ngx_array_t          ngx_bench_uris;
+static ngx_array_t          ngx_bench_names;
+static ngx_array_t          ngx_bench_headers;
+
+static char                *ngx_bench_filter;
+static ngx_msec_t           ngx_bench_msec = 100;
+static char                *ngx_bench_requests_file;
+static char                *ngx_bench_uris_file;
+static char                *ngx_bench_names_file;
+static char                *ngx_bench_headers_file;
+
+/* the results are accumulated here to keep the calls */
+static volatile uintptr_t   ngx_bench_sink;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t    i, n;
+    ngx_bench_t  *b;
+
+    if (ngx_strerror_init() != NGX_OK) {
+        return 1;
+    }
+
+    if (ngx_bench_options(argc, argv) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_time_init();
+
+    ngx_bench_log_file.fd = ngx_stderr;
+    ngx_bench_log.file = &ngx_bench_log_file;
+    ngx_bench_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_bench_cycle.log = &ngx_bench_log;
+    ngx_cycle = &ngx_bench_cycle;
+
+    ngx_pid = ngx_getpid();
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    ngx_cpuinfo();
+
+    if (ngx_crc32_table_init() != NGX_OK) {
+        return 1;
+    }
+
+    ngx_bench_pool = ngx_create_pool(16384, &ngx_bench_log);
+    if (ngx_bench_pool == NULL) {
+        return 1;
+    }
+
+    if (ngx_bench_corpus(&ngx_bench_requests, ngx_bench_requests_file,
+                         ngx_bench_request_samples)
+        != NGX_OK
+        || ngx_bench_corpus(&ngx_bench_uris, ngx_bench_uris_file,
+                            ngx_bench_uri_samples)
+           != NGX_OK
+        || ngx_bench_corpus(&ngx_bench_names, ngx_bench_names_file,
+                            ngx_bench_server_name_samples)
+           != NGX_OK
+        || ngx_bench_corpus(&ngx_bench_headers, ngx_bench_headers_file,
+                            ngx_bench_header_samples)
+           != NGX_OK)
+    {
+        return 1;
+    }
+
+    ngx_log_stderr(0, NGINX_VER
+                   ", %ui request lines, %ui URIs, %ui server names, "
+                   "%ui headers",
+                   ngx_bench_requests.nelts, ngx_bench_uris.nelts,
+                   ngx_bench_names.nelts, ngx_bench_headers.nelts);
+
+    for (i = 0; ngx_bench_benchmarks[i].name; i++) {
+        b = &ngx_bench_benchmarks[i];
+
+        if (ngx_bench_filter
+            && ngx_strstr(b->name, ngx_bench_filter) == NULL)
+        {
+            continue;
+        }
+
+        if (b->init) {
+            switch (b->init(b)) {
+
+            case NGX_OK:
+                break;
+
+            case NGX_DECLINED:
+                ngx_log_stderr(0, "%s: skipped", b->name);
+                continue;
+
+            default:
+                return 1;
+            }
+        }
+
+        ngx_bench_measure(b);
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_bench_options(int argc, char *const *argv)
+{
+    char        **file;
+    ngx_int_t     n;
+    ngx_uint_t    i;
+    const char   *p;
+
+    for (i = 1; i < (ngx_uint_t) argc; i++) {
+
+        p = argv[i];
+
+        if (*p++ != '-' || p[0] == '\0' || p[1] != '\0'
+            || ngx_strchr("btrusH", p[0]) == NULL)
+        {
+            goto invalid;
+        }
+
+        if (argv[i + 1] == NULL) {
+            ngx_log_stderr(0, "option \"-%s\" requires parameter", p);
+            return NGX_ERROR;
+        }
+
+        switch (*p) {
+
+        case 'b':
+            ngx_bench_filter = argv[++i];
+            continue;
+
+        case 't':
+            n = ngx_atoi((u_char *) argv[i + 1], ngx_strlen(argv[i + 1]));
+            if (n <= 0) {
+                ngx_log_stderr(0, "invalid time \"%s\"", argv[i + 1]);
+                return NGX_ERROR;
+            }
+
+            ngx_bench_msec = (ngx_msec_t) n;
+            i++;
+            continue;
+
+        case 'r':
+            file = &ngx_bench_requests_file;
+            break;
+
+        case 'u':
+            file = &ngx_bench_uris_file;
+            break;
+
+        case 's':
+            file = &ngx_bench_names_file;
+            break;
+
+        case 'H':
+            file = &ngx_bench_headers_file;
+            break;
+
+        default:
+            goto invalid;
+        }
+
+        *file = argv[++i];
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_stderr(0, "usage: nginx_bench [-b name] [-t msec] "
+                   "[-r requests] [-u uris] [-s server_names] [-H headers]");
+
+    return NGX_ERROR;
+}
+
+
+/* the samples or the non-empty lines of a file, except for "#" comments */
+
+static ngx_int_t
+ngx_bench_corpus(ngx_array_t *a, char *file, char **samples)
+{
+    u_char           *p, *last, *eol;
+    size_t            size;
+    ssize_t           n;
+    ngx_str_t        *s;
+    ngx_file_t        f;
+    ngx_file_info_t   fi;
+
+    if (ngx_array_init(a, ngx_bench_pool, 64, sizeof(ngx_str_t)) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (file == NULL) {
+        for ( /* void */ ; *samples; samples++) {
+            s = ngx_array_push(a);
+            if (s == NULL) {
+                return NGX_ERROR;
+            }
+
+            s->len = ngx_strlen(*samples);
+            s->data = (u_char *) *samples;
+        }
+
+        return NGX_OK;
+    }
+
+    ngx_memzero(&f, sizeof(ngx_file_t));
+
+    f.name.len = ngx_strlen(file);
+    f.name.data = (u_char *) file;
+    f.log = &ngx_bench_log;
+
+    f.fd = ngx_open_file(file, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (f.fd == NGX_INVALID_FILE) {
+        ngx_log_stderr(ngx_errno, ngx_open_file_n " \"%s\" failed", file);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(f.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_stderr(ngx_errno, ngx_fd_info_n " \"%s\" failed", file);
+        (void) ngx_close_file(f.fd);
+        return NGX_ERROR;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    p = ngx_pnalloc(ngx_bench_pool, size);
+    if (p == NULL) {
+        (void) ngx_close_file(f.fd);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_file(&f, p, size, 0);
+
+    (void) ngx_close_file(f.fd);
+
+    if (n != (ssize_t) size) {
+        ngx_log_stderr(0, "\"%s\" was read partially", file);
+        return NGX_ERROR;
+    }
+
+    for (last = p + size; p < last; p = eol + 1) {
+
+        eol = ngx_strlchr(p, last, LF);
+        if (eol == NULL) {
+            eol = last;
+        }
+
+        n = eol - p;
+
+        if (n && p[n - 1] == CR) {
+            n--;
+        }
+
+        if (n == 0 || p[0] == '#') {
+            continue;
+        }
+
+        s = ngx_array_push(a);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->len = n;
+        s->data = p;
+    }
+
+    if (a->nelts == 0) {
+        ngx_log_stderr(0, "\"%s\" has no entries", file);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_bench_measure(ngx_bench_t *b)
+{
+    u_char      *p, line[NGX_MAX_ERROR_STR];
+    uint64_t     start, elapsed, cycles, best, best_cycles;
+    ngx_uint_t   n, i;
+
+    /* double the number of operations until a run takes 1/8 of the time */
+
+    n = 16;
+
+    for ( ;; ) {
+        start = ngx_bench_time();
+        b->run(b, n);
+        elapsed = ngx_bench_time() - start;
+
+        if (elapsed >= (uint64_t) ngx_bench_msec * 1000000 / 8) {
+            break;
+        }
+
+        n *= 2;
+    }
+
+    n = (ngx_uint_t) (n * ((uint64_t) ngx_bench_msec * 1000000)
+                      / (elapsed ? elapsed : 1));
+    n = n ? n : 1;
+
+    best = (uint64_t) -1;
+    best_cycles = 0;
+
+    for (i = 0; i < NGX_BENCH_ROUNDS; i++) {
+        cycles = ngx_bench_cycles();
+        start = ngx_bench_time();
+
+        b->run(b, n);
+
+        elapsed = ngx_bench_time() - start;
+        cycles = ngx_bench_cycles() - cycles;
+
+        if (elapsed < best) {
+            best = elapsed;
+            best_cycles = cycles;
+        }
+    }
+
+    p = ngx_cpystrn(line, (u_char *) b->name, 32);
+
+    while (p < line + 32) {
+        *p++ = ' ';
+    }
+
+    p = ngx_sprintf(p, "%10.2f ns/op", (double) best / n);
+
+    if (best_cycles) {
+        p = ngx_sprintf(p, "%10.1f cycles/op", (double) best_cycles / n);
+    }
+
+    p = ngx_sprintf(p, "%12ui ops" NGX_LINEFEED, n);
+
+    (void) ngx_write_fd(ngx_stdout, line, p - line);
+}
+
+
+static uint64_t
+ngx_bench_time(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+
+static uint64_t
+ngx_bench_cycles(void)
+{
+#if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
+
+    uint32_t  lo, hi;
+
+    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+
+    return (uint64_t) hi << 32 | lo;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
+/* the lookups are the names and the same number of misses */
+
+static ngx_int_t
+ngx_bench_hash_init(ngx_bench_hash_t *bh, ngx_array_t *names,
+    ngx_array_t *lookups, ngx_uint_t max_size)
+{
+    u_char           *p;
+    ngx_str_t        *name, *key;
+    ngx_uint_t        i, n;
+    ngx_hash_key_t   *hk;
+    ngx_hash_init_t   hash;
+
+    if (bh->keys) {
+        return NGX_OK;
+    }
+
+    name = names->elts;
+
+    hk = ngx_pcalloc(ngx_bench_pool, names->nelts * sizeof(ngx_hash_key_t));
+    if (hk == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < names->nelts; i++) {
+        hk[i].key = name[i];
+        hk[i].key_hash = ngx_hash_key_lc(name[i].data, name[i].len);
+        hk[i].value = &name[i];
+    }
+
+    hash.hash = &bh->hash;
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = max_size;
+    hash.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hash.name = "bench_hash";
+    hash.pool = ngx_bench_pool;
+    hash.temp_pool = NULL;
+
+    if (ngx_hash_init(&hash, hk, names->nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    n = 2 * lookups->nelts;
+
+    bh->keys = ngx_palloc(ngx_bench_pool, n * sizeof(ngx_str_t));
+    bh->hashes = ngx_palloc(ngx_bench_pool, n * sizeof(ngx_uint_t));
+
+    if (bh->keys == NULL || bh->hashes == NULL) {
+        return NGX_ERROR;
+    }
+
+    key = lookups->elts;
+
+    for (i = 0; i < n; i++) {
+        p = ngx_pnalloc(ngx_bench_pool, key[i / 2].len + 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        bh->keys[i].len = key[i / 2].len + (i & 1);
+        bh->keys[i].data = p;
+
+        ngx_strlow(p, key[i / 2].data, key[i / 2].len);
+
+        if (i & 1) {
+            p[key[i / 2].len] = 'x';
+        }
+
+        bh->hashes[i] = ngx_hash_key(p, bh->keys[i].len);
+    }
+
+    bh->nkeys = n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_bench_server_names_init(ngx_bench_t *b)
+{
+    return ngx_bench_hash_init(b->data, &ngx_bench_names, &ngx_bench_names,
+                               ngx_max(512, 4 * ngx_bench_names.nelts));
+}
+
+
+/* the hash of the known headers as ngx_http_init_headers_in_hash() does */
+
+static ngx_int_t
+ngx_bench_headers_in_init(ngx_bench_t *b)
+{
+    ngx_str_t          *s;
+    ngx_array_t         names;
+    ngx_http_header_t  *header;
+
+    if (ngx_array_init(&names, ngx_bench_pool, 32, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    for (header = ngx_http_headers_in; header->name.len; header++) {
+        s = ngx_array_push(&names);
+        if (s == NULL) {
+            return NGX_ERROR;
+        }
+
+        *s = header->name;
+    }
+
+    return ngx_bench_hash_init(b->data, &names, &ngx_bench_headers, 512);
+}
+
+
+static void
+ngx_bench_hash_find(ngx_bench_t *b, ngx_uint_t n)
+{
+    ngx_uint_t         i, k;
+    uintptr_t          found;
+    ngx_bench_hash_t  *bh;
+
+    bh = b->data;
+    found = 0;
+
+    for (i = 0, k = 0; i < n; i++) {
+        found += (uintptr_t) ngx_hash_find(&bh->hash, bh->hashes[k],
+                                           bh->keys[k].data, bh->keys[k].len);
+
+        if (++k == bh->nkeys) {
+            k = 0;
+        }
+    }
+
+    ngx_bench_sink += found;
+}
+
+
+static ngx_int_t
+ngx_bench_request_line_init(ngx_bench_t *b)
+{
+    u_char              *p;
+    ngx_buf_t           *bufs;
+    ngx_str_t           *line;
+    ngx_uint_t           i;
+    ngx_http_request_t   r;
+
+    if (b->data) {
+        return NGX_OK;
+    }
+
+    line = ngx_bench_requests.elts;
+
+    bufs = ngx_pcalloc(ngx_bench_pool,
+                       ngx_bench_requests.nelts * sizeof(ngx_buf_t));
+    if (bufs == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ngx_bench_requests.nelts; i++) {
+        p = ngx_pnalloc(ngx_bench_pool, line[i].len + 2);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        bufs[i].start = p;
+        bufs[i].pos = p;
+
+        p = ngx_cpymem(p, line[i].data, line[i].len);
+        *p++ = CR; *p++ = LF;
+
+        bufs[i].last = p;
+        bufs[i].end = p;
+
+        ngx_memzero(&r, sizeof(ngx_http_request_t));
+
+        if (ngx_http_parse_request_line(&r, &bufs[i]) != NGX_OK) {
+            ngx_log_stderr(0, "invalid request line \"%V\"", &line[i]);
+            return NGX_ERROR;
+        }
+    }
+
+    b->data = bufs;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_bench_request_line(ngx_bench_t *b, ngx_uint_t n)
+{
+    ngx_buf_t           *bufs;
+    ngx_uint_t           i, k;
+    uintptr_t            sum;
+    ngx_http_request_t   r;
+
+    bufs = b->data;
+    sum = 0;
+
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+
+    for (i = 0, k = 0; i < n; i++) {
+        r.state = 0;
+        bufs[k].pos = bufs[k].start;
+
+        sum += ngx_http_parse_request_line(&r, &bufs[k]);
+        sum += r.method;
+
+        if (++k == ngx_bench_requests.nelts) {
+            k = 0;
+        }
+    }
+
+    ngx_bench_sink += sum;
+}
+
+
+/*
+ * a timer tree of a busy worker: the timers are added with a few
+ * typical timeouts and the oldest ones are deleted
+ */
+
+static ngx_int_t
+ngx_bench_rbtree_init(ngx_bench_t *b)
+{
+    ngx_uint_t           i;
+    ngx_bench_rbtree_t  *bt;
+
+    bt = b->data;
+
+    if (bt->nodes) {
+        return NGX_OK;
+    }
+
+    bt->nodes = ngx_pcalloc(ngx_bench_pool,
+                            NGX_BENCH_RBTREE * sizeof(ngx_rbtree_node_t));
+    if (bt->nodes == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&bt->tree, &bt->sentinel, ngx_rbtree_insert_timer_value);
+
+    for (i = 0; i < NGX_BENCH_RBTREE; i++) {
+        bt->nodes[i].key = bt->now + 60000;
+        ngx_rbtree_insert(&bt->tree, &bt->nodes[i]);
+        bt->now++;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_bench_rbtree(ngx_bench_t *b, ngx_uint_t n)
+{
+    ngx_uint_t           i;
+    ngx_rbtree_node_t   *node;
+    ngx_bench_rbtree_t  *bt;
+
+    static ngx_msec_t  timeouts[] = { 60000, 60000, 75000, 5000, 30000,
+                                      60000, 180000, 60000 };
+
+    bt = b->data;
+
+    for (i = 0; i < n; i++) {
+        node = &bt->nodes[bt->next];
+
+        ngx_rbtree_delete(&bt->tree, node);
+
+        node->key = bt->now + timeouts[i & 7];
+        ngx_rbtree_insert(&bt->tree, node);
+
+        bt->now++;
+
+        if (++bt->next == NGX_BENCH_RBTREE) {
+            bt->next = 0;
+        }
+    }
+
+    ngx_bench_sink += bt->tree.root->key;
+}
+
+
+static ngx_int_t
+ngx_bench_slab_init(ngx_bench_t *b)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_slab_pool_t  *sp;
+
+    if (b->data) {
+        return NGX_OK;
+    }
+
+    sp = ngx_memalign(ngx_pagesize, NGX_BENCH_SLAB, &ngx_bench_log);
+    if (sp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+    sp->end = (u_char *) sp + NGX_BENCH_SLAB;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_slab_init(sp);
+
+    b->data = sp;
+
+    return NGX_OK;
+
+#else
+
+    return NGX_DECLINED;
+
+#endif
+}
+
+
+/* the sizes of the nodes of limit_req, limit_conn, cache and upstreams */
+
+static void
+ngx_bench_slab(ngx_bench_t *b, ngx_uint_t n)
+{
+    ngx_uint_t        i, k;
+    ngx_slab_pool_t  *sp;
+    void             *p[NGX_BENCH_SLAB_ALLOCS];
+
+    static size_t  sizes[] = { 64, 72, 96, 128, 48, 200, 64, 512 };
+
+    sp = b->data;
+
+    for (i = 0; i < n; /* void */) {
+
+        for (k = 0; k < NGX_BENCH_SLAB_ALLOCS && i < n; k++, i++) {
+            p[k] = ngx_slab_alloc(sp, sizes[k & 7]);
+        }
+
+        while (k) {
+            ngx_slab_free(sp, p[--k]);
+        }
+    }
+}
+
+
+/*
+ * the allocations of a request: small headers and strings, a buffer;
+ * a pool is created and destroyed for every NGX_BENCH_POOL_ALLOCS of them
+ */
+
+static void
+ngx_bench_palloc(ngx_bench_t *b, ngx_uint_t n)
+{
+    ngx_uint_t   i, k;
+    uintptr_t    sum;
+    ngx_pool_t  *pool;
+
+    static size_t  sizes[] = { 24, 56, 16, 200, 32, 120, 8, 1024,
+                               48, 64, 16, 40, 320, 24, 96, 8 };
+
+    sum = 0;
+
+    for (i = 0; i < n; /* void */) {
+
+        pool = ngx_create_pool(4096, &ngx_bench_log);
+        if (pool == NULL) {
+            return;
+        }
+
+        for (k = 0; k < NGX_BENCH_POOL_ALLOCS && i < n; k++, i++) {
+            sum += (uintptr_t) ngx_palloc(pool, sizes[k & 15]);
+        }
+
+        ngx_destroy_pool(pool);
+    }
+
+    ngx_bench_sink += sum;
+}
+
+
+static ngx_int_t
+ngx_bench_escape_uri_init(ngx_bench_t *b)
+{
+    size_t       len;
+    ngx_str_t   *uri;
+    ngx_uint_t   i;
+
+    if (b->data) {
+        return NGX_OK;
+    }
+
+    uri = ngx_bench_uris.elts;
+    len = 0;
+
+    for (i = 0; i < ngx_bench_uris.nelts; i++) {
+        len = ngx_max(len, uri[i].len);
+    }
+
+    b->data = ngx_pnalloc(ngx_bench_pool, 3 * len);
+    if (b->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_bench_escape_uri(ngx_bench_t *b, ngx_uint_t n)
+{
+    u_char      *dst;
+    uintptr_t    sum;
+    ngx_str_t   *uri;
+    ngx_uint_t   i, k;
+
+    dst = b->data;
+    uri = ngx_bench_uris.elts;
+    sum = 0;
+
+    for (i = 0, k = 0; i < n; i++) {
+        sum += (uintptr_t) ngx_escape_uri(dst, uri[k].data, uri[k].len,
+                                          NGX_ESCAPE_URI);
+
+        if (++k == ngx_bench_uris.nelts) {
+            k = 0;
+        }
+    }
+
+    ngx_bench_sink += sum;
+}
+
+
+static ngx_int_t
+ngx_bench_buffer_init(ngx_bench_t *b)
+{
+    u_char      *p, *last;
+    ngx_str_t   *line;
+    ngx_uint_t   k;
+
+    if (b->data) {
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(ngx_bench_pool, b->size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->data = p;
+    last = p + b->size;
+
+    /* the request lines as the text to digest */
+
+    line = ngx_bench_requests.elts;
+
+    for (k = 0; p < last; k = (k + 1) % ngx_bench_requests.nelts) {
+        p = ngx_cpymem(p, line[k].data,
+                       ngx_min(line[k].len, (size_t) (last - p)));
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_bench_vslprintf_log(ngx_bench_t *b, ngx_uint_t n)
+{
+    u_char       line[NGX_MAX_ERROR_STR];
+    uintptr_t    sum;
+    ngx_str_t   *request, *name;
+    ngx_uint_t   i, k;
+
+    static ngx_str_t  addr = ngx_string("203.0.113.57");
+    static ngx_str_t  time = ngx_string("19/Oct/2014:10:21:07 +0000");
+    static ngx_str_t  agent = ngx_string("Mozilla/5.0 (Windows NT 6.1; WOW64)"
+                        " AppleWebKit/537.36 (KHTML, like Gecko)"
+                        " Chrome/38.0.2125.104 Safari/537.36");
+
+    request = ngx_bench_requests.elts;
+    name = ngx_bench_names.elts;
+    sum = 0;
+
+    for (i = 0, k = 0; i < n; i++) {
+        sum += ngx_slprintf(line, line + NGX_MAX_ERROR_STR,
+                            "%V - - [%V] \"%V\" %ui %O \"http://%V/\" \"%V\"",
+                            &addr, &time, &request[k], (ngx_uint_t) 200,
+                            (off_t) (i & 0xffff), &name[k % ngx_bench_names.nelts],
+                            &agent)
+               - line;
+
+        if (++k == ngx_bench_requests.nelts) {
+            k = 0;
+        }
+    }
+
+    ngx_bench_sink += sum;
+}
+
+
+static void
+ngx_bench_vslprintf_numbers(ngx_bench_t *b, ngx_uint_t n)
+{
+    u_char      line[NGX_MAX_ERROR_STR];
+    uintptr_t   sum;
+    ngx_uint_t  i;
+
+    sum = 0;
+
+    for (i = 0; i < n; i++) {
+        sum += ngx_slprintf(line, line + NGX_MAX_ERROR_STR,
+                            "%ui %i %uL %O %M %xi %08Xd %.3f",
+                            i, -(ngx_int_t) i, (uint64_t) i << 20,
+                            (off_t) i * 4096, (ngx_msec_t) i,
+                            i, (ngx_int_t) i, (double) i / 7)
+               - line;
+    }
+
+    ngx_bench_sink += sum;
+}
+
+
+static void
+ngx_bench_md5(ngx_bench_t *b, ngx_uint_t n)
+{
+    u_char      md5[16];
+    ngx_md5_t   ctx;
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        ngx_md5_init(&ctx);
+        ngx_md5_update(&ctx, b->data, b->size);
+        ngx_md5_final(md5, &ctx);
+
+        ngx_bench_sink += md5[i & 15];
+    }
+}
+
+
+static void
+ngx_bench_crc32_short(ngx_bench_t *b, ngx_uint_t n)
+{
+    uint32_t     crc;
+    ngx_str_t   *name;
+    ngx_uint_t   i, k;
+
+    name = ngx_bench_names.elts;
+    crc = 0;
+
+    for (i = 0, k = 0; i < n; i++) {
+        crc += ngx_crc32_short(name[k].data, name[k].len);
+
+        if (++k == ngx_bench_names.nelts) {
+            k = 0;
+        }
+    }
+
+    ngx_bench_sink += crc;
+}
+
+
+static void
+ngx_bench_crc32_long(ngx_bench_t *b, ngx_uint_t n)
+{
+    uint32_t    crc;
+    ngx_uint_t  i;
+
+    crc = 0;
+
+    for (i = 0; i < n; i++) {
+        crc += ngx_crc32_long(b->data, b->size);
+    }
+
+    ngx_bench_sink += crc;
+}
@@ -0,0 +1,813 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * the tests of the core primitives and modules, built and run by
+ * "make test":
+ *
+ *   objs/nginx_test [-t name] [-s seed]
+ *
+ * the randomized tests are repeatable with the same seed
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_http.h>
+
+
+/*
+ * the modules whose static functions are tested are built into the test
+ * once more, under another module name
+ */
+
+#define ngx_http_limit_req_module  ngx_test_limit_req_module
+#include <ngx_http_limit_req_module.c>
+#undef ngx_http_limit_req_module
+
+
+typedef struct {
+    char                 *name;
+    ngx_int_t           (*run)(void);
+} ngx_test_t;
+
+
+#define NGX_TEST_TIMERS        2048
+#define NGX_TEST_TIMER_STEPS   200000
+
+#define NGX_TEST_SLAB          (256 * 1024)
+#define NGX_TEST_ZONE          (1024 * 1024)
+#define NGX_TEST_SHARDS        4
+
+#define NGX_TEST_HASH_NAMES    100
+#define NGX_TEST_HASH_MAX      400
+
+
+typedef struct {
+    ngx_event_t           event;
+    ngx_rbtree_node_t     ref;
+    ngx_uint_t            expected;  /* unsigned  expected:1; */
+    ngx_uint_t            fired;
+} ngx_test_timer_t;
+
+
+static ngx_int_t ngx_test_options(int argc, char *const *argv);
+static ngx_uint_t ngx_test_random(ngx_uint_t n);
+static ngx_int_t ngx_test_timer(void);
+static ngx_msec_t ngx_test_timer_timeout(void);
+static void ngx_test_timer_arm(ngx_test_timer_t *t, ngx_msec_t timeout);
+static void ngx_test_timer_handler(ngx_event_t *ev);
+static ngx_int_t ngx_test_limit_req(void);
+static ngx_int_t ngx_test_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    char *key);
+static ngx_int_t ngx_test_limit_req_zone(void);
+static ngx_int_t ngx_test_hash(void);
+static ngx_uint_t ngx_test_hash_fits(ngx_hash_key_t *names, ngx_uint_t size,
+    ngx_uint_t bucket_size);
+
+
+static ngx_test_t  ngx_test_tests[] = {
+    { "timer", ngx_test_timer },
+    { "limit_req", ngx_test_limit_req },
+    { "limit_req_zone", ngx_test_limit_req_zone },
+    { "hash", ngx_test_hash },
+    { NULL, NULL }
+};
+
+
+static ngx_log_t              ngx_test_log;
+static ngx_open_file_t        ngx_test_log_file;
+static ngx_cycle_t            ngx_test_cycle;
+
+static char                  *ngx_test_filter;
+static ngx_uint_t             ngx_test_seed = 1;
+static uint64_t               ngx_test_state;
+
+static ngx_rbtree_t           ngx_test_timer_ref;
+static ngx_rbtree_node_t      ngx_test_timer_sentinel;
+static ngx_uint_t             ngx_test_timer_failed;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t   i, n, failed;
+    ngx_test_t  *t;
+
+    if (ngx_strerror_init() != NGX_OK) {
+        return 1;
+    }
+
+    if (ngx_test_options(argc, argv) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_time_init();
+
+    ngx_test_log_file.fd = ngx_stderr;
+    ngx_test_log.file = &ngx_test_log_file;
+    ngx_test_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_test_cycle.log = &ngx_test_log;
+    ngx_cycle = &ngx_test_cycle;
+
+    ngx_pid = ngx_getpid();
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    failed = 0;
+
+    for (i = 0; ngx_test_tests[i].name; i++) {
+        t = &ngx_test_tests[i];
+
+        if (ngx_test_filter && ngx_strstr(t->name, ngx_test_filter) == NULL) {
+            continue;
+        }
+
+        ngx_test_state = ngx_test_seed ^ 0x9e3779b97f4a7c15ULL;
+
+        if (t->run() == NGX_OK) {
+            ngx_log_stderr(0, "test %s: ok", t->name);
+
+        } else {
+            ngx_log_stderr(0, "test %s: FAILED, seed %ui",
+                           t->name, ngx_test_seed);
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+
+static ngx_int_t
+ngx_test_options(int argc, char *const *argv)
+{
+    ngx_int_t    n;
+    ngx_uint_t   i;
+    const char  *p;
+
+    for (i = 1; i < (ngx_uint_t) argc; i++) {
+
+        p = argv[i];
+
+        if (*p++ != '-' || p[0] == '\0' || p[1] != '\0'
+            || ngx_strchr("ts", p[0]) == NULL)
+        {
+            goto invalid;
+        }
+
+        if (argv[i + 1] == NULL) {
+            ngx_log_stderr(0, "option \"-%s\" requires parameter", p);
+            return NGX_ERROR;
+        }
+
+        if (*p == 't') {
+            ngx_test_filter = argv[++i];
+            continue;
+        }
+
+        n = ngx_atoi((u_char *) argv[i + 1], ngx_strlen(argv[i + 1]));
+        if (n == NGX_ERROR) {
+            ngx_log_stderr(0, "invalid seed \"%s\"", argv[i + 1]);
+            return NGX_ERROR;
+        }
+
+        ngx_test_seed = (ngx_uint_t) n;
+        i++;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_stderr(0, "usage: nginx_test [-t name] [-s seed]");
+
+    return NGX_ERROR;
+}
+
+
+/* xorshift64*, the libc generator differs between the platforms */
+
+static ngx_uint_t
+ngx_test_random(ngx_uint_t n)
+{
+    uint64_t  x;
+
+    x = ngx_test_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+
+    ngx_test_state = x;
+
+    return (ngx_uint_t) ((x * 0x2545f4914f6cdd1dULL) >> 32) % n;
+}
+
+
+/*
+ * the event timers are added, re-armed, deleted and expired at random
+ * while the time goes on by small steps, by jumps and by the timeouts
+ * returned by ngx_event_find_timer(); a separate rbtree of the same keys
+ * tells which timers have to expire at each step, so a timer that fires
+ * early or late, or a sleep past the earliest timer, fails the test
+ */
+
+static ngx_int_t
+ngx_test_timer(void)
+{
+    ngx_msec_t          now, timer;
+    ngx_uint_t          i, step, armed;
+    ngx_connection_t    c;
+    ngx_test_timer_t   *timers, *t;
+    ngx_rbtree_node_t  *node;
+
+    timers = ngx_calloc(NGX_TEST_TIMERS * sizeof(ngx_test_timer_t),
+                        &ngx_test_log);
+    if (timers == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    c.fd = (ngx_socket_t) -1;
+
+    /* an unaligned start, the wheel slots are cascaded on the boundaries */
+
+    ngx_current_msec = (ngx_msec_t) 1413700000000ULL + ngx_test_random(65536);
+
+    if (ngx_event_timer_init(&ngx_test_log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&ngx_test_timer_ref, &ngx_test_timer_sentinel,
+                    ngx_rbtree_insert_timer_value);
+
+    /* as the event loop does before the timers are added */
+
+    ngx_event_expire_timers();
+
+    for (i = 0; i < NGX_TEST_TIMERS; i++) {
+        timers[i].event.data = &c;
+        timers[i].event.log = &ngx_test_log;
+        timers[i].event.handler = ngx_test_timer_handler;
+    }
+
+    ngx_test_timer_failed = 0;
+    armed = 0;
+
+    for (step = 0; step < NGX_TEST_TIMER_STEPS; step++) {
+
+        for (i = ngx_test_random(4); i; i--) {
+            t = &timers[ngx_test_random(NGX_TEST_TIMERS)];
+
+            if (t->event.timer_set && ngx_test_random(4) == 0) {
+                ngx_del_timer(&t->event);
+                ngx_rbtree_delete(&ngx_test_timer_ref, &t->ref);
+                continue;
+            }
+
+            ngx_test_timer_arm(t, ngx_test_timer_timeout());
+        }
+
+        /* the time goes on */
+
+        now = ngx_current_msec;
+
+        timer = ngx_event_find_timer();
+
+        if (ngx_test_timer_ref.root != &ngx_test_timer_sentinel) {
+            node = ngx_rbtree_min(ngx_test_timer_ref.root,
+                                  &ngx_test_timer_sentinel);
+
+            if (timer == NGX_TIMER_INFINITE
+                || (ngx_msec_int_t) (now + timer - node->key) > 0)
+            {
+                ngx_log_stderr(0, "find timer returned %M at %M, "
+                               "the earliest timer is %M",
+                               timer, now, node->key);
+                return NGX_ERROR;
+            }
+        }
+
+        switch (ngx_test_random(8)) {
+
+        case 0:
+            now += ngx_test_random(20000);
+            break;
+
+        case 1:
+        case 2:
+            if (timer != NGX_TIMER_INFINITE) {
+                now += timer;
+                break;
+            }
+
+            /* fall through */
+
+        default:
+            now += ngx_test_random(6);
+        }
+
+        ngx_current_msec = now;
+
+        while (ngx_test_timer_ref.root != &ngx_test_timer_sentinel) {
+            node = ngx_rbtree_min(ngx_test_timer_ref.root,
+                                  &ngx_test_timer_sentinel);
+
+            if ((ngx_msec_int_t) (node->key - now) > 0) {
+                break;
+            }
+
+            ngx_rbtree_delete(&ngx_test_timer_ref, node);
+
+            t = (ngx_test_timer_t *)
+                    ((u_char *) node - offsetof(ngx_test_timer_t, ref));
+            t->expected = 1;
+        }
+
+        ngx_event_expire_timers();
+
+        if (ngx_test_timer_failed) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < NGX_TEST_TIMERS; i++) {
+            t = &timers[i];
+
+            if (t->expected != t->fired) {
+                ngx_log_stderr(0, "timer %ui with key %M %s at %M",
+                               i, t->event.timer.key,
+                               t->expected ? "did not fire" : "fired",
+                               now);
+                return NGX_ERROR;
+            }
+
+            t->expected = 0;
+            t->fired = 0;
+
+            if (t->event.timer_set) {
+                armed++;
+            }
+        }
+    }
+
+    for (i = 0; i < NGX_TEST_TIMERS; i++) {
+        if (timers[i].event.timer_set) {
+            ngx_del_timer(&timers[i].event);
+        }
+    }
+
+    ngx_free(timers);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, &ngx_test_log, 0,
+                   "test timer: %ui timers armed in total", armed);
+
+    return NGX_OK;
+}
+
+
+/* the client timeouts, the keepalive ones, and rare long ones */
+
+static ngx_msec_t
+ngx_test_timer_timeout(void)
+{
+    switch (ngx_test_random(8)) {
+
+    case 0:
+        return ngx_test_random(300);
+
+    case 1:
+        return 256 * (1 + ngx_test_random(128));
+
+    case 2:
+        return ngx_test_random(2 * 3600 * 1000);
+
+    case 3:
+        return 75000;
+
+    default:
+        return ngx_test_random(70000);
+    }
+}
+
+
+/*
+ * ngx_add_timer() keeps the old key if it is close to the new one,
+ * so the reference tree takes the key the event has got
+ */
+
+static void
+ngx_test_timer_arm(ngx_test_timer_t *t, ngx_msec_t timeout)
+{
+    if (t->event.timer_set) {
+        ngx_rbtree_delete(&ngx_test_timer_ref, &t->ref);
+    }
+
+    ngx_add_timer(&t->event, timeout);
+
+    t->ref.key = t->event.timer.key;
+
+#if (NGX_TIMER_WHEEL)
+
+    /*
+     * the wheel has already expired the current millisecond,
+     * a timer that is due goes with the next slot
+     */
+
+    if ((ngx_msec_int_t) (t->ref.key - ngx_current_msec) <= 0) {
+        t->ref.key = ngx_current_msec + 1;
+    }
+
+#endif
+
+    ngx_rbtree_insert(&ngx_test_timer_ref, &t->ref);
+}
+
+
+static void
+ngx_test_timer_handler(ngx_event_t *ev)
+{
+    ngx_test_timer_t  *t;
+
+    t = (ngx_test_timer_t *) ev;
+
+    if (!ev->timedout || ev->timer_set) {
+        ngx_log_stderr(0, "timer with key %M fired in a wrong state",
+                       ev->timer.key);
+        ngx_test_timer_failed = 1;
+        return;
+    }
+
+    ev->timedout = 0;
+
+    if (!t->expected) {
+        ngx_log_stderr(0, "timer with key %M fired at %M",
+                       ev->timer.key, ngx_current_msec);
+        ngx_test_timer_failed = 1;
+        return;
+    }
+
+    t->fired = 1;
+
+    /* a keepalive connection waits for the next request */
+
+    if (ngx_test_random(2)) {
+        ngx_test_timer_arm(t, 1 + ngx_test_timer_timeout());
+    }
+}
+
+
+/*
+ * a node of a zone with a long second rate is not expired while its
+ * window still counts the requests, and is expired when it does not
+ */
+
+static ngx_int_t
+ngx_test_limit_req(void)
+{
+    ngx_int_t                    rc;
+    ngx_uint_t                   i, n;
+    ngx_time_t                   tp;
+    ngx_queue_t                 *q;
+    ngx_shm_zone_t               zone;
+    ngx_slab_pool_t             *sp;
+    ngx_http_limit_req_ctx_t     ctx;
+    ngx_http_limit_req_shard_t   shard;
+    ngx_http_limit_req_limit_t   limit;
+
+    sp = ngx_memalign(ngx_pagesize, NGX_TEST_SLAB, &ngx_test_log);
+    if (sp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+    sp->end = (u_char *) sp + NGX_TEST_SLAB;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    ngx_slab_init(sp);
+
+    shard.shpool = sp;
+    shard.sh = ngx_slab_alloc_locked(sp, sizeof(ngx_http_limit_req_shctx_t));
+    if (shard.sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&shard.sh->rbtree, &shard.sh->sentinel,
+                    ngx_http_limit_req_rbtree_insert_value);
+
+    ngx_queue_init(&shard.sh->queue);
+
+    /* rate=1r/s rate=5r/h */
+
+    ngx_memzero(&ctx, sizeof(ngx_http_limit_req_ctx_t));
+
+    ctx.shards = &shard;
+    ctx.nshards = 1;
+    ctx.shard = &shard;
+    ctx.rate = 1000;
+    ctx.windows[0].period = 3600 * 1000;
+    ctx.windows[0].limit = 5;
+    ctx.nwindows = 1;
+
+    ngx_memzero(&zone, sizeof(ngx_shm_zone_t));
+    zone.data = &ctx;
+
+    ngx_memzero(&limit, sizeof(ngx_http_limit_req_limit_t));
+    limit.shm_zone = &zone;
+
+    tp.sec = 1413700000;
+    tp.msec = 0;
+
+    ngx_cached_time = &tp;
+
+    rc = NGX_ERROR;
+
+    for (i = 0; i < 5; i++) {
+        if (ngx_test_limit_req_lookup(&limit, "a") != NGX_OK) {
+            ngx_log_stderr(0, "request %ui of 5 per hour rejected", i + 1);
+            goto done;
+        }
+
+        tp.sec += 2;
+    }
+
+    if (ngx_test_limit_req_lookup(&limit, "a") != NGX_BUSY) {
+        ngx_log_stderr(0, "request 6 of 5 per hour accepted");
+        goto done;
+    }
+
+    /* a new node expires the idle ones */
+
+    tp.sec += 61;
+
+    if (ngx_test_limit_req_lookup(&limit, "b") != NGX_OK) {
+        goto done;
+    }
+
+    if (ngx_test_limit_req_lookup(&limit, "a") != NGX_BUSY) {
+        ngx_log_stderr(0, "node expired while its window counts requests");
+        goto done;
+    }
+
+    tp.sec += 2 * 3600;
+
+    if (ngx_test_limit_req_lookup(&limit, "c") != NGX_OK) {
+        goto done;
+    }
+
+    n = 0;
+
+    for (q = ngx_queue_head(&shard.sh->queue);
+         q != ngx_queue_sentinel(&shard.sh->queue);
+         q = ngx_queue_next(q))
+    {
+        n++;
+    }
+
+    if (n != 1) {
+        ngx_log_stderr(0, "%ui idle nodes are not expired", n - 1);
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_time_init();
+
+    ngx_free(sp);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_test_limit_req_lookup(ngx_http_limit_req_limit_t *limit, char *key)
+{
+    size_t      len;
+    ngx_uint_t  excess;
+
+    len = ngx_strlen(key);
+
+    return ngx_http_limit_req_lookup(limit,
+                                     ngx_crc32_short((u_char *) key, len),
+                                     (u_char *) key, len, &excess, 1);
+}
+
+
+/*
+ * the shards of an approximate zone split the zone equally and are
+ * listed in the zone pool
+ */
+
+static ngx_int_t
+ngx_test_limit_req_zone(void)
+{
+    size_t                       size;
+    ngx_int_t                    rc;
+    ngx_uint_t                   i;
+    ngx_shm_zone_t               zone;
+    ngx_slab_pool_t             *sp, *pool;
+    ngx_http_limit_req_ctx_t     ctx;
+    ngx_http_limit_req_shard_t  *shard;
+
+    sp = ngx_memalign(ngx_pagesize, NGX_TEST_ZONE, &ngx_test_log);
+    if (sp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+    sp->end = (u_char *) sp + NGX_TEST_ZONE;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    rc = NGX_ERROR;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        goto done;
+    }
+
+#endif
+
+    ngx_slab_init(sp);
+
+    ngx_memzero(&ctx, sizeof(ngx_http_limit_req_ctx_t));
+
+    ctx.nshards = NGX_TEST_SHARDS;
+    ctx.rate = 1000;
+    ctx.approximate = 1;
+    ctx.cell_size = offsetof(ngx_http_limit_req_cell_t, windows);
+    ngx_str_set(&ctx.var, "binary_remote_addr");
+
+    ngx_memzero(&zone, sizeof(ngx_shm_zone_t));
+
+    zone.data = &ctx;
+    zone.shm.addr = (u_char *) sp;
+    zone.shm.size = NGX_TEST_ZONE;
+    zone.shm.log = &ngx_test_log;
+    ngx_str_set(&zone.shm.name, "test");
+
+    if (ngx_http_limit_req_init_zone(&zone, NULL) != NGX_OK) {
+        ngx_log_stderr(0, "zone of %ui shards is not created", ctx.nshards);
+        goto done;
+    }
+
+    if (sp->data != ctx.shards) {
+        ngx_log_stderr(0, "zone data does not point to the shards");
+        goto done;
+    }
+
+    i = 0;
+
+    for (pool = sp->pools; pool; pool = pool->next) {
+        i++;
+    }
+
+    if (i != ctx.nshards) {
+        ngx_log_stderr(0, "zone lists %ui pools of %ui shards",
+                       i, ctx.nshards);
+        goto done;
+    }
+
+    size = ctx.shards[0].shpool->end - (u_char *) ctx.shards[0].shpool;
+
+    for (i = 1; i < ctx.nshards; i++) {
+        shard = &ctx.shards[i];
+
+        if ((size_t) (shard->shpool->end - (u_char *) shard->shpool) != size
+            || shard->sh->width != ctx.shards[0].sh->width)
+        {
+            ngx_log_stderr(0, "shard %ui is smaller than shard 0", i);
+            goto done;
+        }
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_free(sp);
+
+    return rc;
+}
+
+
+/*
+ * a hash is built without exceeding the bucket size whenever a fitting
+ * size below max_size exists, even if the max_size does not fit
+ */
+
+static ngx_int_t
+ngx_test_hash(void)
+{
+    ngx_int_t         rc;
+    ngx_uint_t        i, max, size, tested;
+    ngx_pool_t       *pool;
+    ngx_hash_key_t    names[NGX_TEST_HASH_NAMES];
+    ngx_hash_init_t   hinit;
+
+    for (i = 0; i < NGX_TEST_HASH_NAMES; i++) {
+        ngx_str_set(&names[i].key, "example.com");
+        names[i].key_hash = ngx_test_random(0x40000000);
+        names[i].value = &names[i];
+    }
+
+    pool = ngx_create_pool(16384, &ngx_test_log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+    tested = 0;
+
+    for (max = 2; max <= NGX_TEST_HASH_MAX; max++) {
+
+        if (ngx_test_hash_fits(names, max, 64)) {
+            continue;
+        }
+
+        for (size = 1; size < max; size++) {
+            if (ngx_test_hash_fits(names, size, 64)) {
+                break;
+            }
+        }
+
+        if (size == max) {
+            continue;
+        }
+
+        tested++;
+
+        ngx_memzero(&hinit, sizeof(ngx_hash_init_t));
+
+        hinit.key = ngx_hash_key;
+        hinit.max_size = max;
+        hinit.bucket_size = 64;
+        hinit.name = "test_hash";
+        hinit.pool = pool;
+
+        if (ngx_hash_init(&hinit, names, NGX_TEST_HASH_NAMES) != NGX_OK) {
+            goto done;
+        }
+
+        if (!ngx_test_hash_fits(names, hinit.hash->size, 64)) {
+            ngx_log_stderr(0, "hash of max size %ui is built with %ui "
+                           "buckets, while %ui buckets fit", max,
+                           hinit.hash->size, size);
+            goto done;
+        }
+    }
+
+    if (tested == 0) {
+        ngx_log_stderr(0, "no tight max size is found");
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_destroy_pool(pool);
+
+    return rc;
+}
+
+
+static ngx_uint_t
+ngx_test_hash_fits(ngx_hash_key_t *names, ngx_uint_t size,
+    ngx_uint_t bucket_size)
+{
+    ngx_uint_t  i, key;
+    u_short     test[NGX_TEST_HASH_MAX];
+
+    ngx_memzero(test, size * sizeof(u_short));
+
+    for (i = 0; i < NGX_TEST_HASH_NAMES; i++) {
+        key = names[i].key_hash % size;
+        /* the size of an element as ngx_hash_init() counts it */
+
+        test[key] = (u_short) (test[key] + sizeof(void *)
+                               + ngx_align(names[i].key.len + 2,
+                                           sizeof(void *)));
+
+        if (test[key] > bucket_size - sizeof(void *)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
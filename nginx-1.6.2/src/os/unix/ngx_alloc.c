@@ -13,6 +13,8 @@ ngx_uint_t  ngx_pagesize;
 //此值表示pagesize是2的多少次方
 ngx_uint_t  ngx_pagesize_shift;
 ngx_uint_t  ngx_cacheline_size;
+//显式大页(hugetlb)的大小，为0表示系统不支持
+ngx_uint_t  ngx_huge_pagesize;
 
 
 void *
@@ -47,6 +49,57 @@ ngx_calloc(size_t size, ngx_log_t *log)
 }
 
 
+/*
+ * process-lifetime memory, e.g., the connection and event arrays of a worker,
+ * which is never freed; it is backed by explicit huge pages if possible,
+ * otherwise transparent huge pages are requested for it.  NULL is returned
+ * without an error, the caller falls back to ngx_alloc()
+ */
+
+void *
+ngx_huge_alloc(size_t size, ngx_log_t *log)
+{
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    void  *p;
+
+    if (ngx_huge_pagesize && size >= ngx_huge_pagesize) {
+
+        p = mmap(NULL, ngx_align(size, ngx_huge_pagesize),
+                 PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_HUGETLB,
+                 -1, 0);
+
+        if (p != MAP_FAILED) {
+            ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                           "mmap(MAP_HUGETLB): %p:%uz", p, size);
+            return p;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, log, ngx_errno,
+                       "mmap(MAP_HUGETLB, %uz) failed", size);
+    }
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    (void) madvise(p, size, MADV_HUGEPAGE);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                   "mmap(MADV_HUGEPAGE): %p:%uz", p, size);
+
+    return p;
+
+#else
+
+    return NULL;
+
+#endif
+}
+
+
 #if (NGX_HAVE_POSIX_MEMALIGN)
 
 void *
@@ -15,6 +15,7 @@
 
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
+void *ngx_huge_alloc(size_t size, ngx_log_t *log);
 
 #define ngx_free          free
 
@@ -40,6 +41,7 @@ void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log);
 extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
 extern ngx_uint_t  ngx_cacheline_size;
+extern ngx_uint_t  ngx_huge_pagesize;
 
 
 #endif /* _NGX_ALLOC_H_INCLUDED_ */
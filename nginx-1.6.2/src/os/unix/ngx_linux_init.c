@@ -15,6 +15,11 @@ u_char  ngx_linux_kern_osrelease[50];
 int     ngx_linux_rtsig_max;
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+static ngx_uint_t ngx_linux_huge_pagesize(ngx_log_t *log);
+#endif
+
+
 static ngx_os_io_t ngx_linux_io = {
     ngx_unix_recv,
     ngx_readv_chain,
@@ -72,12 +77,73 @@ ngx_os_specific_init(ngx_log_t *log)
     }
 #endif
 
+#if (NGX_HAVE_MAP_HUGETLB)
+    ngx_huge_pagesize = ngx_linux_huge_pagesize(log);
+#endif
+
     ngx_os_io = ngx_linux_io;
 
     return NGX_OK;
 }
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+static ngx_uint_t
+ngx_linux_huge_pagesize(ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   size;
+    u_char      buf[4096];
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return 0;
+    }
+
+    n = read(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    buf[n] = '\0';
+
+    /* "Hugepagesize:       2048 kB" */
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+    if (p == NULL) {
+        return 0;
+    }
+
+    p += sizeof("Hugepagesize:") - 1;
+
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+
+    for (last = p; *last >= '0' && *last <= '9'; last++) { /* void */ }
+
+    size = ngx_atoi(p, last - p);
+
+    if (size <= 0 || ngx_strncmp(last, " kB", 3) != 0) {
+        return 0;
+    }
+
+    return (ngx_uint_t) size * 1024;
+}
+
+#endif
+
+
 void
 ngx_os_specific_status(ngx_log_t *log)
 {
@@ -47,6 +47,11 @@ ngx_signal_t  signals[] = {
       "reopen",
       ngx_signal_handler },
 
+    { ngx_signal_value(NGX_UPDATE_SIGNAL),
+      "SIG" ngx_value(NGX_UPDATE_SIGNAL),
+      "update",
+      ngx_signal_handler },
+
     { ngx_signal_value(NGX_NOACCEPT_SIGNAL),
       "SIG" ngx_value(NGX_NOACCEPT_SIGNAL),
       "",
@@ -362,6 +367,11 @@ ngx_signal_handler(int signo)
             action = ", reopening logs";
             break;
 
+        case ngx_signal_value(NGX_UPDATE_SIGNAL):
+            ngx_update = 1;
+            action = ", updating dynamic tables";
+            break;
+
         case ngx_signal_value(NGX_CHANGEBIN_SIGNAL):
             if (getppid() > 1 || ngx_new_binary > 0) {
 
@@ -421,6 +431,11 @@ ngx_signal_handler(int signo)
             action = ", reopening logs";
             break;
 
+        case ngx_signal_value(NGX_UPDATE_SIGNAL):
+            ngx_update = 1;
+            action = ", updating dynamic tables";
+            break;
+
         case ngx_signal_value(NGX_RECONFIGURE_SIGNAL):
         case ngx_signal_value(NGX_CHANGEBIN_SIGNAL):
         case SIGIO:
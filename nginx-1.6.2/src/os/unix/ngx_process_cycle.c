@@ -48,6 +48,8 @@ ngx_uint_t    ngx_exiting;
 sig_atomic_t  ngx_reconfigure;
 //重新打开所有文件
 sig_atomic_t  ngx_reopen;
+//重新检查所有动态表(map/geo的dynamic文件),不重新读取配置
+sig_atomic_t  ngx_update;
 
 sig_atomic_t  ngx_change_binary;
 ngx_pid_t     ngx_new_binary;
@@ -104,6 +106,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
     sigaddset(&set, SIGINT);
     sigaddset(&set, ngx_signal_value(NGX_RECONFIGURE_SIGNAL));
     sigaddset(&set, ngx_signal_value(NGX_REOPEN_SIGNAL));
+    sigaddset(&set, ngx_signal_value(NGX_UPDATE_SIGNAL));
     sigaddset(&set, ngx_signal_value(NGX_NOACCEPT_SIGNAL));
     sigaddset(&set, ngx_signal_value(NGX_TERMINATE_SIGNAL));
     sigaddset(&set, ngx_signal_value(NGX_SHUTDOWN_SIGNAL));
@@ -277,6 +280,14 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
                                         ngx_signal_value(NGX_REOPEN_SIGNAL));
         }
 
+        if (ngx_update) {
+            ngx_update = 0;
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "updating dynamic tables");
+            ngx_signal_worker_processes(cycle,
+                                        ngx_signal_value(NGX_UPDATE_SIGNAL));
+        }
+
         if (ngx_change_binary) {
             ngx_change_binary = 0;
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "changing binary");
@@ -296,13 +307,18 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
 void
 ngx_single_process_cycle(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_uint_t        i;
+    ngx_core_conf_t  *ccf;
 
     if (ngx_set_environment(cycle, NULL) == NULL) {
         /* fatal */
         exit(2);
     }
 
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    ngx_pool_cache_init(ccf->pool_cache);
+
     for (i = 0; ngx_modules[i]; i++) {
         if (ngx_modules[i]->init_process) {
             if (ngx_modules[i]->init_process(cycle) == NGX_ERROR) {
@@ -346,6 +362,13 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "reopening logs");
             ngx_reopen_files(cycle, (ngx_uid_t) -1);
         }
+
+        if (ngx_update) {
+            ngx_update = 0;
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "updating dynamic tables");
+            ngx_shared_table_refresh(cycle);
+        }
     }
 }
 
@@ -489,6 +512,10 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
         ch.command = NGX_CMD_REOPEN;
         break;
 
+    case ngx_signal_value(NGX_UPDATE_SIGNAL):
+        ch.command = NGX_CMD_UPDATE;
+        break;
+
     default:
         ch.command = 0;
     }
@@ -530,7 +557,9 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
                                   &ch, sizeof(ngx_channel_t), cycle->log)
                 == NGX_OK)
             {
-                if (signo != ngx_signal_value(NGX_REOPEN_SIGNAL)) {
+                if (signo != ngx_signal_value(NGX_REOPEN_SIGNAL)
+                    && signo != ngx_signal_value(NGX_UPDATE_SIGNAL))
+                {
                     ngx_processes[i].exiting = 1;
                 }
 
@@ -713,9 +742,9 @@ ngx_master_process_exit(ngx_cycle_t *cycle)
      * ngx_cycle->pool is already destroyed.
      */
 
-    ngx_exit_log_file.fd = ngx_cycle->log->file->fd;
+    ngx_exit_log = *ngx_log_get_file_log(ngx_cycle->log);
 
-    ngx_exit_log = *ngx_cycle->log;
+    ngx_exit_log_file.fd = ngx_exit_log.file->fd;
     ngx_exit_log.file = &ngx_exit_log_file;
     ngx_exit_log.next = NULL;
 
@@ -806,8 +835,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 }
             }
 
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
-            {
+            if (ngx_event_no_timers_left()) {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 
                 ngx_worker_process_exit(cycle);
@@ -841,6 +869,13 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "reopening logs");
             ngx_reopen_files(cycle, -1);
         }
+
+        if (ngx_update) {
+            ngx_update = 0;
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "updating dynamic tables");
+            ngx_shared_table_refresh(cycle);
+        }
     }
 }
 
@@ -863,6 +898,8 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
 
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
+    ngx_pool_cache_init(ccf->pool_cache);
+
     if (worker >= 0 && ccf->priority != 0) {
         if (setpriority(PRIO_PROCESS, 0, ccf->priority) == -1) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
@@ -933,6 +970,15 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         if (cpu_affinity) {
             ngx_setaffinity(cpu_affinity, cycle->log);
         }
+
+#if (NGX_HAVE_NUMA)
+
+        if (ccf->numa) {
+            ngx_numa_bind(worker, ccf->worker_processes, cpu_affinity,
+                          cycle->log);
+        }
+
+#endif
     }
 
 #if (NGX_HAVE_PR_SET_DUMPABLE)
@@ -1061,6 +1107,11 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, cycle->log, 0,
+                   "pool cache: %ui hits, %ui misses, %ui drops",
+                   ngx_pool_cache_stat.hits, ngx_pool_cache_stat.misses,
+                   ngx_pool_cache_stat.drops);
+
     /*
      * Copy ngx_cycle->log related data to the special static exit cycle,
      * log, and log file structures enough to allow a signal handler to log.
@@ -1068,9 +1119,9 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
      * ngx_cycle->pool is already destroyed.
      */
 
-    ngx_exit_log_file.fd = ngx_cycle->log->file->fd;
+    ngx_exit_log = *ngx_log_get_file_log(ngx_cycle->log);
 
-    ngx_exit_log = *ngx_cycle->log;
+    ngx_exit_log_file.fd = ngx_exit_log.file->fd;
     ngx_exit_log.file = &ngx_exit_log_file;
     ngx_exit_log.next = NULL;
 
@@ -1146,6 +1197,10 @@ ngx_channel_handler(ngx_event_t *ev)
             ngx_reopen = 1;
             break;
 
+        case NGX_CMD_UPDATE:
+            ngx_update = 1;
+            break;
+
         case NGX_CMD_OPEN_CHANNEL:
 
             ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -18,6 +18,7 @@
 #define NGX_CMD_QUIT           3
 #define NGX_CMD_TERMINATE      4
 #define NGX_CMD_REOPEN         5
+#define NGX_CMD_UPDATE         6
 
 
 #define NGX_PROCESS_SINGLE     0
@@ -55,6 +56,7 @@ extern sig_atomic_t    ngx_terminate;
 extern sig_atomic_t    ngx_noaccept;
 extern sig_atomic_t    ngx_reconfigure;
 extern sig_atomic_t    ngx_reopen;
+extern sig_atomic_t    ngx_update;
 extern sig_atomic_t    ngx_change_binary;
 
 
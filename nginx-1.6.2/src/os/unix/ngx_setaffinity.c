@@ -67,3 +67,196 @@ ngx_setaffinity(uint64_t cpu_affinity, ngx_log_t *log)
 }
 
 #endif
+
+
+#if (NGX_HAVE_NUMA)
+
+#include <sys/syscall.h>
+
+
+#define NGX_NUMA_SYSFS       "/sys/devices/system/node/"
+#define NGX_MPOL_PREFERRED   1
+
+
+static ngx_int_t ngx_numa_read_list(u_char *name, cpu_set_t *set,
+    ngx_log_t *log);
+
+
+/*
+ * workers are spread over the NUMA nodes in contiguous groups, e.g.,
+ * with 2 nodes and 8 workers, workers 0-3 run on node 0 and 4-7 on node 1;
+ * a worker with an explicit worker_cpu_affinity mask uses the node of the
+ * first CPU in the mask.  The worker's memory, including the connection
+ * and event arrays and all pools allocated after this call, is then
+ * preferably allocated on its node
+ */
+
+void
+ngx_numa_bind(ngx_int_t worker, ngx_int_t workers, uint64_t cpu_affinity,
+    ngx_log_t *log)
+{
+    u_char         name[sizeof(NGX_NUMA_SYSFS "node/cpulist") + NGX_INT_T_LEN];
+    ngx_int_t      cpu;
+    ngx_uint_t     i, n, nnodes, node;
+    cpu_set_t      nodes, cpus;
+    unsigned long  mask[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+
+    if (ngx_numa_read_list((u_char *) NGX_NUMA_SYSFS "online", &nodes, log)
+        != NGX_OK)
+    {
+        return;
+    }
+
+    nnodes = CPU_COUNT(&nodes);
+
+    if (nnodes < 2) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0,
+                       "worker_numa: single NUMA node");
+        return;
+    }
+
+    cpu = -1;
+
+    if (cpu_affinity) {
+        for (cpu = 0; (cpu_affinity & 1) == 0; cpu++) {
+            cpu_affinity >>= 1;
+        }
+    }
+
+    node = CPU_SETSIZE;
+    n = 0;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+
+        if (!CPU_ISSET(i, &nodes)) {
+            continue;
+        }
+
+        (void) ngx_sprintf(name, NGX_NUMA_SYSFS "node%ui/cpulist%Z", i);
+
+        if (cpu >= 0) {
+            if (ngx_numa_read_list(name, &cpus, log) != NGX_OK) {
+                return;
+            }
+
+            if (CPU_ISSET(cpu, &cpus)) {
+                node = i;
+                break;
+            }
+
+            continue;
+        }
+
+        if (n++ == (ngx_uint_t) (worker * nnodes / workers)) {
+
+            if (ngx_numa_read_list(name, &cpus, log) != NGX_OK) {
+                return;
+            }
+
+            if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                              "sched_setaffinity() failed");
+                return;
+            }
+
+            node = i;
+            break;
+        }
+    }
+
+    if (node == CPU_SETSIZE) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "worker_numa: no NUMA node found for CPU %i", cpu);
+        return;
+    }
+
+    ngx_memzero(mask, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+                                 1UL << (node % (8 * sizeof(unsigned long)));
+
+    if (syscall(SYS_set_mempolicy, NGX_MPOL_PREFERRED, mask,
+                (unsigned long) CPU_SETSIZE)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy(%ui) failed", node);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "worker process %i is bound to NUMA node %ui", worker, node);
+}
+
+
+/* parses the sysfs lists like "0-7,16-23" */
+
+static ngx_int_t
+ngx_numa_read_list(u_char *name, cpu_set_t *set, ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   from, to;
+    u_char      buf[1024];
+
+    CPU_ZERO(set);
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    n = read(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (n <= 0) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "read() \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    buf[n] = '\0';
+
+    for (p = buf; *p >= '0' && *p <= '9'; /* void */) {
+
+        for (last = p; *last >= '0' && *last <= '9'; last++) { /* void */ }
+
+        from = ngx_atoi(p, last - p);
+        to = from;
+
+        if (*last == '-') {
+            for (p = ++last; *last >= '0' && *last <= '9'; last++) {
+                /* void */
+            }
+
+            to = ngx_atoi(p, last - p);
+        }
+
+        if (from == NGX_ERROR || to == NGX_ERROR || to >= CPU_SETSIZE) {
+            break;
+        }
+
+        while (from <= to) {
+            CPU_SET(from, set);
+            from++;
+        }
+
+        p = (*last == ',') ? last + 1 : last;
+    }
+
+    if (*p != '\n' && *p != '\0') {
+        ngx_log_error(NGX_LOG_WARN, log, 0, "invalid list in \"%s\"", name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
@@ -20,4 +20,14 @@ void ngx_setaffinity(uint64_t cpu_affinity, ngx_log_t *log);
 #endif
 
 
+#if (NGX_HAVE_SCHED_SETAFFINITY && NGX_HAVE_SET_MEMPOLICY)
+
+#define NGX_HAVE_NUMA  1
+
+void ngx_numa_bind(ngx_int_t worker, ngx_int_t workers,
+    uint64_t cpu_affinity, ngx_log_t *log);
+
+#endif
+
+
 #endif /* _NGX_SETAFFINITY_H_INCLUDED_ */
@@ -14,6 +14,45 @@
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    if (shm->huge) {
+
+        if (ngx_huge_pagesize) {
+            shm->addr = (u_char *) mmap(NULL,
+                                        ngx_align(shm->size, ngx_huge_pagesize),
+                                        PROT_READ|PROT_WRITE,
+                                        MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+            if (shm->addr != MAP_FAILED) {
+                return NGX_OK;
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, ngx_errno,
+                          "mmap(MAP_HUGETLB, %uz) failed for \"%V\", "
+                          "using regular pages",
+                          ngx_align(shm->size, ngx_huge_pagesize), &shm->name);
+        }
+
+        shm->huge = 0;
+
+        shm->addr = (u_char *) mmap(NULL, shm->size,
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED, -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            /* transparent huge pages, if shmem_enabled allows */
+            (void) madvise(shm->addr, shm->size, MADV_HUGEPAGE);
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_SHARED, %uz) failed", shm->size);
+        return NGX_ERROR;
+    }
+
+#endif
+
 	//开辟一块shm->size大小可以读写的共享内存，内存首地址存放在addr中
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
@@ -32,10 +71,24 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    /* hugetlb mappings can only be unmapped in whole huge pages */
+
+    if (shm->huge) {
+        size = ngx_align(size, ngx_huge_pagesize);
+    }
+
+#endif
+
 	//使用ngx_shm_t中的addr和size参数调用munmap释放共享内在即可
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 
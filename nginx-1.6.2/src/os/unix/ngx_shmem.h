@@ -24,6 +24,8 @@ typedef struct {
     ngx_log_t   *log;
 	//表示共享内存是否已经分配过的标志位，为1时表示已经存在
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+	//请求使用大页；若分配时大页不可用，则被清零
+    ngx_uint_t   huge;     /* unsigned  huge:1;  */
 } ngx_shm_t;
 
 //分配新的共享内存